@@ -179,9 +179,118 @@ int doRfc4493test() {
   Serial.print("Verify (expected: 0): "); Serial.println(verifyAesCMac(K, M, 64,  CMAC40));
 }
 
+/**
+ *  doCycleBenchmark
+ *
+ *  Times the AES primitives and prints the cycles per call and per byte.
+ *  micros() only has a 4 usec resolution, so each primitive is run
+ *  BENCH_ITERATIONS times and the total converted to cycles with F_CPU.
+ *  Build once with and once without AES_TABLES_PROGMEM (see aes_crypt.h)
+ *  to compare the flash and EEPROM S-boxes. The inverse S-box is in the
+ *  EEPROM unless AES_ISBOX_PROGMEM is defined, so the two lookup lines
+ *  compare the two in one run.
+ */
+#define BENCH_ITERATIONS 100
+
+void printBench(const char *name, unsigned long usecs, int bytes)
+{
+  unsigned long cycles = usecs * (F_CPU/1000000L) / BENCH_ITERATIONS;
+  Serial.print(name);
+  Serial.print(": ");
+  Serial.print(cycles);
+  Serial.print(" cycles");
+  if ( bytes > 0 )
+  {
+    Serial.print(", ");
+    Serial.print(cycles/bytes);
+    Serial.print(" cycles/byte");
+  }
+  Serial.print("\n");
+}
+
+void doCycleBenchmark(void)
+{
+  byte_ard pKeys[KEY_BYTES * 11];
+  byte_ard pIV[BLOCK_BYTE_SIZE];
+  byte_ard pText[64];
+  byte_ard pCipher[64];
+  byte_ard pMac[BLOCK_BYTE_SIZE];
+  volatile byte_ard sink = 0;
+  unsigned long start;
+
+  memset(pIV, 0x30, BLOCK_BYTE_SIZE);
+  memset(pText, 0xA5, 64);
+
+  Serial.println("----------------------------------------");
+  #ifdef AES_TABLES_PROGMEM
+  Serial.println("AES cycle counts, S-box in flash");
+  #else
+  Serial.println("AES cycle counts, S-box in EEPROM");
+  #endif
+  Serial.println("----------------------------------------");
+
+  start = micros();
+  for ( int i = 0; i < BENCH_ITERATIONS; i++ )
+    for ( int j = 0; j < 256; j++ )
+      sink ^= getSboxValue(j);
+  printBench("S-box lookup x256", micros()-start, 256);
+
+  start = micros();
+  for ( int i = 0; i < BENCH_ITERATIONS; i++ )
+    for ( int j = 0; j < 256; j++ )
+      sink ^= getISboxValue(j);
+  printBench("Inverse S-box lookup x256", micros()-start, 256);
+
+  start = micros();
+  for ( int i = 0; i < BENCH_ITERATIONS; i++ )
+    KeyExpansion(pKey, pKeys);
+  printBench("KeyExpansion", micros()-start, 0);
+
+  start = micros();
+  for ( int i = 0; i < BENCH_ITERATIONS; i++ )
+    EncryptBlock(pText, (u_int32_ard *)pKeys);
+  printBench("EncryptBlock", micros()-start, BLOCK_BYTE_SIZE);
+
+  start = micros();
+  for ( int i = 0; i < BENCH_ITERATIONS; i++ )
+    DecryptBlock(pText, (u_int32_ard *)pKeys);
+  printBench("DecryptBlock", micros()-start, BLOCK_BYTE_SIZE);
+
+  start = micros();
+  for ( int i = 0; i < BENCH_ITERATIONS; i++ )
+    CBCEncrypt(pText, pCipher, 64, 0, (u_int32_ard *)pKeys, (u_int16_ard *)pIV);
+  printBench("CBCEncrypt 64", micros()-start, 64);
+
+  start = micros();
+  for ( int i = 0; i < BENCH_ITERATIONS; i++ )
+    CBCDecrypt(pCipher, pText, 64, (u_int32_ard *)pKeys, (u_int16_ard *)pIV);
+  printBench("CBCDecrypt 64", micros()-start, 64);
+
+  start = micros();
+  for ( int i = 0; i < BENCH_ITERATIONS; i++ )
+    aesCMac((u_int32_ard *)pKeys, pCipher, 64, pMac);
+  printBench("aesCMac 64", micros()-start, 64);
+
+  // A partial last block takes the padding path
+  start = micros();
+  for ( int i = 0; i < BENCH_ITERATIONS; i++ )
+    aesCMac((u_int32_ard *)pKeys, pCipher, 40, pMac);
+  printBench("aesCMac 40", micros()-start, 40);
+
+  // The block XOR the CMAC chain is built on
+  start = micros();
+  for ( int i = 0; i < BENCH_ITERATIONS; i++ )
+    xorToLength(pText, pCipher, pText);
+  printBench("xorToLength", micros()-start, BLOCK_BYTE_SIZE);
+
+  Serial.print("\n");
+  delay(10000);
+}
+
 void loop(void) {
-  doRfc4493test(); 
+  //doRfc4493test(); 
   //doFips197Test();
   //doCount();  
+  doCycleBenchmark();
 }
 
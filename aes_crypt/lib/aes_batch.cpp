@@ -0,0 +1,437 @@
+/*
+ * File name: aes_batch.cpp
+ * Date:      2026-10-19 12:30
+ * Author:
+ *
+ * Lane interleaved AES. The state of up to BATCH_LANES blocks is held
+ * column major like the single block code, but every state byte is a 64 bit
+ * word holding that byte for all lanes:
+ *
+ *    w[i+4*j]  ==  state(i,j) of lane 0..7, one lane per byte
+ *
+ * ShiftRows becomes a permutation of words, MixColumns and AddRoundKey are
+ * plain 64 bit arithmetic on all lanes at once (xtime is done SWAR style),
+ * and the 128 S-box lookups of a round are independent of each other. The
+ * lanes may each use a different key schedule.
+ *
+ * By default the rounds themselves are run by the bitsliced core in
+ * aes_bitslice.cpp, which needs no tables and runs in constant time. Build
+ * with -DAES_BATCH_TABLES for the S-box table rounds below.
+ */
+
+#include "aes_batch.h"
+#include "aes_bitslice.h"
+
+#ifndef _ARDUINO_DUEMILANOVE
+
+// The lookup tables are defined in aes_crypt.cpp (through aes_tables.h).
+extern byte_ard sbox[256];
+extern byte_ard isbox[256];
+
+typedef union
+{
+  u_int64_ard w[BLOCK_BYTE_SIZE];
+  byte_ard c[BLOCK_BYTE_SIZE][BATCH_LANES];
+} lane_block;
+
+// Round keys of all lanes, transposed the same way as the state.
+typedef struct
+{
+  lane_block rk[ROUNDS+1];
+  const u_int32_ard* loaded[BATCH_LANES];  // The schedule each lane holds.
+#ifndef AES_BATCH_TABLES
+  u_int64_ard planes[(ROUNDS+1)*BS_WORDS]; // rk for the bitsliced core
+  int planesStale;
+#endif
+} lane_keys;
+
+#define LO7 0x7f7f7f7f7f7f7f7fULL
+#define LO1 0x0101010101010101ULL
+
+// xtime() on eight bytes at once.
+#define lane_xtime(x) ((((x) & LO7) << 1) ^ ((((x) >> 7) & LO1) * 0x1b))
+
+// Makes lane l of k hold the schedule pKeys. Only reloads on change, so a
+// lane that keeps its key between calls costs nothing.
+static void loadLaneKey(lane_keys* k, int l, const u_int32_ard* pKeys)
+{
+  if (k->loaded[l] == pKeys)
+    return;
+
+  const byte_ard* cKeys = (const byte_ard*)pKeys;
+  for (int r = 0; r <= ROUNDS; r++)
+    for (int j = 0; j < BLOCK_BYTE_SIZE; j++)
+      k->rk[r].c[j][l] = cKeys[r*BLOCK_BYTE_SIZE + j];
+
+  k->loaded[l] = pKeys;
+#ifndef AES_BATCH_TABLES
+  k->planesStale = 1;
+#endif
+}
+
+static void initLaneKeys(lane_keys* k)
+{
+  memset(k, 0, sizeof(lane_keys));
+}
+
+static inline void laneAddRoundKey(lane_block* s, const lane_block* rk)
+{
+  for (int j = 0; j < BLOCK_BYTE_SIZE; j++)
+    s->w[j] ^= rk->w[j];
+}
+
+static inline void laneSubAndShift(lane_block* s)
+{
+  lane_block t;
+  for (int j = 0; j < BLOCK_BYTE_SIZE; j++)
+    for (int l = 0; l < BATCH_LANES; l++)
+      t.c[j][l] = sbox[s->c[j][l]];
+
+  // state(i,j) = state(i,j+i)
+  for (int i = 0; i < 4; i++)
+    for (int j = 0; j < 4; j++)
+      s->w[i+4*j] = t.w[i+4*((j+i)&3)];
+}
+
+static inline void laneInvSubAndShift(lane_block* s)
+{
+  lane_block t;
+  for (int j = 0; j < BLOCK_BYTE_SIZE; j++)
+    for (int l = 0; l < BATCH_LANES; l++)
+      t.c[j][l] = isbox[s->c[j][l]];
+
+  // state(i,j+i) = state(i,j)
+  for (int i = 0; i < 4; i++)
+    for (int j = 0; j < 4; j++)
+      s->w[i+4*((j+i)&3)] = t.w[i+4*j];
+}
+
+// Same formulation as MixColumns() in aes_crypt.cpp.
+static inline void laneMixColumns(lane_block* s)
+{
+  for (int c = 0; c < 4; c++)
+  {
+    u_int64_ard* p = &s->w[4*c];
+    u_int64_ard a = p[0] ^ p[1] ^ p[2] ^ p[3];
+    u_int64_ard s0 = p[0];
+    p[0] ^= lane_xtime(p[0] ^ p[1]) ^ a;
+    p[1] ^= lane_xtime(p[1] ^ p[2]) ^ a;
+    p[2] ^= lane_xtime(p[2] ^ p[3]) ^ a;
+    p[3] ^= lane_xtime(p[3] ^ s0) ^ a;
+  }
+}
+
+// InvMixColumns is MixColumns preceded by a multiplication with
+// {04}x^2 + {05}, see Daemen and Rijmen (sec. 4.1.3).
+static inline void laneInvMixColumns(lane_block* s)
+{
+  for (int c = 0; c < 4; c++)
+  {
+    u_int64_ard* p = &s->w[4*c];
+    u_int64_ard u = lane_xtime(lane_xtime(p[0] ^ p[2]));
+    u_int64_ard v = lane_xtime(lane_xtime(p[1] ^ p[3]));
+    p[0] ^= u;
+    p[1] ^= v;
+    p[2] ^= u;
+    p[3] ^= v;
+  }
+  laneMixColumns(s);
+}
+
+#ifndef AES_BATCH_TABLES
+// Converts the round keys once per key change, not once per block.
+static void refreshKeyPlanes(lane_keys* k)
+{
+  if (!k->planesStale)
+    return;
+
+  for (int r = 0; r <= ROUNDS; r++)
+    bsToPlanes(k->rk[r].w, &k->planes[r*BS_WORDS]);
+  k->planesStale = 0;
+}
+
+static void laneEncrypt(lane_block* s, lane_keys* k)
+{
+  u_int64_ard q[BS_WORDS];
+
+  refreshKeyPlanes(k);
+  bsToPlanes(s->w, q);
+  bsEncrypt(q, k->planes);
+  bsFromPlanes(q, s->w);
+}
+
+static void laneDecrypt(lane_block* s, lane_keys* k)
+{
+  u_int64_ard q[BS_WORDS];
+
+  refreshKeyPlanes(k);
+  bsToPlanes(s->w, q);
+  bsDecrypt(q, k->planes);
+  bsFromPlanes(q, s->w);
+}
+#else
+static void laneEncrypt(lane_block* s, const lane_keys* k)
+{
+  laneAddRoundKey(s, &k->rk[0]);
+  for (int round = 1; round < ROUNDS; round++)
+  {
+    laneSubAndShift(s);
+    laneMixColumns(s);
+    laneAddRoundKey(s, &k->rk[round]);
+  }
+  laneSubAndShift(s);
+  laneAddRoundKey(s, &k->rk[ROUNDS]);
+}
+
+static void laneDecrypt(lane_block* s, const lane_keys* k)
+{
+  laneAddRoundKey(s, &k->rk[ROUNDS]);
+  for (int round = ROUNDS-1; round > 0; round--)
+  {
+    laneInvSubAndShift(s);
+    laneAddRoundKey(s, &k->rk[round]);
+    laneInvMixColumns(s);
+  }
+  laneInvSubAndShift(s);
+  laneAddRoundKey(s, &k->rk[0]);
+}
+#endif // AES_BATCH_TABLES
+
+static void loadLane(lane_block* s, int l, const byte_ard* block)
+{
+  for (int j = 0; j < BLOCK_BYTE_SIZE; j++)
+    s->c[j][l] = block[j];
+}
+
+static void storeLane(const lane_block* s, int l, byte_ard* block)
+{
+  for (int j = 0; j < BLOCK_BYTE_SIZE; j++)
+    block[j] = s->c[j][l];
+}
+
+/**
+ * EncryptBlockBatch / DecryptBlockBatch
+ *
+ * In place encryption (decryption) of the n blocks pBlocks[i], each under
+ * its own key schedule pKeys[i]. Same results as calling EncryptBlock()
+ * (DecryptBlock()) n times.
+ */
+void EncryptBlockBatch(byte_ard** pBlocks, const u_int32_ard** pKeys, u_int32_ard n)
+{
+  lane_keys k;
+  lane_block s;
+  initLaneKeys(&k);
+
+  for (u_int32_ard i = 0; i < n; i += BATCH_LANES)
+  {
+    u_int32_ard lanes = (n - i < BATCH_LANES) ? n - i : BATCH_LANES;
+    for (u_int32_ard l = 0; l < lanes; l++)
+    {
+      loadLaneKey(&k, l, pKeys[i+l]);
+      loadLane(&s, l, pBlocks[i+l]);
+    }
+    laneEncrypt(&s, &k);
+    for (u_int32_ard l = 0; l < lanes; l++)
+      storeLane(&s, l, pBlocks[i+l]);
+  }
+}
+
+void DecryptBlockBatch(byte_ard** pBlocks, const u_int32_ard** pKeys, u_int32_ard n)
+{
+  lane_keys k;
+  lane_block s;
+  initLaneKeys(&k);
+
+  for (u_int32_ard i = 0; i < n; i += BATCH_LANES)
+  {
+    u_int32_ard lanes = (n - i < BATCH_LANES) ? n - i : BATCH_LANES;
+    for (u_int32_ard l = 0; l < lanes; l++)
+    {
+      loadLaneKey(&k, l, pKeys[i+l]);
+      loadLane(&s, l, pBlocks[i+l]);
+    }
+    laneDecrypt(&s, &k);
+    for (u_int32_ard l = 0; l < lanes; l++)
+      storeLane(&s, l, pBlocks[i+l]);
+  }
+}
+
+/**
+ * aesCMacBatch
+ *
+ * RFC 4493 AES-CMAC of n independent messages. The CBC chain of each message
+ * is serial, so a group of BATCH_LANES messages advances one block at a time
+ * in lock step. Lanes whose message is done idle until the longest message
+ * of the group is done, so batches of similar lengths work best.
+ */
+void aesCMacBatch(struct cmac_job* jobs, u_int32_ard n)
+{
+  lane_keys k;
+  lane_block s;
+  initLaneKeys(&k);
+
+  for (u_int32_ard g = 0; g < n; g += BATCH_LANES)
+  {
+    struct cmac_job* job = jobs + g;
+    u_int32_ard lanes = (n - g < BATCH_LANES) ? n - g : BATCH_LANES;
+    byte_ard M_last[BATCH_LANES][BLOCK_BYTE_SIZE];
+    u_int32_ard blockCount[BATCH_LANES];
+    u_int32_ard maxBlocks = 0;
+
+    // Step 1. L := AES-128(K, 0) for every lane.
+    memset(&s, 0, sizeof(s));
+    for (u_int32_ard l = 0; l < lanes; l++)
+      loadLaneKey(&k, l, job[l].KS);
+    laneEncrypt(&s, &k);
+
+    // Steps 2-4. Subkeys and the (padded) last block of each message.
+    for (u_int32_ard l = 0; l < lanes; l++)
+    {
+      byte_ard L[BLOCK_BYTE_SIZE], K1[BLOCK_BYTE_SIZE], K2[BLOCK_BYTE_SIZE];
+      storeLane(&s, l, L);
+      expandMacKey(L, K1);
+      expandMacKey(K1, K2);
+
+      u_int32_ard length = job[l].length;
+      u_int32_ard tail = length % BLOCK_BYTE_SIZE;
+      blockCount[l] = (length + BLOCK_BYTE_SIZE - 1) / BLOCK_BYTE_SIZE;
+
+      if (blockCount[l] > 0 && tail == 0)
+      {
+        xorToLength((byte_ard*)&job[l].M[length - BLOCK_BYTE_SIZE], K1, M_last[l]);
+      }
+      else
+      {
+        if (blockCount[l] == 0)
+          blockCount[l] = 1;
+        byte_ard pad[BLOCK_BYTE_SIZE];
+        initBlockZero(pad);
+        memcpy(pad, &job[l].M[length - tail], tail);
+        pad[tail] = 0x80;
+        xorToLength(pad, K2, M_last[l]);
+      }
+
+      if (blockCount[l] > maxBlocks)
+        maxBlocks = blockCount[l];
+    }
+
+    // Steps 5-7. X := 0, Y := X XOR M_i, X := AES-128(K,Y) for all lanes.
+    memset(&s, 0, sizeof(s));
+    for (u_int32_ard b = 0; b < maxBlocks; b++)
+    {
+      for (u_int32_ard l = 0; l < lanes; l++)
+      {
+        const byte_ard* M_i;
+        if (b + 1 < blockCount[l])
+          M_i = &job[l].M[b*BLOCK_BYTE_SIZE];
+        else if (b + 1 == blockCount[l])
+          M_i = M_last[l];
+        else
+          continue;  // Done, the lane idles.
+
+        for (int j = 0; j < BLOCK_BYTE_SIZE; j++)
+          s.c[j][l] ^= M_i[j];
+      }
+
+      laneEncrypt(&s, &k);
+
+      for (u_int32_ard l = 0; l < lanes; l++)
+      {
+        if (b + 1 == blockCount[l])
+          storeLane(&s, l, job[l].cmac);
+      }
+    }
+  }
+}
+
+/**
+ * verifyAesCMacBatch
+ *
+ * RFC 4493 Verify_MAC for n messages. Sets jobs[i].valid to CMAC_VALID or
+ * CMAC_INVALID by comparing the computed MAC with jobs[i].cmac, and returns
+ * the number of valid messages.
+ */
+u_int32_ard verifyAesCMacBatch(struct cmac_job* jobs, u_int32_ard n)
+{
+  u_int32_ard validCount = 0;
+
+  for (u_int32_ard g = 0; g < n; g += BATCH_LANES)
+  {
+    u_int32_ard lanes = (n - g < BATCH_LANES) ? n - g : BATCH_LANES;
+    byte_ard computed[BATCH_LANES][BLOCK_BYTE_SIZE];
+    struct cmac_job local[BATCH_LANES];
+
+    for (u_int32_ard l = 0; l < lanes; l++)
+    {
+      local[l] = jobs[g+l];
+      local[l].cmac = computed[l];
+    }
+    aesCMacBatch(local, lanes);
+
+    for (u_int32_ard l = 0; l < lanes; l++)
+    {
+      // Compare all bytes, no early exit.
+      byte_ard diff = 0;
+      for (int j = 0; j < BLOCK_BYTE_SIZE; j++)
+        diff |= computed[l][j] ^ jobs[g+l].cmac[j];
+
+      jobs[g+l].valid = (diff == 0) ? CMAC_VALID : CMAC_INVALID;
+      if (diff == 0)
+        validCount++;
+    }
+  }
+
+  return validCount;
+}
+
+/**
+ * CBCDecryptBatch
+ *
+ * CBC decryption of n messages. Unlike encryption, CBC decryption is
+ * parallel across the blocks of a message, so the blocks of all messages
+ * are simply dealt out to the lanes in order:
+ *
+ *    P_i = D_k(C_i) XOR C_{i-1},  C_0 = IV
+ */
+void CBCDecryptBatch(struct cbc_job* jobs, u_int32_ard n)
+{
+  lane_keys k;
+  lane_block s;
+  initLaneKeys(&k);
+
+  byte_ard* out[BATCH_LANES];
+  const byte_ard* chain[BATCH_LANES];
+  u_int32_ard lanes = 0;
+
+  for (u_int32_ard i = 0; i < n; i++)
+  {
+    u_int32_ard blocks = jobs[i].length / BLOCK_BYTE_SIZE;
+
+    for (u_int32_ard b = 0; b < blocks; b++)
+    {
+      loadLaneKey(&k, lanes, jobs[i].pKeys);
+      loadLane(&s, lanes, &jobs[i].pText[b*BLOCK_BYTE_SIZE]);
+      out[lanes] = &jobs[i].pBuffer[b*BLOCK_BYTE_SIZE];
+      chain[lanes] = (b == 0) ? jobs[i].pIV : &jobs[i].pText[(b-1)*BLOCK_BYTE_SIZE];
+
+      if (++lanes == BATCH_LANES)
+      {
+        laneDecrypt(&s, &k);
+        for (u_int32_ard l = 0; l < lanes; l++)
+          for (int j = 0; j < BLOCK_BYTE_SIZE; j++)
+            out[l][j] = s.c[j][l] ^ chain[l][j];
+        lanes = 0;
+      }
+    }
+  }
+
+  if (lanes > 0)
+  {
+    laneDecrypt(&s, &k);
+    for (u_int32_ard l = 0; l < lanes; l++)
+      for (int j = 0; j < BLOCK_BYTE_SIZE; j++)
+        out[l][j] = s.c[j][l] ^ chain[l][j];
+  }
+}
+
+#endif // _ARDUINO_DUEMILANOVE
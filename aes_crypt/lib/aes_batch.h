@@ -0,0 +1,62 @@
+/*
+ * File name: aes_batch.h
+ * Date:      2026-10-19 12:30
+ * Author:
+ *
+ * Batch AES for the sink. Works on many independent (key schedule, message)
+ * pairs at once and runs the AES rounds of up to BATCH_LANES of them side by
+ * side, one byte of each lane packed into every 64 bit word of the state.
+ * Single messages should keep using aes_crypt.h and aes_cmac.h.
+ *
+ * Uses 64 bit words, so this is not built for the Arduino.
+ */
+
+#ifndef __AES_BATCH_H__
+#define __AES_BATCH_H__
+
+#include "aes_crypt.h"
+#include "aes_cmac.h"
+
+#ifndef _ARDUINO_DUEMILANOVE
+
+// Blocks processed side by side, one per byte of a 64 bit word.
+#define BATCH_LANES 8
+
+/**
+ * One CMAC computation or verification. KS is the key schedule of the MAC
+ * key, M the message of length bytes. aesCMacBatch() writes the MAC to cmac,
+ * verifyAesCMacBatch() compares against it and sets valid.
+ */
+struct cmac_job
+{
+  const u_int32_ard* KS;
+  const byte_ard* M;
+  u_int32_ard length;
+  byte_ard* cmac;
+  int32_ard valid;                 // CMAC_VALID or CMAC_INVALID
+};
+
+/**
+ * One CBC decryption. length must be a multiple of BLOCK_BYTE_SIZE and
+ * pBuffer must not overlap pText.
+ */
+struct cbc_job
+{
+  const u_int32_ard* pKeys;
+  const byte_ard* pText;
+  byte_ard* pBuffer;
+  u_int32_ard length;
+  const byte_ard* pIV;
+};
+
+void EncryptBlockBatch(byte_ard** pBlocks, const u_int32_ard** pKeys, u_int32_ard n);
+void DecryptBlockBatch(byte_ard** pBlocks, const u_int32_ard** pKeys, u_int32_ard n);
+
+void aesCMacBatch(struct cmac_job* jobs, u_int32_ard n);
+u_int32_ard verifyAesCMacBatch(struct cmac_job* jobs, u_int32_ard n);
+
+void CBCDecryptBatch(struct cbc_job* jobs, u_int32_ard n);
+
+#endif // _ARDUINO_DUEMILANOVE
+
+#endif // __AES_BATCH_H__
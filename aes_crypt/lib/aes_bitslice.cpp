@@ -0,0 +1,415 @@
+/*
+ * File name: aes_bitslice.cpp
+ * Date:      2026-10-19 14:50
+ * Author:
+ *
+ * Layout of the bitsliced state q[16]. q[8*h + b] is bit plane b (bit b of
+ * every state byte) of state rows 2h and 2h+1:
+ *
+ *    bit 32*(row&1) + 8*col + lane  ==  bit b of state(row,col) of the lane
+ *
+ * So every row is a 32 bit quarter plane and
+ *  - ShiftRows rotates each row by a multiple of 8 bits,
+ *  - MixColumns combines rows, i.e. whole words, and multiplies by {02}
+ *    by renaming planes,
+ *  - SubBytes is a boolean circuit over the 8 planes.
+ *
+ * The S-box is the 113 gate circuit of Boyar and Peralta, "A depth-16
+ * circuit for the AES S-box" (2011). The inverse S-box reuses it between
+ * two inverse affine transforms, see bsInvSubBytes().
+ */
+
+#include "aes_bitslice.h"
+
+#ifndef _ARDUINO_DUEMILANOVE
+
+/* Transposes the 8x8 bit matrix in x, bit 8i+j <-> bit 8j+i. Hacker's
+ * Delight (2nd ed.) section 7-3.
+ */
+static inline u_int64_ard transposeBits(u_int64_ard x)
+{
+  u_int64_ard t;
+  t = (x ^ (x >> 7)) & 0x00AA00AA00AA00AAULL;
+  x = x ^ t ^ (t << 7);
+  t = (x ^ (x >> 14)) & 0x0000CCCC0000CCCCULL;
+  x = x ^ t ^ (t << 14);
+  t = (x ^ (x >> 28)) & 0x00000000F0F0F0F0ULL;
+  x = x ^ t ^ (t << 28);
+  return x;
+}
+
+/* Transposes the 8x8 byte matrix a, byte j of a[i] <-> byte i of a[j]:
+ * swap the off diagonal quadrants, then do the same within every quadrant.
+ */
+static inline void transposeBytes(u_int64_ard* a)
+{
+  u_int64_ard t;
+  for (int k = 0; k < 4; k++)
+  {
+    t = ((a[k] >> 32) ^ a[k+4]) & 0x00000000FFFFFFFFULL;
+    a[k] ^= t << 32;
+    a[k+4] ^= t;
+  }
+  for (int k = 0; k < 8; k += (k & 1) ? 3 : 1)   // 0, 1, 4, 5
+  {
+    t = ((a[k] >> 16) ^ a[k+2]) & 0x0000FFFF0000FFFFULL;
+    a[k] ^= t << 16;
+    a[k+2] ^= t;
+  }
+  for (int k = 0; k < 8; k += 2)
+  {
+    t = ((a[k] >> 8) ^ a[k+1]) & 0x00FF00FF00FF00FFULL;
+    a[k] ^= t << 8;
+    a[k+1] ^= t;
+  }
+}
+
+/**
+ * bsToPlanes / bsFromPlanes
+ *
+ * Word j = row + 4*col of w holds state(row,col) of every lane. Transposing
+ * its bits gives the plane bits of that state byte (byte b = plane b), and
+ * a byte transpose of the eight words of a row pair then gathers plane b
+ * of those rows into one word.
+ */
+void bsToPlanes(const u_int64_ard* w, u_int64_ard* q)
+{
+  for (int h = 0; h < 2; h++)
+  {
+    u_int64_ard* a = q + 8*h;
+    // a[k]: row 2h + (k>>2), column k&3
+    for (int k = 0; k < 8; k++)
+      a[k] = transposeBits(w[2*h + (k >> 2) + 4*(k & 3)]);
+    transposeBytes(a);
+  }
+}
+
+void bsFromPlanes(const u_int64_ard* q, u_int64_ard* w)
+{
+  for (int h = 0; h < 2; h++)
+  {
+    u_int64_ard a[8];
+    for (int k = 0; k < 8; k++)
+      a[k] = q[8*h + k];
+    transposeBytes(a);
+    for (int k = 0; k < 8; k++)
+      w[2*h + (k >> 2) + 4*(k & 3)] = transposeBits(a[k]);
+  }
+}
+
+static inline void bsAddRoundKey(u_int64_ard* q, const u_int64_ard* rk)
+{
+  for (int i = 0; i < BS_WORDS; i++)
+    q[i] ^= rk[i];
+}
+
+/* The S-box on the 8 planes p[0] (LSB) .. p[7] (MSB) of a state half. */
+static inline void bsSboxHalf(u_int64_ard* p)
+{
+  u_int64_ard x0, x1, x2, x3, x4, x5, x6, x7;
+  u_int64_ard y1, y2, y3, y4, y5, y6, y7, y8, y9;
+  u_int64_ard y10, y11, y12, y13, y14, y15, y16, y17, y18, y19;
+  u_int64_ard y20, y21;
+  u_int64_ard z0, z1, z2, z3, z4, z5, z6, z7, z8, z9;
+  u_int64_ard z10, z11, z12, z13, z14, z15, z16, z17;
+  u_int64_ard t0, t1, t2, t3, t4, t5, t6, t7, t8, t9;
+  u_int64_ard t10, t11, t12, t13, t14, t15, t16, t17, t18, t19;
+  u_int64_ard t20, t21, t22, t23, t24, t25, t26, t27, t28, t29;
+  u_int64_ard t30, t31, t32, t33, t34, t35, t36, t37, t38, t39;
+  u_int64_ard t40, t41, t42, t43, t44, t45, t46, t47, t48, t49;
+  u_int64_ard t50, t51, t52, t53, t54, t55, t56, t57, t58, t59;
+  u_int64_ard t60, t61, t62, t63, t64, t65, t66, t67;
+  u_int64_ard s0, s1, s2, s3, s4, s5, s6, s7;
+
+  // The circuit numbers bits from the MSB.
+  x0 = p[7]; x1 = p[6]; x2 = p[5]; x3 = p[4];
+  x4 = p[3]; x5 = p[2]; x6 = p[1]; x7 = p[0];
+
+  // Top linear transformation.
+  y14 = x3 ^ x5;
+  y13 = x0 ^ x6;
+  y9 = x0 ^ x3;
+  y8 = x0 ^ x5;
+  t0 = x1 ^ x2;
+  y1 = t0 ^ x7;
+  y4 = y1 ^ x3;
+  y12 = y13 ^ y14;
+  y2 = y1 ^ x0;
+  y5 = y1 ^ x6;
+  y3 = y5 ^ y8;
+  t1 = x4 ^ y12;
+  y15 = t1 ^ x5;
+  y20 = t1 ^ x1;
+  y6 = y15 ^ x7;
+  y10 = y15 ^ t0;
+  y11 = y20 ^ y9;
+  y7 = x7 ^ y11;
+  y17 = y10 ^ y11;
+  y19 = y10 ^ y8;
+  y16 = t0 ^ y11;
+  y21 = y13 ^ y16;
+  y18 = x0 ^ y16;
+
+  // Non-linear section, the inversion in GF(2^8).
+  t2 = y12 & y15;
+  t3 = y3 & y6;
+  t4 = t3 ^ t2;
+  t5 = y4 & x7;
+  t6 = t5 ^ t2;
+  t7 = y13 & y16;
+  t8 = y5 & y1;
+  t9 = t8 ^ t7;
+  t10 = y2 & y7;
+  t11 = t10 ^ t7;
+  t12 = y9 & y11;
+  t13 = y14 & y17;
+  t14 = t13 ^ t12;
+  t15 = y8 & y10;
+  t16 = t15 ^ t12;
+  t17 = t4 ^ t14;
+  t18 = t6 ^ t16;
+  t19 = t9 ^ t14;
+  t20 = t11 ^ t16;
+  t21 = t17 ^ y20;
+  t22 = t18 ^ y19;
+  t23 = t19 ^ y21;
+  t24 = t20 ^ y18;
+
+  t25 = t21 ^ t22;
+  t26 = t21 & t23;
+  t27 = t24 ^ t26;
+  t28 = t25 & t27;
+  t29 = t28 ^ t22;
+  t30 = t23 ^ t24;
+  t31 = t22 ^ t26;
+  t32 = t31 & t30;
+  t33 = t32 ^ t24;
+  t34 = t23 ^ t33;
+  t35 = t27 ^ t33;
+  t36 = t24 & t35;
+  t37 = t36 ^ t34;
+  t38 = t27 ^ t36;
+  t39 = t29 & t38;
+  t40 = t25 ^ t39;
+
+  t41 = t40 ^ t37;
+  t42 = t29 ^ t33;
+  t43 = t29 ^ t40;
+  t44 = t33 ^ t37;
+  t45 = t42 ^ t41;
+  z0 = t44 & y15;
+  z1 = t37 & y6;
+  z2 = t33 & x7;
+  z3 = t43 & y16;
+  z4 = t40 & y1;
+  z5 = t29 & y7;
+  z6 = t42 & y11;
+  z7 = t45 & y17;
+  z8 = t41 & y10;
+  z9 = t44 & y12;
+  z10 = t37 & y3;
+  z11 = t33 & y4;
+  z12 = t43 & y13;
+  z13 = t40 & y5;
+  z14 = t29 & y2;
+  z15 = t42 & y9;
+  z16 = t45 & y14;
+  z17 = t41 & y8;
+
+  // Bottom linear transformation, with the affine constant.
+  t46 = z15 ^ z16;
+  t47 = z10 ^ z11;
+  t48 = z5 ^ z13;
+  t49 = z9 ^ z10;
+  t50 = z2 ^ z12;
+  t51 = z2 ^ z5;
+  t52 = z7 ^ z8;
+  t53 = z0 ^ z3;
+  t54 = z6 ^ z7;
+  t55 = z16 ^ z17;
+  t56 = z12 ^ t48;
+  t57 = t50 ^ t53;
+  t58 = z4 ^ t46;
+  t59 = z3 ^ t54;
+  t60 = t46 ^ t57;
+  t61 = z14 ^ t57;
+  t62 = t52 ^ t58;
+  t63 = t49 ^ t58;
+  t64 = z4 ^ t59;
+  t65 = t61 ^ t62;
+  t66 = z1 ^ t63;
+  s0 = t59 ^ t63;
+  s6 = t56 ^ ~t62;
+  s7 = t48 ^ ~t60;
+  t67 = t64 ^ t65;
+  s3 = t53 ^ t66;
+  s4 = t51 ^ t66;
+  s5 = t47 ^ t65;
+  s1 = t64 ^ ~s3;
+  s2 = t55 ^ ~t67;
+
+  p[7] = s0; p[6] = s1; p[5] = s2; p[4] = s3;
+  p[3] = s4; p[2] = s5; p[1] = s6; p[0] = s7;
+}
+
+/* The inverse of the S-box affine transform, including its constant:
+ * b_i = b_(i+2) ^ b_(i+5) ^ b_(i+7) ^ {05}_i.
+ */
+static inline void bsInvAffineHalf(u_int64_ard* p)
+{
+  u_int64_ard a[8];
+  for (int i = 0; i < 8; i++)
+    a[i] = p[i];
+  for (int i = 0; i < 8; i++)
+    p[i] = a[(i+2) & 7] ^ a[(i+5) & 7] ^ a[(i+7) & 7];
+  p[0] = ~p[0];
+  p[2] = ~p[2];
+}
+
+static inline void bsSubBytes(u_int64_ard* q)
+{
+  bsSboxHalf(q);
+  bsSboxHalf(q + 8);
+}
+
+/* With S(x) = A(x^-1) and A^-1 the inverse affine transform above,
+ * S^-1(y) = (A^-1(y))^-1 = A^-1(S(A^-1(y))).
+ */
+static inline void bsInvSubBytes(u_int64_ard* q)
+{
+  for (int h = 0; h < BS_WORDS; h += 8)
+  {
+    bsInvAffineHalf(q + h);
+    bsSboxHalf(q + h);
+    bsInvAffineHalf(q + h);
+  }
+}
+
+// Rotates both 32 bit halves of x right by k bits (0 < k < 32).
+#define rotr_rows(x, k) ((((x) >> (k)) & (0xFFFFFFFFULL >> (k)) * 0x100000001ULL) | \
+                         (((x) << (32-(k))) & ~((0xFFFFFFFFULL >> (k)) * 0x100000001ULL)))
+
+#define LO_ROW 0x00000000FFFFFFFFULL
+#define HI_ROW 0xFFFFFFFF00000000ULL
+
+// Row r is rotated right by 8r bits: state(r,c) = state(r,c+r).
+static inline void bsShiftRows(u_int64_ard* q)
+{
+  for (int b = 0; b < 8; b++)
+  {
+    u_int64_ard x = q[b];
+    q[b] = (x & LO_ROW) | (rotr_rows(x, 8) & HI_ROW);
+    x = q[8+b];
+    q[8+b] = (rotr_rows(x, 16) & LO_ROW) | (rotr_rows(x, 24) & HI_ROW);
+  }
+}
+
+static inline void bsInvShiftRows(u_int64_ard* q)
+{
+  for (int b = 0; b < 8; b++)
+  {
+    u_int64_ard x = q[b];
+    q[b] = (x & LO_ROW) | (rotr_rows(x, 24) & HI_ROW);
+    x = q[8+b];
+    q[8+b] = (rotr_rows(x, 16) & LO_ROW) | (rotr_rows(x, 8) & HI_ROW);
+  }
+}
+
+// Multiplication by {02} of the 8 planes p[0..7] is a renaming of the planes
+// plus the reduction by x^8 = x^4 + x^3 + x + 1.
+static inline void bsXtimeHalf(u_int64_ard* p)
+{
+  u_int64_ard hi = p[7];
+  p[7] = p[6];
+  p[6] = p[5];
+  p[5] = p[4];
+  p[4] = p[3] ^ hi;
+  p[3] = p[2] ^ hi;
+  p[2] = p[1];
+  p[1] = p[0] ^ hi;
+  p[0] = hi;
+}
+
+/* out_r = {02}a_r ^ {03}a_(r+1) ^ a_(r+2) ^ a_(r+3)
+ *       = {02}(a_r ^ a_(r+1)) ^ a_(r+1) ^ a_(r+2) ^ a_(r+3)
+ *
+ * With rows (0,1) in the low half and (2,3) in the high half of a plane,
+ * the rows r+1 of (0,1),(2,3) are (1,2),(3,0) and the rows r+2 are the
+ * other half.
+ */
+static inline void bsMixColumns(u_int64_ard* q)
+{
+  u_int64_ard r1[BS_WORDS], t[BS_WORDS];
+
+  for (int b = 0; b < 8; b++)
+  {
+    u_int64_ard w0 = q[b], w1 = q[8+b];
+    r1[b] = (w0 >> 32) | (w1 << 32);
+    r1[8+b] = (w1 >> 32) | (w0 << 32);
+    t[b] = w0 ^ r1[b];
+    t[8+b] = w1 ^ r1[8+b];
+  }
+
+  bsXtimeHalf(t);
+  bsXtimeHalf(t + 8);
+
+  for (int b = 0; b < 8; b++)
+  {
+    // Rows r+3 are rows r+1 of the other half.
+    u_int64_ard w0 = q[b], w1 = q[8+b];
+    u_int64_ard odd = r1[b] ^ r1[8+b];
+    q[b] = t[b] ^ odd ^ w1;
+    q[8+b] = t[8+b] ^ odd ^ w0;
+  }
+}
+
+// InvMixColumns is MixColumns preceded by a multiplication with
+// {04}x^2 + {05}, as in aes_batch.cpp.
+static inline void bsInvMixColumns(u_int64_ard* q)
+{
+  u_int64_ard u[8];
+
+  for (int b = 0; b < 8; b++)
+    u[b] = q[b] ^ q[8+b];
+  bsXtimeHalf(u);
+  bsXtimeHalf(u);
+  for (int b = 0; b < 8; b++)
+  {
+    q[b] ^= u[b];
+    q[8+b] ^= u[b];
+  }
+
+  bsMixColumns(q);
+}
+
+void bsEncrypt(u_int64_ard* q, const u_int64_ard* rk)
+{
+  bsAddRoundKey(q, rk);
+  for (int round = 1; round < ROUNDS; round++)
+  {
+    bsSubBytes(q);
+    bsShiftRows(q);
+    bsMixColumns(q);
+    bsAddRoundKey(q, rk + round*BS_WORDS);
+  }
+  bsSubBytes(q);
+  bsShiftRows(q);
+  bsAddRoundKey(q, rk + ROUNDS*BS_WORDS);
+}
+
+void bsDecrypt(u_int64_ard* q, const u_int64_ard* rk)
+{
+  bsAddRoundKey(q, rk + ROUNDS*BS_WORDS);
+  for (int round = ROUNDS-1; round > 0; round--)
+  {
+    bsInvShiftRows(q);
+    bsInvSubBytes(q);
+    bsAddRoundKey(q, rk + round*BS_WORDS);
+    bsInvMixColumns(q);
+  }
+  bsInvShiftRows(q);
+  bsInvSubBytes(q);
+  bsAddRoundKey(q, rk);
+}
+
+#endif // _ARDUINO_DUEMILANOVE
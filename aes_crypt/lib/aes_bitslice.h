@@ -0,0 +1,42 @@
+/*
+ * File name: aes_bitslice.h
+ * Date:      2026-10-19 14:50
+ * Author:
+ *
+ * Bitsliced AES core for eight blocks at once. Every AES operation is
+ * computed with 64 bit AND/XOR/shift arithmetic on the bits of all eight
+ * blocks together, the S-box included, so there are no table lookups and
+ * no data dependent memory accesses or branches anywhere.
+ *
+ * The functions work on the lane interleaved words used by aes_batch.cpp
+ * (word j holds state byte j of all eight lanes, one lane per byte). The
+ * batch functions in aes_batch.h use this core unless the library is built
+ * with -DAES_BATCH_TABLES, which brings back the S-box table rounds.
+ *
+ * Uses 64 bit words, so this is not built for the Arduino.
+ */
+
+#ifndef __AES_BITSLICE_H__
+#define __AES_BITSLICE_H__
+
+#include "aes_crypt.h"
+
+#ifndef _ARDUINO_DUEMILANOVE
+
+// Words in a bitsliced state: 8 bit planes, each split in two 64 bit halves
+// (state rows 0-1 and 2-3).
+#define BS_WORDS 16
+
+// Converts 16 lane interleaved words to bit planes and back. The conversion
+// is its own inverse, so either function undoes the other.
+void bsToPlanes(const u_int64_ard* w, u_int64_ard* q);
+void bsFromPlanes(const u_int64_ard* q, u_int64_ard* w);
+
+// Encrypts (decrypts) the eight blocks in q. rk holds the ROUNDS+1 round
+// keys of the eight lanes, each converted with bsToPlanes().
+void bsEncrypt(u_int64_ard* q, const u_int64_ard* rk);
+void bsDecrypt(u_int64_ard* q, const u_int64_ard* rk);
+
+#endif // _ARDUINO_DUEMILANOVE
+
+#endif // __AES_BITSLICE_H__
@@ -13,21 +13,36 @@
 void leftShiftKey(byte_ard *orig, byte_ard *shifted){
     byte_ard overFlow =  0x0;
 
-    int32_ard i;
-    for(i = BLOCK_BYTE_SIZE - 1; i >= 0; i--){
+    for(byte_ard i = BLOCK_BYTE_SIZE; i-- > 0; ){
         shifted[i] = (orig[i] << 1);
         shifted[i] = shifted[i] | overFlow;
         overFlow = (orig[i] & 0x80) ? 0x1 : 0x0;
     }
 }
 
+// Performs (p XOR q) on a whole block and copies the result into r, which 
+// may be p or q. On the Intel platforms this is two 64 bit XORs (memcpy 
+// keeps it safe for unaligned blocks and compiles to plain loads), on the 
+// 8 bit AVR a byte loop with a byte counter is as wide as it gets.
+static inline void xorBlock(const byte_ard *p, const byte_ard *q, byte_ard *r){
+#if defined(_INTEL_64) || defined(_INTEL_32)
+    u_int64_ard a[2], b[2];
+    memcpy(a, p, BLOCK_BYTE_SIZE);
+    memcpy(b, q, BLOCK_BYTE_SIZE);
+    a[0] ^= b[0];
+    a[1] ^= b[1];
+    memcpy(r, a, BLOCK_BYTE_SIZE);
+#else
+    for(byte_ard i = 0; i < BLOCK_BYTE_SIZE; i++){
+        r[i] = p[i] ^ q[i];
+    }
+#endif
+}
+
 // Performs (p XOR q) on every element of an array of length BLOCK_BYTE_SIZE
 // and copies the result into r.
 void xorToLength(byte_ard *p, byte_ard *q, byte_ard *r){
-    int32_ard i;
-    for(i = 0; i < BLOCK_BYTE_SIZE; i++){
-        r[i] = p[i] ^ q[i];
-    }
+    xorBlock(p, q, r);
 }
 
 /* A not quite literal implementation of the Generate_Subkey psuedocode
@@ -48,25 +63,14 @@ void expandMacKey(byte_ard *origKey, byte_ard *newKey){
 // Pads a message with a single '1' followed by the minimum number
 // of '0' such that the string's total lenght is 128 bits.
 void padding ( byte_ard *lastb, byte_ard *pad, u_int32_ard length ) {
-    u_int32_ard i;
-
-    for (i=0; i<BLOCK_BYTE_SIZE; i++) {
-        if (i < length) {
-            pad[i] = lastb[i];
-        } else if (i == length) {
-            pad[i] = 0x80;
-        } else {
-            pad[i] = 0x00;
-        }
-    }
+    memcpy(pad, lastb, length);
+    pad[length] = 0x80;
+    memset(pad + length + 1, 0x00, BLOCK_BYTE_SIZE - length - 1);
 }
 
 // Initialize an AES block with zeros.
 void initBlockZero(byte_ard *block){
-    int32_ard i;
-    for(i=0; i < BLOCK_BYTE_SIZE; i++){
-        block[i] = 0x0;
-    }
+    memset(block, 0x0, BLOCK_BYTE_SIZE);
 }
 
 /* This is a more or less literal implementation of the AES-CMAC psuedo 
@@ -85,89 +89,104 @@ void initBlockZero(byte_ard *block){
  * +++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++
  */
 void aesCMac(const u_int32_ard* KS, byte_ard *M, u_int32_ard M_length, byte_ard *CMAC){
+    struct cmac_ctx ctx;
 
-    byte_ard K1[BLOCK_BYTE_SIZE], K2[BLOCK_BYTE_SIZE],
-             L[BLOCK_BYTE_SIZE], M_last[BLOCK_BYTE_SIZE];
-
-    initBlockZero(K1); initBlockZero(K2);
-    initBlockZero(L); initBlockZero(M_last);
+    aesCMacInit(&ctx, KS);
+    aesCMacUpdate(&ctx, M, M_length);
+    aesCMacFinal(&ctx, CMAC);
+}
 
-    u_int32_ard blockCount = 0;
+/* Streaming AES-CMAC. The message is fed to aesCMacUpdate() in pieces of 
+ * any length and the CMAC is the same as aesCMac() of the pieces put 
+ * together.
+ *
+ * Step 6 of the algorithm, X := AES-128(K, X XOR M_i), is run on every 
+ * block as soon as it is known not to be the last one. The last block, 
+ * whole or not, is always held back in the context, since only 
+ * aesCMacFinal() knows whether more is coming and it needs the last block 
+ * for steps 3 and 4.
+ */
+void aesCMacInit(struct cmac_ctx* ctx, const u_int32_ard* KS){
+    ctx->KS = KS;
+    initBlockZero(ctx->X);
+    ctx->pendingLength = 0;
+}
 
-    bool isComplete = true;
+void aesCMacUpdate(struct cmac_ctx* ctx, const byte_ard *M, u_int32_ard length){
+    // Top up the held back block. It is only folded into the chain once 
+    // there is more of the message after it.
+    if(ctx->pendingLength < BLOCK_BYTE_SIZE){
+        byte_ard n = BLOCK_BYTE_SIZE - ctx->pendingLength;
+        if(length < n){
+            n = length;
+        }
+        memcpy(ctx->pending + ctx->pendingLength, M, n);
+        ctx->pendingLength += n;
+        M += n;
+        length -= n;
+    }
+    if(length == 0){
+        return;
+    }
+    xorBlock(ctx->X, ctx->pending, ctx->X);
+    EncryptBlock((void*)ctx->X, ctx->KS);
+
+    // Whole blocks straight from the message, all but the last.
+    while(length > BLOCK_BYTE_SIZE){
+        xorBlock(ctx->X, M, ctx->X);
+        EncryptBlock((void*)ctx->X, ctx->KS);
+        M += BLOCK_BYTE_SIZE;
+        length -= BLOCK_BYTE_SIZE;
+    }
+    memcpy(ctx->pending, M, length);
+    ctx->pendingLength = length;
+}
 
-    /*byte_ard pKeys[KEY_BYTES * 12];
-      KeyExpansion(pKey, pKeys);*/
+void aesCMacFinal(struct cmac_ctx* ctx, byte_ard *CMAC){
+    byte_ard K1[BLOCK_BYTE_SIZE], K2[BLOCK_BYTE_SIZE], L[BLOCK_BYTE_SIZE];
 
     // Step 1.
-    //EncryptBlock((char*)L, (const u_int32_ard*) pKeys);
-    EncryptBlock((void*)L, KS);
+    initBlockZero(L);
+    EncryptBlock((void*)L, ctx->KS);
 
     expandMacKey(L, K1);
     expandMacKey(K1, K2);
 
-    // Step 2. determine the needed number of blocks of lenght BLOCK_BYTE_SIZE.
-    //blockCount = (u_int32_ard)ceil((double) M_length/(double) BLOCK_BYTE_SIZE);
-    //blockCount = neededblocks(M_length);
-    blockCount = (u_int32_ard)ceil((float32_ard) M_length / (float32_ard)BLOCK_BYTE_SIZE);
-    //blockCount = 1;
+    aesCMacFinalSubkeys(ctx, K1, K2, CMAC);
+}
 
-    // Step 3. Check whether M needs padding or not.
-    if(blockCount == 0){
-        blockCount = 1;
-        isComplete = false;
+// Steps 2 to 7 with the subkeys of step 1 given.
+void aesCMacFinalSubkeys(struct cmac_ctx* ctx, const byte_ard *K1,
+                         const byte_ard *K2, byte_ard *CMAC){
+    // Steps 2 to 4. The last block is XORed with K1 if it is complete, 
+    // otherwise it is padded and XORed with K2. The empty message is one 
+    // padded block. Then XOR and encrypt it to produce the CMAC.
+    if (ctx->pendingLength == BLOCK_BYTE_SIZE) {
+        xorBlock(ctx->X, ctx->pending, ctx->X);
+        xorBlock(ctx->X, K1, ctx->X);
     } else {
-        if ((M_length % BLOCK_BYTE_SIZE) == 0) { // The last block needs no padding.
-            isComplete = true;
-        } else {
-            isComplete = false;
-        }
+        byte_ard M_lastPad[BLOCK_BYTE_SIZE];
+        padding(ctx->pending, M_lastPad, ctx->pendingLength);
+        xorBlock(ctx->X, M_lastPad, ctx->X);
+        xorBlock(ctx->X, K2, ctx->X);
     }
+    EncryptBlock((void*)ctx->X, ctx->KS);
 
-    // Step 4. Handle messages depending whether they are an integer multiple
-    // of BLOCK_BYTE_SIZE or not.
-    byte_ard M_lastPad[BLOCK_BYTE_SIZE];
-
-    if (isComplete) { // the last block does not need padding.
-        xorToLength(&M[BLOCK_BYTE_SIZE * (blockCount - 1)], K1, M_last);
-    } else { // No padding needed.
-        initBlockZero(M_lastPad);
-        padding(&M[BLOCK_BYTE_SIZE * (blockCount - 1)], M_lastPad,
-                (M_length % BLOCK_BYTE_SIZE));
-        xorToLength(M_lastPad, K2, M_last);
-    }
-
-    // Step 5. Perfrom the CBC encryption chain up to (M_length - 1) 
-    byte_ard X[BLOCK_BYTE_SIZE], Y[BLOCK_BYTE_SIZE];
-    initBlockZero(X);
-    initBlockZero(Y);
-
-    // Step 6.
-    u_int32_ard i, j;
-    for(i = 0; i < blockCount-1; i++){
-        //Y := X XOR M_i;
-        xorToLength(X, &M[BLOCK_BYTE_SIZE * i], Y);
-
-        //AES-128(K,Y);
-        //EncryptBlock((char*) Y, (const u_int32_ard*) KS);
-        EncryptBlock((void*) Y, KS);
-
-        // X:= AES-128(K,Y); Necessary because encryptBlock does not copy the
-        // encrypted text into a new target vector.
-        for(j = 0; j < BLOCK_BYTE_SIZE; j++){
-            X[j] = Y[j];
-        }
-    }
+    // Step 7. T := AES-128(K,Y); where in our case T == CMAC
+    memcpy(CMAC, ctx->X, BLOCK_BYTE_SIZE);
+}
 
-    // XOR and encrypt the last block of M to produce the CMAC.
-    xorToLength(X, M_last, Y);
-    //EncryptBlock((char*) Y, (const u_int32_ard*) K);
-    EncryptBlock((void*) Y, KS);
+/* AES-CMAC under a key with a precomputed schedule and subkeys, which saves
+ * the key expansion and the encryption of step 1. A one block message, such
+ * as a key being derived, then costs a single block encryption.
+ */
+void aesCMacKey(const struct cmac_key* key, const byte_ard *M,
+                u_int32_ard length, byte_ard *CMAC){
+    struct cmac_ctx ctx;
 
-    // Step 7. T := AES-128(K,Y); where in our case T == CMAC
-    for(i = 0; i < BLOCK_BYTE_SIZE; i++){
-        CMAC[i] = Y[i];
-    }
+    aesCMacInit(&ctx, (const u_int32_ard*)key->KS);
+    aesCMacUpdate(&ctx, M, length);
+    aesCMacFinalSubkeys(&ctx, key->K1, key->K2, CMAC);
 }
 
 /* Implementation of the verify_MAC psuedo code algorithm in section 2.5 
@@ -203,3 +222,17 @@ int32_ard verifyAesCMac(const u_int32_ard *KS, byte_ard *M,
     return 1;
 }
 
+/* Encrypt-then-MAC in place, for the sensor send path. CBC encrypts the 
+ * M_length bytes at M into M itself (which must have room for the padding, 
+ * see CBCEncryptInPlace()) and computes the CMAC of the ciphertext into cmac. 
+ * cmac may point to the end of the ciphertext in the same buffer, so a whole 
+ * message can be built in one allocation. Returns the ciphertext length.
+ */
+u_int32_ard encryptThenMac(const u_int32_ard* cryptKS, const u_int32_ard* macKS,
+                           const u_int16_ard* pIV, byte_ard *M, u_int32_ard M_length,
+                           u_int32_ard padding, byte_ard *cmac){
+
+    u_int32_ard cipherLength = CBCEncryptInPlace(M, M_length, padding, cryptKS, pIV);
+    aesCMac(macKS, M, cipherLength, cmac);
+    return cipherLength;
+}
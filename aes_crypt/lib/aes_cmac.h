@@ -6,7 +6,6 @@
 
  
 #include <string.h>
-#include <math.h>
 #include "aes_crypt.h"
 
 #ifndef __AES_CMAC_H__
@@ -25,8 +24,39 @@ void initBlockZero(byte_ard *block);
 void expandMacKey(byte_ard *origKey, byte_ard *newKey);
 void aesCMac(	const u_int32_ard* KS, byte_ard *M, u_int32_ard length, 
 				byte_ard *cmac);
+
+// Streaming AES-CMAC, for messages that arrive in pieces.
+struct cmac_ctx
+{
+    const u_int32_ard* KS;
+    byte_ard X[BLOCK_BYTE_SIZE];        // The CBC chain
+    byte_ard pending[BLOCK_BYTE_SIZE];  // The last block so far, held back
+    byte_ard pendingLength;
+};
+
+void aesCMacInit(struct cmac_ctx* ctx, const u_int32_ard* KS);
+void aesCMacUpdate(struct cmac_ctx* ctx, const byte_ard *M, u_int32_ard length);
+void aesCMacFinal(struct cmac_ctx* ctx, byte_ard *cmac);
+
+// A CMAC key with its schedule and subkeys K1 and K2 worked out in advance,
+// for keys that never change such as the derivation constants.
+struct cmac_key
+{
+    byte_ard KS[BLOCK_BYTE_SIZE*(ROUNDS+1)];
+    byte_ard K1[BLOCK_BYTE_SIZE];
+    byte_ard K2[BLOCK_BYTE_SIZE];
+};
+
+void aesCMacFinalSubkeys(struct cmac_ctx* ctx, const byte_ard *K1,
+                         const byte_ard *K2, byte_ard *cmac);
+void aesCMacKey(const struct cmac_key* key, const byte_ard *M,
+                u_int32_ard length, byte_ard *cmac);
+
 int32_ard verifyAesCMac(const u_int32_ard *KS, byte_ard *M,
                         u_int32_ard M_length, byte_ard* CMACm);
+u_int32_ard encryptThenMac(const u_int32_ard* cryptKS, const u_int32_ard* macKS,
+                           const u_int16_ard* pIV, byte_ard *M, u_int32_ard M_length,
+                           u_int32_ard padding, byte_ard *cmac);
 
 
 #endif
@@ -6,6 +6,15 @@
 
 #include "aes_constants.h"
 
+#ifdef _ARDUINO_DUEMILANOVE
+  #include <avr/pgmspace.h>
+  #define CONST_KEY(name) const struct cmac_key name PROGMEM
+#else
+  #define CONST_KEY(name) const struct cmac_key name
+#endif
+
+#ifndef _ARDUINO_DUEMILANOVE
+
 // The constant used to derive K_ATa from K_AT.
 byte_ard cAlpha[]= { 0x65, 0xa4, 0x56, 0x5d, 0x09, 0xd6, 0x7e, 0xfa,
                     0xb5, 0x9d, 0x6f, 0x1c, 0xc1, 0xc5, 0x79, 0x9d };
@@ -22,3 +31,149 @@ byte_ard cGamma[] = { 0xf1, 0x15, 0x3e, 0xb6, 0xb0, 0x1f, 0xa8, 0xc7,
 byte_ard cEpsilon[] = { 0x3c, 0xdd, 0x2d, 0x67, 0xdf, 0x88, 0xef, 0xb2,
                         0xe1, 0x31, 0x33, 0xe7, 0xc9, 0x3a, 0x63, 0xeb };
 
+#endif // _ARDUINO_DUEMILANOVE
+
+/* The key schedules (KeyExpansion()) and the RFC 4493 subkeys K1 and K2 of
+ * the constants above. test_cases/aes_constants_test.cpp checks them against
+ * the constants, so regenerate them with it if a constant ever changes.
+ */
+CONST_KEY(cAlphaKey) = {
+  {
+    0x65, 0xa4, 0x56, 0x5d, 0x09, 0xd6, 0x7e, 0xfa,
+    0xb5, 0x9d, 0x6f, 0x1c, 0xc1, 0xc5, 0x79, 0x9d,
+    0xc2, 0x12, 0x08, 0x25, 0xcb, 0xc4, 0x76, 0xdf,
+    0x7e, 0x59, 0x19, 0xc3, 0xbf, 0x9c, 0x60, 0x5e,
+    0x1e, 0xc2, 0x50, 0x2d, 0xd5, 0x06, 0x26, 0xf2,
+    0xab, 0x5f, 0x3f, 0x31, 0x14, 0xc3, 0x5f, 0x6f,
+    0x34, 0x0d, 0xf8, 0xd7, 0xe1, 0x0b, 0xde, 0x25,
+    0x4a, 0x54, 0xe1, 0x14, 0x5e, 0x97, 0xbe, 0x7b,
+    0xb4, 0xa3, 0xd9, 0x8f, 0x55, 0xa8, 0x07, 0xaa,
+    0x1f, 0xfc, 0xe6, 0xbe, 0x41, 0x6b, 0x58, 0xc5,
+    0xdb, 0xc9, 0x7f, 0x0c, 0x8e, 0x61, 0x78, 0xa6,
+    0x91, 0x9d, 0x9e, 0x18, 0xd0, 0xf6, 0xc6, 0xdd,
+    0xb9, 0x7d, 0xbe, 0x7c, 0x37, 0x1c, 0xc6, 0xda,
+    0xa6, 0x81, 0x58, 0xc2, 0x76, 0x77, 0x9e, 0x1f,
+    0x0c, 0x76, 0x7e, 0x44, 0x3b, 0x6a, 0xb8, 0x9e,
+    0x9d, 0xeb, 0xe0, 0x5c, 0xeb, 0x9c, 0x7e, 0x43,
+    0x52, 0x85, 0x64, 0xad, 0x69, 0xef, 0xdc, 0x33,
+    0xf4, 0x04, 0x3c, 0x6f, 0x1f, 0x98, 0x42, 0x2c,
+    0x0f, 0xa9, 0x15, 0x6d, 0x66, 0x46, 0xc9, 0x5e,
+    0x92, 0x42, 0xf5, 0x31, 0x8d, 0xda, 0xb7, 0x1d,
+    0x6e, 0x00, 0xb1, 0x30, 0x08, 0x46, 0x78, 0x6e,
+    0x9a, 0x04, 0x8d, 0x5f, 0x17, 0xde, 0x3a, 0x42 },
+  {
+    0x05, 0x58, 0xbf, 0x92, 0x3b, 0x96, 0x30, 0xea,
+    0xe0, 0x26, 0x64, 0x43, 0xc9, 0x31, 0xcc, 0x9c },
+  {
+    0x0a, 0xb1, 0x7f, 0x24, 0x77, 0x2c, 0x61, 0xd5,
+    0xc0, 0x4c, 0xc8, 0x87, 0x92, 0x63, 0x99, 0x38 }
+};
+
+CONST_KEY(cBetaKey) = {
+  {
+    0x10, 0x9b, 0x58, 0xba, 0x59, 0xe0, 0xd6, 0x6e,
+    0xe9, 0xf7, 0x35, 0xab, 0x6a, 0x99, 0xe3, 0x61,
+    0xff, 0x8a, 0xb7, 0xb8, 0xa6, 0x6a, 0x61, 0xd6,
+    0x4f, 0x9d, 0x54, 0x7d, 0x25, 0x04, 0xb7, 0x1c,
+    0x0f, 0x23, 0x2b, 0x87, 0xa9, 0x49, 0x4a, 0x51,
+    0xe6, 0xd4, 0x1e, 0x2c, 0xc3, 0xd0, 0xa9, 0x30,
+    0x7b, 0xf0, 0x2f, 0xa9, 0xd2, 0xb9, 0x65, 0xf8,
+    0x34, 0x6d, 0x7b, 0xd4, 0xf7, 0xbd, 0xd2, 0xe4,
+    0x09, 0x45, 0x46, 0xc1, 0xdb, 0xfc, 0x23, 0x39,
+    0xef, 0x91, 0x58, 0xed, 0x18, 0x2c, 0x8a, 0x09,
+    0x68, 0x3b, 0x47, 0x6c, 0xb3, 0xc7, 0x64, 0x55,
+    0x5c, 0x56, 0x3c, 0xb8, 0x44, 0x7a, 0xb6, 0xb1,
+    0x92, 0x75, 0x8f, 0x77, 0x21, 0xb2, 0xeb, 0x22,
+    0x7d, 0xe4, 0xd7, 0x9a, 0x39, 0x9e, 0x61, 0x2b,
+    0xd9, 0x9a, 0x7e, 0x65, 0xf8, 0x28, 0x95, 0x47,
+    0x85, 0xcc, 0x42, 0xdd, 0xbc, 0x52, 0x23, 0xf6,
+    0x59, 0xbc, 0x3c, 0x00, 0xa1, 0x94, 0xa9, 0x47,
+    0x24, 0x58, 0xeb, 0x9a, 0x98, 0x0a, 0xc8, 0x6c,
+    0x25, 0x54, 0x6c, 0x46, 0x84, 0xc0, 0xc5, 0x01,
+    0xa0, 0x98, 0x2e, 0x9b, 0x38, 0x92, 0xe6, 0xf7,
+    0x5c, 0xda, 0x04, 0x41, 0xd8, 0x1a, 0xc1, 0x40,
+    0x78, 0x82, 0xef, 0xdb, 0x40, 0x10, 0x09, 0x2c },
+  {
+    0xbd, 0x45, 0xf7, 0x1f, 0xce, 0x3b, 0xca, 0x06,
+    0xd1, 0xf3, 0x94, 0x35, 0xc3, 0xe4, 0xa1, 0xf2 },
+  {
+    0x7a, 0x8b, 0xee, 0x3f, 0x9c, 0x77, 0x94, 0x0d,
+    0xa3, 0xe7, 0x28, 0x6b, 0x87, 0xc9, 0x43, 0x63 }
+};
+
+CONST_KEY(cGammaKey) = {
+  {
+    0xf1, 0x15, 0x3e, 0xb6, 0xb0, 0x1f, 0xa8, 0xc7,
+    0xa2, 0x3b, 0x9f, 0x9b, 0x95, 0x2d, 0xcc, 0x06,
+    0x28, 0x5e, 0x51, 0x9c, 0x98, 0x41, 0xf9, 0x5b,
+    0x3a, 0x7a, 0x66, 0xc0, 0xaf, 0x57, 0xaa, 0xc6,
+    0x71, 0xf2, 0xe5, 0xe5, 0xe9, 0xb3, 0x1c, 0xbe,
+    0xd3, 0xc9, 0x7a, 0x7e, 0x7c, 0x9e, 0xd0, 0xb8,
+    0x7e, 0x82, 0x89, 0xf5, 0x97, 0x31, 0x95, 0x4b,
+    0x44, 0xf8, 0xef, 0x35, 0x38, 0x66, 0x3f, 0x8d,
+    0x45, 0xf7, 0xd4, 0xf2, 0xd2, 0xc6, 0x41, 0xb9,
+    0x96, 0x3e, 0xae, 0x8c, 0xae, 0x58, 0x91, 0x01,
+    0x3f, 0x76, 0xa8, 0x16, 0xed, 0xb0, 0xe9, 0xaf,
+    0x7b, 0x8e, 0x47, 0x23, 0xd5, 0xd6, 0xd6, 0x22,
+    0xe9, 0x80, 0x3b, 0x15, 0x04, 0x30, 0xd2, 0xba,
+    0x7f, 0xbe, 0x95, 0x99, 0xaa, 0x68, 0x43, 0xbb,
+    0xec, 0x9a, 0xd1, 0xb9, 0xe8, 0xaa, 0x03, 0x03,
+    0x97, 0x14, 0x96, 0x9a, 0x3d, 0x7c, 0xd5, 0x21,
+    0x7c, 0x99, 0x2c, 0x9e, 0x94, 0x33, 0x2f, 0x9d,
+    0x03, 0x27, 0xb9, 0x07, 0x3e, 0x5b, 0x6c, 0x26,
+    0x5e, 0xc9, 0xdb, 0x2c, 0xca, 0xfa, 0xf4, 0xb1,
+    0xc9, 0xdd, 0x4d, 0xb6, 0xf7, 0x86, 0x21, 0x90,
+    0x2c, 0x34, 0xbb, 0x44, 0xe6, 0xce, 0x4f, 0xf5,
+    0x2f, 0x13, 0x02, 0x43, 0xd8, 0x95, 0x23, 0xd3 },
+  {
+    0xfb, 0x91, 0x6c, 0x7e, 0x44, 0x04, 0x07, 0x89,
+    0x0f, 0x98, 0x1f, 0xa1, 0x4c, 0x38, 0xdb, 0x67 },
+  {
+    0xf7, 0x22, 0xd8, 0xfc, 0x88, 0x08, 0x0f, 0x12,
+    0x1f, 0x30, 0x3f, 0x42, 0x98, 0x71, 0xb6, 0x49 }
+};
+
+CONST_KEY(cEpsilonKey) = {
+  {
+    0x3c, 0xdd, 0x2d, 0x67, 0xdf, 0x88, 0xef, 0xb2,
+    0xe1, 0x31, 0x33, 0xe7, 0xc9, 0x3a, 0x63, 0xeb,
+    0xbd, 0x26, 0xc4, 0xba, 0x62, 0xae, 0x2b, 0x08,
+    0x83, 0x9f, 0x18, 0xef, 0x4a, 0xa5, 0x7b, 0x04,
+    0xb9, 0x07, 0x36, 0x6c, 0xdb, 0xa9, 0x1d, 0x64,
+    0x58, 0x36, 0x05, 0x8b, 0x12, 0x93, 0x7e, 0x8f,
+    0x61, 0xf4, 0x45, 0xa5, 0xba, 0x5d, 0x58, 0xc1,
+    0xe2, 0x6b, 0x5d, 0x4a, 0xf0, 0xf8, 0x23, 0xc5,
+    0x28, 0xd2, 0xe3, 0x29, 0x92, 0x8f, 0xbb, 0xe8,
+    0x70, 0xe4, 0xe6, 0xa2, 0x80, 0x1c, 0xc5, 0x67,
+    0xa4, 0x74, 0x66, 0xe4, 0x36, 0xfb, 0xdd, 0x0c,
+    0x46, 0x1f, 0x3b, 0xae, 0xc6, 0x03, 0xfe, 0xc9,
+    0xff, 0xcf, 0xbb, 0x50, 0xc9, 0x34, 0x66, 0x5c,
+    0x8f, 0x2b, 0x5d, 0xf2, 0x49, 0x28, 0xa3, 0x3b,
+    0x8b, 0xc5, 0x59, 0x6b, 0x42, 0xf1, 0x3f, 0x37,
+    0xcd, 0xda, 0x62, 0xc5, 0x84, 0xf2, 0xc1, 0xfe,
+    0x82, 0xbd, 0xe2, 0x34, 0xc0, 0x4c, 0xdd, 0x03,
+    0x0d, 0x96, 0xbf, 0xc6, 0x89, 0x64, 0x7e, 0x38,
+    0xda, 0x4e, 0xe5, 0x93, 0x1a, 0x02, 0x38, 0x90,
+    0x17, 0x94, 0x87, 0x56, 0x9e, 0xf0, 0xf9, 0x6e,
+    0x60, 0xd7, 0x7a, 0x98, 0x7a, 0xd5, 0x42, 0x08,
+    0x6d, 0x41, 0xc5, 0x5e, 0xf3, 0xb1, 0x3c, 0x30 },
+  {
+    0xef, 0x66, 0x1c, 0x17, 0x97, 0xc9, 0x11, 0xa1,
+    0x1e, 0x78, 0x59, 0x4d, 0x58, 0xdc, 0xce, 0x60 },
+  {
+    0xde, 0xcc, 0x38, 0x2f, 0x2f, 0x92, 0x23, 0x42,
+    0x3c, 0xf0, 0xb2, 0x9a, 0xb1, 0xb9, 0x9c, 0x47 }
+};
+
+void deriveKey(const struct cmac_key* constant, const byte_ard* pKey,
+               byte_ard* pDerived)
+{
+#ifdef _ARDUINO_DUEMILANOVE
+  // The key has to be in RAM for EncryptBlock(), but only for this call.
+  struct cmac_key key;
+  memcpy_P(&key, constant, sizeof(key));
+  aesCMacKey(&key, pKey, KEY_BYTES, pDerived);
+#else
+  aesCMacKey(constant, pKey, KEY_BYTES, pDerived);
+#endif
+}
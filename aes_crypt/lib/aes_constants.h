@@ -8,7 +8,10 @@
 #define __AES_CONSTANTS_H__
 
 #include "aes_crypt.h"
+#include "aes_cmac.h"
 
+// The Arduino only needs the expanded keys below.
+#ifndef _ARDUINO_DUEMILANOVE
 extern byte_ard cAlpha[];
 
 extern byte_ard cBeta[];
@@ -16,6 +19,21 @@ extern byte_ard cBeta[];
 extern byte_ard cGamma[];
 
 extern byte_ard cEpsilon[];
+#endif
+
+// The constants as CMAC keys, with their key schedules and subkeys expanded
+// in advance. In flash on the Arduino, so use them through deriveKey().
+extern const struct cmac_key cAlphaKey;
+
+extern const struct cmac_key cBetaKey;
+
+extern const struct cmac_key cGammaKey;
+
+extern const struct cmac_key cEpsilonKey;
 
+// Derives pDerived = CMAC(constant, pKey) from the KEY_BYTES at pKey, with
+// one of the constant keys above.
+void deriveKey(const struct cmac_key* constant, const byte_ard* pKey,
+               byte_ard* pDerived);
 
 #endif
@@ -30,7 +30,7 @@
   #include <WProgram.h>   // Needed for Serial.print debugging
   #include "edevdata.h"   // The EEPROM memory layout
 #endif /* _ARDUINO_DUEMILANOVE */
-#ifndef _ARDUINO_DUEMILANOVE
+#if !defined(_ARDUINO_DUEMILANOVE) || defined(AES_TABLES_PROGMEM)
   #include "aes_tables.h"
 #endif
 
@@ -480,7 +480,8 @@ void DecryptBlock(void* pEncrypted, const u_int32_ard *pKeys)
   *
   * In order to use the CBC Mode of Operation the following has to be declared
   *  - A unsigned char (byte_ard) array containing the cleartext/ciphertext.
-  *  - A buffer of length (blocks*BLOCK_BYTE_SIZE) for post-CBC data.
+  *  - A buffer of length (blocks*BLOCK_BYTE_SIZE) for post-CBC data. For encryption
+  *    this may be the cleartext array itself, see CBCEncryptInPlace().
   *  - The length of the char array. (Decryption: must be mod 16 == 0)
   *  - The number of chars needed to 'pad' the array. (Encryption only)
   *      (if the integer is BLOCK_BYTE_SIZE+1 then CBCEncrypt will calc. the padding itself.) 
@@ -498,7 +499,7 @@ void CBCEncrypt(void *pTextIn, void* pBuffer, u_int32_ard length,
   byte_ard *cBuffer = (byte_ard*)pBuffer;
   byte_ard lastblock[BLOCK_BYTE_SIZE];
   byte_ard currblock[BLOCK_BYTE_SIZE];
-  u_int32_ard blocks = (length + padding) / BLOCK_BYTE_SIZE;
+  u_int32_ard blocks;
 
   memcpy(lastblock,pIV,BLOCK_BYTE_SIZE);
 
@@ -510,6 +511,8 @@ void CBCEncrypt(void *pTextIn, void* pBuffer, u_int32_ard length,
     else
       padding = BLOCK_BYTE_SIZE - (length % BLOCK_BYTE_SIZE);  
   }
+  // Only count the blocks once the padding is known.
+  blocks = (length + padding) / BLOCK_BYTE_SIZE;
 
   
   // Copy and pad the 
@@ -590,6 +593,28 @@ void CBCEncrypt(void *pTextIn, void* pBuffer, u_int32_ard length,
   } // for (blocks)
 } // CBCEncrypt()
 
+// CBCEncryptInPlace()
+//
+// CBC encryption of the length bytes at pBuffer into the same buffer, which
+// must have room for the padding. Saves the firmware a second buffer the size
+// of the message. Returns the length of the ciphertext.
+u_int32_ard CBCEncryptInPlace(void* pBuffer, u_int32_ard length,
+                              u_int32_ard padding, const u_int32_ard *pKeys,
+                              const u_int16_ard *pIV)
+{
+  if (padding == (BLOCK_BYTE_SIZE +1) )
+  {
+    if ((length % BLOCK_BYTE_SIZE) == 0)
+      padding = 0;
+    else
+      padding = BLOCK_BYTE_SIZE - (length % BLOCK_BYTE_SIZE);
+  }
+  // CBCEncrypt copies the text to the output buffer before encrypting it
+  // block by block there, so the buffers may be the same.
+  CBCEncrypt(pBuffer, pBuffer, length, padding, pKeys, pIV);
+  return length + padding;
+} // CBCEncryptInPlace()
+
 // CBCDecrypt()
 //
 // C_0 = IV
@@ -703,15 +728,165 @@ void CBCDecrypt(void* pText, void* pBuffer, u_int32_ard length,
   
 } // CBCDecrypt()
 
+// Streaming CBC
+//
+// The same chaining as CBCEncrypt() and CBCDecrypt(), but the text is fed in
+// pieces of any length, so a message can be encrypted from its scattered
+// parts without first copying them together. Only whole blocks are written
+// out, a partial block is held in the context until the rest of it arrives.
+// The update functions return the number of bytes written to pBuffer, which
+// is where the next call should write.
+//
+// The output may be the input itself, as long as it does not run ahead of
+// it: pBuffer may be pText less the bytes still pending in the context.
+
+// CBCEncryptBlock()
+//
+// Encrypts one block into the chain and writes it out.
+static void CBCEncryptBlock(struct cbc_ctx* ctx, const byte_ard* pBlock,
+                            byte_ard* cBuffer)
+{
+  for (byte_ard j = 0; j < BLOCK_BYTE_SIZE; j++)
+  {
+    ctx->chain[j] ^= pBlock[j];
+  }
+  EncryptBlock((void*)ctx->chain, ctx->pKeys);
+  memcpy(cBuffer, ctx->chain, BLOCK_BYTE_SIZE);
+}
+
+// CBCDecryptBlock()
+//
+// Decrypts one block, which may be the output block, and moves the chain on.
+static void CBCDecryptBlock(struct cbc_ctx* ctx, const byte_ard* pBlock,
+                            byte_ard* cBuffer)
+{
+  byte_ard currblock[BLOCK_BYTE_SIZE];
+
+  memcpy(currblock, pBlock, BLOCK_BYTE_SIZE);
+  DecryptBlock((void*)currblock, ctx->pKeys);
+  for (byte_ard j = 0; j < BLOCK_BYTE_SIZE; j++)
+  {
+    currblock[j] ^= ctx->chain[j];
+  }
+  memcpy(ctx->chain, pBlock, BLOCK_BYTE_SIZE);
+  memcpy(cBuffer, currblock, BLOCK_BYTE_SIZE);
+}
+
+// CBCStreamUpdate()
+//
+// Tops up the pending block, then works on whole blocks straight from the
+// input. Shared by encryption and decryption.
+static u_int32_ard CBCStreamUpdate(struct cbc_ctx* ctx, const void* pText,
+                                   u_int32_ard length, void* pBuffer,
+                                   void (*doBlock)(struct cbc_ctx*, const byte_ard*, byte_ard*))
+{
+  const byte_ard *cText = (const byte_ard*)pText;
+  byte_ard *cBuffer = (byte_ard*)pBuffer;
+  u_int32_ard written = 0;
+
+  if (ctx->pendingLength > 0)
+  {
+    byte_ard n = BLOCK_BYTE_SIZE - ctx->pendingLength;
+    if (length < n)
+      n = length;
+    memcpy(ctx->pending + ctx->pendingLength, cText, n);
+    ctx->pendingLength += n;
+    cText += n;
+    length -= n;
+    if (ctx->pendingLength < BLOCK_BYTE_SIZE)
+      return 0;
+    doBlock(ctx, ctx->pending, cBuffer);
+    ctx->pendingLength = 0;
+    written = BLOCK_BYTE_SIZE;
+  }
+
+  while (length >= BLOCK_BYTE_SIZE)
+  {
+    doBlock(ctx, cText, cBuffer + written);
+    cText += BLOCK_BYTE_SIZE;
+    length -= BLOCK_BYTE_SIZE;
+    written += BLOCK_BYTE_SIZE;
+  }
+
+  memcpy(ctx->pending, cText, length);
+  ctx->pendingLength = length;
+  return written;
+}
+
+// CBCEncryptInit()
+void CBCEncryptInit(struct cbc_ctx* ctx, const u_int32_ard *pKeys,
+                    const u_int16_ard *pIV)
+{
+  ctx->pKeys = pKeys;
+  memcpy(ctx->chain, pIV, BLOCK_BYTE_SIZE);
+  ctx->pendingLength = 0;
+} // CBCEncryptInit()
+
+// CBCEncryptUpdate()
+u_int32_ard CBCEncryptUpdate(struct cbc_ctx* ctx, const void* pText,
+                             u_int32_ard length, void* pBuffer)
+{
+  return CBCStreamUpdate(ctx, pText, length, pBuffer, CBCEncryptBlock);
+} // CBCEncryptUpdate()
+
+// CBCEncryptFinal()
+//
+// Pads the text as CBCEncrypt() does and writes out what is left. padding
+// is counted from the total length of the text, AUTOPAD pads to the next
+// block boundary.
+u_int32_ard CBCEncryptFinal(struct cbc_ctx* ctx, u_int32_ard padding,
+                            void* pBuffer)
+{
+  byte_ard *cBuffer = (byte_ard*)pBuffer;
+  u_int32_ard written = 0;
+
+  if (padding == (BLOCK_BYTE_SIZE +1) )
+  {
+    padding = (BLOCK_BYTE_SIZE - ctx->pendingLength) % BLOCK_BYTE_SIZE;
+  }
+
+  while (padding > 0)
+  {
+    ctx->pending[ctx->pendingLength++] = 0x80;
+    padding--;
+    if (ctx->pendingLength == BLOCK_BYTE_SIZE)
+    {
+      CBCEncryptBlock(ctx, ctx->pending, cBuffer + written);
+      ctx->pendingLength = 0;
+      written += BLOCK_BYTE_SIZE;
+    }
+  }
+  return written;
+} // CBCEncryptFinal()
+
+// CBCDecryptInit()
+void CBCDecryptInit(struct cbc_ctx* ctx, const u_int32_ard *pKeys,
+                    const u_int16_ard *pIV)
+{
+  CBCEncryptInit(ctx, pKeys, pIV);
+} // CBCDecryptInit()
+
+// CBCDecryptUpdate()
+//
+// The ciphertext is whole blocks, so there is no final step.
+u_int32_ard CBCDecryptUpdate(struct cbc_ctx* ctx, const void* pText,
+                             u_int32_ard length, void* pBuffer)
+{
+  return CBCStreamUpdate(ctx, pText, length, pBuffer, CBCDecryptBlock);
+} // CBCDecryptUpdate()
+
 /**
  *  getSboxValue
  *
- *  Accessor for the SBOX lookup table. Arduino systems look into the EEPROM
- *  while other platforms use in-memory tables.
+ *  Accessor for the SBOX lookup table. Arduino systems look into the flash
+ *  with AES_TABLES_PROGMEM and into the EEPROM otherwise, while other platforms
+ *  use in-memory tables.
  */
 byte_ard getSboxValue(int index)
 {
-  #ifdef _ARDUINO_DUEMILANOVE
+  #if defined(_ARDUINO_DUEMILANOVE) && defined(AES_TABLES_PROGMEM)
+    return pgm_read_byte(&sbox[index]);
+  #elif defined(_ARDUINO_DUEMILANOVE)
     if( (S_TABLE_START+index) >= EEPROM_SIZE )
       return 0x00;
     return EEPROM.read(S_TABLE_START+index);
@@ -723,12 +898,15 @@ byte_ard getSboxValue(int index)
 /**
  *  getISboxValue
  *
- *  Accessor for the ISBOX lookup table. Arduino systems look into the EEPROM
- *  while other platforms use in-memory tables.
+ *  Accessor for the ISBOX lookup table. Arduino systems look into the flash
+ *  with AES_ISBOX_PROGMEM and into the EEPROM otherwise, while other platforms
+ *  use in-memory tables.
  */
 byte_ard getISboxValue(int index)
 {
-  #ifdef _ARDUINO_DUEMILANOVE
+  #if defined(_ARDUINO_DUEMILANOVE) && defined(AES_ISBOX_PROGMEM)
+    return pgm_read_byte(&isbox[index]);
+  #elif defined(_ARDUINO_DUEMILANOVE)
     if( (IS_TABLE_START+index) >= EEPROM_SIZE )
       return 0x00;
     return EEPROM.read(IS_TABLE_START+index);
@@ -740,12 +918,15 @@ byte_ard getISboxValue(int index)
 /**
  *  getRconValue
  *
- *  Accessor for the Rcon lookup table. Arduino systems look into the EEPROM
- *  while other platforms use in-memory tables.
+ *  Accessor for the Rcon lookup table. Arduino systems look into the flash
+ *  with AES_TABLES_PROGMEM and into the EEPROM otherwise, while other platforms
+ *  use in-memory tables.
  */
 byte_ard getRconValue(int index)
 {
-  #ifdef _ARDUINO_DUEMILANOVE
+  #if defined(_ARDUINO_DUEMILANOVE) && defined(AES_TABLES_PROGMEM)
+    return pgm_read_byte(&Rcon[index]);
+  #elif defined(_ARDUINO_DUEMILANOVE)
     if( (RCON_TABLE_START+index) >= EEPROM_SIZE )
       return 0x00;
     return EEPROM.read(RCON_TABLE_START+index);
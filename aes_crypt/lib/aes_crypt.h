@@ -37,6 +37,11 @@
   #define unroll_decrypt_loop
   #define unroll_cbc_decrypt_loop
   #define unroll_cbc_encrypt_loop
+
+  // Read the S-box and Rcon from flash rather than the EEPROM. Comment out to
+  // use the tables burned into the EEPROM by tsburner. See aes_tables.h.
+  #define AES_TABLES_PROGMEM
+  //#define AES_ISBOX_PROGMEM
 #endif
 
 //#define unroll_cbc_encrypt_loop
@@ -81,8 +86,33 @@ void CBCEncrypt(void* pTextIn, void* pBuffer, u_int32_ard length,
                 u_int32_ard padding, const u_int32_ard *pKeys,
                 const u_int16_ard *pIV);
 
+u_int32_ard CBCEncryptInPlace(void* pBuffer, u_int32_ard length,
+                              u_int32_ard padding, const u_int32_ard *pKeys,
+                              const u_int16_ard *pIV);
+
 void CBCDecrypt(void* pTextIn, void* pBuffer, u_int32_ard length,
                 const u_int32_ard *pKeys, const u_int16_ard *pIV);
+
+// Streaming CBC, for text that arrives in pieces. See aes_crypt.cpp.
+struct cbc_ctx
+{
+  const u_int32_ard *pKeys;
+  byte_ard chain[BLOCK_BYTE_SIZE];    // The last ciphertext block, the IV at first
+  byte_ard pending[BLOCK_BYTE_SIZE];  // A partial block waiting for more text
+  byte_ard pendingLength;
+};
+
+void CBCEncryptInit(struct cbc_ctx* ctx, const u_int32_ard *pKeys,
+                    const u_int16_ard *pIV);
+u_int32_ard CBCEncryptUpdate(struct cbc_ctx* ctx, const void* pText,
+                             u_int32_ard length, void* pBuffer);
+u_int32_ard CBCEncryptFinal(struct cbc_ctx* ctx, u_int32_ard padding,
+                            void* pBuffer);
+
+void CBCDecryptInit(struct cbc_ctx* ctx, const u_int32_ard *pKeys,
+                    const u_int16_ard *pIV);
+u_int32_ard CBCDecryptUpdate(struct cbc_ctx* ctx, const void* pText,
+                             u_int32_ard length, void* pBuffer);
                 
 // Accessors for lookup tables
 byte_ard getSboxValue(int index);
@@ -0,0 +1,158 @@
+/*
+ * File name: aes_drbg.cpp
+ * Date:      2026-10-19 20:30
+ * Author:
+ *
+ * The key stream comes from CTRCrypt(), so a long request is encrypted
+ * through the batch AES like any other CTR message. Keys are generated from
+ * seed material that lives on the stack only for the length of the call.
+ */
+
+#include "aes_drbg.h"
+#include "aes_gcm.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/random.h>
+
+// Increments the last four bytes of the block as a big endian counter, the
+// way CTRCrypt() does.
+static void incCounter32(byte_ard* pCounter)
+{
+  for (int16_ard i = BLOCK_BYTE_SIZE - 1; i >= BLOCK_BYTE_SIZE - 4; i--)
+    if (++pCounter[i] != 0)
+      break;
+}
+
+/* CTR_DRBG_Update. The new key and V are the next DRBG_SEED_SIZE bytes of
+ * key stream XOR the provided data, or the key stream itself when pData is
+ * NULL.
+ */
+static void drbgUpdate(struct ctr_drbg* d, const byte_ard* pData)
+{
+  byte_ard temp[DRBG_SEED_SIZE];
+
+  if (pData != NULL)
+    memcpy(temp, pData, DRBG_SEED_SIZE);
+  else
+    memset(temp, 0, DRBG_SEED_SIZE);
+
+  CTRCrypt(temp, temp, DRBG_SEED_SIZE, d->keys, d->counter);
+  KeyExpansion(temp, d->keys);
+  memcpy(d->counter, temp + KEY_BYTES, BLOCK_BYTE_SIZE);
+  incCounter32(d->counter);
+
+  memset(temp, 0, DRBG_SEED_SIZE);
+}
+
+void drbgInstantiate(struct ctr_drbg* d, const byte_ard* pSeed)
+{
+  byte_ard zero[KEY_BYTES];
+
+  memset(zero, 0, KEY_BYTES);
+  KeyExpansion(zero, d->keys);
+  memset(d->counter, 0, BLOCK_BYTE_SIZE);
+  incCounter32(d->counter);
+
+  drbgUpdate(d, pSeed);
+  d->reseedCounter = 1;
+}
+
+void drbgReseed(struct ctr_drbg* d, const byte_ard* pSeed)
+{
+  drbgUpdate(d, pSeed);
+  d->reseedCounter = 1;
+}
+
+void drbgGenerate(struct ctr_drbg* d, byte_ard* pOut, u_int32_ard length)
+{
+  while (length > 0)
+  {
+    u_int32_ard n = length < DRBG_MAX_REQUEST ? length : DRBG_MAX_REQUEST;
+
+    memset(pOut, 0, n);
+    CTRCrypt(pOut, pOut, n, d->keys, d->counter);
+    drbgUpdate(d, NULL);
+    d->reseedCounter++;
+
+    pOut += n;
+    length -= n;
+  }
+}
+
+// Bumped in the child on every fork(), starts at 1 so 0 means unseeded.
+static volatile u_int32_ard forkCount = 1;
+static pthread_once_t atforkOnce = PTHREAD_ONCE_INIT;
+
+static void countFork()
+{
+  forkCount++;
+}
+
+static void registerAtfork()
+{
+  pthread_atfork(NULL, NULL, countFork);
+}
+
+// Fills pSeed from getrandom(), or /dev/urandom on kernels without it.
+static int32_ard getEntropy(byte_ard* pSeed, u_int32_ard length)
+{
+  u_int32_ard got = 0;
+
+  while (got < length)
+  {
+    ssize_t n = getrandom(pSeed + got, length - got, 0);
+    if (n > 0)
+      got += n;
+    else if (errno != EINTR)
+      break;
+  }
+  if (got == length)
+    return DRBG_OK;
+
+  FILE* urandom = fopen("/dev/urandom", "r");
+  if (urandom == NULL)
+    return DRBG_FAILED;
+  got = fread(pSeed, 1, length, urandom);
+  fclose(urandom);
+  return got == length ? DRBG_OK : DRBG_FAILED;
+}
+
+static __thread struct ctr_drbg threadDrbg;
+
+int32_ard randomBytes(void* pOut, u_int32_ard length)
+{
+  struct ctr_drbg* d = &threadDrbg;
+  byte_ard* p = (byte_ard*)pOut;
+  byte_ard seed[DRBG_SEED_SIZE];
+
+  pthread_once(&atforkOnce, registerAtfork);
+
+  // Every thread and every child process seeds its own generator.
+  if (d->forks != forkCount)
+  {
+    if (getEntropy(seed, DRBG_SEED_SIZE) != DRBG_OK)
+      return DRBG_FAILED;
+    drbgInstantiate(d, seed);
+    d->forks = forkCount;
+  }
+
+  while (length > 0)
+  {
+    u_int32_ard n = length < DRBG_MAX_REQUEST ? length : DRBG_MAX_REQUEST;
+
+    if (d->reseedCounter > DRBG_RESEED_INTERVAL)
+    {
+      if (getEntropy(seed, DRBG_SEED_SIZE) != DRBG_OK)
+        return DRBG_FAILED;
+      drbgReseed(d, seed);
+    }
+    drbgGenerate(d, p, n);
+    p += n;
+    length -= n;
+  }
+
+  memset(seed, 0, DRBG_SEED_SIZE);
+  return DRBG_OK;
+}
@@ -0,0 +1,67 @@
+/*
+ * File name: aes_drbg.h
+ * Date:      2026-10-19 20:10
+ * Author:
+ *
+ * CTR_DRBG (NIST SP 800-90A) on the library's AES-128, without a derivation
+ * function, for the servers and tools. Keys and key material come from here
+ * rather than from /dev/urandom byte by byte.
+ *
+ * The counter is the last 32 bits of V, as CTRCrypt() counts (ctr_len = 32
+ * in SP 800-90A terms), so a request is at most DRBG_MAX_REQUEST bytes.
+ * drbgGenerate() splits longer ones.
+ *
+ * randomBytes() is the one most callers want. Every thread gets its own
+ * generator, seeded from getrandom() on first use and reseeded after
+ * DRBG_RESEED_INTERVAL requests, and again in the child after a fork(), so a
+ * forked server child never repeats its parent's output. The fork is noticed
+ * with pthread_atfork(), so a request costs no system call.
+ *
+ * Not built for the Arduino.
+ */
+
+#ifndef __AES_DRBG_H__
+#define __AES_DRBG_H__
+
+#include "aes_crypt.h"
+
+#define DRBG_SEED_SIZE        (KEY_BYTES + BLOCK_BYTE_SIZE)  // seedlen
+#define DRBG_MAX_REQUEST      65536                           // 2^19 bits
+#define DRBG_RESEED_INTERVAL  65536                           // Requests
+
+#define DRBG_OK 1
+#define DRBG_FAILED 0
+
+struct ctr_drbg
+{
+  u_int32_ard keys[KEY_WORDS*(ROUNDS+1)];  // Schedule of the DRBG key
+  byte_ard counter[BLOCK_BYTE_SIZE];       // V + 1, the next counter block
+  u_int32_ard reseedCounter;
+  u_int32_ard forks;                       // Forks seen when seeded, 0 if unseeded
+};
+
+/**
+ * Instantiates d from DRBG_SEED_SIZE bytes of full entropy seed material
+ * (the entropy input XOR the personalization string).
+ */
+void drbgInstantiate(struct ctr_drbg* d, const byte_ard* pSeed);
+
+/**
+ * Reseeds d with DRBG_SEED_SIZE bytes of entropy (XOR additional input).
+ */
+void drbgReseed(struct ctr_drbg* d, const byte_ard* pSeed);
+
+/**
+ * Writes length bytes to pOut, in requests of at most DRBG_MAX_REQUEST
+ * bytes. Does not reseed, see randomBytes().
+ */
+void drbgGenerate(struct ctr_drbg* d, byte_ard* pOut, u_int32_ard length);
+
+/**
+ * Writes length random bytes to pOut from the calling thread's generator.
+ * Returns DRBG_OK, or DRBG_FAILED if no entropy could be had from the
+ * system, in which case pOut holds nothing usable.
+ */
+int32_ard randomBytes(void* pOut, u_int32_ard length);
+
+#endif // __AES_DRBG_H__
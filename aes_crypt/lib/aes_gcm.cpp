@@ -0,0 +1,368 @@
+/*
+ * File name: aes_gcm.cpp
+ * Date:      2026-10-19 13:40
+ * Author:
+ *
+ * GHASH multiplies in GF(2^128) with the bit order of the GCM spec. There
+ * are three versions of the multiplication:
+ *  - With PCLMULQDQ (carry-less multiply) when the Intel CPU has it. This
+ *    is picked at run time, the rest of the library is built for plain x86.
+ *  - A bit serial one on 64 bit words for other Intel CPUs.
+ *  - A bit serial one on bytes for the Arduino. It needs no tables, which
+ *    the Arduino has no RAM to spare for.
+ * All of them run in constant time. Build with -DGCM_NO_PCLMUL to force the
+ * 64 bit word version on Intel.
+ *
+ * Off the Arduino every block, the hash key and the tag mask included, is
+ * encrypted by the bitsliced EncryptBlockBatch(), so the key does not leak
+ * through the cache timing of the table based EncryptBlock(). Only with
+ * -DAES_BATCH_TABLES, where the batch code uses tables as well, do messages
+ * shorter than BATCH_LANES blocks keep EncryptBlock().
+ */
+
+#include "aes_gcm.h"
+
+#ifndef _ARDUINO_DUEMILANOVE
+  #include "aes_batch.h"
+
+  // Counter blocks encrypted per EncryptBlockBatch() call, and the shortest
+  // text that goes through it.
+  #define CTR_CHUNK_BLOCKS (8*BATCH_LANES)
+  #ifndef AES_BATCH_TABLES
+    #define CTR_BATCH_MIN 1
+  #else
+    #define CTR_BATCH_MIN (BATCH_LANES*BLOCK_BYTE_SIZE)
+  #endif
+#endif
+
+#if !defined(_ARDUINO_DUEMILANOVE) && !defined(GCM_NO_PCLMUL) && \
+    defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #define GCM_PCLMUL
+  #include <wmmintrin.h>
+  #include <tmmintrin.h>
+#endif
+
+// Adds one to the big endian 32 bit counter in the last four bytes.
+static void incCounter(byte_ard* pCounter)
+{
+  for (int16_ard i = BLOCK_BYTE_SIZE - 1; i >= BLOCK_BYTE_SIZE - 4; i--)
+  {
+    if (++pCounter[i] != 0)
+      break;
+  }
+}
+
+void CTRCrypt(const void* pTextIn, void* pBuffer, u_int32_ard length,
+              const u_int32_ard* pKeys, byte_ard* pCounter)
+{
+  const byte_ard* pIn = (const byte_ard*)pTextIn;
+  byte_ard* pOut = (byte_ard*)pBuffer;
+  byte_ard keystream[BLOCK_BYTE_SIZE];
+
+#ifndef _ARDUINO_DUEMILANOVE
+  // The counter blocks are independent, so the key stream comes from
+  // EncryptBlockBatch(), up to CTR_CHUNK_BLOCKS blocks per call so the batch
+  // code sets up its round keys once per chunk.
+  byte_ard streams[CTR_CHUNK_BLOCKS][BLOCK_BYTE_SIZE];
+  byte_ard* pStreams[CTR_CHUNK_BLOCKS];
+  const u_int32_ard* pChunkKeys[CTR_CHUNK_BLOCKS];
+
+  for (int16_ard b = 0; b < CTR_CHUNK_BLOCKS; b++)
+  {
+    pStreams[b] = streams[b];
+    pChunkKeys[b] = pKeys;
+  }
+
+  while (length >= CTR_BATCH_MIN)
+  {
+    u_int32_ard blocks = (length + BLOCK_BYTE_SIZE - 1) / BLOCK_BYTE_SIZE;
+    if (blocks > CTR_CHUNK_BLOCKS)
+      blocks = CTR_CHUNK_BLOCKS;
+
+    for (u_int32_ard b = 0; b < blocks; b++)
+    {
+      memcpy(streams[b], pCounter, BLOCK_BYTE_SIZE);
+      incCounter(pCounter);
+    }
+    EncryptBlockBatch(pStreams, pChunkKeys, blocks);
+
+    // The last block of the text may be a partial one.
+    for (u_int32_ard b = 0; b < blocks; b++)
+    {
+      u_int16_ard n = (length < BLOCK_BYTE_SIZE) ? length : BLOCK_BYTE_SIZE;
+      for (u_int16_ard i = 0; i < n; i++)
+        pOut[i] = pIn[i] ^ streams[b][i];
+      pIn += n;
+      pOut += n;
+      length -= n;
+    }
+  }
+#endif
+
+  while (length > 0)
+  {
+    memcpy(keystream, pCounter, BLOCK_BYTE_SIZE);
+    EncryptBlock(keystream, pKeys);
+    incCounter(pCounter);
+
+    u_int16_ard n = (length < BLOCK_BYTE_SIZE) ? length : BLOCK_BYTE_SIZE;
+    for (u_int16_ard i = 0; i < n; i++)
+      pOut[i] = pIn[i] ^ keystream[i];
+
+    pIn += n;
+    pOut += n;
+    length -= n;
+  }
+}
+
+#ifdef GCM_PCLMUL
+/* X = X*H with carry-less multiplication, after Gueron and Kounavis, "Intel
+ * Carry-Less Multiplication Instruction and its Usage for Computing the GCM
+ * Mode", algorithm 5. The operands are byte reversed on the way in and out.
+ */
+__attribute__((target("pclmul,ssse3")))
+static void gfMulPclmul(byte_ard* X, const byte_ard* H)
+{
+  const __m128i bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+                                     8, 9, 10, 11, 12, 13, 14, 15);
+  __m128i a = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)X), bswap);
+  __m128i b = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)H), bswap);
+  __m128i t2, t3, t4, t5, t6, t7, t8, t9;
+
+  // 256 bit product t6:t3
+  t3 = _mm_clmulepi64_si128(a, b, 0x00);
+  t4 = _mm_clmulepi64_si128(a, b, 0x10);
+  t5 = _mm_clmulepi64_si128(a, b, 0x01);
+  t6 = _mm_clmulepi64_si128(a, b, 0x11);
+  t4 = _mm_xor_si128(t4, t5);
+  t5 = _mm_slli_si128(t4, 8);
+  t4 = _mm_srli_si128(t4, 8);
+  t3 = _mm_xor_si128(t3, t5);
+  t6 = _mm_xor_si128(t6, t4);
+
+  // Shift left by one for the reflected bit order
+  t7 = _mm_srli_epi32(t3, 31);
+  t8 = _mm_srli_epi32(t6, 31);
+  t3 = _mm_slli_epi32(t3, 1);
+  t6 = _mm_slli_epi32(t6, 1);
+  t9 = _mm_srli_si128(t7, 12);
+  t8 = _mm_slli_si128(t8, 4);
+  t7 = _mm_slli_si128(t7, 4);
+  t3 = _mm_or_si128(t3, t7);
+  t6 = _mm_or_si128(t6, t8);
+  t6 = _mm_or_si128(t6, t9);
+
+  // Reduce modulo x^128 + x^7 + x^2 + x + 1
+  t7 = _mm_slli_epi32(t3, 31);
+  t8 = _mm_slli_epi32(t3, 30);
+  t9 = _mm_slli_epi32(t3, 25);
+  t7 = _mm_xor_si128(t7, t8);
+  t7 = _mm_xor_si128(t7, t9);
+  t8 = _mm_srli_si128(t7, 4);
+  t7 = _mm_slli_si128(t7, 12);
+  t3 = _mm_xor_si128(t3, t7);
+
+  t2 = _mm_srli_epi32(t3, 1);
+  t4 = _mm_srli_epi32(t3, 2);
+  t5 = _mm_srli_epi32(t3, 7);
+  t2 = _mm_xor_si128(t2, t4);
+  t2 = _mm_xor_si128(t2, t5);
+  t2 = _mm_xor_si128(t2, t8);
+  t3 = _mm_xor_si128(t3, t2);
+  t6 = _mm_xor_si128(t6, t3);
+
+  _mm_storeu_si128((__m128i*)X, _mm_shuffle_epi8(t6, bswap));
+}
+#endif
+
+#ifndef _ARDUINO_DUEMILANOVE
+static u_int64_ard load64(const byte_ard* p)
+{
+  u_int64_ard w = 0;
+  for (int16_ard i = 0; i < 8; i++)
+    w = (w << 8) | p[i];
+  return w;
+}
+
+static void store64(byte_ard* p, u_int64_ard w)
+{
+  for (int16_ard i = 7; i >= 0; i--)
+  {
+    p[i] = (byte_ard)w;
+    w >>= 8;
+  }
+}
+
+/* X = X*H, algorithm 1 of SP 800-38D on two 64 bit words. The bit tests
+ * are turned into masks so there are no secret dependent branches.
+ */
+static void gfMulPortable(byte_ard* X, const byte_ard* H)
+{
+  u_int64_ard xh = load64(X), xl = load64(X + 8);
+  u_int64_ard vh = load64(H), vl = load64(H + 8);
+  u_int64_ard zh = 0, zl = 0;
+
+  for (int16_ard i = 0; i < 128; i++)
+  {
+    u_int64_ard bit = (i < 64) ? (xh >> (63 - i)) : (xl >> (127 - i));
+    u_int64_ard mask = (u_int64_ard)0 - (bit & 1);
+    zh ^= vh & mask;
+    zl ^= vl & mask;
+
+    mask = (u_int64_ard)0 - (vl & 1);
+    vl = (vl >> 1) | (vh << 63);
+    vh = (vh >> 1) ^ (mask & ((u_int64_ard)0xE1 << 56));
+  }
+
+  store64(X, zh);
+  store64(X + 8, zl);
+}
+#else
+/* X = X*H, algorithm 1 of SP 800-38D on bytes. */
+static void gfMulPortable(byte_ard* X, const byte_ard* H)
+{
+  byte_ard Z[BLOCK_BYTE_SIZE];
+  byte_ard V[BLOCK_BYTE_SIZE];
+
+  memset(Z, 0, BLOCK_BYTE_SIZE);
+  memcpy(V, H, BLOCK_BYTE_SIZE);
+
+  for (int16_ard i = 0; i < 128; i++)
+  {
+    byte_ard mask = -((X[i >> 3] >> (7 - (i & 7))) & 1);
+    for (int16_ard j = 0; j < BLOCK_BYTE_SIZE; j++)
+      Z[j] ^= V[j] & mask;
+
+    mask = -(V[BLOCK_BYTE_SIZE-1] & 1);
+    for (int16_ard j = BLOCK_BYTE_SIZE - 1; j > 0; j--)
+      V[j] = (V[j] >> 1) | (V[j-1] << 7);
+    V[0] = (V[0] >> 1) ^ (mask & 0xE1);
+  }
+
+  memcpy(X, Z, BLOCK_BYTE_SIZE);
+}
+#endif
+
+static void gfMul(byte_ard* X, const byte_ard* H)
+{
+#ifdef GCM_PCLMUL
+  static int16_ard hasPclmul = -1;
+  if (hasPclmul < 0)
+    hasPclmul = __builtin_cpu_supports("pclmul") ? 1 : 0;
+  if (hasPclmul)
+  {
+    gfMulPclmul(X, H);
+    return;
+  }
+#endif
+  gfMulPortable(X, H);
+}
+
+// Absorbs length bytes into the GHASH state Y, zero padding the last block.
+static void ghashUpdate(byte_ard* Y, const byte_ard* H, const byte_ard* p,
+                        u_int32_ard length)
+{
+  while (length > 0)
+  {
+    u_int16_ard n = (length < BLOCK_BYTE_SIZE) ? length : BLOCK_BYTE_SIZE;
+    for (u_int16_ard i = 0; i < n; i++)
+      Y[i] ^= p[i];
+    gfMul(Y, H);
+
+    p += n;
+    length -= n;
+  }
+}
+
+/* Computes the tag over the additional data and the ciphertext, i.e.
+ * GHASH(A || C || len(A) || len(C)) encrypted with the counter block J0.
+ */
+static void gcmTag(const u_int32_ard* pKeys, const byte_ard* pNonce,
+                   const byte_ard* pAad, u_int32_ard aadLength,
+                   const byte_ard* pCipher, u_int32_ard length, byte_ard* pTag)
+{
+  byte_ard H[BLOCK_BYTE_SIZE];
+  byte_ard Y[BLOCK_BYTE_SIZE];
+  byte_ard lengths[BLOCK_BYTE_SIZE];
+
+  // The hash key is the encrypted zero block, the tag mask the encrypted
+  // J0 = nonce || 0x00000001.
+  memset(H, 0, BLOCK_BYTE_SIZE);
+  memcpy(pTag, pNonce, GCM_NONCE_SIZE);
+  pTag[12] = 0x00;
+  pTag[13] = 0x00;
+  pTag[14] = 0x00;
+  pTag[15] = 0x01;
+#if !defined(_ARDUINO_DUEMILANOVE) && !defined(AES_BATCH_TABLES)
+  byte_ard* pBlocks[2] = { H, pTag };
+  const u_int32_ard* pBlockKeys[2] = { pKeys, pKeys };
+  EncryptBlockBatch(pBlocks, pBlockKeys, 2);
+#else
+  EncryptBlock(H, pKeys);
+  EncryptBlock(pTag, pKeys);
+#endif
+
+  memset(Y, 0, BLOCK_BYTE_SIZE);
+  ghashUpdate(Y, H, pAad, aadLength);
+  ghashUpdate(Y, H, pCipher, length);
+
+  // Bit lengths as two 64 bit big endian numbers.
+  memset(lengths, 0, BLOCK_BYTE_SIZE);
+  for (int16_ard i = 0; i < 4; i++)
+  {
+    lengths[7 - i] = (byte_ard)((aadLength << 3) >> (8*i));
+    lengths[15 - i] = (byte_ard)((length << 3) >> (8*i));
+  }
+  lengths[3] = (byte_ard)(aadLength >> 29);
+  lengths[11] = (byte_ard)(length >> 29);
+  ghashUpdate(Y, H, lengths, BLOCK_BYTE_SIZE);
+
+  for (int16_ard i = 0; i < BLOCK_BYTE_SIZE; i++)
+    pTag[i] ^= Y[i];
+}
+
+// The first counter block used for the message itself, J0 + 1.
+static void initCounter(byte_ard* pCounter, const byte_ard* pNonce)
+{
+  memcpy(pCounter, pNonce, GCM_NONCE_SIZE);
+  pCounter[12] = 0x00;
+  pCounter[13] = 0x00;
+  pCounter[14] = 0x00;
+  pCounter[15] = 0x02;
+}
+
+void aesGcmEncrypt(const u_int32_ard* pKeys, const byte_ard* pNonce,
+                   const byte_ard* pAad, u_int32_ard aadLength,
+                   const void* pTextIn, void* pBuffer, u_int32_ard length,
+                   byte_ard* pTag)
+{
+  byte_ard counter[BLOCK_BYTE_SIZE];
+
+  initCounter(counter, pNonce);
+  CTRCrypt(pTextIn, pBuffer, length, pKeys, counter);
+  gcmTag(pKeys, pNonce, pAad, aadLength, (const byte_ard*)pBuffer, length, pTag);
+}
+
+int32_ard aesGcmDecrypt(const u_int32_ard* pKeys, const byte_ard* pNonce,
+                        const byte_ard* pAad, u_int32_ard aadLength,
+                        const void* pTextIn, void* pBuffer, u_int32_ard length,
+                        const byte_ard* pTag)
+{
+  byte_ard counter[BLOCK_BYTE_SIZE];
+  byte_ard tag[GCM_TAG_SIZE];
+  byte_ard diff = 0;
+
+  gcmTag(pKeys, pNonce, pAad, aadLength, (const byte_ard*)pTextIn, length, tag);
+
+  // Compare all of the tag, an early exit would leak how much matched.
+  for (int16_ard i = 0; i < GCM_TAG_SIZE; i++)
+    diff |= tag[i] ^ pTag[i];
+
+  if (diff != 0)
+    return GCM_TAG_INVALID;
+
+  initCounter(counter, pNonce);
+  CTRCrypt(pTextIn, pBuffer, length, pKeys, counter);
+
+  return GCM_TAG_VALID;
+}
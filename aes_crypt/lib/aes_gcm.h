@@ -0,0 +1,54 @@
+/*
+ * File name: aes_gcm.h
+ * Date:      2026-10-19 13:40
+ * Author:
+ *
+ * AES in counter mode (CTR) and Galois/Counter mode (GCM, NIST SP 800-38D)
+ * with 128 bit keys, a 96 bit nonce and a full 128 bit tag.
+ *
+ * Unlike CBC+CMAC, GCM encrypts and authenticates in a single pass and
+ * every block can be computed independently. The nonce must never repeat
+ * under the same key, a message counter is the usual choice.
+ */
+
+#ifndef __AES_GCM_H__
+#define __AES_GCM_H__
+
+#include "aes_crypt.h"
+
+#define GCM_NONCE_SIZE 12
+#define GCM_TAG_SIZE 16
+
+#define GCM_TAG_VALID 1
+#define GCM_TAG_INVALID 0
+
+/**
+ * Encrypts or decrypts (the same thing in CTR) length bytes. pCounter is the
+ * 16 byte initial counter block, its last four bytes are incremented as a
+ * big endian counter for every block, as GCM does. On return it holds the
+ * next unused counter. pTextIn and pBuffer may be the same buffer.
+ */
+void CTRCrypt(const void* pTextIn, void* pBuffer, u_int32_ard length,
+              const u_int32_ard* pKeys, byte_ard* pCounter);
+
+/**
+ * Encrypts length bytes from pTextIn to pBuffer and writes the tag over the
+ * additional data pAad and the ciphertext to pTag. pTextIn and pBuffer may
+ * be the same buffer.
+ */
+void aesGcmEncrypt(const u_int32_ard* pKeys, const byte_ard* pNonce,
+                   const byte_ard* pAad, u_int32_ard aadLength,
+                   const void* pTextIn, void* pBuffer, u_int32_ard length,
+                   byte_ard* pTag);
+
+/**
+ * Checks pTag against the additional data and the length bytes of
+ * ciphertext in pTextIn. Only if it matches is the ciphertext decrypted to
+ * pBuffer. Returns GCM_TAG_VALID or GCM_TAG_INVALID.
+ */
+int32_ard aesGcmDecrypt(const u_int32_ard* pKeys, const byte_ard* pNonce,
+                        const byte_ard* pAad, u_int32_ard aadLength,
+                        const void* pTextIn, void* pBuffer, u_int32_ard length,
+                        const byte_ard* pTag);
+
+#endif // __AES_GCM_H__
@@ -29,7 +29,21 @@
 
 #include "tstypes.h"
 
-byte_ard isbox[256] = {
+//
+// With AES_TABLES_PROGMEM (see aes_crypt.h) the Arduino build keeps the tables
+// in flash, to be read with pgm_read_byte(). The inverse S-box is only used by
+// the decryption, which the sensors only do during the key exchange, so it
+// stays in the EEPROM unless AES_ISBOX_PROGMEM is defined as well.
+//
+#ifdef _ARDUINO_DUEMILANOVE
+  #include <avr/pgmspace.h>
+  #define AES_TABLE(name,len) const byte_ard name[len] PROGMEM
+#else
+  #define AES_TABLE(name,len) byte_ard name[len]
+#endif
+
+#if !defined(_ARDUINO_DUEMILANOVE) || defined(AES_ISBOX_PROGMEM)
+AES_TABLE(isbox,256) = {
     0x52, 0x09, 0x6a, 0xd5, 0x30, 0x36, 0xa5, 0x38, 0xbf, 0x40, 0xa3, 0x9e, 0x81, 0xf3, 0xd7, 0xfb, 
     0x7c, 0xe3, 0x39, 0x82, 0x9b, 0x2f, 0xff, 0x87, 0x34, 0x8e, 0x43, 0x44, 0xc4, 0xde, 0xe9, 0xcb, 
     0x54, 0x7b, 0x94, 0x32, 0xa6, 0xc2, 0x23, 0x3d, 0xee, 0x4c, 0x95, 0x0b, 0x42, 0xfa, 0xc3, 0x4e, 
@@ -47,8 +61,9 @@ byte_ard isbox[256] = {
     0xa0, 0xe0, 0x3b, 0x4d, 0xae, 0x2a, 0xf5, 0xb0, 0xc8, 0xeb, 0xbb, 0x3c, 0x83, 0x53, 0x99, 0x61, 
     0x17, 0x2b, 0x04, 0x7e, 0xba, 0x77, 0xd6, 0x26, 0xe1, 0x69, 0x14, 0x63, 0x55, 0x21, 0x0c, 0x7d
 };
+#endif
 
-byte_ard sbox[256] = {
+AES_TABLE(sbox,256) = {
     0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
     0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
     0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
@@ -67,7 +82,7 @@ byte_ard sbox[256] = {
     0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
 };
 
-byte_ard Rcon[255] = {
+AES_TABLE(Rcon,16) = {
     0x8d, 0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1b, 0x36, 0x6c, 0xd8, 0xab, 0x4d, 0x9a}; 
 
 #endif /* _AES_TABLES_H */
@@ -8,27 +8,15 @@
  */
 
 #include "aes_utils.h"
+#include "aes_drbg.h"
 
 int generateKey(byte_ard *newKey) {
-	generateKeyOfLength(newKey, KEY_BYTES);
+	return generateKeyOfLength(newKey, KEY_BYTES);
 }
 
+// Keys come from the calling thread's CTR_DRBG, see aes_drbg.h.
 int generateKeyOfLength(byte_ard *newKey, int length) {
-	byte_ard res = 0;
-    u_int32_ard f;
-	FILE * urandom = fopen("/dev/urandom","r");
-
-	if(urandom)
-    {
-		for(u_int32_ard i=0; i<length; i++)
-        {
-			f = fread(&res, 1, sizeof(res), urandom);
-			newKey[i] = res;
-		}
-		fclose(urandom);
-		return 1;
-	}
-	return res;
+	return randomBytes(newKey, length) == DRBG_OK ? 1 : 0;
 }
 
 void printByteArd(unsigned char* pBytes, unsigned long dLength, 
@@ -0,0 +1,91 @@
+/*
+ * File name: msg_arena.cpp
+ * Date:      2026-10-19 23:20
+ * Author:
+ */
+
+#include "msg_arena.h"
+#include <stdlib.h>
+
+// The arena msgAlloc() takes from, per thread.
+static __thread struct msg_arena* currentArena = NULL;
+
+static u_int32_ard alignUp(u_int32_ard size)
+{
+  return (size + ARENA_ALIGN - 1) & ~(u_int32_ard)(ARENA_ALIGN - 1);
+}
+
+int32_ard arenaInit(struct msg_arena* a, u_int32_ard size)
+{
+  a->size = alignUp(size);
+  a->base = (byte_ard*)malloc(a->size);
+  a->used = 0;
+  a->overflow = NULL;
+  a->highWater = 0;
+  a->overflows = 0;
+  return a->base != NULL ? 1 : 0;
+}
+
+void arenaDestroy(struct msg_arena* a)
+{
+  arenaReset(a);
+  free(a->base);
+  a->base = NULL;
+  a->size = 0;
+}
+
+void* arenaAlloc(struct msg_arena* a, u_int32_ard size)
+{
+  size = alignUp(size);
+
+  if (a->used + size <= a->size)
+  {
+    void* p = a->base + a->used;
+    a->used += size;
+    if (a->used > a->highWater)
+      a->highWater = a->used;
+    return p;
+  }
+
+  // Does not fit, an extra block of its own. The header is padded so the
+  // memory after it stays aligned.
+  u_int32_ard header = alignUp(sizeof(struct arena_block));
+  struct arena_block* block = (struct arena_block*)malloc(header + size);
+  if (block == NULL)
+    return NULL;
+  block->next = a->overflow;
+  a->overflow = block;
+  return (byte_ard*)block + header;
+}
+
+void arenaReset(struct msg_arena* a)
+{
+  if (a->overflow != NULL)
+    a->overflows++;
+
+  while (a->overflow != NULL)
+  {
+    struct arena_block* next = a->overflow->next;
+    free(a->overflow);
+    a->overflow = next;
+  }
+  a->used = 0;
+}
+
+void arenaUse(struct msg_arena* a)
+{
+  currentArena = a;
+}
+
+void* msgAlloc(u_int32_ard size)
+{
+  if (currentArena != NULL)
+    return arenaAlloc(currentArena, size);
+  return malloc(size);
+}
+
+void msgFree(void* p)
+{
+  if (currentArena == NULL)
+    free(p);
+}
@@ -0,0 +1,79 @@
+/*
+ * File name: msg_arena.h
+ * Date:      2026-10-19 23:20
+ * Author:
+ *
+ * Bump allocator for the memory a server needs while it handles one
+ * message: the buffers the unpack functions of protocol.cpp fill in, the
+ * sensor profile and the like. Allocating is moving a pointer, and
+ * arenaReset() gives everything back at once after the response is out,
+ * so nothing on the message path is freed piecemeal and nothing leaks when
+ * a handler bails out early.
+ *
+ * The arena is one block allocated up front. A message that needs more
+ * than that still gets its memory, from extra blocks on the heap that the
+ * next reset frees, and the arena counts it so the size can be fixed.
+ *
+ * protocol.cpp and payload_codec.cpp allocate with msgAlloc(), which takes
+ * from the arena the calling thread has chosen with arenaUse(), or from
+ * malloc() if it has none. Memory from an arena must not be free()d, use
+ * msgFree(), which only frees what came from malloc().
+ *
+ * Not built for the Arduino.
+ */
+
+#ifndef __MSG_ARENA_H__
+#define __MSG_ARENA_H__
+
+#include "tstypes.h"
+
+#define ARENA_ALIGN 16
+#define ARENA_DEFAULT_SIZE (64*1024)
+
+struct arena_block
+{
+  struct arena_block* next;
+};
+
+struct msg_arena
+{
+  byte_ard* base;                // The block allocated up front
+  u_int32_ard size;
+  u_int32_ard used;
+  struct arena_block* overflow;  // Extra blocks since the last reset
+  u_int32_ard highWater;         // Most used between two resets
+  u_int32_ard overflows;         // Resets that had to free extra blocks
+};
+
+/**
+ * Allocates the block of size bytes. Returns 1, or 0 if it could not be
+ * allocated.
+ */
+int32_ard arenaInit(struct msg_arena* a, u_int32_ard size);
+
+/**
+ * Frees the block and any extra blocks.
+ */
+void arenaDestroy(struct msg_arena* a);
+
+/**
+ * Returns size bytes aligned to ARENA_ALIGN, valid until the next reset.
+ * NULL only if the heap is out of memory.
+ */
+void* arenaAlloc(struct msg_arena* a, u_int32_ard size);
+
+/**
+ * Gives back everything allocated since the last reset.
+ */
+void arenaReset(struct msg_arena* a);
+
+/**
+ * Makes msgAlloc() in the calling thread take from a, or from malloc() if
+ * a is NULL.
+ */
+void arenaUse(struct msg_arena* a);
+
+void* msgAlloc(u_int32_ard size);
+void msgFree(void* p);
+
+#endif // __MSG_ARENA_H__
@@ -0,0 +1,292 @@
+/*
+ * File name: payload_codec.cpp
+ * Date:      2026-10-19 17:40
+ * Author:
+ *
+ * The packer runs on the tsensor, so it works on bytes and 32 bit
+ * accumulators and allocates nothing. The unpacker is only built for the
+ * sink. The deltas have a fixed width within an interface, so their bit
+ * offsets are known up front and the sink extracts, zig-zag decodes and
+ * prefix sums eight of them at a time with AVX2 when the CPU has it. This
+ * is picked at run time, build with -DPAYLOAD_NO_AVX2 to force the scalar
+ * version.
+ */
+
+#include "payload_codec.h"
+#ifndef _ARDUINO_DUEMILANOVE
+  #include "msg_arena.h"
+#endif
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_ARDUINO_DUEMILANOVE) && !defined(PAYLOAD_NO_AVX2) && \
+    defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  #define PAYLOAD_AVX2
+  #include <immintrin.h>
+#endif
+
+static u_int16_ard zigzag(int16_ard d)
+{
+  return (u_int16_ard)(d < 0 ? ((-d) << 1) - 1 : d << 1);
+}
+
+static byte_ard bitWidth(u_int16_ard v)
+{
+  byte_ard bits = 0;
+  while (v != 0)
+  {
+    bits++;
+    v >>= 1;
+  }
+  return bits;
+}
+
+// The width of the widest zig-zag delta of interface i.
+static byte_ard deltaBits(const byte_ard* pSamples, byte_ard icnt, byte_ard i,
+                          byte_ard records, u_int16_ard mask)
+{
+  u_int16_ard all = 0;
+  for (u_int16_ard r = 1; r < records; r++)
+  {
+    int16_ard d = (int16_ard)(pSamples[r*icnt+i] & mask) -
+                  (int16_ard)(pSamples[(r-1)*icnt+i] & mask);
+    all |= zigzag(d);
+  }
+  return bitWidth(all);
+}
+
+static u_int16_ard streamSize(byte_ard valueBits, byte_ard dbits, byte_ard records)
+{
+  if (records == 0)
+    return 0;
+  return (valueBits + (u_int32_ard)(records-1)*dbits + 7) / 8;
+}
+
+u_int16_ard payload_packed_size(const byte_ard* pSamples, byte_ard icnt,
+                                byte_ard records, byte_ard valueBits)
+{
+  u_int16_ard mask = (1 << valueBits) - 1;
+  u_int16_ard size = PAYLOAD_HEADER_SIZE + icnt*PAYLOAD_IFHEADER_SIZE;
+  for (byte_ard i = 0; i < icnt; i++)
+    size += streamSize(valueBits, deltaBits(pSamples, icnt, i, records, mask), records);
+  return size;
+}
+
+struct bitWriter
+{
+  byte_ard* p;
+  u_int32_ard acc;
+  byte_ard n;
+};
+
+static void putBits(struct bitWriter* w, u_int16_ard v, byte_ard bits)
+{
+  w->acc |= (u_int32_ard)v << w->n;
+  w->n += bits;
+  while (w->n >= 8)
+  {
+    *w->p++ = w->acc & 0xFF;
+    w->acc >>= 8;
+    w->n -= 8;
+  }
+}
+
+// Ends an interface stream on a byte boundary.
+static void flushBits(struct bitWriter* w)
+{
+  if (w->n > 0)
+    *w->p++ = w->acc & 0xFF;
+  w->acc = 0;
+  w->n = 0;
+}
+
+u_int16_ard pack_payload(const byte_ard* pSamples, byte_ard icnt,
+                         byte_ard records, const byte_ard* pTypes,
+                         byte_ard valueBits, byte_ard* pBuffer)
+{
+  u_int16_ard mask = (1 << valueBits) - 1;
+  struct bitWriter w;
+
+  pBuffer[0] = (icnt << 4) | PAYLOAD_VERSION;
+  pBuffer[1] = records;
+
+  w.p = pBuffer + PAYLOAD_HEADER_SIZE + icnt*PAYLOAD_IFHEADER_SIZE;
+  w.acc = 0;
+  w.n = 0;
+
+  for (byte_ard i = 0; i < icnt; i++)
+  {
+    byte_ard dbits = deltaBits(pSamples, icnt, i, records, mask);
+    byte_ard* pIfHeader = pBuffer + PAYLOAD_HEADER_SIZE + i*PAYLOAD_IFHEADER_SIZE;
+    pIfHeader[0] = (pTypes[i] << 4) | (valueBits - 1);
+    pIfHeader[1] = dbits;
+
+    if (records == 0)
+      continue;
+    putBits(&w, pSamples[i] & mask, valueBits);
+    for (u_int16_ard r = 1; r < records; r++)
+    {
+      int16_ard d = (int16_ard)(pSamples[r*icnt+i] & mask) -
+                    (int16_ard)(pSamples[(r-1)*icnt+i] & mask);
+      putBits(&w, zigzag(d), dbits);
+    }
+    flushBits(&w);
+  }
+
+  return w.p - pBuffer;
+}
+
+#ifndef _ARDUINO_DUEMILANOVE
+
+// Reads the bits bit field at bit offset pos, without reading past it.
+static u_int32_ard getBits(const byte_ard* p, u_int32_ard pos, byte_ard bits)
+{
+  u_int32_ard w = 0;
+  u_int32_ard need = ((pos & 7) + bits + 7) / 8;
+  for (u_int32_ard i = 0; i < need; i++)
+    w |= (u_int32_ard)p[(pos >> 3) + i] << (8*i);
+  return (w >> (pos & 7)) & ((1u << bits) - 1);
+}
+
+#ifdef PAYLOAD_AVX2
+/* Decodes the deltas of one interface eight at a time, as long as the 32 bit
+ * loads stay inside the stream. Each lane loads the word its field starts
+ * in and shifts it down, the deltas are then prefix summed across the eight
+ * lanes on top of the running value v. Returns how many deltas were decoded
+ * and leaves the last value in v.
+ */
+__attribute__((target("avx2")))
+static u_int32_ard unpackDeltasAvx2(const byte_ard* p, u_int32_ard streamLen,
+                                    byte_ard valueBits, byte_ard dbits,
+                                    u_int32_ard count, u_int16_ard mask,
+                                    u_int16_ard* v, u_int16_ard* pOut,
+                                    byte_ard stride)
+{
+  const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m256i fieldMask = _mm256_set1_epi32((1 << dbits) - 1);
+  const __m256i one = _mm256_set1_epi32(1);
+  const __m256i seven = _mm256_set1_epi32(7);
+  const __m256i stepBits = _mm256_mullo_epi32(lanes, _mm256_set1_epi32(dbits));
+  int32_ard sums[8];
+  u_int32_ard done = 0;
+
+  while (done + 8 <= count)
+  {
+    u_int32_ard pos = valueBits + done*dbits;
+    if (((pos + 7*dbits) >> 3) + 4 > streamLen)
+      break;
+
+    __m256i offs = _mm256_add_epi32(_mm256_set1_epi32(pos), stepBits);
+    __m256i words = _mm256_i32gather_epi32((const int*)p, _mm256_srli_epi32(offs, 3), 1);
+    __m256i z = _mm256_and_si256(_mm256_srlv_epi32(words, _mm256_and_si256(offs, seven)),
+                                 fieldMask);
+
+    // Zig-zag decode, (z >> 1) ^ -(z & 1)
+    __m256i d = _mm256_xor_si256(_mm256_srli_epi32(z, 1),
+                                 _mm256_sub_epi32(_mm256_setzero_si256(),
+                                                  _mm256_and_si256(z, one)));
+
+    // Prefix sum within each 128 bit half, then carry the low half's total
+    // into the high half.
+    d = _mm256_add_epi32(d, _mm256_slli_si256(d, 4));
+    d = _mm256_add_epi32(d, _mm256_slli_si256(d, 8));
+    __m256i carry = _mm256_shuffle_epi32(d, 0xFF);
+    d = _mm256_add_epi32(d, _mm256_permute2x128_si256(carry, carry, 0x08));
+    d = _mm256_add_epi32(d, _mm256_set1_epi32(*v));
+
+    _mm256_storeu_si256((__m256i*)sums, d);
+    for (byte_ard j = 0; j < 8; j++)
+      pOut[(done + 1 + j)*stride] = sums[j] & mask;
+    *v = sums[7] & mask;
+    done += 8;
+  }
+  return done;
+}
+#endif
+
+// Unpacks the records samples of one interface to every stride'th value.
+static void unpackInterface(const byte_ard* p, u_int32_ard streamLen,
+                            byte_ard valueBits, byte_ard dbits, byte_ard records,
+                            u_int16_ard* pOut, byte_ard stride)
+{
+  u_int16_ard mask = (1 << valueBits) - 1;
+  u_int32_ard count = records - 1;
+  u_int32_ard done = 0;
+  u_int16_ard v = getBits(p, 0, valueBits);
+
+  pOut[0] = v;
+
+#ifdef PAYLOAD_AVX2
+  static int16_ard hasAvx2 = -1;
+  if (hasAvx2 < 0)
+    hasAvx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+  if (hasAvx2 && dbits > 0)
+    done = unpackDeltasAvx2(p, streamLen, valueBits, dbits, count, mask, &v, pOut, stride);
+#endif
+
+  for (; done < count; done++)
+  {
+    u_int32_ard z = getBits(p, valueBits + done*dbits, dbits);
+    v = (v + ((z >> 1) ^ (0 - (z & 1)))) & mask;
+    pOut[(done + 1)*stride] = v;
+  }
+}
+
+int32_ard unpack_payload(const byte_ard* pStream, u_int16_ard length,
+                         struct payload* pl)
+{
+  u_int16_ard streamLens[PAYLOAD_MAX_INTERFACES];
+  u_int32_ard total;
+
+  if (length < PAYLOAD_HEADER_SIZE || (pStream[0] & 0x0F) != PAYLOAD_VERSION)
+    return PAYLOAD_INVALID;
+
+  pl->icnt = pStream[0] >> 4;
+  pl->records = pStream[1];
+  total = PAYLOAD_HEADER_SIZE + pl->icnt*PAYLOAD_IFHEADER_SIZE;
+  if (pl->icnt == 0 || total > length)
+    return PAYLOAD_INVALID;
+
+  for (byte_ard i = 0; i < pl->icnt; i++)
+  {
+    const byte_ard* pIfHeader = pStream + PAYLOAD_HEADER_SIZE + i*PAYLOAD_IFHEADER_SIZE;
+    pl->types[i] = pIfHeader[0] >> 4;
+    pl->valueBits[i] = (pIfHeader[0] & 0x0F) + 1;
+    if (pl->valueBits[i] > PAYLOAD_MAX_VALUE_BITS || pIfHeader[1] > PAYLOAD_MAX_VALUE_BITS + 1)
+      return PAYLOAD_INVALID;
+    streamLens[i] = streamSize(pl->valueBits[i], pIfHeader[1], pl->records);
+    total += streamLens[i];
+  }
+  if (total > length)
+    return PAYLOAD_INVALID;
+
+  pl->values = (u_int16_ard*)msgAlloc((pl->records*pl->icnt + 1)*sizeof(u_int16_ard));
+  if (pl->values == NULL)
+    return PAYLOAD_INVALID;
+  if (pl->records == 0)
+    return PAYLOAD_VALID;
+
+  const byte_ard* p = pStream + PAYLOAD_HEADER_SIZE + pl->icnt*PAYLOAD_IFHEADER_SIZE;
+  for (byte_ard i = 0; i < pl->icnt; i++)
+  {
+    byte_ard dbits = pStream[PAYLOAD_HEADER_SIZE + i*PAYLOAD_IFHEADER_SIZE + 1];
+    unpackInterface(p, streamLens[i], pl->valueBits[i], dbits, pl->records,
+                    pl->values + i, pl->icnt);
+    p += streamLens[i];
+  }
+  return PAYLOAD_VALID;
+}
+
+int32_ard payload_times(const byte_ard* pStream, u_int16_ard length)
+{
+  if (length < 1 || PAYLOAD_TIMES_SIZE(pStream[0]) > length)
+    return -1;
+  return pStream[0];
+}
+
+u_int16_ard payload_time_offset(const byte_ard* pStream, byte_ard record)
+{
+  return pStream[1 + 2*record] | (pStream[2 + 2*record] << 8);
+}
+
+#endif // _ARDUINO_DUEMILANOVE
@@ -0,0 +1,105 @@
+/*
+ * File name: payload_codec.h
+ * Date:      2026-10-19 17:40
+ * Author:
+ *
+ * Compact encoding of the measurement payload of data messages, shared by
+ * the tsensor and the sink. The samples of each interface are delta encoded
+ * and the deltas zig-zag mapped and bit packed at a fixed width, the
+ * smallest one that holds every delta of the interface in the message. A
+ * slowly changing reading then costs two or three bits per sample, a
+ * constant one none at all. The payload describes itself:
+ *
+ *    [ICNT (4) | Version (4)][Records (1)]
+ *    ICNT times: [ITYPE (4) | ABITL - 1 (4)][DBITL (1)]
+ *    ICNT times, each starting on a byte boundary:
+ *       First sample (ABITL bits), Records - 1 zig-zag deltas (DBITL bits each)
+ *
+ * Bit fields are packed least significant bit first. A record is one sample
+ * of every interface, and the samples are interleaved by record in the
+ * unpacked buffers, as in the tsensor measurement buffer.
+ *
+ * A data message with a packed payload has MSG_T_DATA_PACKED_FLAG (see
+ * protocol.h) set in its message type.
+ *
+ * In adaptive sampling the tsensor keeps samples at irregular times, so the
+ * time of each record goes with them. Such a message has
+ * MSG_T_DATA_TIMED_FLAG set and its payload, raw or packed, follows the
+ * record times:
+ *
+ *    [Records (1)]
+ *    Records times: Seconds the record was sampled before the message
+ *                   time (2, low to high)
+ */
+
+#ifndef __PAYLOAD_CODEC_H__
+#define __PAYLOAD_CODEC_H__
+
+#include "tstypes.h"
+
+#define PAYLOAD_VERSION          1
+#define PAYLOAD_HEADER_SIZE      2
+#define PAYLOAD_IFHEADER_SIZE    2
+#define PAYLOAD_MAX_INTERFACES   15
+#define PAYLOAD_MAX_VALUE_BITS   14   // So a zig-zag delta fits 15 bits
+
+#define PAYLOAD_TIMES_SIZE(records) (1 + 2*(records))
+
+#define PAYLOAD_VALID            1
+#define PAYLOAD_INVALID          0
+
+/**
+ * The size of the packed payload for records samples of icnt interfaces
+ * with valueBits significant bits each.
+ */
+u_int16_ard payload_packed_size(const byte_ard* pSamples, byte_ard icnt,
+                                byte_ard records, byte_ard valueBits);
+
+/**
+ * Packs the interleaved samples to pBuffer, which must hold
+ * payload_packed_size() bytes. pTypes holds the type code of each
+ * interface. Returns the packed size.
+ */
+u_int16_ard pack_payload(const byte_ard* pSamples, byte_ard icnt,
+                         byte_ard records, const byte_ard* pTypes,
+                         byte_ard valueBits, byte_ard* pBuffer);
+
+#ifndef _ARDUINO_DUEMILANOVE
+
+/**
+ * An unpacked payload. values holds records*icnt samples interleaved by
+ * record and is allocated by unpack_payload() with msgAlloc(), the caller
+ * frees it with msgFree().
+ */
+struct payload
+{
+  byte_ard icnt;                              // Interface count
+  byte_ard records;                           // Samples per interface
+  byte_ard types[PAYLOAD_MAX_INTERFACES];     // Interface type codes
+  byte_ard valueBits[PAYLOAD_MAX_INTERFACES]; // Significant bits per sample
+  u_int16_ard* values;
+};
+
+/**
+ * Unpacks the length bytes at pStream. Returns PAYLOAD_VALID, or
+ * PAYLOAD_INVALID if the payload is malformed or truncated, in which case
+ * nothing is allocated.
+ */
+int32_ard unpack_payload(const byte_ard* pStream, u_int16_ard length,
+                         struct payload* pl);
+
+/**
+ * The number of records timed at the start of the length bytes at pStream,
+ * or -1 if they do not hold the times. The samples follow the times, at
+ * pStream + PAYLOAD_TIMES_SIZE(records).
+ */
+int32_ard payload_times(const byte_ard* pStream, u_int16_ard length);
+
+/**
+ * The seconds record was sampled before the message time.
+ */
+u_int16_ard payload_time_offset(const byte_ard* pStream, byte_ard record);
+
+#endif // _ARDUINO_DUEMILANOVE
+
+#endif // __PAYLOAD_CODEC_H__
@@ -24,6 +24,15 @@
  */
 
 #include "protocol.h"
+#include "aes_gcm.h"
+#ifndef _ARDUINO_DUEMILANOVE
+  #include "aes_batch.h"
+  #include "msg_arena.h"
+#else
+  // No arenas on the sensor.
+  #define msgAlloc malloc
+  #define msgFree free
+#endif
 
 /*
   TODO: Don't use a hardcoded IV
@@ -32,6 +41,20 @@ byte_ard IV[] = {
   0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30 
 };
 
+/*
+  The message sizes are on the wire, the layouts in protocol.h must not move
+  them. A size that changes makes one of these arrays negative and stops the
+  build.
+ */
+typedef char check_idmsg_size[IDMSG_FULLSIZE == 39 ? 1 : -1];
+typedef char check_keytosink_size[KEYTOSINK_FULLSIZE == 73 ? 1 : -1];
+typedef char check_keytosens_size[KEYTOSENS_FULLSIZE == 49 ? 1 : -1];
+typedef char check_rekey_size[REKEY_FULLSIZE == 39 ? 1 : -1];
+typedef char check_newkey_size[NEWKEY_FULLSIZE == 55 ? 1 : -1];
+typedef char check_data_header_size[DataMsg::headerSize == 8 && DataMsg::Plain::headerSize == 11 ? 1 : -1];
+typedef char check_gcm_header_size[DATA_GCM_HEADER_SIZE == 20 ? 1 : -1];
+typedef char check_gwframe_header_size[GWFRAME_HEADER_SIZE == 9 ? 1 : -1];
+
 /**
  *
  * pack_idresponse()
@@ -47,49 +70,21 @@ byte_ard IV[] = {
  */
 void pack_idresponse(struct message* msg, const u_int32_ard* pKeys, const u_int32_ard* pCmacKeys, void *pBuffer)
 {
-  byte_ard crypt_buff[IDMSG_CRYPTSIZE];
-  byte_ard cmac_buff[IDMSG_CRYPTSIZE];
-  byte_ard temp[ID_SIZE + NONCE_SIZE];
-  
-  for (u_int32_ard i = 0; i < ID_SIZE; i++)
-  {
-    temp[i] = msg->pID[i];
-  }
-  for(u_int32_ard i = 0; i < NONCE_SIZE; i++)
-  {
-    temp[ID_SIZE + i] = ( msg->nonce >> (i*8) ) & 0xFF;
-  }
-
-  // Encrypt-then-MAC (Bellare and Namprempre)
-  CBCEncrypt((void*)temp, (void*) crypt_buff, (ID_SIZE+NONCE_SIZE),
-             AUTOPAD, pKeys, (const u_int16_ard*)IV);
+  byte_ard* cBuffer = (byte_ard*)pBuffer;
+  byte_ard plain[IdMsg::Plain::size];
 
-  // CMac the crypted ID and Nonce. 
-  aesCMac(pCmacKeys, crypt_buff, IDMSG_CRYPTSIZE, cmac_buff);
+  putField<IdMsg::Plain::Id>(plain, msg->pID);
+  putIntField<IdMsg::Plain::Nonce>(plain, msg->nonce);
 
-  byte_ard* cBuffer = (byte_ard*)pBuffer;
-  
-  // First byte is the msg type. If longer than one byte, add loop.
-  //cBuffer[0] = msg->msgtype;
-  cBuffer[0] = MSG_T_GET_ID_R;
   msg->msgtype = MSG_T_GET_ID_R;
+  cBuffer[IdMsg::MsgType::offset] = MSG_T_GET_ID_R;
+  putField<IdMsg::Id>(cBuffer, msg->pID);
 
-  // This will strip off the null char wich isn't crypted.
-  for (u_int16_ard i = 0; i < ID_SIZE; i++)
-  {
-    cBuffer[i + MSGTYPE_SIZE] = msg->pID[i];
-  }
-  // Add the ciphertext behind the msgtype and plaintext id
-  for (u_int32_ard i = 0; i <  IDMSG_CRYPTSIZE; i++)
-  {
-    cBuffer[MSGTYPE_SIZE + ID_SIZE + i] = crypt_buff[i];
-  }
-
-  // Add the CMac behind the msgtype, plaintext id and E(Public ID, Nonce)
-  for (u_int32_ard j = 0; j < IDMSG_CRYPTSIZE; j++)
-  {
-    cBuffer[MSGTYPE_SIZE + ID_SIZE + IDMSG_CRYPTSIZE + j] = cmac_buff[j];
-  }
+  // Encrypt-then-MAC (Bellare and Namprempre), straight into the message.
+  CBCEncrypt((void*)plain, (void*)(cBuffer + IdMsg::Cipher::offset), IdMsg::Plain::size,
+             AUTOPAD, pKeys, (const u_int16_ard*)IV);
+  aesCMac(pCmacKeys, cBuffer + IdMsg::Cipher::offset, IdMsg::Cipher::size,
+          cBuffer + IdMsg::Cmac::offset);
 }
 
 /**
@@ -111,42 +106,18 @@ void unpack_idresponse(void* pStream, const u_int32_ard* pKeys,
                        struct message* msg)
 {
   byte_ard* cStream = (byte_ard*)pStream;
-  
-  // First MSGTYPE_SIZE (1) bytes is msgcode. Assumes one byte, no loop.
-  msg->msgtype = cStream[0];
+  byte_ard plain_buff[IdMsg::Plain::cryptSize];
 
-  byte_ard plain_buff[IDMSG_CRYPTSIZE];
+  msg->msgtype = cStream[IdMsg::MsgType::offset];
+  getField<IdMsg::Cipher>(cStream, msg->ciphertext);
+  getField<IdMsg::Cmac>(cStream, msg->cmac);
 
-  // Get the ciphertext. 
-  for(u_int16_ard i = 0; i < IDMSG_CRYPTSIZE; i++)
-  {
-    msg->ciphertext[i] = cStream[MSGTYPE_SIZE + ID_SIZE + i];
-  }
-
-  // Decipher
-  CBCDecrypt((void*)msg->ciphertext, (void*)plain_buff, IDMSG_CRYPTSIZE, pKeys,
+  CBCDecrypt((void*)msg->ciphertext, (void*)plain_buff, IdMsg::Cipher::size, pKeys,
              (const u_int16_ard*)IV);
 
-  // Get the ciphered public id (now deciphered) into the stuct and append \0
-  for(u_int16_ard i = 0; i < ID_SIZE; i++)
-  {
-    msg->pID[i] = plain_buff[i];
-  }
-  //msg->pID[ID_SIZE] = '\0';
-
-  // Get the nonce into the struct, cast to int again. 
-  msg->nonce=0;
-  for (u_int16_ard i = 0; i < NONCE_SIZE; i++)
-  {
-    msg->nonce += (plain_buff[ID_SIZE+i] << (i*8));
-  }
-
-  // Get the cmac into the struct.
-  for (u_int16_ard i = 0; i < BLOCK_BYTE_SIZE; i++)
-  {
-    //msg->cmac[i] = plain_buff[ID_SIZE+NONCE_SIZE+i];
-    msg->cmac[i] = cStream[MSGTYPE_SIZE + ID_SIZE + IDMSG_CRYPTSIZE + i];
-  }
+  // The ID is taken from the ciphertext, not the plaintext header.
+  getField<IdMsg::Plain::Id>(plain_buff, msg->pID);
+  msg->nonce = getIntField<IdMsg::Plain::Nonce>(plain_buff);
 }
 
 /**
@@ -172,64 +143,26 @@ void unpack_idresponse(void* pStream, const u_int32_ard* pKeys,
 void pack_keytosink(struct message* msg, const u_int32_ard* pKeys, const u_int32_ard* pCmacKeys, void *pBuffer)
 {
   byte_ard* cBuffer = (byte_ard*)pBuffer;
-  msg->msgtype = MSG_T_KEY_TO_SINK;
-  cBuffer[0] = MSG_T_KEY_TO_SINK;
-
-  // NEW: Place the sensor ID in the message.
-  for (u_int16_ard i = 0; i < ID_SIZE; i++)
-  {
-    cBuffer[MSGTYPE_SIZE+i] = msg->pID[i];
-  }
-  
-  // Place the key in the "plaintext" to the sink. (SSLed)
-  for (u_int16_ard i = 0; i < KEY_BYTES; i++)
-  {
-    cBuffer[MSGTYPE_SIZE+ID_SIZE+i] = msg->key[i];
-  }
-
-  // t_ST, expiration time. u_int32
-  byte_ard* pTimer = (byte_ard*)&msg->renewal_timer;
-  for (u_int16_ard i = 0; i < TIMER_SIZE; i++)
-  {
-    cBuffer[MSGTYPE_SIZE+ID_SIZE+KEY_BYTES+i] = pTimer[i];
-  }
-
-  // Create the buffer that is to be ciphered
-  byte_ard temp[NONCE_SIZE+KEY_BYTES+TIMER_SIZE];
-  byte_ard cipher_buff[KEYTOSINK_CRYPTSIZE];
+  byte_ard plain[KeyToSinkMsg::Plain::size];
 
-  for(u_int32_ard i = 0; i < NONCE_SIZE; i++)
-  {
-    temp[i] = ( msg->nonce >> (i*8) ) & 0xFF;
-  }
-  
-  // Key
-  for (u_int16_ard i = 0; i < KEY_BYTES; i++)
-  {
-    temp[NONCE_SIZE+i] = msg->key[i];
-  }
-  //Timer (pointer declartion above)
-  for (u_int16_ard i = 0; i < TIMER_SIZE; i++)
-  {
-    temp[NONCE_SIZE+KEY_BYTES+i] = pTimer[i];
-  }
-
-  // Cipher
-  CBCEncrypt((void*)temp, (void*)cipher_buff, (NONCE_SIZE + ID_SIZE + KEY_BYTES + TIMER_SIZE),
-             AUTOPAD, pKeys, (const u_int16_ard*)IV);
-  aesCMac(pCmacKeys, cipher_buff, KEYTOSINK_CRYPTSIZE, msg->cmac);
-
-  // Put the cipherstuff into the buffer
-  for (u_int16_ard i = 0; i < KEYTOSINK_CRYPTSIZE; i++)
-  {
-    cBuffer[MSGTYPE_SIZE + ID_SIZE + KEY_BYTES + TIMER_SIZE + i] = cipher_buff[i];
-  }
-
-  // cmac 
-  for (u_int16_ard i = 0; i < BLOCK_BYTE_SIZE; i++)
-  {
-    cBuffer[MSGTYPE_SIZE+ID_SIZE+KEY_BYTES+TIMER_SIZE+KEYTOSINK_CRYPTSIZE+i] = msg->cmac[i];
-  }
+  msg->msgtype = MSG_T_KEY_TO_SINK;
+  cBuffer[KeyToSinkMsg::MsgType::offset] = MSG_T_KEY_TO_SINK;
+
+  // The sensor ID, and the key and timer in the "plaintext" to the sink. (SSLed)
+  putField<KeyToSinkMsg::Id>(cBuffer, msg->pID);
+  putField<KeyToSinkMsg::Key>(cBuffer, msg->key);
+  putIntField<KeyToSinkMsg::Timer>(cBuffer, msg->renewal_timer);
+
+  // The same for the sensor, with the nonce, under its own key.
+  putIntField<KeyToSinkMsg::Plain::Nonce>(plain, msg->nonce);
+  putField<KeyToSinkMsg::Plain::Key>(plain, msg->key);
+  putIntField<KeyToSinkMsg::Plain::Timer>(plain, msg->renewal_timer);
+
+  CBCEncrypt((void*)plain, (void*)(cBuffer + KeyToSinkMsg::Cipher::offset),
+             KeyToSinkMsg::Plain::size, AUTOPAD, pKeys, (const u_int16_ard*)IV);
+  aesCMac(pCmacKeys, cBuffer + KeyToSinkMsg::Cipher::offset, KeyToSinkMsg::Cipher::size,
+          msg->cmac);
+  putField<KeyToSinkMsg::Cmac>(cBuffer, msg->cmac);
 }
 
 /**
@@ -253,44 +186,18 @@ void pack_keytosink(struct message* msg, const u_int32_ard* pKeys, const u_int32
 void unpack_keytosink(void *pStream, struct message* msg)
 {
   byte_ard* cStream = (byte_ard*)pStream;
-  // Assumes one byte for msgtype
-  msg->msgtype = cStream[0];
-
-  // NEW: The ID is here .
-  for (u_int16_ard i = 0; i < ID_SIZE; i++)
-  {
-    msg->pID[i] = cStream[MSGTYPE_SIZE + i];
-  }
-  
-  // Key
-  for (u_int16_ard i = 0; i < KEY_BYTES; i++)
-  {
-    msg->key[i] = cStream[MSGTYPE_SIZE+ID_SIZE+i];
-  }
 
-  // Timer
-  byte_ard* temp = (byte_ard*)malloc(TIMER_SIZE);
-  for (u_int16_ard i = 0; i < TIMER_SIZE; i++)
-  {
-    temp[i] = cStream[MSGTYPE_SIZE + ID_SIZE + KEY_BYTES + i];
-  }
-  msg->renewal_timer = (u_int32_ard)*temp;
-  free(temp);
+  msg->msgtype = cStream[KeyToSinkMsg::MsgType::offset];
+  getField<KeyToSinkMsg::Id>(cStream, msg->pID);
+  getField<KeyToSinkMsg::Key>(cStream, msg->key);
+  msg->renewal_timer = getIntField<KeyToSinkMsg::Timer>(cStream);
 
   // Since this method unpacks the stream on the Sink, it cannot decipher
   // the ciphertext. (Thus, it is missing the pKey pointer) The Ciphertext
   // will be stored in the struct and will be forwarded to the client and
   // sensor. The Hash is also useless for the sink and is forwarded.
-
-  for(u_int16_ard i = 0; i < KEYTOSINK_CRYPTSIZE; i++)
-  {
-    msg->ciphertext[i] = cStream[MSGTYPE_SIZE + KEY_BYTES + ID_SIZE + TIMER_SIZE + i];
-  }
-  for(u_int16_ard i = 0; i < BLOCK_BYTE_SIZE; i++)
-  {
-    msg->cmac[i] = cStream[MSGTYPE_SIZE + KEY_BYTES + ID_SIZE + TIMER_SIZE + KEYTOSINK_CRYPTSIZE + i];
-  }
-  
+  getField<KeyToSinkMsg::Cipher>(cStream, msg->ciphertext);
+  getField<KeyToSinkMsg::Cmac>(cStream, msg->cmac);
 }
 
 /**
@@ -311,19 +218,13 @@ void unpack_keytosink(void *pStream, struct message* msg)
 void pack_keytosens(struct message* msg, void *pBuffer)
 {
   byte_ard* cBuffer = (byte_ard*)pBuffer;
-  cBuffer[0] = MSG_T_KEY_TO_SENSE;
+
   msg->msgtype = MSG_T_KEY_TO_SENSE;
+  cBuffer[KeyToSenseMsg::MsgType::offset] = MSG_T_KEY_TO_SENSE;
 
-  // The ciphertext containing the Nonce, key and Timer. 
-  for (u_int16_ard i = 0; i < KEYTOSINK_CRYPTSIZE; i++)
-  {
-    cBuffer[MSGTYPE_SIZE + i] = msg->ciphertext[i];
-  }
-  // The hash
-  for (u_int16_ard i = 0; i < BLOCK_BYTE_SIZE; i++)
-  {
-    cBuffer[MSGTYPE_SIZE + KEYTOSINK_CRYPTSIZE + i] = msg->cmac[i];
-  }
+  // The ciphertext containing the Nonce, key and Timer, and the hash.
+  putField<KeyToSenseMsg::Cipher>(cBuffer, msg->ciphertext);
+  putField<KeyToSenseMsg::Cmac>(cBuffer, msg->cmac);
 }
 
 /**
@@ -346,43 +247,18 @@ void pack_keytosens(struct message* msg, void *pBuffer)
 void unpack_keytosens(void *pStream, const u_int32_ard* pKeys, struct message* msg)
 {
   byte_ard* cStream = (byte_ard*)pStream;
-  msg->msgtype = cStream[0];
+  byte_ard plainbuff[KeyToSinkMsg::Plain::cryptSize];
 
-  // Extract the ciphertext
-  for (u_int16_ard i = 0; i < KEYTOSINK_CRYPTSIZE; i++)
-  {
-    msg->ciphertext[i] = cStream[MSGTYPE_SIZE + i];
-  }
-  //Extract the hash
-  for(u_int16_ard i = 0; i < BLOCK_BYTE_SIZE; i++)
-  {
-    msg->cmac[i] = cStream[MSGTYPE_SIZE + (KEYTOSINK_CRYPTSIZE) + i];
-  }
-  byte_ard plainbuff[KEYTOSINK_CRYPTSIZE];
-    
-  CBCDecrypt((void*)msg->ciphertext, (void*)plainbuff, KEYTOSINK_CRYPTSIZE,
-             pKeys, (const u_int16_ard*)IV);
+  msg->msgtype = cStream[KeyToSenseMsg::MsgType::offset];
+  getField<KeyToSenseMsg::Cipher>(cStream, msg->ciphertext);
+  getField<KeyToSenseMsg::Cmac>(cStream, msg->cmac);
 
-  // 1 - nonce
-  msg->nonce=0;
-  for (u_int16_ard i = 0; i < NONCE_SIZE; i++)
-  {
-    msg->nonce += plainbuff[i]<<(i*8);
-  }
+  CBCDecrypt((void*)msg->ciphertext, (void*)plainbuff, KeyToSenseMsg::Cipher::size,
+             pKeys, (const u_int16_ard*)IV);
 
-  // 2 - key
-  for (u_int16_ard i = 0; i < KEY_BYTES; i++)
-  {
-    msg->key[i] = plainbuff[NONCE_SIZE + i];
-  }
-  
-  // 3 - timer
-  byte_ard timertemp[TIMER_SIZE];
-  for (u_int16_ard i = 0; i < TIMER_SIZE; i++)
-  {
-    timertemp[i] = plainbuff[NONCE_SIZE + KEY_BYTES + i];
-  }
-  msg->renewal_timer = (u_int32_ard)*timertemp;
+  msg->nonce = getIntField<KeyToSinkMsg::Plain::Nonce>(plainbuff);
+  getField<KeyToSinkMsg::Plain::Key>(plainbuff, msg->key);
+  msg->renewal_timer = getIntField<KeyToSinkMsg::Plain::Timer>(plainbuff);
 }
 
 /**
@@ -401,55 +277,24 @@ void unpack_keytosens(void *pStream, const u_int32_ard* pKeys, struct message* m
 void pack_rekey(struct message* msg, const u_int32_ard* pKeys, const u_int32_ard* pCmacKeys, void* pBuffer)
 {
   byte_ard* cBuffer = (byte_ard*) pBuffer;
-  // MSGTYPE
-  if (msg->msgtype == MSG_T_REKEY_HANDSHAKE)
-  {
-    cBuffer[0] = msg->msgtype;
-  }
-  else
-  {
-    msg->msgtype = MSG_T_REKEY_REQUEST;
-  }
-  
-  // T (Public ID)
-  for (u_int16_ard i = 0; i < ID_SIZE; i ++)
-  {
-    cBuffer[MSGTYPE_SIZE + i] = msg->pID[i];
-  }
+  byte_ard plain[RekeyMsg::Plain::size];
 
-  // Create the ciphered packet
-  // ID
-  byte_ard temp[ID_SIZE + NONCE_SIZE];
-  for (u_int16_ard i = 0; i < ID_SIZE; i++)
-  {
-    temp[i] = msg->pID[i];
-  }
-  // Nonce
-  for(u_int32_ard i = 0; i < NONCE_SIZE; i++)
+  if (msg->msgtype != MSG_T_REKEY_HANDSHAKE)
   {
-    temp[ID_SIZE+i] = ( msg->nonce >> (i*8) ) & 0xFF;
+    msg->msgtype = MSG_T_REKEY_REQUEST;
   }
+  cBuffer[RekeyMsg::MsgType::offset] = msg->msgtype;
 
-  byte_ard cipher_buff[REKEY_CRYPTSIZE];
+  // T (Public ID)
+  putField<RekeyMsg::Id>(cBuffer, msg->pID);
 
-  // Cipher
-  CBCEncrypt((void*)temp, (void*)cipher_buff, (ID_SIZE + NONCE_SIZE), AUTOPAD,
-             pKeys, (const u_int16_ard*)IV);
+  putField<RekeyMsg::Plain::Id>(plain, msg->pID);
+  putIntField<RekeyMsg::Plain::Nonce>(plain, msg->nonce);
 
-  // Stick it in the buffer
-  for (u_int16_ard i = 0; i < REKEY_CRYPTSIZE; i++)
-  {
-    cBuffer[MSGTYPE_SIZE + ID_SIZE + i] = cipher_buff[i];
-  }
-
-  // CMac
-  aesCMac(pCmacKeys, cipher_buff, REKEY_CRYPTSIZE, msg->cmac);
-  // Stick it in the buffer
-  for (u_int16_ard i = 0; i < BLOCK_BYTE_SIZE; i++)
-  {
-    cBuffer[MSGTYPE_SIZE + ID_SIZE + REKEY_CRYPTSIZE + i] = msg->cmac[i];
-  }
-  
+  CBCEncrypt((void*)plain, (void*)(cBuffer + RekeyMsg::Cipher::offset), RekeyMsg::Plain::size,
+             AUTOPAD, pKeys, (const u_int16_ard*)IV);
+  aesCMac(pCmacKeys, cBuffer + RekeyMsg::Cipher::offset, RekeyMsg::Cipher::size, msg->cmac);
+  putField<RekeyMsg::Cmac>(cBuffer, msg->cmac);
 }
 /**
  * unpack_rekey()
@@ -472,39 +317,20 @@ void pack_rekey(struct message* msg, const u_int32_ard* pKeys, const u_int32_ard
 void unpack_rekey(void* pStream, const u_int32_ard* pKeys, struct message* msg)
 {
   byte_ard* cStream = (byte_ard*)pStream;
-  msg->msgtype = cStream[0];
+  byte_ard plainbuff[RekeyMsg::Plain::cryptSize];
 
-  // The ID is only extacted from the ciphertext
+  msg->msgtype = cStream[RekeyMsg::MsgType::offset];
 
-  // Extract the ciphertext
-  for (u_int16_ard i = 0; i < REKEY_CRYPTSIZE; i ++)
-  {
-    msg->ciphertext[i] = cStream[MSGTYPE_SIZE + ID_SIZE + i];
-  }
-  // Extract the cmac
-  for (u_int16_ard i = 0; i < BLOCK_BYTE_SIZE; i++)
-  {
-    msg->cmac[i] = cStream[MSGTYPE_SIZE + ID_SIZE + REKEY_CRYPTSIZE + i];
-  }
+  // The ID is only extacted from the ciphertext
+  getField<RekeyMsg::Cipher>(cStream, msg->ciphertext);
+  getField<RekeyMsg::Cmac>(cStream, msg->cmac);
 
-  // Decipher
-  byte_ard plainbuff[REKEY_CRYPTSIZE];
-  CBCDecrypt((void*)msg->ciphertext, (void*)plainbuff, REKEY_CRYPTSIZE,
+  CBCDecrypt((void*)msg->ciphertext, (void*)plainbuff, RekeyMsg::Cipher::size,
              pKeys, (const u_int16_ard*)IV);
 
-  // Extract the ID for the ciphertext
-  for (u_int16_ard i = 0; i < ID_SIZE; i ++)
-  {
-    msg->pID[i] = plainbuff[i];
-  }
+  getField<RekeyMsg::Plain::Id>(plainbuff, msg->pID);
   msg->pID[ID_SIZE] = '\0';
-
-  // Extract the Nonce from the ciphertext
-  msg->nonce=0;
-  for (u_int16_ard i = 0; i < NONCE_SIZE; i++)
-  {
-    msg->nonce += (plainbuff[ID_SIZE+i] << (i*8));
-  }
+  msg->nonce = getIntField<RekeyMsg::Plain::Nonce>(plainbuff);
 }
 
 /**
@@ -512,68 +338,31 @@ void unpack_rekey(void* pStream, const u_int32_ard* pKeys, struct message* msg)
  *
  * The method intended for the Sink to send the new key to the sensor.
  *
- * Name:   MSG Code | Ciphertext                                                  | CMAC    
- * Bytes:  1        | 32                                                          | 16
- * Data:   0x32     | Public ID, Nonce, Rand key material, Renewal timer, Padding |
+ * Name:   MSG Code | Public ID   | Ciphertext                                                  | CMAC    
+ * Bytes:  1        | 6 (ID_SIZE) | 32                                                          | 16
+ * Data:   0x32     |             | Public ID, Nonce, Rand key material, Renewal timer, Padding |
  *
- * Total bytecount: 49 bytes
+ * Total bytecount: 55 bytes
  */
 
 void pack_newkey(struct message* msg, const u_int32_ard* pKeys, const u_int32_ard* pCmacKeys, void* pBuffer)
 {
   byte_ard* cBuffer = (byte_ard*)pBuffer;
-  cBuffer[0] = MSG_T_REKEY_RESPONSE;
-  msg->msgtype = MSG_T_REKEY_RESPONSE;
-  
-  for(u_int16_ard i = 0; i < ID_SIZE; i++)
-  {
-    cBuffer[MSGTYPE_SIZE + i] = msg->pID[i];
-  }
+  byte_ard plain[NewKeyMsg::Plain::size];
 
-  // Construct the ciphertext
-  byte_ard temp[ID_SIZE + NONCE_SIZE + KEY_BYTES + TIMER_SIZE];
-  
-  for (u_int16_ard i = 0; i < ID_SIZE; i++)
-  {
-    temp[i] = msg->pID[i];
-  }
-  
-  for(u_int32_ard i = 0; i < NONCE_SIZE; i++)
-  {
-    temp[ID_SIZE+i] = ( msg->nonce >> (i*8) ) & 0xFF;
-  }
-  
-  for(u_int16_ard i = 0; i < KEY_BYTES; i++)
-  {
-    temp[ID_SIZE + NONCE_SIZE + i] = msg->rand[i];
-  }
-  
-  byte_ard* temp_timer = (byte_ard*)&msg->renewal_timer;
-  for(u_int16_ard i = 0; i < TIMER_SIZE; i++)
-  {
-    temp[ID_SIZE + NONCE_SIZE + KEY_BYTES + i] = temp_timer[i];
-  }
-
-  byte_ard cipher_buff[NEWKEY_CRYPTSIZE];
-
-  // Cipher
-  CBCEncrypt((void*)temp, (void*)cipher_buff,
-             (ID_SIZE+NONCE_SIZE+KEY_BYTES+TIMER_SIZE), AUTOPAD,
-             pKeys, (const u_int16_ard*)IV);
-  // Stick it in the buffer
-  for (u_int16_ard i = 0; i < NEWKEY_CRYPTSIZE; i++)
-  {
-    cBuffer[MSGTYPE_SIZE + ID_SIZE + i] = cipher_buff[i];
-  }
+  msg->msgtype = MSG_T_REKEY_RESPONSE;
+  cBuffer[NewKeyMsg::MsgType::offset] = MSG_T_REKEY_RESPONSE;
+  putField<NewKeyMsg::Id>(cBuffer, msg->pID);
 
-  // CMac
-  aesCMac(pCmacKeys, cipher_buff, NEWKEY_CRYPTSIZE, msg->cmac);
+  putField<NewKeyMsg::Plain::Id>(plain, msg->pID);
+  putIntField<NewKeyMsg::Plain::Nonce>(plain, msg->nonce);
+  putField<NewKeyMsg::Plain::Rand>(plain, msg->rand);
+  putIntField<NewKeyMsg::Plain::Timer>(plain, msg->renewal_timer);
 
-  for (u_int16_ard i = 0; i < BLOCK_BYTE_SIZE; i++)
-  {
-    cBuffer[MSGTYPE_SIZE + ID_SIZE + NEWKEY_CRYPTSIZE + i] = msg->cmac[i];
-  }
-  
+  CBCEncrypt((void*)plain, (void*)(cBuffer + NewKeyMsg::Cipher::offset), NewKeyMsg::Plain::size,
+             AUTOPAD, pKeys, (const u_int16_ard*)IV);
+  aesCMac(pCmacKeys, cBuffer + NewKeyMsg::Cipher::offset, NewKeyMsg::Cipher::size, msg->cmac);
+  putField<NewKeyMsg::Cmac>(cBuffer, msg->cmac);
 }
 
 /**
@@ -596,52 +385,21 @@ void pack_newkey(struct message* msg, const u_int32_ard* pKeys, const u_int32_ar
 void unpack_newkey(void* pStream, const u_int32_ard* pKeys, struct message* msg)
 {
   byte_ard* cStream = (byte_ard*)pStream;
+  byte_ard plainbuff[NewKeyMsg::Plain::cryptSize];
 
-  msg->msgtype = cStream[0];
+  msg->msgtype = cStream[NewKeyMsg::MsgType::offset];
 
   // Skip the ID sent in plaintext and grab the cipherstream
-  for (u_int32_ard i = 0; i < NEWKEY_CRYPTSIZE; i++)
-  {
-    msg->ciphertext[i] = cStream[MSGTYPE_SIZE + ID_SIZE + i];
-  }
-
-  byte_ard plainbuff[NEWKEY_CRYPTSIZE];
+  getField<NewKeyMsg::Cipher>(cStream, msg->ciphertext);
+  getField<NewKeyMsg::Cmac>(cStream, msg->cmac);
 
-  CBCDecrypt((void*)msg->ciphertext, (void*)plainbuff, NEWKEY_CRYPTSIZE, pKeys,
+  CBCDecrypt((void*)msg->ciphertext, (void*)plainbuff, NewKeyMsg::Cipher::size, pKeys,
              (const u_int16_ard*)IV);
 
-  // Cipertext part 1 - ID
-  for (u_int16_ard i = 0; i < ID_SIZE; i++)
-  {
-    msg->pID[i] = plainbuff[i];
-  }
-  
-  // Ciphertext part 2 - Nonce
-  msg->nonce=0;
-  for (u_int16_ard i = 0; i < NONCE_SIZE; i++)
-  {
-    msg->nonce += (plainbuff[ID_SIZE+i] << (i*8));
-  }
-
-  // Ciphertext part 3 - Random
-  for (u_int16_ard i = 0; i < KEY_BYTES; i++)
-  {
-    msg->rand[i] = plainbuff[ID_SIZE + NONCE_SIZE + i];
-  }
-
-  // Ciphertext part 4 - Timer
-  byte_ard* temp_timer = (byte_ard*)malloc(TIMER_SIZE);
-  for(u_int16_ard i = 0; i < TIMER_SIZE; i++)
-  {
-    temp_timer[i] = plainbuff[ID_SIZE + NONCE_SIZE + KEY_BYTES + i];
-  }
-  msg->renewal_timer = (u_int32_ard)*temp_timer;
-  free(temp_timer);
-
-  for (u_int16_ard i = 0; i < BLOCK_BYTE_SIZE; i++)
-  {
-    msg->cmac[i] = cStream[MSGTYPE_SIZE + ID_SIZE + NEWKEY_CRYPTSIZE + i];
-  }
+  getField<NewKeyMsg::Plain::Id>(plainbuff, msg->pID);
+  msg->nonce = getIntField<NewKeyMsg::Plain::Nonce>(plainbuff);
+  getField<NewKeyMsg::Plain::Rand>(plainbuff, msg->rand);
+  msg->renewal_timer = getIntField<NewKeyMsg::Plain::Timer>(plainbuff);
 }
 
 /**
@@ -657,80 +415,38 @@ void unpack_newkey(void* pStream, const u_int32_ard* pKeys, struct message* msg)
 
 void pack_data(struct data* msg, const u_int32_ard* pKeys, const u_int32_ard* pCmacKeys, void* pBuffer)
 {
-  /**
-   * Msg type
-   */
   byte_ard* cBuffer = (byte_ard*)pBuffer;
-  cBuffer[0] = MSG_T_DATA_SEND;
+  byte_ard* cipher = cBuffer + DataMsg::headerSize;
+  byte_ard header[DataMsg::Plain::headerSize];
+  struct cbc_ctx cbc;
+  u_int16_ard written;
 
   /**
-   * NOTE: Here we use integer division to figure out how many blocks
-   * we need for the ciphertext. In future versions every method in
-   * the Tsense protocol will use this method instead of the retarded
-   * constants.
-   *
-   * The +1's is for the the two length indicators. One is on the
-   * ciphered stream, indicating the length of the buffer that holds
-   * the measurment data and the other one is on the plaintext part
-   * indidating how long the crypto part of the packet is.
+   * The ciphertext holds the ID, the message time, the length of the
+   * measurement data and the data, padded to whole blocks.
    */
-  
-  u_int16_ard plainsize = ID_SIZE + MSGTIME_SIZE + 1 + (u_int16_ard) msg->data_len;
-  // Since cipher_len is always going to be congruent to 16 in modulus 16, we can
-  // use it to indicate much larger ciphertext then 127 if we use that fact. 
-  msg->cipher_len = (1 + (plainsize/BLOCK_BYTE_SIZE)) * BLOCK_BYTE_SIZE;
-  cBuffer[MSGTYPE_SIZE] = msg->cipher_len;
-
-  /**
-   * Sink needs the device ID to look up the encryption key.
-   */
-  for (u_int16_ard i = 0; i < ID_SIZE; i++)
-  {
-    cBuffer[MSGTYPE_SIZE + 1 + i] = msg->id[i];
-  }
+  u_int16_ard plainsize = DataMsg::Plain::headerSize + (u_int16_ard)msg->data_len;
+  msg->cipher_len = paddedSize(plainsize);
 
-  /**
-   * Malloc is needed because we don't know the exact size
-   */
-  byte_ard* plaintext = (byte_ard*)malloc(plainsize);
+  cBuffer[DataMsg::MsgType::offset] = MSG_T_DATA_SEND;
+  cBuffer[DataMsg::CipherLen::offset] = msg->cipher_len;
 
-  // Populate plaintext.
-  for (u_int16_ard i = 0; i < ID_SIZE; i++)
-  {
-    plaintext[i] = msg->id[i];
-  }
-  byte_ard* temp_msgtime = (byte_ard*)&msg->msgtime;
-  for (u_int16_ard i = 0; i < MSGTIME_SIZE; i++)
-  {
-    plaintext[ID_SIZE + i] = temp_msgtime[i];
-  }
-  // One byte - no loop
-  plaintext[ID_SIZE + MSGTIME_SIZE] = msg->data_len;
+  // Sink needs the device ID to look up the encryption key.
+  putField<DataMsg::Id>(cBuffer, msg->id);
 
-  // Data
-  for(u_int16_ard i = 0; i < (u_int16_ard)msg->data_len; i++)
-  {
-    plaintext[ID_SIZE + MSGTIME_SIZE + 1 + i] = msg->data[i];
-  }
+  putField<DataMsg::Plain::Id>(header, msg->id);
+  putIntField<DataMsg::Plain::MsgTime>(header, msg->msgtime);
+  header[DataMsg::Plain::DataLen::offset] = msg->data_len;
 
-  byte_ard cipher_buff[(u_int16_ard)msg->cipher_len];
+  // The header and the data are encrypted from where they are, straight
+  // into the message, and the CMAC follows the ciphertext.
+  CBCEncryptInit(&cbc, pKeys, (const u_int16_ard*)IV);
+  written = CBCEncryptUpdate(&cbc, header, DataMsg::Plain::headerSize, cipher);
+  written += CBCEncryptUpdate(&cbc, msg->data, msg->data_len, cipher + written);
+  written += CBCEncryptFinal(&cbc, AUTOPAD, cipher + written);
 
-  CBCEncrypt((void*)plaintext, (void*)cipher_buff, plainsize, AUTOPAD,
-             pKeys, (const u_int16_ard*)IV);
-  free(plaintext);
-  aesCMac(pCmacKeys, cipher_buff, (u_int16_ard)msg->cipher_len, msg->cmac);
-
-  // Stick it in the buffer
-  for(u_int16_ard i = 0; i < (u_int16_ard)msg->cipher_len; i++)
-  {
-    // +1 to accomendate for the crypto length indicator. 
-    cBuffer[MSGTYPE_SIZE + 1 + ID_SIZE + i] = cipher_buff[i];
-  }
-
-  for(u_int16_ard i = 0; i < BLOCK_BYTE_SIZE; i++)
-  {
-    cBuffer[MSGTYPE_SIZE + 1 + ID_SIZE + (int16_ard)msg->cipher_len + i] = msg->cmac[i];
-  }
+  aesCMac(pCmacKeys, cipher, written, msg->cmac);
+  memcpy(cipher + written, msg->cmac, BLOCK_BYTE_SIZE);
 }
 
 /**
@@ -740,7 +456,8 @@ void pack_data(struct data* msg, const u_int32_ard* pKeys, const u_int32_ard* pC
  * measurment data with the session key. Runs on a regular
  * architecture so wasting ram here is ok.
  *
- * NOTE: Does malloc() on msg->ciphertext and msg->data !
+ * NOTE: Does malloc() on msg->ciphertext and msg->data, or takes them from
+ *       the thread's arena, see msg_arena.h !
  *
  *    Name          | Summary                            | Data
  *    ------------------------------------------------------------------
@@ -755,73 +472,137 @@ void pack_data(struct data* msg, const u_int32_ard* pKeys, const u_int32_ard* pC
  *
  */
 
+static void unpack_data_plaintext(byte_ard* plainbuff, struct data* msg);
+
 void unpack_data(void* pStream, const u_int32_ard* pKeys, struct data* msg)
 {
-
   byte_ard* cStream = (byte_ard*)pStream;
   
-  msg->msgtype = cStream[0];
-  msg->cipher_len = cStream[1];
+  msg->msgtype = cStream[DataMsg::MsgType::offset];
+  msg->cipher_len = cStream[DataMsg::CipherLen::offset];
 
   // Store the cipher length in a usigned 16-bit int so we don't have to typecast
   // all the time.
   u_int16_ard cipherlen = (u_int16_ard)msg->cipher_len;
   
   // NOTE: Malloc, Needs to be set free!!
-  msg->ciphertext = (byte_ard*)malloc(cipherlen);
-
-  // Read the ciphertext
-  for (u_int16_ard i = 0; i < cipherlen; i++)
-  {
-    msg->ciphertext[i] = cStream[MSGTYPE_SIZE + 1 + ID_SIZE + i]; /// ERROR MISSING i
-  }
-
-  // .. and cmac
-  for (u_int16_ard i = 0; i < BLOCK_BYTE_SIZE; i++)
-  {
-    msg->cmac[i] = cStream[MSGTYPE_SIZE + 1 + ID_SIZE + cipherlen + i];
-  }
+  msg->ciphertext = (byte_ard*)msgAlloc(cipherlen);
+  memcpy(msg->ciphertext, cStream + DataMsg::headerSize, cipherlen);
+  memcpy(msg->cmac, cStream + DataMsg::headerSize + cipherlen, BLOCK_BYTE_SIZE);
 
   // Decrypt
   // Malloc, is free'd in the end of unpack_data()
-  byte_ard* plainbuff = (byte_ard*)malloc(cipherlen);
+  byte_ard* plainbuff = (byte_ard*)msgAlloc(cipherlen);
 
   CBCDecrypt((void*)msg->ciphertext, (void*)plainbuff, cipherlen, pKeys,
            (const u_int16_ard*)IV);
 
-  // ID
-  for (u_int16_ard i = 0; i < ID_SIZE; i ++)
+  unpack_data_plaintext(plainbuff, msg);
+  
+  msgFree(plainbuff);
+}
+
+/**
+ * unpack_data_plaintext()
+ *
+ * Fills in the fields of msg carried in the decrypted part of a data
+ * message. Shared by unpack_data() and unpack_data_batch().
+ *
+ * NOTE: Does malloc() on msg->data, or takes it from the thread's arena !
+ */
+
+static void unpack_data_plaintext(byte_ard* plainbuff, struct data* msg)
+{
+  getField<DataMsg::Plain::Id>(plainbuff, msg->id);
+  msg->msgtime = getIntField<DataMsg::Plain::MsgTime>(plainbuff);
+  msg->data_len = plainbuff[DataMsg::Plain::DataLen::offset];
+
+  // NOTE: msg->data is malloced. NEEDS TO BE SET FREE 
+  msg->data = (byte_ard*)msgAlloc(msg->data_len);
+  memcpy(msg->data, plainbuff + DataMsg::Plain::headerSize, msg->data_len);
+}
+
+#ifndef _ARDUINO_DUEMILANOVE
+/**
+ * unpack_data_batch()
+ *
+ * unpack_data() for n messages at once, for a sink with a backlog. The
+ * message in pStreams[i] is verified with the MAC key schedule pCmacKeys[i]
+ * and, if the MAC checks out, decrypted with pKeys[i]. The CMACs and the
+ * decryptions are computed with the batch functions in aes_batch.h.
+ *
+ * valid[i] is set to CMAC_VALID or CMAC_INVALID. The return value is the
+ * number of valid messages. Only valid messages are decrypted, for those
+ * msgs[i] is filled in as by unpack_data(). For invalid ones only msgtype,
+ * cipher_len, the ciphertext and the cmac are set.
+ *
+ * NOTE: Does malloc() on msg->ciphertext for every message and msg->data 
+ *       for the valid ones, or takes them from the thread's arena.
+ */
+
+u_int32_ard unpack_data_batch(void** pStreams, const u_int32_ard** pKeys,
+                              const u_int32_ard** pCmacKeys, struct data* msgs,
+                              int32_ard* valid, u_int32_ard n)
+{
+  struct cmac_job* macJobs = (struct cmac_job*)msgAlloc(n*sizeof(struct cmac_job));
+  struct cbc_job* cbcJobs = (struct cbc_job*)msgAlloc(n*sizeof(struct cbc_job));
+  byte_ard** plainbuffs = (byte_ard**)msgAlloc(n*sizeof(byte_ard*));
+  u_int32_ard validCount;
+  u_int32_ard decryptCount = 0;
+
+  for (u_int32_ard i = 0; i < n; i++)
   {
-    msg->id[i] = plainbuff[i];
+    byte_ard* cStream = (byte_ard*)pStreams[i];
+    u_int16_ard cipherlen = cStream[DataMsg::CipherLen::offset];
+
+    msgs[i].msgtype = cStream[DataMsg::MsgType::offset];
+    msgs[i].cipher_len = cipherlen;
+    msgs[i].ciphertext = (byte_ard*)msgAlloc(cipherlen);
+    memcpy(msgs[i].ciphertext, cStream + DataMsg::headerSize, cipherlen);
+    memcpy(msgs[i].cmac, cStream + DataMsg::headerSize + cipherlen, BLOCK_BYTE_SIZE);
+
+    macJobs[i].KS = pCmacKeys[i];
+    macJobs[i].M = msgs[i].ciphertext;
+    macJobs[i].length = cipherlen;
+    macJobs[i].cmac = msgs[i].cmac;
   }
 
-  // Msg time (Unix time)
-  // Malloc, free'd a few lines below
-//  byte_ard* temp_msgtime = (byte_ard*)malloc(MSGTIME_SIZE);
-  msg->msgtime=0;
-  for(u_int16_ard i = 0; i < MSGTIME_SIZE; i++)
+  // Encrypt-then-MAC, nothing is decrypted before its MAC checks out.
+  validCount = verifyAesCMacBatch(macJobs, n);
+
+  for (u_int32_ard i = 0; i < n; i++)
   {
-    //temp_msgtime[i] = plainbuff[ID_SIZE + i];
-	msg->msgtime += ( plainbuff[ID_SIZE+i] << (i*8) );
+    valid[i] = macJobs[i].valid;
+    plainbuffs[i] = NULL;
+    if (valid[i] != CMAC_VALID)
+      continue;
+
+    plainbuffs[i] = (byte_ard*)msgAlloc(msgs[i].cipher_len);
+    cbcJobs[decryptCount].pKeys = pKeys[i];
+    cbcJobs[decryptCount].pText = msgs[i].ciphertext;
+    cbcJobs[decryptCount].pBuffer = plainbuffs[i];
+    cbcJobs[decryptCount].length = msgs[i].cipher_len;
+    cbcJobs[decryptCount].pIV = IV;
+    decryptCount++;
   }
-  //msg->msgtime = (u_int32_ard)*temp_msgtime;
-  //free(temp_msgtime);
 
-  // Buffer length
-  msg->data_len = plainbuff[ID_SIZE + MSGTIME_SIZE];
-  u_int16_ard datalen = (u_int16_ard)msg->data_len;
-  
-  // NOTE: msg->data is malloced. NEEDS TO BE SET FREE 
-  msg->data = (byte_ard*)malloc(datalen);
-  
-  // Data
-  for(u_int16_ard i = 0; i < datalen; i++)
+  CBCDecryptBatch(cbcJobs, decryptCount);
+
+  for (u_int32_ard i = 0; i < n; i++)
   {
-    msg->data[i] = plainbuff[ID_SIZE + MSGTIME_SIZE + 1 + i];
+    if (plainbuffs[i] == NULL)
+      continue;
+    unpack_data_plaintext(plainbuffs[i], &msgs[i]);
+    msgFree(plainbuffs[i]);
   }
-  
-  free(plainbuff);
+
+  msgFree(plainbuffs);
+  msgFree(cbcJobs);
+  msgFree(macJobs);
+
+  return validCount;
 }
+#endif // _ARDUINO_DUEMILANOVE
 
 /**
  * unpack_data_getid() is a small utility method for the sink to
@@ -834,13 +615,146 @@ void unpack_data(void* pStream, const u_int32_ard* pKeys, struct data* msg)
  */
 
 void unpack_data_getid(void* pStream, void* pID)
+{
+  getField<DataMsg::Id>((byte_ard*)pStream, (byte_ard*)pID);
+}
+
+/**
+ * pack_data_gcm()
+ *
+ * Packs measurment data like pack_data() but encrypts and authenticates it
+ * in a single AES-GCM pass with the session encryption key. The plaintext
+ * header, nonce included, is authenticated as additional data, so the ID
+ * is not repeated inside the ciphertext and no padding is needed.
+ *
+ * pNonce must be GCM_NONCE_SIZE bytes and must never be used twice with
+ * the same key. The whole message is DATA_GCM_FULLSIZE(msg->data_len) bytes.
+ *
+ * Name:    MSG Code | Cipher Len | Pub ID | Nonce | Ciphertext                | Tag
+ * Bytes:   1        | 1          | 6      | 12    | Msg Time: 4, Data: Varies | 16
+ * Data:    0x02     |            |        |       | Msg Time, Data            |
+ */
+
+void pack_data_gcm(struct data* msg, const u_int32_ard* pKeys, const byte_ard* pNonce, void* pBuffer)
+{
+  byte_ard* cBuffer = (byte_ard*)pBuffer;
+  byte_ard* cipher = cBuffer + DATA_GCM_HEADER_SIZE;
+
+  msg->cipher_len = MSGTIME_SIZE + msg->data_len;
+
+  cBuffer[DataGcmMsg::MsgType::offset] = MSG_T_DATA_SEND_GCM;
+  cBuffer[DataGcmMsg::CipherLen::offset] = msg->cipher_len;
+  putField<DataGcmMsg::Id>(cBuffer, msg->id);
+  putField<DataGcmMsg::Nonce>(cBuffer, pNonce);
+
+  // The plaintext is laid out in place and encrypted over itself.
+  putIntField<DataGcmMsg::Plain::MsgTime>(cipher, msg->msgtime);
+  memcpy(cipher + MSGTIME_SIZE, msg->data, msg->data_len);
+
+  aesGcmEncrypt(pKeys, pNonce, cBuffer, DATA_GCM_HEADER_SIZE, cipher, cipher,
+                msg->cipher_len, msg->cmac);
+
+  memcpy(cipher + msg->cipher_len, msg->cmac, GCM_TAG_SIZE);
+}
+
+/**
+ * unpack_data_gcm()
+ *
+ * Reads a bytestream from pack_data_gcm(). The tag is checked before
+ * anything is decrypted. Returns GCM_TAG_VALID or GCM_TAG_INVALID.
+ *
+ * NOTE: Does malloc() on msg->data (or takes it from the thread's arena),
+ *       but only if the tag is valid. Unlike unpack_data() the ciphertext
+ *       is not kept, msg->ciphertext is NULL.
+ *
+ *    Name          | Summary                            | Data
+ *    ------------------------------------------------------------------
+ *    msgtype       | 1-byte message code                | 0x02
+ *    id            | 6-byte public id (authenticated)   |
+ *    msgtime       | 4-byte unix time in u_int          |
+ *    data_len      | 1-byte denotes length of data      |
+ *    cipher_len    | 1-byte denotes length of ciphertext|
+ *    data          | Data itself. data-len bytes.       |
+ *    cmac          | The GCM tag.                       |
+ */
+
+int32_ard unpack_data_gcm(void* pStream, const u_int32_ard* pKeys, struct data* msg)
+{
+  byte_ard* cStream = (byte_ard*)pStream;
+  const byte_ard* pNonce = cStream + DataGcmMsg::Nonce::offset;
+  const byte_ard* cipher = cStream + DATA_GCM_HEADER_SIZE;
+
+  msg->msgtype = cStream[DataGcmMsg::MsgType::offset];
+  msg->cipher_len = cStream[DataGcmMsg::CipherLen::offset];
+  msg->ciphertext = NULL;
+  msg->data = NULL;
+  getField<DataGcmMsg::Id>(cStream, msg->id);
+
+  u_int16_ard cipherlen = (u_int16_ard)msg->cipher_len;
+  memcpy(msg->cmac, cipher + cipherlen, GCM_TAG_SIZE);
+
+  if (cipherlen < MSGTIME_SIZE)
+  {
+    return GCM_TAG_INVALID;
+  }
+
+  byte_ard* plainbuff = (byte_ard*)msgAlloc(cipherlen);
+
+  if (aesGcmDecrypt(pKeys, pNonce, cStream, DATA_GCM_HEADER_SIZE, cipher,
+                    plainbuff, cipherlen, msg->cmac) != GCM_TAG_VALID)
+  {
+    msgFree(plainbuff);
+    return GCM_TAG_INVALID;
+  }
+
+  msg->msgtime = getIntField<DataGcmMsg::Plain::MsgTime>(plainbuff);
+
+  msg->data_len = cipherlen - MSGTIME_SIZE;
+  msg->data = (byte_ard*)msgAlloc(msg->data_len);
+  memcpy(msg->data, plainbuff + MSGTIME_SIZE, msg->data_len);
+
+  msgFree(plainbuff);
+  return GCM_TAG_VALID;
+}
+
+/**
+ * pack_gwframe_header()
+ *
+ * Writes the envelope header that precedes every message on a gateway
+ * session. The payload itself is written by the caller directly after the
+ * header, GWFRAME_HEADER_SIZE bytes into pBuffer.
+ *
+ * Name:    Msg Code | Sensor ID | Payload length
+ * Bytes:   1        | 6         | 2 (LSB first)
+ * Data:    0xA1     |           |
+ */
+
+void pack_gwframe_header(const byte_ard* pID, u_int16_ard payloadLen, void* pBuffer)
+{
+  byte_ard* cBuffer = (byte_ard*)pBuffer;
+
+  cBuffer[GwFrameMsg::MsgType::offset] = MSG_T_GATEWAY_FRAME;
+  putField<GwFrameMsg::Id>(cBuffer, pID);
+  putIntField<GwFrameMsg::Length>(cBuffer, payloadLen);
+}
+
+/**
+ * unpack_gwframe_header()
+ *
+ * Reads an envelope header written by pack_gwframe_header(). Copies the
+ * sensor ID into pID and returns the payload length. Returns 0 if the stream
+ * does not start with a gateway frame.
+ */
+
+u_int16_ard unpack_gwframe_header(void* pStream, byte_ard* pID)
 {
   byte_ard* cStream = (byte_ard*)pStream;
-  byte_ard* cID = (byte_ard*)cStream;
 
-  // No buffer overflow. 
-  for(u_int16_ard i = 0; i < ID_SIZE; i++)
+  if (cStream[GwFrameMsg::MsgType::offset] != MSG_T_GATEWAY_FRAME)
   {
-    cID[i] = cStream[MSGTYPE_SIZE + 1 + i];
+    return 0;
   }
+
+  getField<GwFrameMsg::Id>(cStream, pID);
+  return getIntField<GwFrameMsg::Length>(cStream);
 }
@@ -26,53 +26,245 @@
 
 #include "aes_crypt.h"
 #include "aes_cmac.h"
+#include "aes_gcm.h"
 #include <stdlib.h>
 #include <string.h>
 
 /**
- * Some defines - Please take care if you change them.
- *
- *  The macros below depend on these sizes for easy calculation. If you ahvenge
- *  NONCE_SIZE, TIMER_SIZE, MSGTYPE_SIZE, IDSIZE - please fix the macros below
- *  accordingly. As is, this applies to the _PADLEN macros, since they use the
- *  BLOCK_BYTE_SIZE without a dynamic multiplicator and will return minus values
- *  if the _SIZE defines get larger. 
+ * Field sizes in bytes.
  */
 #define ID_SIZE 6
 #define MSGTYPE_SIZE 1
 #define NONCE_SIZE 2
 #define TIMER_SIZE 2
 #define MSGTIME_SIZE 4
+#define CIPHERLEN_SIZE 1
+
+/**
+ * Message layouts
+ *
+ *  Every message is described by its fields in order, and all offsets and
+ *  sizes are worked out by the compiler from the field sizes. A field is
+ *  declared by naming the field it follows:
+ *
+ *    typedef MsgField<Previous, Size> Name;
+ *
+ *  which makes Name::offset, Name::size and Name::end compile time
+ *  constants. The first field follows MsgStart. The encrypted part of a
+ *  message has a layout of its own, Plain, which is padded to whole cipher
+ *  blocks by PaddedSize. Only plain C++98 enums and templates are used, so
+ *  this builds for the AVR as well.
+ *
+ *  Changing a size, or adding a field, moves everything after it. Nothing
+ *  has to be recomputed by hand.
+ */
+struct MsgStart
+{
+  enum { end = 0 };
+};
+
+template <class Previous, int Size>
+struct MsgField
+{
+  enum { offset = Previous::end, size = Size, end = Previous::end + Size };
+};
+
+template <int Size>
+struct PaddedSize
+{
+  enum { value = ((Size + BLOCK_BYTE_SIZE - 1) / BLOCK_BYTE_SIZE) * BLOCK_BYTE_SIZE };
+};
+
+// The same for sizes only known at run time.
+inline u_int16_ard paddedSize(u_int16_ard size)
+{
+  return ((size + BLOCK_BYTE_SIZE - 1) / BLOCK_BYTE_SIZE) * BLOCK_BYTE_SIZE;
+}
+
+// idresponse, sensor to auth server: E(Public ID, Nonce)
+struct IdMsg
+{
+  struct Plain
+  {
+    typedef MsgField<MsgStart, ID_SIZE> Id;
+    typedef MsgField<Id, NONCE_SIZE> Nonce;
+    enum { size = Nonce::end, cryptSize = PaddedSize<size>::value };
+  };
+  typedef MsgField<MsgStart, MSGTYPE_SIZE> MsgType;
+  typedef MsgField<MsgType, ID_SIZE> Id;
+  typedef MsgField<Id, Plain::cryptSize> Cipher;
+  typedef MsgField<Cipher, BLOCK_BYTE_SIZE> Cmac;
+  enum { size = Cmac::end };
+};
+
+// keytosink, auth server to sink: the session key in the clear (over TLS) and
+// E(Nonce, Session key, Renewal timer) for the sensor
+struct KeyToSinkMsg
+{
+  struct Plain
+  {
+    typedef MsgField<MsgStart, NONCE_SIZE> Nonce;
+    typedef MsgField<Nonce, KEY_BYTES> Key;
+    typedef MsgField<Key, TIMER_SIZE> Timer;
+    enum { size = Timer::end, cryptSize = PaddedSize<size>::value };
+  };
+  typedef MsgField<MsgStart, MSGTYPE_SIZE> MsgType;
+  typedef MsgField<MsgType, ID_SIZE> Id;
+  typedef MsgField<Id, KEY_BYTES> Key;
+  typedef MsgField<Key, TIMER_SIZE> Timer;
+  typedef MsgField<Timer, Plain::cryptSize> Cipher;
+  typedef MsgField<Cipher, BLOCK_BYTE_SIZE> Cmac;
+  enum { size = Cmac::end };
+};
+
+// keytosense, sink to sensor: the sensor's part of keytosink
+struct KeyToSenseMsg
+{
+  typedef MsgField<MsgStart, MSGTYPE_SIZE> MsgType;
+  typedef MsgField<MsgType, KeyToSinkMsg::Plain::cryptSize> Cipher;
+  typedef MsgField<Cipher, BLOCK_BYTE_SIZE> Cmac;
+  enum { size = Cmac::end };
+};
+
+// rekey request or handshake, sensor to sink: E(Public ID, Nonce)
+struct RekeyMsg
+{
+  struct Plain
+  {
+    typedef MsgField<MsgStart, ID_SIZE> Id;
+    typedef MsgField<Id, NONCE_SIZE> Nonce;
+    enum { size = Nonce::end, cryptSize = PaddedSize<size>::value };
+  };
+  typedef MsgField<MsgStart, MSGTYPE_SIZE> MsgType;
+  typedef MsgField<MsgType, ID_SIZE> Id;
+  typedef MsgField<Id, Plain::cryptSize> Cipher;
+  typedef MsgField<Cipher, BLOCK_BYTE_SIZE> Cmac;
+  enum { size = Cmac::end };
+};
+
+// newkey, sink to sensor: E(Public ID, Nonce, Key material, Renewal timer)
+struct NewKeyMsg
+{
+  struct Plain
+  {
+    typedef MsgField<MsgStart, ID_SIZE> Id;
+    typedef MsgField<Id, NONCE_SIZE> Nonce;
+    typedef MsgField<Nonce, KEY_BYTES> Rand;
+    typedef MsgField<Rand, TIMER_SIZE> Timer;
+    enum { size = Timer::end, cryptSize = PaddedSize<size>::value };
+  };
+  typedef MsgField<MsgStart, MSGTYPE_SIZE> MsgType;
+  typedef MsgField<MsgType, ID_SIZE> Id;
+  typedef MsgField<Id, Plain::cryptSize> Cipher;
+  typedef MsgField<Cipher, BLOCK_BYTE_SIZE> Cmac;
+  enum { size = Cmac::end };
+};
+
+// Data, sensor to sink: E(Public ID, Msg time, Data length, Data). The
+// ciphertext starts at headerSize and is followed by the CMAC.
+struct DataMsg
+{
+  struct Plain
+  {
+    typedef MsgField<MsgStart, ID_SIZE> Id;
+    typedef MsgField<Id, MSGTIME_SIZE> MsgTime;
+    typedef MsgField<MsgTime, 1> DataLen;
+    enum { headerSize = DataLen::end };
+  };
+  typedef MsgField<MsgStart, MSGTYPE_SIZE> MsgType;
+  typedef MsgField<MsgType, CIPHERLEN_SIZE> CipherLen;
+  typedef MsgField<CipherLen, ID_SIZE> Id;
+  enum { headerSize = Id::end };
+};
+
+/**
+ * Data messages encrypted with AES-GCM. The header is authenticated along
+ * with the ciphertext, which is the message time and the data unpadded.
+ */
+struct DataGcmMsg
+{
+  typedef MsgField<MsgStart, MSGTYPE_SIZE> MsgType;
+  typedef MsgField<MsgType, CIPHERLEN_SIZE> CipherLen;
+  typedef MsgField<CipherLen, ID_SIZE> Id;
+  typedef MsgField<Id, GCM_NONCE_SIZE> Nonce;
+  enum { headerSize = Nonce::end };
+
+  struct Plain
+  {
+    typedef MsgField<MsgStart, MSGTIME_SIZE> MsgTime;
+    enum { headerSize = MsgTime::end };
+  };
+};
 
 /**
- * Some macros to calculate the various lengths of various things.
+ * Gateway session envelope. A gateway keeps one long lived connection to the
+ * sink and multiplexes the messages of many sensors over it. Every message,
+ * in either direction, is wrapped as
  *
- *  Please thread carefully if changing something. The general rule here is
- *    _PADLEN = Number of characters needed to pad the block. <16 chars.
- *    _CRYPTSIZE = The length of the crypted size. Divisable by 16.
- *    _FULLSIZE = The length of the full packet, everthing included.
- * 
- *  The _PADLEN macros are sensetive to change.
+ *    [MSG_T_GATEWAY_FRAME][Sensor ID (6)][Payload length (2, LSB first)][Payload]
  *
- *  TODO: Rewrite this heap of constants with Z/16Z
+ * The sensor ID in the envelope is only used for routing responses back to
+ * the right sensor. The payload is an ordinary protocol message.
  */
-#define IDMSG_PADLEN BLOCK_BYTE_SIZE - (ID_SIZE+NONCE_SIZE)
-#define IDMSG_CRYPTSIZE ID_SIZE + NONCE_SIZE + (IDMSG_PADLEN)
-#define IDMSG_FULLSIZE MSGTYPE_SIZE + ID_SIZE + IDMSG_CRYPTSIZE + BLOCK_BYTE_SIZE
+#define GWFRAME_LEN_SIZE 2
 
-#define KEYTOSINK_PADLEN (BLOCK_BYTE_SIZE - (NONCE_SIZE + TIMER_SIZE+ ID_SIZE))
-#define KEYTOSINK_CRYPTSIZE (NONCE_SIZE + ID_SIZE + KEY_BYTES + TIMER_SIZE + KEYTOSINK_PADLEN)
-#define KEYTOSINK_FULLSIZE MSGTYPE_SIZE + ID_SIZE + KEY_BYTES + TIMER_SIZE + KEYTOSINK_CRYPTSIZE + BLOCK_BYTE_SIZE
+struct GwFrameMsg
+{
+  typedef MsgField<MsgStart, MSGTYPE_SIZE> MsgType;
+  typedef MsgField<MsgType, ID_SIZE> Id;
+  typedef MsgField<Id, GWFRAME_LEN_SIZE> Length;
+  enum { headerSize = Length::end };
+};
 
-#define KEYTOSENS_FULLSIZE MSGTYPE_SIZE + KEYTOSINK_CRYPTSIZE + BLOCK_BYTE_SIZE
+/**
+ * The sizes of the fixed size messages and of their encrypted parts.
+ */
+#define IDMSG_CRYPTSIZE       IdMsg::Plain::cryptSize
+#define IDMSG_FULLSIZE        IdMsg::size
+#define KEYTOSINK_CRYPTSIZE   KeyToSinkMsg::Plain::cryptSize
+#define KEYTOSINK_FULLSIZE    KeyToSinkMsg::size
+#define KEYTOSENS_FULLSIZE    KeyToSenseMsg::size
+#define REKEY_CRYPTSIZE       RekeyMsg::Plain::cryptSize
+#define REKEY_FULLSIZE        RekeyMsg::size
+#define NEWKEY_CRYPTSIZE      NewKeyMsg::Plain::cryptSize
+#define NEWKEY_FULLSIZE       NewKeyMsg::size
 
-#define REKEY_PADLEN BLOCK_BYTE_SIZE - (NONCE_SIZE + ID_SIZE)
-#define REKEY_CRYPTSIZE (ID_SIZE + NONCE_SIZE + REKEY_PADLEN)
-#define REKEY_FULLSIZE MSGTYPE_SIZE + ID_SIZE + REKEY_CRYPTSIZE + BLOCK_BYTE_SIZE
+#define DATA_GCM_HEADER_SIZE  DataGcmMsg::headerSize
+#define DATA_GCM_FULLSIZE(datalen) (DATA_GCM_HEADER_SIZE + MSGTIME_SIZE + (datalen) + GCM_TAG_SIZE)
 
-#define NEWKEY_PADLEN  BLOCK_BYTE_SIZE - (ID_SIZE + NONCE_SIZE + TIMER_SIZE)   // Rand size is one block. 
-#define NEWKEY_CRYPTSIZE ID_SIZE + NONCE_SIZE + KEY_BYTES + TIMER_SIZE + (NEWKEY_PADLEN)
-#define NEWKEY_FULLSIZE MSGTYPE_SIZE + ID_SIZE + NEWKEY_CRYPTSIZE + BLOCK_BYTE_SIZE
+#define GWFRAME_HEADER_SIZE   GwFrameMsg::headerSize
+
+/**
+ * Field access. The offsets and sizes are constants, so these compile to
+ * straight-line copies at fixed offsets. Integers are sent LSB first.
+ */
+template <class Field>
+inline void putField(byte_ard* pBuffer, const byte_ard* pSrc)
+{
+  memcpy(pBuffer + Field::offset, pSrc, Field::size);
+}
+
+template <class Field>
+inline void getField(const byte_ard* pStream, byte_ard* pDst)
+{
+  memcpy(pDst, pStream + Field::offset, Field::size);
+}
+
+template <class Field>
+inline void putIntField(byte_ard* pBuffer, u_int32_ard value)
+{
+  for (int16_ard i = 0; i < Field::size; i++)
+    pBuffer[Field::offset + i] = (byte_ard)(value >> (8*i));
+}
+
+template <class Field>
+inline u_int32_ard getIntField(const byte_ard* pStream)
+{
+  u_int32_ard value = 0;
+  for (int16_ard i = 0; i < Field::size; i++)
+    value |= (u_int32_ard)pStream[Field::offset + i] << (8*i);
+  return value;
+}
 
 /**
  * Defines for message identifiers
@@ -81,6 +273,10 @@
  *       but skipping 0x60. 
  */
 #define MSG_T_DATA_SEND          0x01
+#define MSG_T_DATA_SEND_GCM      0x02
+#define MSG_T_DATA_PACKED_FLAG   0x04  // Or'ed into the data types, see payload_codec.h
+#define MSG_T_DATA_TIMED_FLAG    0x08  // Likewise, record times ahead of the samples
+#define MSG_T_DATA_FLAGS         (MSG_T_DATA_PACKED_FLAG | MSG_T_DATA_TIMED_FLAG)
 #define MSG_T_GET_ID_R           0x10
 #define MSG_T_KEY_TO_SINK        0x11
 #define MSG_T_KEY_TO_SENSE       0x12
@@ -89,6 +285,7 @@
 #define MSG_T_REKEY_HANDSHAKE    0x31
 #define MSG_T_REKEY_RESPONSE     0x32
 #define MSG_T_FINISH             0x90
+#define MSG_T_GATEWAY_FRAME      0xA1
 #define MSG_T_ERROR              0xff
 
 /**
@@ -147,6 +344,21 @@ void unpack_newkey(void* pStream, const u_int32_ard* pKeys, struct message* msg)
 
 void pack_data(struct data* msg, const u_int32_ard* pKeys, const u_int32_ard* pCmacKeys, void* pBuffer);
 void unpack_data(void* pStream, const u_int32_ard* pKeys, struct data* msg);
-void unpack_data(void* pStream, void* pID);
+void unpack_data_getid(void* pStream, void* pID);
+#ifndef _ARDUINO_DUEMILANOVE
+u_int32_ard unpack_data_batch(void** pStreams, const u_int32_ard** pKeys,
+                              const u_int32_ard** pCmacKeys, struct data* msgs,
+                              int32_ard* valid, u_int32_ard n);
+#endif
+
+void pack_data_gcm(struct data* msg, const u_int32_ard* pKeys, const byte_ard* pNonce, void* pBuffer);
+int32_ard unpack_data_gcm(void* pStream, const u_int32_ard* pKeys, struct data* msg);
+
+/**
+ * Gateway sessions
+ */
+
+void pack_gwframe_header(const byte_ard* pID, u_int16_ard payloadLen, void* pBuffer);
+u_int16_ard unpack_gwframe_header(void* pStream, byte_ard* pID);
 
 #endif
@@ -0,0 +1,288 @@
+/*
+ * File name: serial_link.cpp
+ * Date:      2026-10-20 01:30
+ * Author:
+ *
+ * Runs on the tsensor and on the host alike. Sequence numbers wrap at 256
+ * and are compared by their difference, which is fine as long as far fewer
+ * than 128 frames are in flight.
+ */
+
+#include "serial_link.h"
+#include <string.h>
+
+static const long linkBauds[LINK_BAUD_CODES] = {
+  9600, 19200, 38400, 57600, 115200, 230400, 500000
+};
+
+// How far seq is ahead of base, negative if it is behind.
+static int seqDiff(byte_ard seq, byte_ard base)
+{
+  return (signed char)(byte_ard)(seq - base);
+}
+
+u_int16_ard crc16(const byte_ard* buf, u_int16_ard len)
+{
+  u_int16_ard crc = 0xFFFF;
+  for (u_int16_ard i = 0; i < len; i++)
+  {
+    crc ^= (u_int16_ard)buf[i] << 8;
+    for (byte_ard bit = 0; bit < 8; bit++)
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+u_int16_ard cobs_encode(const byte_ard* in, u_int16_ard len, byte_ard* out)
+{
+  u_int16_ard codePos = 0;
+  u_int16_ard pos = 1;
+  byte_ard code = 1;
+
+  for (u_int16_ard i = 0; i < len; i++)
+  {
+    if (in[i] != 0)
+    {
+      out[pos++] = in[i];
+      code++;
+    }
+    if (in[i] == 0 || code == 0xFF)
+    {
+      out[codePos] = code;
+      codePos = pos++;
+      code = 1;
+    }
+  }
+  out[codePos] = code;
+  return pos;
+}
+
+int32_ard cobs_decode(const byte_ard* in, u_int16_ard len, byte_ard* out)
+{
+  u_int16_ard pos = 0;
+  u_int16_ard outLen = 0;
+
+  while (pos < len)
+  {
+    byte_ard code = in[pos++];
+    if (code == 0 || pos + code - 1 > len)
+      return -1;
+    for (byte_ard i = 1; i < code; i++)
+    {
+      if (in[pos] == 0)
+        return -1;
+      out[outLen++] = in[pos++];
+    }
+    // A full block has no zero after it, nor has the last one
+    if (code != 0xFF && pos < len)
+      out[outLen++] = 0;
+  }
+  return outLen;
+}
+
+u_int16_ard link_encode_frame(byte_ard ctl, byte_ard seq, const byte_ard* payload,
+                              u_int16_ard len, byte_ard* out)
+{
+  byte_ard body[LINK_BODY_MAX];
+  body[0] = ctl;
+  body[1] = seq;
+  memcpy(body+LINK_HEADER_SIZE, payload, len);
+  u_int16_ard crc = crc16(body, LINK_HEADER_SIZE+len);
+  body[LINK_HEADER_SIZE+len] = crc & 0xFF;
+  body[LINK_HEADER_SIZE+len+1] = crc >> 8;
+
+  out[0] = LINK_DELIM;
+  u_int16_ard n = 1 + cobs_encode(body, LINK_HEADER_SIZE+len+LINK_CRC_SIZE, out+1);
+  out[n++] = LINK_DELIM;
+  return n;
+}
+
+long link_baud(byte_ard code)
+{
+  return code < LINK_BAUD_CODES ? linkBauds[code] : 0;
+}
+
+void link_init(struct serial_link* link, long baud)
+{
+  memset(link, 0, sizeof(struct serial_link));
+  link_set_baud(link, baud);
+}
+
+void link_set_baud(struct serial_link* link, long baud)
+{
+  link->retryMs = 2 * LINK_FRAME_MAX * 10 * 1000L / baud + LINK_TURNAROUND_MS;
+}
+
+int32_ard link_rx_byte(struct serial_link* link, byte_ard b)
+{
+  if (b != LINK_DELIM)
+  {
+    if (link->frameLen < LINK_FRAME_MAX)
+      link->frame[link->frameLen++] = b;
+    else
+      link->overrun = 1;
+    return LINK_RX_NONE;
+  }
+
+  // Delimiters back to back are idle line
+  if (link->frameLen == 0)
+    return LINK_RX_NONE;
+
+  int32_ard len = link->overrun ? -1 : cobs_decode(link->frame, link->frameLen, link->frame);
+  link->frameLen = 0;
+  link->overrun = 0;
+  if (len < LINK_HEADER_SIZE + LINK_CRC_SIZE ||
+      crc16(link->frame, len - LINK_CRC_SIZE) !=
+      (link->frame[len-2] | (link->frame[len-1] << 8)))
+  {
+    link->crcErrors++;
+    return LINK_RX_BAD;
+  }
+
+  link->rxCtl = link->frame[0];
+  link->rxFrameSeq = link->frame[1];
+  link->rxLen = len - LINK_HEADER_SIZE - LINK_CRC_SIZE;
+  return LINK_RX_FRAME;
+}
+
+void link_accept(struct serial_link* link)
+{
+  int diff = seqDiff(link->rxFrameSeq, link->rxSeq);
+  if (diff == 0)
+  {
+    link->current = 1;
+    return;
+  }
+  if (diff < 0)
+    return;   // Resent after its ACK was lost
+
+  link->gap = 1;
+#ifndef _ARDUINO_DUEMILANOVE
+  if (diff >= LINK_WINDOW)
+    return;
+  struct link_slot* slot = &link->rx[link->rxFrameSeq % LINK_WINDOW];
+  slot->used = 1;
+  slot->seq = link->rxFrameSeq;
+  slot->len = link->rxLen;
+  memcpy(slot->data, link->frame+LINK_HEADER_SIZE, link->rxLen);
+#endif
+}
+
+const byte_ard* link_deliver(struct serial_link* link, u_int16_ard* len)
+{
+  if (link->current)
+  {
+    link->current = 0;
+    link->gap = 0;
+    link->rxSeq++;
+    *len = link->rxLen;
+    return link->frame + LINK_HEADER_SIZE;
+  }
+
+#ifndef _ARDUINO_DUEMILANOVE
+  struct link_slot* slot = &link->rx[link->rxSeq % LINK_WINDOW];
+  if (slot->used && slot->seq == link->rxSeq)
+  {
+    slot->used = 0;
+    link->rxSeq++;
+    *len = slot->len;
+    return slot->data;
+  }
+  // Anything still held is past another missing frame
+  link->gap = 0;
+  for (byte_ard i = 0; i < LINK_WINDOW; i++)
+    if (link->rx[i].used && seqDiff(link->rx[i].seq, link->rxSeq) > 0)
+      link->gap = 1;
+#endif
+  return NULL;
+}
+
+void link_reply(struct serial_link* link, byte_ard* ctl, byte_ard* seq)
+{
+  if (link->gap)
+  {
+    *ctl = LINK_CTL_NAK;
+    *seq = link->rxSeq;
+  }
+  else
+  {
+    *ctl = LINK_CTL_ACK;
+    *seq = link->rxSeq - 1;
+  }
+}
+
+int32_ard link_queue(struct serial_link* link, const byte_ard* payload, u_int16_ard len)
+{
+  for (byte_ard i = 0; i < LINK_WINDOW; i++)
+  {
+    struct link_slot* slot = &link->tx[i];
+    if (slot->used)
+      continue;
+    slot->used = 1;
+    slot->seq = link->txSeq++;
+    slot->tries = 0;
+    slot->resend = 0;
+    slot->len = len;
+    memcpy(slot->data, payload, len);
+    return 1;
+  }
+  return 0;
+}
+
+struct link_slot* link_due(struct serial_link* link, u_int32_ard now)
+{
+  // Oldest first, so the receiver sees them in order where it can
+  struct link_slot* due = NULL;
+  for (byte_ard i = 0; i < LINK_WINDOW; i++)
+  {
+    struct link_slot* slot = &link->tx[i];
+    if (!slot->used)
+      continue;
+    if (slot->tries > 0 && !slot->resend && now - slot->sentAt < link->retryMs)
+      continue;
+    if (slot->tries >= LINK_MAX_TRIES)
+    {
+      slot->used = 0;
+      link->drops++;
+      continue;
+    }
+    if (due == NULL || seqDiff(slot->seq, due->seq) < 0)
+      due = slot;
+  }
+
+  if (due != NULL)
+  {
+    if (due->tries > 0)
+      link->retransmits++;
+    due->tries++;
+    due->resend = 0;
+    due->sentAt = now;
+  }
+  return due;
+}
+
+void link_control(struct serial_link* link)
+{
+  // Both acknowledge the frames before the one a NAK names
+  byte_ard acked = link->rxCtl == LINK_CTL_NAK ? link->rxFrameSeq - 1 : link->rxFrameSeq;
+
+  for (byte_ard i = 0; i < LINK_WINDOW; i++)
+  {
+    struct link_slot* slot = &link->tx[i];
+    if (!slot->used)
+      continue;
+    if (seqDiff(slot->seq, acked) <= 0)
+      slot->used = 0;
+    else if (link->rxCtl == LINK_CTL_NAK && slot->seq == link->rxFrameSeq)
+      slot->resend = 1;
+  }
+}
+
+byte_ard link_free(const struct serial_link* link)
+{
+  byte_ard n = 0;
+  for (byte_ard i = 0; i < LINK_WINDOW; i++)
+    if (!link->tx[i].used)
+      n++;
+  return n;
+}
@@ -0,0 +1,223 @@
+/*
+ * File name: serial_link.h
+ * Date:      2026-10-20 01:30
+ * Author:
+ *
+ * Framed link layer for the serial line between the tsensor and the host
+ * (the gateway or the simulator), used once both ends have agreed to it
+ * with LINK_START_CMD. It carries the same byte stream as the raw line,
+ * the protocol messages and the T <-> C commands of tsensor.pde unchanged,
+ * cut into frames of at most LINK_MTU bytes:
+ *
+ *    [0x00] COBS( [Ctl (1)][Seq (1)][Payload (0..LINK_MTU)][CRC-16 (2)] ) [0x00]
+ *
+ * COBS takes the zeroes out of the frame, so a zero always delimits one and
+ * a receiver that lost a byte is back in step at the next. The CRC is
+ * CRC-16/CCITT (0x1021, 0xFFFF) over control, sequence number and payload,
+ * least significant byte first. A frame that fails it is dropped.
+ *
+ * Data frames are numbered, the receiver ACKs the last one it has in order
+ * and NAKs the first one missing when a later one shows up. The sender keeps
+ * up to LINK_WINDOW frames until they are ACKed and resends exactly the one
+ * a NAK names, or any it gets no ACK for within the retry time of the line,
+ * at most LINK_MAX_TRIES times. Receivers off the Arduino hold frames that
+ * come ahead of a missing one, so only the lost frame crosses the line
+ * again; the tsensor drops them and relies on the host's resends.
+ *
+ * Negotiation, in raw mode at 9600 baud: the host sends LINK_START_CMD and
+ * the code of the fastest rate it can do, the sensor answers LINK_START_R
+ * and the code of the rate it picked (at most its own limit), and both
+ * switch to that rate and to frames. The host confirms with any frame. A
+ * sensor that hears no valid frame for LINK_CONFIRM_MS after the switch,
+ * or for LINK_IDLE_MS later on, goes back to raw mode at 9600 baud; the
+ * host sends a keepalive (an ACK) every LINK_KEEPALIVE_MS to prevent that.
+ * Firmware without the link layer answers LINK_START_CMD with an ACK for
+ * an unknown message and the line stays raw.
+ */
+
+#ifndef __SERIAL_LINK_H__
+#define __SERIAL_LINK_H__
+
+#include "tstypes.h"
+
+#define LINK_DELIM 0x00
+
+// Frame control
+#define LINK_CTL_DATA  0x01
+#define LINK_CTL_ACK   0x02   // Seq is the last frame received in order
+#define LINK_CTL_NAK   0x03   // Seq is the first frame missing
+
+#define LINK_HEADER_SIZE 2
+#define LINK_CRC_SIZE    2
+#define LINK_MTU         64   // Payload bytes per frame
+#define LINK_BODY_MAX    (LINK_HEADER_SIZE + LINK_MTU + LINK_CRC_SIZE)
+// A COBS code byte per 254 bytes and a delimiter on both ends
+#define LINK_FRAME_MAX   (LINK_BODY_MAX + LINK_BODY_MAX/254 + 1 + 2)
+#define LINK_CTL_FRAME_SIZE (LINK_HEADER_SIZE + LINK_CRC_SIZE + 1 + 2)
+
+// Frames in flight. The host holds as many that arrive ahead of a missing one.
+#ifdef _ARDUINO_DUEMILANOVE
+  #define LINK_WINDOW    2
+#else
+  #define LINK_WINDOW    4
+#endif
+#define LINK_MAX_TRIES   5
+#define LINK_TURNAROUND_MS 50 // What the other end may take to answer
+
+// Negotiation. T <-> C commands in the numbering of tsensor.pde.
+#define LINK_START_CMD   0x60
+#define LINK_START_R     0x61
+#define LINK_START_R_SIZE 2
+
+#define LINK_BAUD_9600   0
+#define LINK_BAUD_19200  1
+#define LINK_BAUD_38400  2
+#define LINK_BAUD_57600  3
+#define LINK_BAUD_115200 4
+#define LINK_BAUD_230400 5
+#define LINK_BAUD_500000 6    // No error at all from a 16 MHz clock
+#define LINK_BAUD_CODES  7
+
+#define LINK_CONFIRM_MS   2000
+#define LINK_IDLE_MS      60000
+#define LINK_KEEPALIVE_MS 20000
+
+// What link_rx_byte() got
+#define LINK_RX_NONE   0
+#define LINK_RX_FRAME  1
+#define LINK_RX_BAD   -1
+
+/**
+ * A data frame held by the sender until it is ACKed, or by the receiver
+ * until the frames before it are in.
+ */
+struct link_slot
+{
+  byte_ard used;
+  byte_ard seq;
+  byte_ard tries;              // Times sent
+  byte_ard resend;             // NAKed, send again at once
+  u_int32_ard sentAt;
+  u_int16_ard len;
+  byte_ard data[LINK_MTU];
+};
+
+/**
+ * One end of a framed line. The owner reads and writes the line, the link
+ * decodes what comes in byte by byte and keeps the sequence numbers, the
+ * frames in flight and the counters.
+ */
+struct serial_link
+{
+  byte_ard txSeq;                      // Of the next frame queued
+  struct link_slot tx[LINK_WINDOW];
+  u_int16_ard retryMs;
+
+  byte_ard rxSeq;                      // Of the next frame expected
+  byte_ard gap;                        // A frame after rxSeq was seen
+  byte_ard current;                    // The frame received is next for link_deliver()
+#ifndef _ARDUINO_DUEMILANOVE
+  struct link_slot rx[LINK_WINDOW];    // Frames ahead of a missing one
+#endif
+
+  byte_ard frame[LINK_FRAME_MAX];      // Bytes of the frame coming in, then the decoded frame
+  u_int16_ard frameLen;
+  byte_ard overrun;
+  byte_ard rxCtl;                      // The frame link_rx_byte() returned
+  byte_ard rxFrameSeq;
+  u_int16_ard rxLen;                   // Its payload length, payload at frame+LINK_HEADER_SIZE
+
+  u_int32_ard crcErrors;
+  u_int32_ard retransmits;
+  u_int32_ard drops;                   // Frames given up after LINK_MAX_TRIES
+};
+
+/**
+ * CRC-16/CCITT of len bytes, bitwise, so there is no table to keep.
+ */
+u_int16_ard crc16(const byte_ard* buf, u_int16_ard len);
+
+/**
+ * COBS encodes len bytes to out, which must hold len + len/254 + 1 bytes.
+ * Returns the encoded length.
+ */
+u_int16_ard cobs_encode(const byte_ard* in, u_int16_ard len, byte_ard* out);
+
+/**
+ * Decodes len COBS encoded bytes to out, which may be in. Returns the
+ * decoded length, or -1 if the input holds a zero or ends in a block.
+ */
+int32_ard cobs_decode(const byte_ard* in, u_int16_ard len, byte_ard* out);
+
+/**
+ * Builds the frame for ctl, seq and len bytes of payload in out, which
+ * must hold LINK_FRAME_MAX bytes. Returns the length to write.
+ */
+u_int16_ard link_encode_frame(byte_ard ctl, byte_ard seq, const byte_ard* payload,
+                              u_int16_ard len, byte_ard* out);
+
+/**
+ * The line rate for a LINK_BAUD_ code, 0 for an unknown code.
+ */
+long link_baud(byte_ard code);
+
+/**
+ * Starts a link on a line running at baud. Sequence numbers start at 0 on
+ * both ends.
+ */
+void link_init(struct serial_link* link, long baud);
+
+/**
+ * Sets the retry time for a line running at baud: two of the longest
+ * frames on the wire and the turnaround.
+ */
+void link_set_baud(struct serial_link* link, long baud);
+
+/**
+ * Takes the next byte from the line. Returns LINK_RX_FRAME when it ends a
+ * valid frame, which is then described by rxCtl, rxFrameSeq and rxLen,
+ * LINK_RX_BAD when it ends one that is not, and LINK_RX_NONE otherwise.
+ */
+int32_ard link_rx_byte(struct serial_link* link, byte_ard b);
+
+/**
+ * Takes the data frame link_rx_byte() returned. Then link_deliver() hands
+ * out the payloads now in order and link_reply() tells what to answer.
+ */
+void link_accept(struct serial_link* link);
+
+/**
+ * The next payload in order, or NULL. Valid until the next byte is taken.
+ */
+const byte_ard* link_deliver(struct serial_link* link, u_int16_ard* len);
+
+/**
+ * The ACK or NAK to send for what was received.
+ */
+void link_reply(struct serial_link* link, byte_ard* ctl, byte_ard* seq);
+
+/**
+ * Queues len (at most LINK_MTU) bytes as the next data frame. Returns 1,
+ * or 0 if LINK_WINDOW frames are in flight.
+ */
+int32_ard link_queue(struct serial_link* link, const byte_ard* payload, u_int16_ard len);
+
+/**
+ * The next frame to send at now: a new one, a NAKed one or one whose ACK
+ * is overdue. It counts as sent. NULL if there is none. Frames sent
+ * LINK_MAX_TRIES times are dropped.
+ */
+struct link_slot* link_due(struct serial_link* link, u_int32_ard now);
+
+/**
+ * The ACK or NAK frame link_rx_byte() returned. Frees the frames it
+ * acknowledges and marks a NAKed one for resending.
+ */
+void link_control(struct serial_link* link);
+
+/**
+ * Number of frames that can be queued.
+ */
+byte_ard link_free(const struct serial_link* link);
+
+#endif // __SERIAL_LINK_H__
@@ -0,0 +1,230 @@
+/**
+ * Tests the batch AES functions against the single message ones and times
+ * batch CMAC verification of many small messages against verifyAesCMac().
+ */
+
+#include "aes_batch.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/time.h>
+
+#define JOBS 37          // Not a multiple of BATCH_LANES on purpose.
+#define MAX_MSG 100
+#define TIMED_JOBS 64
+#define TIMED_REPS 20000
+
+byte_ard Keys[JOBS][KEY_BYTES*11];
+byte_ard Msgs[JOBS][MAX_MSG];
+u_int32_ard Lens[JOBS];
+
+void randomBytes(byte_ard* p, int len)
+{
+  for (int i = 0; i < len; i++)
+    p[i] = rand() & 0xFF;
+}
+
+double elapsed(timeval* start, timeval* stop)
+{
+  return (stop->tv_sec - start->tv_sec) + (stop->tv_usec - start->tv_usec)/1e6;
+}
+
+int blocktest()
+{
+  byte_ard blocks[JOBS][BLOCK_BYTE_SIZE], expected[JOBS][BLOCK_BYTE_SIZE];
+  byte_ard* pBlocks[JOBS];
+  const u_int32_ard* pKeys[JOBS];
+
+  printf("block: ");
+  for (int i = 0; i < JOBS; i++)
+  {
+    randomBytes(blocks[i], BLOCK_BYTE_SIZE);
+    memcpy(expected[i], blocks[i], BLOCK_BYTE_SIZE);
+    EncryptBlock(expected[i], (const u_int32_ard*)Keys[i]);
+    pBlocks[i] = blocks[i];
+    pKeys[i] = (const u_int32_ard*)Keys[i];
+  }
+
+  EncryptBlockBatch(pBlocks, pKeys, JOBS);
+  if (memcmp(blocks, expected, sizeof(blocks)) != 0)
+  {
+    printf("Failed: EncryptBlockBatch differs from EncryptBlock\n");
+    return 1;
+  }
+
+  for (int i = 0; i < JOBS; i++)
+    DecryptBlock(expected[i], (const u_int32_ard*)Keys[i]);
+  DecryptBlockBatch(pBlocks, pKeys, JOBS);
+  if (memcmp(blocks, expected, sizeof(blocks)) != 0)
+  {
+    printf("Failed: DecryptBlockBatch differs from DecryptBlock\n");
+    return 1;
+  }
+
+  printf("Checks out!\n");
+  return 0;
+}
+
+int cmactest()
+{
+  struct cmac_job jobs[JOBS];
+  byte_ard macs[JOBS][BLOCK_BYTE_SIZE];
+
+  printf("cmac: ");
+  for (int i = 0; i < JOBS; i++)
+  {
+    jobs[i].KS = (const u_int32_ard*)Keys[i];
+    jobs[i].M = Msgs[i];
+    jobs[i].length = Lens[i];
+    jobs[i].cmac = macs[i];
+  }
+  aesCMacBatch(jobs, JOBS);
+
+  for (int i = 0; i < JOBS; i++)
+  {
+    byte_ard expected[BLOCK_BYTE_SIZE];
+    aesCMac((const u_int32_ard*)Keys[i], Msgs[i], Lens[i], expected);
+    if (memcmp(expected, macs[i], BLOCK_BYTE_SIZE) != 0)
+    {
+      printf("Failed: aesCMacBatch differs from aesCMac (length %d)\n", Lens[i]);
+      return 1;
+    }
+  }
+
+  // Now verify, with every third MAC broken.
+  for (int i = 0; i < JOBS; i += 3)
+    macs[i][i % BLOCK_BYTE_SIZE] ^= 0x01;
+
+  u_int32_ard validCount = verifyAesCMacBatch(jobs, JOBS);
+  for (int i = 0; i < JOBS; i++)
+  {
+    int expected = (i % 3 == 0) ? CMAC_INVALID : CMAC_VALID;
+    if (jobs[i].valid != expected)
+    {
+      printf("Failed: verifyAesCMacBatch got message %d wrong\n", i);
+      return 1;
+    }
+  }
+  if (validCount != JOBS - (JOBS+2)/3)
+  {
+    printf("Failed: valid count %d\n", validCount);
+    return 1;
+  }
+
+  printf("Checks out!\n");
+  return 0;
+}
+
+int cbctest()
+{
+  byte_ard IV[BLOCK_BYTE_SIZE];
+  byte_ard cipher[JOBS][MAX_MSG+BLOCK_BYTE_SIZE];
+  byte_ard plain[JOBS][MAX_MSG+BLOCK_BYTE_SIZE];
+  byte_ard expected[JOBS][MAX_MSG+BLOCK_BYTE_SIZE];
+  struct cbc_job jobs[JOBS];
+
+  printf("cbc: ");
+  randomBytes(IV, BLOCK_BYTE_SIZE);
+  for (int i = 0; i < JOBS; i++)
+  {
+    u_int32_ard length = ((Lens[i] / BLOCK_BYTE_SIZE) + 1) * BLOCK_BYTE_SIZE;
+    CBCEncrypt(Msgs[i], cipher[i], Lens[i], AUTOPAD,
+               (const u_int32_ard*)Keys[i], (const u_int16_ard*)IV);
+    CBCDecrypt(cipher[i], expected[i], length,
+               (const u_int32_ard*)Keys[i], (const u_int16_ard*)IV);
+
+    jobs[i].pKeys = (const u_int32_ard*)Keys[i];
+    jobs[i].pText = cipher[i];
+    jobs[i].pBuffer = plain[i];
+    jobs[i].length = length;
+    jobs[i].pIV = IV;
+  }
+
+  CBCDecryptBatch(jobs, JOBS);
+
+  for (int i = 0; i < JOBS; i++)
+  {
+    if (memcmp(plain[i], expected[i], jobs[i].length) != 0 ||
+        memcmp(plain[i], Msgs[i], Lens[i]) != 0)
+    {
+      printf("Failed: CBCDecryptBatch differs from CBCDecrypt (length %d)\n", Lens[i]);
+      return 1;
+    }
+  }
+
+  printf("Checks out!\n");
+  return 0;
+}
+
+// Verifies TIMED_JOBS data message sized (48 byte) MACs one at a time and
+// in batches and prints the throughput of both.
+void timedtest()
+{
+  struct cmac_job jobs[TIMED_JOBS];
+  byte_ard macs[TIMED_JOBS][BLOCK_BYTE_SIZE];
+  timeval tstart, tstop;
+
+  for (int i = 0; i < TIMED_JOBS; i++)
+  {
+    jobs[i].KS = (const u_int32_ard*)Keys[i % JOBS];
+    jobs[i].M = Msgs[i % JOBS];
+    jobs[i].length = 48;
+    jobs[i].cmac = macs[i];
+    aesCMac(jobs[i].KS, Msgs[i % JOBS], 48, macs[i]);
+  }
+
+  gettimeofday(&tstart, NULL);
+  int valid = 0;
+  for (int r = 0; r < TIMED_REPS; r++)
+    for (int i = 0; i < TIMED_JOBS; i++)
+      valid += verifyAesCMac(jobs[i].KS, Msgs[i % JOBS], 48, macs[i]);
+  gettimeofday(&tstop, NULL);
+  double single = elapsed(&tstart, &tstop);
+
+  gettimeofday(&tstart, NULL);
+  for (int r = 0; r < TIMED_REPS; r++)
+    valid += verifyAesCMacBatch(jobs, TIMED_JOBS);
+  gettimeofday(&tstop, NULL);
+  double batch = elapsed(&tstart, &tstop);
+
+  double msgs = (double)TIMED_REPS * TIMED_JOBS;
+  printf("\nVerifying %d x %d 48 byte messages (%d valid):\n",
+         TIMED_REPS, TIMED_JOBS, valid);
+  printf("  verifyAesCMac:      %.3f s, %.0f msg/s\n", single, msgs/single);
+  printf("  verifyAesCMacBatch: %.3f s, %.0f msg/s\n", batch, msgs/batch);
+}
+
+int main(int argc, char* argv[])
+{
+  srand(time(NULL));
+
+  for (int i = 0; i < JOBS; i++)
+  {
+    byte_ard key[KEY_BYTES];
+    randomBytes(key, KEY_BYTES);
+    KeyExpansion(key, Keys[i]);
+    randomBytes(Msgs[i], MAX_MSG);
+    // Cover the empty message, exact blocks and partial blocks.
+    Lens[i] = (i < 4) ? i*BLOCK_BYTE_SIZE : rand() % MAX_MSG;
+  }
+
+  printf("AES batch tests\n\n");
+
+  int failed = blocktest() + cmactest() + cbctest();
+
+  if (failed == 0)
+  {
+    printf("\nAll OK!\n");
+  }
+  else
+  {
+    printf("\nSome test(s) failed!\n");
+    return 1;
+  }
+
+  if (argc > 1 && strcmp(argv[1], "-t") == 0)
+    timedtest();
+
+  return 0;
+}
@@ -0,0 +1,105 @@
+/**
+ * Checks the precomputed key schedules and CMAC subkeys of the derivation
+ * constants against KeyExpansion() and RFC 4493, and the derivations made
+ * with them against plain aesCMac(). Prints the table that belongs in
+ * aes_constants.cpp for a constant that does not match.
+ */
+
+#include "aes_constants.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void printBytes(const byte_ard* p, int length)
+{
+  for (int i = 0; i < length; i++)
+    printf("%s0x%02x%s", i % 8 == 0 ? "    " : "", p[i],
+           i == length - 1 ? "" : (i % 8 == 7 ? ",\n" : ", "));
+}
+
+int checkKey(const char* name, byte_ard* constant, const struct cmac_key* key)
+{
+  struct cmac_key expected;
+  byte_ard L[BLOCK_BYTE_SIZE];
+
+  KeyExpansion(constant, expected.KS);
+  memset(L, 0, BLOCK_BYTE_SIZE);
+  EncryptBlock(L, (const u_int32_ard*)expected.KS);
+  expandMacKey(L, expected.K1);
+  expandMacKey(expected.K1, expected.K2);
+
+  if (memcmp(&expected, key, sizeof(expected)) == 0)
+    return 0;
+
+  printf("Failed: %s does not match, it should be\n\n", name);
+  printf("CONST_KEY(%s) = {\n  {\n", name);
+  printBytes(expected.KS, sizeof(expected.KS));
+  printf(" },\n  {\n");
+  printBytes(expected.K1, BLOCK_BYTE_SIZE);
+  printf(" },\n  {\n");
+  printBytes(expected.K2, BLOCK_BYTE_SIZE);
+  printf(" }\n};\n\n");
+  return 1;
+}
+
+// deriveKey() and aesCMacKey() against aesCMac() with the schedule expanded
+// on the spot, for messages of every length up to four blocks.
+int checkDerive(byte_ard* constant, const struct cmac_key* key)
+{
+  byte_ard sched[BLOCK_BYTE_SIZE*(ROUNDS+1)];
+  byte_ard M[4*BLOCK_BYTE_SIZE];
+  byte_ard expected[BLOCK_BYTE_SIZE], derived[BLOCK_BYTE_SIZE];
+
+  KeyExpansion(constant, sched);
+  for (int length = 0; length <= 4*BLOCK_BYTE_SIZE; length++)
+  {
+    for (int i = 0; i < length; i++)
+      M[i] = rand();
+    aesCMac((const u_int32_ard*)sched, M, length, expected);
+    aesCMacKey(key, M, length, derived);
+    if (memcmp(expected, derived, BLOCK_BYTE_SIZE) != 0)
+    {
+      printf("Failed: aesCMacKey() of %d bytes\n", length);
+      return 1;
+    }
+    if (length == KEY_BYTES)
+    {
+      deriveKey(key, M, derived);
+      if (memcmp(expected, derived, BLOCK_BYTE_SIZE) != 0)
+      {
+        printf("Failed: deriveKey()\n");
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char* argv[])
+{
+  int failed = 0;
+
+  printf("Derivation constant tests\n\n");
+
+  srand(1);
+  failed += checkKey("cAlphaKey", cAlpha, &cAlphaKey);
+  failed += checkKey("cBetaKey", cBeta, &cBetaKey);
+  failed += checkKey("cGammaKey", cGamma, &cGammaKey);
+  failed += checkKey("cEpsilonKey", cEpsilon, &cEpsilonKey);
+
+  failed += checkDerive(cAlpha, &cAlphaKey);
+  failed += checkDerive(cBeta, &cBetaKey);
+  failed += checkDerive(cGamma, &cGammaKey);
+  failed += checkDerive(cEpsilon, &cEpsilonKey);
+
+  if (failed == 0)
+  {
+    printf("All OK!\n");
+  }
+  else
+  {
+    printf("\nSome test(s) failed!\n");
+  }
+
+  return failed;
+}
@@ -0,0 +1,190 @@
+/**
+ * Tests AES-GCM against test cases 1-4 (AES-128) of McGrew and Viega, "The
+ * Galois/Counter Mode of Operation (GCM)", and CTRCrypt() against
+ * AES-GCM encryption of a long message.
+ */
+
+#include "aes_gcm.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+struct gcm_vector
+{
+  const char* key;
+  const char* iv;
+  const char* plain;
+  const char* aad;
+  const char* cipher;
+  const char* tag;
+};
+
+const struct gcm_vector vectors[] = {
+  { "00000000000000000000000000000000",
+    "000000000000000000000000",
+    "",
+    "",
+    "",
+    "58e2fccefa7e3061367f1d57a4e7455a" },
+  { "00000000000000000000000000000000",
+    "000000000000000000000000",
+    "00000000000000000000000000000000",
+    "",
+    "0388dace60b6a392f328c2b971b2fe78",
+    "ab6e47d42cec13bdf53a67b21257bddf" },
+  { "feffe9928665731c6d6a8f9467308308",
+    "cafebabefacedbaddecaf888",
+    "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72"
+    "1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b391aafd255",
+    "",
+    "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e"
+    "21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091473f5985",
+    "4d5c2af327cd64a62cf35abd2ba6fab4" },
+  { "feffe9928665731c6d6a8f9467308308",
+    "cafebabefacedbaddecaf888",
+    "d9313225f88406e5a55909c5aff5269a86a7a9531534f7da2e4c303d8a318a72"
+    "1c3c0c95956809532fcf0e2449a6b525b16aedf5aa0de657ba637b39",
+    "feedfacedeadbeeffeedfacedeadbeefabaddad2",
+    "42831ec2217774244b7221b784d0d49ce3aa212f2c02a4e035c17e2329aca12e"
+    "21d514b25466931c7d8f6a5aac84aa051ba30b396a0aac973d58e091",
+    "5bc94fbc3221a5db94fae95ae7121a47" }
+};
+
+// Decodes a hex string into p and returns the number of bytes.
+int fromHex(const char* hex, byte_ard* p)
+{
+  int len = strlen(hex)/2;
+  for (int i = 0; i < len; i++)
+  {
+    unsigned int b;
+    sscanf(hex + 2*i, "%2x", &b);
+    p[i] = (byte_ard)b;
+  }
+  return len;
+}
+
+int vectortest(int n)
+{
+  byte_ard key[KEY_BYTES], keys[KEY_BYTES*11];
+  byte_ard iv[GCM_NONCE_SIZE];
+  byte_ard plain[64], aad[32], cipher[64], tag[GCM_TAG_SIZE];
+  byte_ard buffer[64], out[GCM_TAG_SIZE];
+
+  const struct gcm_vector* v = &vectors[n];
+  fromHex(v->key, key);
+  fromHex(v->iv, iv);
+  int plainLen = fromHex(v->plain, plain);
+  int aadLen = fromHex(v->aad, aad);
+  fromHex(v->cipher, cipher);
+  fromHex(v->tag, tag);
+
+  KeyExpansion(key, keys);
+
+  printf("Test case %d: ", n+1);
+
+  aesGcmEncrypt((const u_int32_ard*)keys, iv, aad, aadLen, plain, buffer,
+                plainLen, out);
+  if (memcmp(buffer, cipher, plainLen) != 0)
+  {
+    printf("Failed: ciphertext\n");
+    return 1;
+  }
+  if (memcmp(out, tag, GCM_TAG_SIZE) != 0)
+  {
+    printf("Failed: tag\n");
+    return 1;
+  }
+
+  // Decrypt in place
+  if (aesGcmDecrypt((const u_int32_ard*)keys, iv, aad, aadLen, buffer, buffer,
+                    plainLen, tag) != GCM_TAG_VALID ||
+      memcmp(buffer, plain, plainLen) != 0)
+  {
+    printf("Failed: decryption\n");
+    return 1;
+  }
+
+  // A flipped tag bit must be caught and nothing decrypted.
+  tag[n] ^= 0x01;
+  memcpy(buffer, cipher, plainLen);
+  if (aesGcmDecrypt((const u_int32_ard*)keys, iv, aad, aadLen, buffer, buffer,
+                    plainLen, tag) != GCM_TAG_INVALID ||
+      memcmp(buffer, cipher, plainLen) != 0)
+  {
+    printf("Failed: accepted a bad tag\n");
+    return 1;
+  }
+
+  printf("Checks out!\n");
+  return 0;
+}
+
+// A long message goes through the batched CTR path, it must agree with
+// counting block by block.
+int ctrtest()
+{
+  byte_ard key[KEY_BYTES], keys[KEY_BYTES*11];
+  byte_ard counter[BLOCK_BYTE_SIZE], block[BLOCK_BYTE_SIZE];
+  const int len = 21*BLOCK_BYTE_SIZE + 5;
+  byte_ard plain[len], cipher[len];
+
+  printf("CTR: ");
+  for (int i = 0; i < KEY_BYTES; i++)
+    key[i] = rand() & 0xFF;
+  for (int i = 0; i < len; i++)
+    plain[i] = rand() & 0xFF;
+  KeyExpansion(key, keys);
+
+  // Start close to the wrap of the low counter byte.
+  memset(counter, 0, BLOCK_BYTE_SIZE);
+  counter[15] = 0xFA;
+  CTRCrypt(plain, cipher, len, (const u_int32_ard*)keys, counter);
+
+  for (int i = 0; i < len; i++)
+  {
+    if (i % BLOCK_BYTE_SIZE == 0)
+    {
+      memset(block, 0, BLOCK_BYTE_SIZE);
+      int c = 0xFA + i/BLOCK_BYTE_SIZE;
+      block[14] = c >> 8;
+      block[15] = c & 0xFF;
+      EncryptBlock(block, (const u_int32_ard*)keys);
+    }
+    if ((plain[i] ^ block[i % BLOCK_BYTE_SIZE]) != cipher[i])
+    {
+      printf("Failed: byte %d\n", i);
+      return 1;
+    }
+  }
+
+  if (counter[14] != 0x01 || counter[15] != 0x10)
+  {
+    printf("Failed: counter not advanced\n");
+    return 1;
+  }
+
+  printf("Checks out!\n");
+  return 0;
+}
+
+int main(int argc, char* argv[])
+{
+  int failed = 0;
+
+  printf("AES-GCM tests\n\n");
+
+  for (unsigned int i = 0; i < sizeof(vectors)/sizeof(vectors[0]); i++)
+    failed += vectortest(i);
+  failed += ctrtest();
+
+  if (failed == 0)
+  {
+    printf("\nAll OK!\n");
+  }
+  else
+  {
+    printf("\nSome test(s) failed!\n");
+  }
+
+  return failed;
+}
@@ -4,6 +4,8 @@ rm aes_cmac.cpp
 rm aes_cmac.h
 rm aes_crypt.cpp
 rm aes_crypt.h
+rm aes_gcm.cpp
+rm aes_gcm.h
 rm protocol.cpp
 rm protocol.h
 rm tstypes.h
@@ -4,6 +4,8 @@ ln -s ../../lib/aes_cmac.cpp .
 ln -s ../../lib/aes_cmac.h .
 ln -s ../../lib/aes_crypt.cpp .
 ln -s ../../lib/aes_crypt.h .
+ln -s ../../lib/aes_gcm.cpp .
+ln -s ../../lib/aes_gcm.h .
 ln -s ../../lib/protocol.cpp .
 ln -s ../../lib/protocol.h .
 ln -s ../../lib/tstypes.h .
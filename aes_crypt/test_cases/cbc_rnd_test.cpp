@@ -2,6 +2,7 @@
 // CBC Mac test cases
 
 #include "aes_crypt.h"
+#include "aes_cmac.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -35,6 +36,13 @@ int len(byte_ard* str)
   
 }
 
+// A piece of at most left bytes, now and then an empty one.
+u_int32_ard randomPiece(u_int32_ard left)
+{
+  u_int32_ard piece = rand() % 40;
+  return piece < left ? piece : left;
+}
+
 bool runTest(byte_ard *text, int length, const u_int32_ard *Keys, const u_int16_ard *IV, bool verbose=false, bool printableStr=false)
 {
   u_int32_ard padding = 0;
@@ -86,6 +94,81 @@ bool runTest(byte_ard *text, int length, const u_int32_ard *Keys, const u_int16_
       break;
     }
   }
+
+  // Encrypting in place must give the same ciphertext, and encrypt-then-MAC
+  // the same ciphertext and the MAC over it.
+  byte_ard inplace_buffer[needed_length+1];
+  memset(inplace_buffer,0,needed_length+1);
+  memcpy(inplace_buffer,text,length);
+  if ( CBCEncryptInPlace((void *) inplace_buffer, length, AUTOPAD, Keys, IV) != needed_length ||
+       memcmp(inplace_buffer,buffer,needed_length) != 0 )
+  {
+    printf("In place encryption differs\n");
+    retval=false;
+  }
+
+  byte_ard mac[BLOCK_BYTE_SIZE];
+  byte_ard etm_mac[BLOCK_BYTE_SIZE];
+  aesCMac(Keys, buffer, needed_length, mac);
+  memset(inplace_buffer,0,needed_length+1);
+  memcpy(inplace_buffer,text,length);
+  if ( encryptThenMac(Keys, Keys, IV, inplace_buffer, length, AUTOPAD, etm_mac) != needed_length ||
+       memcmp(inplace_buffer,buffer,needed_length) != 0 || memcmp(etm_mac,mac,BLOCK_BYTE_SIZE) != 0 )
+  {
+    printf("Encrypt-then-MAC differs\n");
+    retval=false;
+  }
+
+  // Streaming in random pieces must give the same ciphertext, plaintext and
+  // MAC. The encryption is done in place, each piece written where the text
+  // it ends came from.
+  struct cbc_ctx cbc;
+  struct cmac_ctx cmac;
+  u_int32_ard done, out;
+  memset(inplace_buffer,0,needed_length+1);
+  memcpy(inplace_buffer,text,length);
+  CBCEncryptInit(&cbc, Keys, IV);
+  for ( done = 0, out = 0; done < (u_int32_ard)length; )
+  {
+    u_int32_ard piece = randomPiece(length - done);
+    out += CBCEncryptUpdate(&cbc, inplace_buffer + done, piece, inplace_buffer + out);
+    done += piece;
+  }
+  out += CBCEncryptFinal(&cbc, AUTOPAD, inplace_buffer + out);
+  if ( out != needed_length || memcmp(inplace_buffer,buffer,needed_length) != 0 )
+  {
+    printf("Streaming encryption differs\n");
+    retval=false;
+  }
+
+  memset(decipher_buffer,0,needed_length+1);
+  CBCDecryptInit(&cbc, Keys, IV);
+  for ( done = 0, out = 0; done < needed_length; )
+  {
+    u_int32_ard piece = randomPiece(needed_length - done);
+    out += CBCDecryptUpdate(&cbc, buffer + done, piece, decipher_buffer + out);
+    done += piece;
+  }
+  if ( out != needed_length || memcmp(decipher_buffer,text,length) != 0 )
+  {
+    printf("Streaming decryption differs\n");
+    retval=false;
+  }
+
+  aesCMacInit(&cmac, Keys);
+  for ( done = 0; done < needed_length; )
+  {
+    u_int32_ard piece = randomPiece(needed_length - done);
+    aesCMacUpdate(&cmac, buffer + done, piece);
+    done += piece;
+  }
+  aesCMacFinal(&cmac, etm_mac);
+  if ( memcmp(etm_mac,mac,BLOCK_BYTE_SIZE) != 0 )
+  {
+    printf("Streaming CMAC differs\n");
+    retval=false;
+  }
+
   if ( retval )
     printf("Checks out\n");
   else
@@ -0,0 +1,763 @@
+/*
+ * File name: crypto_bench.cpp
+ * Date:      2026-10-19 15:40
+ * Author:
+ *
+ * Micro-benchmarks for the AES primitives and every pack_/unpack_ function
+ * in protocol.cpp, each timed on its own.
+ *
+ * Every benchmark is warmed up while the number of iterations per trial is
+ * calibrated, then run for a number of trials. For each benchmark the mean,
+ * standard deviation and minimum of ns/op over the trials are reported, as
+ * well as cycles/byte. Cycles are read from the time stamp counter on x86
+ * (which ticks at the nominal clock rate); elsewhere they are nanoseconds.
+ * The process is pinned to one core so the counter and caches stay put.
+ *
+ * With -j the results are written as JSON. With -b the run is compared to
+ * such a file from an earlier run: a benchmark whose best trial got slower
+ * than the baseline's best by more than the tolerance is a regression, and
+ * the program then exits with 1. Only the files written by this program are
+ * understood, one result per line.
+ *
+ * Usage: crypto_bench [-c cpu] [-n trials] [-t msec] [-f filter]
+ *                     [-j out.json] [-b baseline.json] [-r percent]
+ */
+
+#ifndef _GNU_SOURCE
+  #define _GNU_SOURCE  // sched_setaffinity()
+#endif
+
+#include "protocol.h"
+#include "aes_batch.h"  // BATCH_LANES
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+  #include <sched.h>
+#endif
+#if defined(__i386__) || defined(__x86_64__)
+  #include <x86intrin.h>
+#endif
+
+#define MAX_SIZE 4096
+#define MAX_TRIALS 100
+#define MAX_RESULTS 128
+
+// Message sizes swept by the CBC and CMAC benchmarks
+const u_int32_ard cryptSizes[] = { 16, 64, 256, 1024, MAX_SIZE, 0 };
+// CMAC lengths, with partial last blocks to time the padded path
+const u_int32_ard cmacSizes[] = { 16, 40, 64, 100, 256, 1024, MAX_SIZE, 0 };
+// Data lengths swept by the data message benchmarks
+const u_int32_ard dataSizes[] = { 1, 16, 64, 128, 200, 0 };
+// For benchmarks without a size parameter
+const u_int32_ard noSizes[] = { 1, 0 };
+
+byte_ard Key[KEY_BYTES] = {
+  0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6,
+  0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c
+};
+byte_ard IVBytes[BLOCK_BYTE_SIZE] = {
+  0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30,
+  0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30
+};
+byte_ard Keys[KEY_BYTES*11];
+byte_ard CmacKeys[KEY_BYTES*11];
+byte_ard ID[ID_SIZE] = { 't', 's', 'e', 'n', 's', 'e' };
+
+/**
+ * State shared by the setup and run functions of a benchmark. The setup
+ * function fills in bytes, the number of bytes one operation handles.
+ */
+struct bench_ctx
+{
+  u_int32_ard size;
+  u_int32_ard bytes;
+  byte_ard in[MAX_SIZE + 2*BLOCK_BYTE_SIZE];
+  byte_ard out[MAX_SIZE + 2*BLOCK_BYTE_SIZE];
+  byte_ard streams[BATCH_LANES][MAX_SIZE];
+  struct message msg;
+  struct data dat;
+  struct data dats[BATCH_LANES];
+  byte_ard pID[ID_SIZE];
+  byte_ard key[KEY_BYTES];
+  byte_ard ciphertext[BLOCK_BYTE_SIZE*4];
+  byte_ard nonce[GCM_NONCE_SIZE];
+};
+
+struct bench
+{
+  const char* name;
+  void (*setup)(struct bench_ctx* c);
+  void (*run)(struct bench_ctx* c);
+  const u_int32_ard* sizes;
+};
+
+struct result
+{
+  char name[64];
+  u_int32_ard bytes;
+  long iterations;
+  double nsMean;
+  double nsStddev;
+  double nsMin;
+  double cpbMean;
+  double cpbStddev;
+};
+
+// Keeps the compiler from dropping work whose result is never read.
+volatile byte_ard sink;
+
+u_int64_ard readCycles()
+{
+#if defined(__i386__) || defined(__x86_64__)
+  return __rdtsc();
+#else
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+double readNs()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+void fillRandom(byte_ard* p, u_int32_ard len)
+{
+  for (u_int32_ard i = 0; i < len; i++)
+    p[i] = rand() & 0xFF;
+}
+
+/**
+ * Message setup
+ */
+
+void setupMessage(struct bench_ctx* c)
+{
+  c->msg.msgtype = 0;
+  c->msg.pID = ID;
+  c->msg.nonce = 0x1234;
+  c->msg.key = Key;
+  c->msg.renewal_timer = 600;
+  fillRandom(c->msg.rand, KEY_BYTES);
+}
+
+// Points the struct at buffers for the unpack functions to write into.
+void setupRecvMessage(struct bench_ctx* c)
+{
+  c->msg.pID = c->pID;
+  c->msg.key = c->key;
+  c->msg.ciphertext = c->ciphertext;
+}
+
+void setupData(struct bench_ctx* c, struct data* d)
+{
+  memcpy(d->id, ID, ID_SIZE);
+  d->msgtime = 1287500000;
+  d->data_len = c->size;
+  d->data = c->in;
+}
+
+// Size of a packed data message, see pack_data()
+u_int32_ard dataFullSize(u_int32_ard datalen)
+{
+  u_int32_ard plain = ID_SIZE + MSGTIME_SIZE + 1 + datalen;
+  u_int32_ard cipher = (plain/BLOCK_BYTE_SIZE + (plain % BLOCK_BYTE_SIZE != 0))*BLOCK_BYTE_SIZE;
+  return MSGTYPE_SIZE + 1 + ID_SIZE + cipher + BLOCK_BYTE_SIZE;
+}
+
+/**
+ * AES primitives
+ */
+
+void setupKey(struct bench_ctx* c)
+{
+  c->bytes = KEY_BYTES;
+}
+
+void runKeyExpansion(struct bench_ctx* c)
+{
+  KeyExpansion(Key, c->out);
+}
+
+void setupBlock(struct bench_ctx* c)
+{
+  c->bytes = BLOCK_BYTE_SIZE;
+  fillRandom(c->in, BLOCK_BYTE_SIZE);
+}
+
+void runEncryptBlock(struct bench_ctx* c)
+{
+  EncryptBlock(c->in, (const u_int32_ard*)Keys);
+}
+
+void runDecryptBlock(struct bench_ctx* c)
+{
+  DecryptBlock(c->in, (const u_int32_ard*)Keys);
+}
+
+void setupCrypt(struct bench_ctx* c)
+{
+  c->bytes = c->size;
+  fillRandom(c->in, c->size);
+}
+
+void runCBCEncrypt(struct bench_ctx* c)
+{
+  CBCEncrypt(c->in, c->out, c->size, AUTOPAD, (const u_int32_ard*)Keys,
+             (const u_int16_ard*)IVBytes);
+}
+
+void runCBCDecrypt(struct bench_ctx* c)
+{
+  CBCDecrypt(c->in, c->out, c->size, (const u_int32_ard*)Keys,
+             (const u_int16_ard*)IVBytes);
+}
+
+void runCMac(struct bench_ctx* c)
+{
+  aesCMac((const u_int32_ard*)CmacKeys, c->in, c->size, c->out);
+}
+
+/**
+ * Key exchange and re-keying messages. The unpack setups pack a message
+ * first to have something valid to unpack.
+ */
+
+void setupPackIdResponse(struct bench_ctx* c)
+{
+  c->bytes = IDMSG_FULLSIZE;
+  setupMessage(c);
+}
+
+void runPackIdResponse(struct bench_ctx* c)
+{
+  pack_idresponse(&c->msg, (const u_int32_ard*)Keys, (const u_int32_ard*)CmacKeys, c->out);
+}
+
+void setupUnpackIdResponse(struct bench_ctx* c)
+{
+  setupPackIdResponse(c);
+  pack_idresponse(&c->msg, (const u_int32_ard*)Keys, (const u_int32_ard*)CmacKeys, c->in);
+  setupRecvMessage(c);
+}
+
+void runUnpackIdResponse(struct bench_ctx* c)
+{
+  unpack_idresponse(c->in, (const u_int32_ard*)Keys, &c->msg);
+}
+
+void setupPackKeyToSink(struct bench_ctx* c)
+{
+  c->bytes = KEYTOSINK_FULLSIZE;
+  setupMessage(c);
+}
+
+void runPackKeyToSink(struct bench_ctx* c)
+{
+  pack_keytosink(&c->msg, (const u_int32_ard*)Keys, (const u_int32_ard*)CmacKeys, c->out);
+}
+
+void setupUnpackKeyToSink(struct bench_ctx* c)
+{
+  setupPackKeyToSink(c);
+  pack_keytosink(&c->msg, (const u_int32_ard*)Keys, (const u_int32_ard*)CmacKeys, c->in);
+  setupRecvMessage(c);
+}
+
+void runUnpackKeyToSink(struct bench_ctx* c)
+{
+  unpack_keytosink(c->in, &c->msg);
+}
+
+// pack_keytosens() forwards what unpack_keytosink() read.
+void setupPackKeyToSens(struct bench_ctx* c)
+{
+  setupUnpackKeyToSink(c);
+  unpack_keytosink(c->in, &c->msg);
+  c->bytes = KEYTOSENS_FULLSIZE;
+}
+
+void runPackKeyToSens(struct bench_ctx* c)
+{
+  pack_keytosens(&c->msg, c->out);
+}
+
+void setupUnpackKeyToSens(struct bench_ctx* c)
+{
+  setupPackKeyToSens(c);
+  pack_keytosens(&c->msg, c->in);
+  setupRecvMessage(c);
+}
+
+void runUnpackKeyToSens(struct bench_ctx* c)
+{
+  unpack_keytosens(c->in, (const u_int32_ard*)Keys, &c->msg);
+}
+
+void setupPackRekey(struct bench_ctx* c)
+{
+  c->bytes = REKEY_FULLSIZE;
+  setupMessage(c);
+}
+
+void runPackRekey(struct bench_ctx* c)
+{
+  pack_rekey(&c->msg, (const u_int32_ard*)Keys, (const u_int32_ard*)CmacKeys, c->out);
+}
+
+void setupUnpackRekey(struct bench_ctx* c)
+{
+  setupPackRekey(c);
+  pack_rekey(&c->msg, (const u_int32_ard*)Keys, (const u_int32_ard*)CmacKeys, c->in);
+  setupRecvMessage(c);
+}
+
+void runUnpackRekey(struct bench_ctx* c)
+{
+  unpack_rekey(c->in, (const u_int32_ard*)Keys, &c->msg);
+}
+
+void setupPackNewkey(struct bench_ctx* c)
+{
+  c->bytes = NEWKEY_FULLSIZE;
+  setupMessage(c);
+}
+
+void runPackNewkey(struct bench_ctx* c)
+{
+  pack_newkey(&c->msg, (const u_int32_ard*)Keys, (const u_int32_ard*)CmacKeys, c->out);
+}
+
+void setupUnpackNewkey(struct bench_ctx* c)
+{
+  setupPackNewkey(c);
+  pack_newkey(&c->msg, (const u_int32_ard*)Keys, (const u_int32_ard*)CmacKeys, c->in);
+  setupRecvMessage(c);
+}
+
+void runUnpackNewkey(struct bench_ctx* c)
+{
+  unpack_newkey(c->in, (const u_int32_ard*)Keys, &c->msg);
+}
+
+/**
+ * Data messages. The unpack functions malloc() the ciphertext and data,
+ * freeing them is part of the measured cost as it is on the sink.
+ */
+
+void setupPackData(struct bench_ctx* c)
+{
+  c->bytes = dataFullSize(c->size);
+  fillRandom(c->in, c->size);
+  setupData(c, &c->dat);
+}
+
+void runPackData(struct bench_ctx* c)
+{
+  pack_data(&c->dat, (const u_int32_ard*)Keys, (const u_int32_ard*)CmacKeys, c->out);
+}
+
+void setupUnpackData(struct bench_ctx* c)
+{
+  setupPackData(c);
+  pack_data(&c->dat, (const u_int32_ard*)Keys, (const u_int32_ard*)CmacKeys, c->streams[0]);
+}
+
+void runUnpackData(struct bench_ctx* c)
+{
+  unpack_data(c->streams[0], (const u_int32_ard*)Keys, &c->dat);
+  free(c->dat.ciphertext);
+  free(c->dat.data);
+}
+
+void runUnpackDataGetId(struct bench_ctx* c)
+{
+  unpack_data_getid(c->streams[0], c->pID);
+}
+
+// BATCH_LANES messages per operation.
+void setupUnpackDataBatch(struct bench_ctx* c)
+{
+  setupPackData(c);
+  c->bytes *= BATCH_LANES;
+  for (int i = 0; i < BATCH_LANES; i++)
+    pack_data(&c->dat, (const u_int32_ard*)Keys, (const u_int32_ard*)CmacKeys, c->streams[i]);
+}
+
+void runUnpackDataBatch(struct bench_ctx* c)
+{
+  void* pStreams[BATCH_LANES];
+  const u_int32_ard* pKeys[BATCH_LANES];
+  const u_int32_ard* pCmacKeys[BATCH_LANES];
+  int32_ard valid[BATCH_LANES];
+
+  for (int i = 0; i < BATCH_LANES; i++)
+  {
+    pStreams[i] = c->streams[i];
+    pKeys[i] = (const u_int32_ard*)Keys;
+    pCmacKeys[i] = (const u_int32_ard*)CmacKeys;
+  }
+  unpack_data_batch(pStreams, pKeys, pCmacKeys, c->dats, valid, BATCH_LANES);
+  for (int i = 0; i < BATCH_LANES; i++)
+  {
+    free(c->dats[i].ciphertext);
+    if (valid[i] == CMAC_VALID)
+      free(c->dats[i].data);
+  }
+}
+
+void setupPackDataGcm(struct bench_ctx* c)
+{
+  c->bytes = DATA_GCM_FULLSIZE(c->size);
+  fillRandom(c->in, c->size);
+  fillRandom(c->nonce, GCM_NONCE_SIZE);
+  setupData(c, &c->dat);
+}
+
+void runPackDataGcm(struct bench_ctx* c)
+{
+  pack_data_gcm(&c->dat, (const u_int32_ard*)Keys, c->nonce, c->out);
+}
+
+void setupUnpackDataGcm(struct bench_ctx* c)
+{
+  setupPackDataGcm(c);
+  pack_data_gcm(&c->dat, (const u_int32_ard*)Keys, c->nonce, c->streams[0]);
+}
+
+void runUnpackDataGcm(struct bench_ctx* c)
+{
+  if (unpack_data_gcm(c->streams[0], (const u_int32_ard*)Keys, &c->dat) == GCM_TAG_VALID)
+    free(c->dat.data);
+}
+
+/**
+ * Gateway sessions
+ */
+
+void setupGwframe(struct bench_ctx* c)
+{
+  c->bytes = GWFRAME_HEADER_SIZE;
+  pack_gwframe_header(ID, 100, c->in);
+}
+
+void runPackGwframeHeader(struct bench_ctx* c)
+{
+  pack_gwframe_header(ID, 100, c->out);
+}
+
+void runUnpackGwframeHeader(struct bench_ctx* c)
+{
+  sink = unpack_gwframe_header(c->in, c->pID);
+}
+
+const struct bench benches[] = {
+  { "KeyExpansion",          setupKey,              runKeyExpansion,        noSizes },
+  { "EncryptBlock",          setupBlock,            runEncryptBlock,        noSizes },
+  { "DecryptBlock",          setupBlock,            runDecryptBlock,        noSizes },
+  { "CBCEncrypt",            setupCrypt,            runCBCEncrypt,          cryptSizes },
+  { "CBCDecrypt",            setupCrypt,            runCBCDecrypt,          cryptSizes },
+  { "aesCMac",               setupCrypt,            runCMac,                cmacSizes },
+  { "pack_idresponse",       setupPackIdResponse,   runPackIdResponse,      noSizes },
+  { "unpack_idresponse",     setupUnpackIdResponse, runUnpackIdResponse,    noSizes },
+  { "pack_keytosink",        setupPackKeyToSink,    runPackKeyToSink,       noSizes },
+  { "unpack_keytosink",      setupUnpackKeyToSink,  runUnpackKeyToSink,     noSizes },
+  { "pack_keytosens",        setupPackKeyToSens,    runPackKeyToSens,       noSizes },
+  { "unpack_keytosens",      setupUnpackKeyToSens,  runUnpackKeyToSens,     noSizes },
+  { "pack_rekey",            setupPackRekey,        runPackRekey,           noSizes },
+  { "unpack_rekey",          setupUnpackRekey,      runUnpackRekey,         noSizes },
+  { "pack_newkey",           setupPackNewkey,       runPackNewkey,          noSizes },
+  { "unpack_newkey",         setupUnpackNewkey,     runUnpackNewkey,        noSizes },
+  { "pack_data",             setupPackData,         runPackData,            dataSizes },
+  { "unpack_data",           setupUnpackData,       runUnpackData,          dataSizes },
+  { "unpack_data_getid",     setupUnpackData,       runUnpackDataGetId,     noSizes },
+  { "unpack_data_batch",     setupUnpackDataBatch,  runUnpackDataBatch,     dataSizes },
+  { "pack_data_gcm",         setupPackDataGcm,      runPackDataGcm,         dataSizes },
+  { "unpack_data_gcm",       setupUnpackDataGcm,    runUnpackDataGcm,       dataSizes },
+  { "pack_gwframe_header",   setupGwframe,          runPackGwframeHeader,   noSizes },
+  { "unpack_gwframe_header", setupGwframe,          runUnpackGwframeHeader, noSizes }
+};
+
+/**
+ * Measurement
+ */
+
+// Runs one trial of iterations operations, returns ns and cycles per op.
+void runTrial(const struct bench* b, struct bench_ctx* c, long iterations,
+              double* ns, double* cycles)
+{
+  double start = readNs();
+  u_int64_ard cstart = readCycles();
+  for (long i = 0; i < iterations; i++)
+    b->run(c);
+  u_int64_ard cstop = readCycles();
+  double stop = readNs();
+
+  *ns = (stop - start)/iterations;
+  *cycles = (double)(cstop - cstart)/iterations;
+}
+
+// Doubles the iterations until a trial takes trialNs. This warms up the
+// caches and branch predictors as well.
+long calibrate(const struct bench* b, struct bench_ctx* c, double trialNs)
+{
+  long iterations = 1;
+  double ns, cycles;
+
+  for (;;)
+  {
+    runTrial(b, c, iterations, &ns, &cycles);
+    if (ns*iterations >= trialNs || iterations >= (1L << 30))
+      return iterations;
+    iterations *= 2;
+  }
+}
+
+void measure(const struct bench* b, struct bench_ctx* c, int trials,
+             double trialNs, struct result* r)
+{
+  double ns[MAX_TRIALS], cpb[MAX_TRIALS];
+  double cycles;
+
+  r->iterations = calibrate(b, c, trialNs);
+  for (int t = 0; t < trials; t++)
+  {
+    runTrial(b, c, r->iterations, &ns[t], &cycles);
+    cpb[t] = cycles/r->bytes;
+  }
+
+  r->nsMean = r->cpbMean = r->nsMin = 0.0;
+  for (int t = 0; t < trials; t++)
+  {
+    r->nsMean += ns[t];
+    r->cpbMean += cpb[t];
+    if (t == 0 || ns[t] < r->nsMin)
+      r->nsMin = ns[t];
+  }
+  r->nsMean /= trials;
+  r->cpbMean /= trials;
+
+  r->nsStddev = r->cpbStddev = 0.0;
+  for (int t = 0; t < trials; t++)
+  {
+    r->nsStddev += (ns[t] - r->nsMean)*(ns[t] - r->nsMean);
+    r->cpbStddev += (cpb[t] - r->cpbMean)*(cpb[t] - r->cpbMean);
+  }
+  if (trials > 1)
+  {
+    r->nsStddev = sqrt(r->nsStddev/(trials - 1));
+    r->cpbStddev = sqrt(r->cpbStddev/(trials - 1));
+  }
+}
+
+void pinToCpu(int cpu)
+{
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  if (sched_setaffinity(0, sizeof(set), &set) != 0)
+    fprintf(stderr, "Could not pin to cpu %d, running unpinned\n", cpu);
+#else
+  fprintf(stderr, "Pinning is not supported here, running unpinned\n");
+#endif
+}
+
+/**
+ * JSON output and baseline comparison
+ */
+
+int writeJson(const char* path, struct result* results, int count, int cpu,
+              int trials)
+{
+  FILE* f = fopen(path, "w");
+  if (f == NULL)
+  {
+    perror(path);
+    return 1;
+  }
+
+  fprintf(f, "{\n  \"cpu\": %d,\n  \"trials\": %d,\n  \"results\": [\n", cpu, trials);
+  for (int i = 0; i < count; i++)
+  {
+    struct result* r = &results[i];
+    fprintf(f, "    {\"name\": \"%s\", \"bytes\": %u, \"iterations\": %ld, "
+            "\"ns_per_op\": %.3f, \"ns_per_op_stddev\": %.3f, \"ns_per_op_min\": %.3f, "
+            "\"cycles_per_byte\": %.3f, \"cycles_per_byte_stddev\": %.3f}%s\n",
+            r->name, r->bytes, r->iterations, r->nsMean, r->nsStddev, r->nsMin,
+            r->cpbMean, r->cpbStddev, (i < count - 1) ? "," : "");
+  }
+  fprintf(f, "  ]\n}\n");
+  fclose(f);
+  return 0;
+}
+
+// Reads the number following "key": on the line, returns 0 if not found.
+int jsonNumber(const char* line, const char* key, double* value)
+{
+  char pattern[64];
+  snprintf(pattern, sizeof(pattern), "\"%s\": ", key);
+  const char* p = strstr(line, pattern);
+  if (p == NULL)
+    return 0;
+  return sscanf(p + strlen(pattern), "%lf", value) == 1;
+}
+
+// Returns the number of regressions, or -1 if the baseline can't be read.
+int compareBaseline(const char* path, struct result* results, int count,
+                    double tolerance)
+{
+  FILE* f = fopen(path, "r");
+  if (f == NULL)
+  {
+    perror(path);
+    return -1;
+  }
+
+  int regressions = 0;
+  int compared = 0;
+  char line[512];
+
+  printf("\nCompared to %s (tolerance %.1f%%):\n", path, tolerance);
+  while (fgets(line, sizeof(line), f) != NULL)
+  {
+    char name[64];
+    double bytes, baseMin;
+    const char* p = strstr(line, "\"name\": \"");
+    if (p == NULL || sscanf(p + 9, "%63[^\"]", name) != 1 ||
+        !jsonNumber(line, "bytes", &bytes) ||
+        !jsonNumber(line, "ns_per_op_min", &baseMin))
+      continue;
+
+    for (int i = 0; i < count; i++)
+    {
+      struct result* r = &results[i];
+      if (strcmp(r->name, name) != 0 || r->bytes != (u_int32_ard)bytes)
+        continue;
+
+      double change = 100.0*(r->nsMin - baseMin)/baseMin;
+      int regressed = change > tolerance;
+      printf("  %-24s %6u bytes %10.1f -> %10.1f ns/op %+7.1f%%%s\n",
+             name, r->bytes, baseMin, r->nsMin, change,
+             regressed ? "  REGRESSION" : "");
+      regressions += regressed;
+      compared++;
+    }
+  }
+  fclose(f);
+
+  if (compared == 0)
+    printf("  Nothing in common with the baseline!\n");
+  return regressions;
+}
+
+void usage(const char* prog)
+{
+  fprintf(stderr, "Usage: %s [-c cpu] [-n trials] [-t msec] [-f filter]\n"
+          "          [-j out.json] [-b baseline.json] [-r percent]\n"
+          "  -c  core to pin to, -1 for none (default 0)\n"
+          "  -n  trials per benchmark (default 11)\n"
+          "  -t  length of a trial in ms (default 20)\n"
+          "  -f  only run benchmarks whose name contains filter\n"
+          "  -j  write the results as JSON\n"
+          "  -b  compare to a JSON baseline, exit with 1 on regression\n"
+          "  -r  allowed slowdown in percent (default 10)\n", prog);
+}
+
+int main(int argc, char* argv[])
+{
+  int cpu = 0;
+  int trials = 11;
+  double trialMs = 20.0;
+  double tolerance = 10.0;
+  const char* filter = NULL;
+  const char* jsonPath = NULL;
+  const char* baselinePath = NULL;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "c:n:t:f:j:b:r:h")) != -1)
+  {
+    switch (opt)
+    {
+      case 'c': cpu = atoi(optarg); break;
+      case 'n': trials = atoi(optarg); break;
+      case 't': trialMs = atof(optarg); break;
+      case 'f': filter = optarg; break;
+      case 'j': jsonPath = optarg; break;
+      case 'b': baselinePath = optarg; break;
+      case 'r': tolerance = atof(optarg); break;
+      default:
+        usage(argv[0]);
+        return 2;
+    }
+  }
+  if (trials < 1 || trials > MAX_TRIALS)
+  {
+    fprintf(stderr, "Trials must be between 1 and %d\n", MAX_TRIALS);
+    return 2;
+  }
+
+  if (cpu >= 0)
+    pinToCpu(cpu);
+
+  srand(1);
+  KeyExpansion(Key, Keys);
+  KeyExpansion(Key, CmacKeys);
+
+  struct bench_ctx* c = (struct bench_ctx*)malloc(sizeof(struct bench_ctx));
+  struct result* results = (struct result*)malloc(MAX_RESULTS*sizeof(struct result));
+  int count = 0;
+
+  printf("%-24s %6s %10s %10s %10s %10s %8s\n", "benchmark", "bytes", "ns/op",
+         "stddev", "min", "cyc/byte", "stddev");
+  for (unsigned int i = 0; i < sizeof(benches)/sizeof(benches[0]); i++)
+  {
+    const struct bench* b = &benches[i];
+    if (filter != NULL && strstr(b->name, filter) == NULL)
+      continue;
+
+    for (const u_int32_ard* size = b->sizes; *size != 0 && count < MAX_RESULTS; size++)
+    {
+      struct result* r = &results[count++];
+      c->size = *size;
+      b->setup(c);
+      strncpy(r->name, b->name, sizeof(r->name) - 1);
+      r->name[sizeof(r->name) - 1] = '\0';
+      r->bytes = c->bytes;
+      measure(b, c, trials, trialMs*1e6, r);
+
+      printf("%-24s %6u %10.1f %10.1f %10.1f %10.2f %8.2f\n", r->name, r->bytes,
+             r->nsMean, r->nsStddev, r->nsMin, r->cpbMean, r->cpbStddev);
+    }
+  }
+
+  int failed = 0;
+  if (jsonPath != NULL && writeJson(jsonPath, results, count, cpu, trials) != 0)
+    failed = 1;
+
+  if (baselinePath != NULL)
+  {
+    int regressions = compareBaseline(baselinePath, results, count, tolerance);
+    if (regressions != 0)
+    {
+      if (regressions > 0)
+        printf("\n%d regression(s)!\n", regressions);
+      failed = 1;
+    }
+    else
+    {
+      printf("\nNo regressions.\n");
+    }
+  }
+
+  free(results);
+  free(c);
+  return failed;
+}
@@ -0,0 +1,175 @@
+/**
+ * Tests the CTR_DRBG. Known answers for instantiate, generate and reseed
+ * (AES-128, no derivation function), requests longer than
+ * DRBG_MAX_REQUEST, and that threads and forked children do not share
+ * output.
+ */
+
+#include "aes_drbg.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+// From OpenSSL's CTR-DRBG (AES-128-CTR, no derivation function, empty
+// personalization string), entropy byte i being i*7 + 3.
+byte_ard firstOut[64] = {
+  0x80,0x03,0xc1,0x23,0x57,0x76,0xf8,0x2c,0x90,0x49,0x04,0x63,0x68,0xbf,0x7c,0xea,
+  0x67,0x93,0x9e,0x9a,0x89,0x4f,0xe4,0xce,0xef,0xa7,0x72,0xdd,0xbc,0x3c,0xfa,0x33,
+  0xdb,0x67,0xbc,0xe7,0xd2,0x82,0x01,0x38,0xf0,0x67,0x6b,0xb6,0x57,0xbd,0xd8,0xbc,
+  0x28,0xa2,0x22,0x15,0xa2,0x3b,0x34,0xee,0x11,0x5f,0x18,0x75,0x39,0x79,0xb4,0x03 };
+
+byte_ard secondOut[64] = {
+  0xb4,0x73,0x01,0x69,0x17,0x75,0xe9,0x5f,0xd5,0x84,0x99,0x9d,0xd0,0xb6,0xf1,0x45,
+  0x75,0x6d,0x78,0x70,0x7b,0x7d,0xff,0x58,0x63,0x6f,0x59,0x7c,0x1c,0xa8,0xdb,0x29,
+  0xda,0xec,0x5c,0xff,0xe9,0x04,0xa5,0x36,0x90,0x92,0x53,0xad,0x0e,0x0e,0xb2,0xc4,
+  0xd3,0x60,0xe7,0x48,0x1c,0x04,0x07,0xfa,0x33,0x17,0xc4,0x3a,0xe7,0x8e,0x61,0xe2 };
+
+byte_ard reseededOut[64] = {
+  0x33,0x89,0x3b,0x06,0x86,0x39,0xb6,0x55,0xb9,0xde,0x8f,0x69,0x89,0x4d,0x17,0xf4,
+  0xde,0x75,0xc1,0xfd,0x88,0xb2,0x65,0x69,0x3c,0x8b,0x0d,0x03,0x35,0xfa,0x2a,0xe9,
+  0xf6,0x86,0xf7,0x5d,0x73,0x3e,0xd1,0x12,0x9f,0x0b,0x50,0x11,0x1a,0xd2,0x3d,0xb7,
+  0x05,0x95,0x33,0x43,0x70,0x38,0x6c,0xf1,0x4f,0x49,0x7f,0x0b,0x4b,0x87,0x1e,0xa7 };
+
+int check(const char* name, const byte_ard* got, const byte_ard* expected, int length)
+{
+  if (memcmp(got, expected, length) != 0)
+  {
+    printf("Failed: %s\n", name);
+    return 1;
+  }
+  return 0;
+}
+
+int kattest()
+{
+  byte_ard entropy[2*DRBG_SEED_SIZE];
+  byte_ard out[64];
+  struct ctr_drbg d;
+  int failed = 0;
+
+  for (int i = 0; i < 2*DRBG_SEED_SIZE; i++)
+    entropy[i] = i*7 + 3;
+
+  drbgInstantiate(&d, entropy);
+  drbgGenerate(&d, out, 64);
+  failed += check("first generate", out, firstOut, 64);
+  drbgGenerate(&d, out, 64);
+  failed += check("second generate", out, secondOut, 64);
+  drbgReseed(&d, entropy + DRBG_SEED_SIZE);
+  drbgGenerate(&d, out, 64);
+  failed += check("generate after reseed", out, reseededOut, 64);
+
+  // A partial last block is the start of the full one.
+  drbgInstantiate(&d, entropy);
+  drbgGenerate(&d, out, 13);
+  failed += check("partial block", out, firstOut, 13);
+  return failed;
+}
+
+// A long request is split at DRBG_MAX_REQUEST, as two separate requests.
+int longtest()
+{
+  u_int32_ard length = DRBG_MAX_REQUEST + 100;
+  byte_ard* whole = (byte_ard*)malloc(length);
+  byte_ard* split = (byte_ard*)malloc(length);
+  byte_ard seed[DRBG_SEED_SIZE];
+  struct ctr_drbg d;
+  int failed = 0;
+
+  for (int i = 0; i < DRBG_SEED_SIZE; i++)
+    seed[i] = 0xA5 ^ i;
+
+  drbgInstantiate(&d, seed);
+  drbgGenerate(&d, whole, length);
+  drbgInstantiate(&d, seed);
+  drbgGenerate(&d, split, DRBG_MAX_REQUEST);
+  drbgGenerate(&d, split + DRBG_MAX_REQUEST, 100);
+  failed += check("long request", whole, split, length);
+
+  if (randomBytes(whole, length) != DRBG_OK)
+  {
+    printf("Failed: randomBytes() of %u bytes\n", length);
+    failed++;
+  }
+  free(whole);
+  free(split);
+  return failed;
+}
+
+void* threadBytes(void* pOut)
+{
+  randomBytes(pOut, 32);
+  return NULL;
+}
+
+int threadtest()
+{
+  byte_ard mine[32], theirs[32];
+  pthread_t thread;
+
+  randomBytes(mine, 32);
+  pthread_create(&thread, NULL, threadBytes, theirs);
+  pthread_join(thread, NULL);
+  randomBytes(mine, 32);
+  if (memcmp(mine, theirs, 32) == 0)
+  {
+    printf("Failed: two threads generated the same bytes\n");
+    return 1;
+  }
+  return 0;
+}
+
+// The parent has seeded its generator, the child must not continue from it.
+int forktest()
+{
+  byte_ard parent[32], child[32];
+  int fds[2];
+
+  randomBytes(parent, 32);
+  if (pipe(fds) != 0)
+    return 1;
+  pid_t pid = fork();
+  if (pid == 0)
+  {
+    randomBytes(child, 32);
+    write(fds[1], child, 32);
+    _exit(0);
+  }
+  randomBytes(parent, 32);
+  int got = read(fds[0], child, 32);
+  waitpid(pid, NULL, 0);
+  close(fds[0]);
+  close(fds[1]);
+  if (got != 32 || memcmp(parent, child, 32) == 0)
+  {
+    printf("Failed: forked child repeated its parent's bytes\n");
+    return 1;
+  }
+  return 0;
+}
+
+int main(int argc, char* argv[])
+{
+  int failed = 0;
+
+  printf("CTR_DRBG tests\n\n");
+
+  failed += kattest();
+  failed += longtest();
+  failed += threadtest();
+  failed += forktest();
+
+  if (failed == 0)
+  {
+    printf("\nAll OK!\n");
+  }
+  else
+  {
+    printf("\nSome test(s) failed!\n");
+  }
+
+  return failed;
+}
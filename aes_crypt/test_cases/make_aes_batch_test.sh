@@ -0,0 +1,2 @@
+g++ -Wall -D_INTEL_64 aes_batch_test.cpp ../lib/aes_batch.cpp ../lib/aes_bitslice.cpp ../lib/aes_crypt.cpp ../lib/aes_cmac.cpp -I ../lib/ -O2 -o aes_batch_test
+g++ -Wall -D_INTEL_64 -DAES_BATCH_TABLES aes_batch_test.cpp ../lib/aes_batch.cpp ../lib/aes_bitslice.cpp ../lib/aes_crypt.cpp ../lib/aes_cmac.cpp -I ../lib/ -O2 -o aes_batch_test_tables
@@ -0,0 +1,2 @@
+#!/bin/sh
+g++ -Wall -D_INTEL_64 aes_constants_test.cpp ../lib/aes_constants.cpp ../lib/aes_cmac.cpp ../lib/aes_crypt.cpp -I ../lib/ -O2 -o aes_constants_test
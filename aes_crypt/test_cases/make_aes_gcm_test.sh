@@ -0,0 +1,3 @@
+#!/bin/sh
+g++ -Wall -D_INTEL_64 aes_gcm_test.cpp ../lib/aes_gcm.cpp ../lib/aes_batch.cpp ../lib/aes_bitslice.cpp ../lib/aes_cmac.cpp ../lib/aes_crypt.cpp -I ../lib/ -O2 -o aes_gcm_test
+g++ -Wall -D_INTEL_64 -DGCM_NO_PCLMUL aes_gcm_test.cpp ../lib/aes_gcm.cpp ../lib/aes_batch.cpp ../lib/aes_bitslice.cpp ../lib/aes_cmac.cpp ../lib/aes_crypt.cpp -I ../lib/ -O2 -o aes_gcm_test_portable
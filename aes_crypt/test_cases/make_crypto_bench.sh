@@ -0,0 +1 @@
+g++ -Wall -D_INTEL_64 crypto_bench.cpp ../lib/aes_crypt.cpp ../lib/aes_cmac.cpp ../lib/protocol.cpp ../lib/msg_arena.cpp ../lib/aes_batch.cpp ../lib/aes_bitslice.cpp ../lib/aes_gcm.cpp -I ../lib/ -O2 -o crypto_bench -lm
@@ -0,0 +1,2 @@
+#!/bin/sh
+g++ -Wall -D_INTEL_64 drbg_test.cpp ../lib/aes_drbg.cpp ../lib/aes_gcm.cpp ../lib/aes_batch.cpp ../lib/aes_bitslice.cpp ../lib/aes_cmac.cpp ../lib/aes_crypt.cpp -I ../lib/ -O2 -lpthread -o drbg_test
@@ -0,0 +1,2 @@
+#!/bin/sh
+g++ -Wall -D_INTEL_64 msg_arena_test.cpp ../lib/msg_arena.cpp ../lib/protocol.cpp ../lib/aes_crypt.cpp ../lib/aes_cmac.cpp ../lib/aes_batch.cpp ../lib/aes_bitslice.cpp ../lib/aes_gcm.cpp -I ../lib/ -O2 -o msg_arena_test
@@ -0,0 +1,3 @@
+#!/bin/sh
+g++ -Wall -D_INTEL_64 payload_codec_test.cpp ../lib/payload_codec.cpp ../lib/msg_arena.cpp -I ../lib/ -O2 -o payload_codec_test
+g++ -Wall -D_INTEL_64 -DPAYLOAD_NO_AVX2 payload_codec_test.cpp ../lib/payload_codec.cpp ../lib/msg_arena.cpp -I ../lib/ -O2 -o payload_codec_test_portable
@@ -1,2 +1,2 @@
-#g++ -Wall -D_INTEL_32 protocol_tests.cpp ../lib/aes_crypt.cpp ../lib/protocol.cpp ../lib/aes_cmac.cpp -I ../lib/ -O2 -o ptests
-g++ -Wall -D_INTEL_64 protocol_tests.cpp ../lib/aes_crypt.cpp ../lib/protocol.cpp ../lib/aes_cmac.cpp -I ../lib/ -O2 -o ptests
+#g++ -Wall -D_INTEL_32 protocol_tests.cpp ../lib/aes_crypt.cpp ../lib/protocol.cpp ../lib/msg_arena.cpp ../lib/aes_cmac.cpp ../lib/aes_batch.cpp ../lib/aes_bitslice.cpp ../lib/aes_gcm.cpp -I ../lib/ -O2 -o ptests
+g++ -Wall -D_INTEL_64 protocol_tests.cpp ../lib/aes_crypt.cpp ../lib/protocol.cpp ../lib/msg_arena.cpp ../lib/aes_cmac.cpp ../lib/aes_batch.cpp ../lib/aes_bitslice.cpp ../lib/aes_gcm.cpp -I ../lib/ -O2 -o ptests
@@ -0,0 +1,2 @@
+#!/bin/sh
+g++ -Wall -D_INTEL_64 serial_link_test.cpp ../lib/serial_link.cpp -I ../lib/ -O2 -o serial_link_test
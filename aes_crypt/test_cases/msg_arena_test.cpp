@@ -0,0 +1,162 @@
+/**
+ * Tests the message arena. Alignment, reset, messages that outgrow the
+ * arena, and that unpack_data() taking its buffers from an arena gives
+ * the same message as with malloc() and leaves nothing behind a reset.
+ */
+
+#include "msg_arena.h"
+#include "protocol.h"
+#include "aes_crypt.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+byte_ard Key[] = { 0x2b,0x7e,0x15,0x16,0x28,0xae,0xd2,0xa6,
+                   0xab,0xf7,0x15,0x88,0x09,0xcf,0x4f,0x3c };
+byte_ard CmacKey[] = { 0x00,0x01,0x02,0x03,0x04,0x05,0x06,0x07,
+                       0x08,0x09,0x0a,0x0b,0x0c,0x0d,0x0e,0x0f };
+byte_ard Keys[BLOCK_BYTE_SIZE*11];
+byte_ard CmacKeys[BLOCK_BYTE_SIZE*11];
+
+int check(const char* name, bool ok)
+{
+  if (!ok)
+  {
+    printf("Failed: %s\n", name);
+    return 1;
+  }
+  return 0;
+}
+
+int alloctest()
+{
+  struct msg_arena a;
+  int failed = 0;
+
+  failed += check("init", arenaInit(&a, 1000) == 1);
+  failed += check("size rounded up", a.size == 1008);
+
+  byte_ard* p1 = (byte_ard*)arenaAlloc(&a, 1);
+  byte_ard* p2 = (byte_ard*)arenaAlloc(&a, 17);
+  byte_ard* p3 = (byte_ard*)arenaAlloc(&a, 16);
+  failed += check("first from the base", p1 == a.base);
+  failed += check("aligned", ((size_t)p2 % ARENA_ALIGN) == 0 &&
+                             ((size_t)p3 % ARENA_ALIGN) == 0);
+  failed += check("no overlap", p2 == p1 + 16 && p3 == p2 + 32);
+  failed += check("used", a.used == 64);
+
+  arenaReset(&a);
+  failed += check("reset", a.used == 0 && a.highWater == 64);
+  failed += check("reused", arenaAlloc(&a, 8) == p1);
+  arenaReset(&a);
+
+  // More than fits, extra blocks until the next reset.
+  byte_ard* big = (byte_ard*)arenaAlloc(&a, 4000);
+  byte_ard* more = (byte_ard*)arenaAlloc(&a, 900);
+  byte_ard* past = (byte_ard*)arenaAlloc(&a, 200);
+  failed += check("overflow allocated", big != NULL && past != NULL);
+  failed += check("overflow outside the block",
+                  big < a.base || big >= a.base + a.size);
+  failed += check("overflow aligned", ((size_t)big % ARENA_ALIGN) == 0 &&
+                                      ((size_t)past % ARENA_ALIGN) == 0);
+  failed += check("block still used", more == a.base);
+  memset(big, 0xaa, 4000);
+  arenaReset(&a);
+  failed += check("overflow counted", a.overflows == 1 && a.overflow == NULL);
+  arenaReset(&a);
+  failed += check("counted once", a.overflows == 1);
+
+  arenaDestroy(&a);
+  failed += check("destroyed", a.base == NULL);
+
+  printf("Allocation: %s\n", failed == 0 ? "OK" : "FAILED");
+  return failed;
+}
+
+int unpacktest()
+{
+  struct msg_arena a;
+  int failed = 0;
+  byte_ard id[ID_SIZE] = { 1, 2, 3, 4, 5, 6 };
+  byte_ard data[40];
+  for (int i = 0; i < 40; i++)
+    data[i] = (byte_ard)(i*3);
+
+  struct data senddata;
+  memcpy(senddata.id, id, ID_SIZE);
+  senddata.data = data;
+  senddata.msgtime = 1234;
+  senddata.data_len = sizeof(data);
+
+  byte_ard buffer[DataMsg::headerSize +
+                  paddedSize(DataMsg::Plain::headerSize + sizeof(data)) +
+                  BLOCK_BYTE_SIZE];
+  pack_data(&senddata, (const u_int32_ard*)Keys, (const u_int32_ard*)CmacKeys,
+            (void*)buffer);
+
+  // Heap first, no arena in use.
+  struct data heapdata;
+  unpack_data((void*)buffer, (const u_int32_ard*)Keys, &heapdata);
+
+  arenaInit(&a, ARENA_DEFAULT_SIZE);
+  arenaUse(&a);
+
+  struct data arenadata;
+  unpack_data((void*)buffer, (const u_int32_ard*)Keys, &arenadata);
+  failed += check("buffers from the arena",
+                  arenadata.ciphertext >= a.base &&
+                  arenadata.data >= a.base &&
+                  arenadata.data < a.base + a.size);
+  failed += check("same message",
+                  arenadata.msgtime == heapdata.msgtime &&
+                  arenadata.data_len == heapdata.data_len &&
+                  memcmp(arenadata.id, heapdata.id, ID_SIZE) == 0 &&
+                  memcmp(arenadata.data, data, sizeof(data)) == 0 &&
+                  memcmp(arenadata.ciphertext, heapdata.ciphertext,
+                         heapdata.cipher_len) == 0 &&
+                  memcmp(arenadata.cmac, heapdata.cmac, BLOCK_BYTE_SIZE) == 0);
+
+  // msgFree() leaves arena memory to the reset.
+  msgFree(arenadata.data);
+  arenaReset(&a);
+  failed += check("nothing left", a.used == 0 && a.overflow == NULL);
+
+  // A message after the reset gets the same memory.
+  byte_ard* first = arenadata.ciphertext;
+  unpack_data((void*)buffer, (const u_int32_ard*)Keys, &arenadata);
+  failed += check("memory reused", arenadata.ciphertext == first &&
+                  memcmp(arenadata.data, data, sizeof(data)) == 0);
+
+  arenaUse(NULL);
+  arenaDestroy(&a);
+
+  free(heapdata.ciphertext);
+  msgFree(heapdata.data);
+
+  printf("Unpack: %s\n", failed == 0 ? "OK" : "FAILED");
+  return failed;
+}
+
+int main()
+{
+  int failed = 0;
+
+  KeyExpansion(Key, Keys);
+  KeyExpansion(CmacKey, CmacKeys);
+
+  printf("Message arena tests\n\n");
+
+  failed += alloctest();
+  failed += unpacktest();
+
+  if (failed == 0)
+  {
+    printf("\nAll OK!\n");
+  }
+  else
+  {
+    printf("\nSome test(s) failed!\n");
+  }
+
+  return failed;
+}
@@ -0,0 +1,163 @@
+/**
+ * Tests the measurement payload codec. Random sample sequences, from
+ * constant to full range noise, must survive a pack/unpack round trip, and
+ * truncated or malformed payloads must be rejected.
+ */
+
+#include "payload_codec.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#define MAX_RECORDS 255
+#define MAX_ICNT 4
+
+// Fills records samples of icnt interfaces, each a random walk with steps
+// of up to +-maxStep, clamped to valueBits.
+void makeSamples(byte_ard* samples, int icnt, int records, int maxStep, int valueBits)
+{
+  int top = (1 << valueBits) - 1;
+  for (int i = 0; i < icnt; i++)
+  {
+    int v = rand() & top;
+    for (int r = 0; r < records; r++)
+    {
+      samples[r*icnt+i] = v;
+      if (maxStep > 0)
+        v += rand() % (2*maxStep+1) - maxStep;
+      if (v < 0) v = 0;
+      if (v > top) v = top;
+    }
+  }
+}
+
+int roundtrip(int icnt, int records, int maxStep, int valueBits, bool verbose)
+{
+  byte_ard samples[MAX_RECORDS*MAX_ICNT];
+  byte_ard types[MAX_ICNT] = { 0x01, 0x0A, 0x03, 0x0F };
+  byte_ard packed[PAYLOAD_HEADER_SIZE + MAX_ICNT*PAYLOAD_IFHEADER_SIZE + 2*MAX_RECORDS*MAX_ICNT];
+  struct payload pl;
+
+  makeSamples(samples, icnt, records, maxStep, valueBits);
+
+  u_int16_ard size = payload_packed_size(samples, icnt, records, valueBits);
+  u_int16_ard len = pack_payload(samples, icnt, records, types, valueBits, packed);
+  if (size != len)
+  {
+    printf("Failed: packed %d bytes, expected %d\n", len, size);
+    return 1;
+  }
+  if (verbose)
+    printf("%d x %d samples, step %2d: %4d bytes packed from %4d\n",
+           icnt, records, maxStep, len, icnt*records);
+
+  if (unpack_payload(packed, len, &pl) != PAYLOAD_VALID)
+  {
+    printf("Failed: payload of %d x %d samples rejected\n", icnt, records);
+    return 1;
+  }
+  int failed = 0;
+  if (pl.icnt != icnt || pl.records != records)
+    failed = 1;
+  for (int i = 0; i < icnt && !failed; i++)
+    if (pl.types[i] != types[i] || pl.valueBits[i] != valueBits)
+      failed = 1;
+  for (int k = 0; k < icnt*records && !failed; k++)
+    if (pl.values[k] != samples[k])
+      failed = 1;
+  free(pl.values);
+  if (failed)
+  {
+    printf("Failed: %d x %d samples, step %d did not round trip\n", icnt, records, maxStep);
+    return 1;
+  }
+
+  // Every proper prefix of the payload is truncated.
+  for (u_int16_ard n = 0; n < len; n++)
+  {
+    if (unpack_payload(packed, n, &pl) != PAYLOAD_INVALID)
+    {
+      printf("Failed: payload truncated to %d of %d bytes accepted\n", n, len);
+      free(pl.values);
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int malformedtest()
+{
+  byte_ard samples[4] = { 1, 2, 3, 4 };
+  byte_ard types[2] = { 0x01, 0x0A };
+  byte_ard packed[64];
+  struct payload pl;
+
+  u_int16_ard len = pack_payload(samples, 2, 2, types, 8, packed);
+
+  packed[0] = (packed[0] & 0xF0) | (PAYLOAD_VERSION + 1);
+  if (unpack_payload(packed, len, &pl) != PAYLOAD_INVALID)
+  {
+    printf("Failed: unknown version accepted\n");
+    return 1;
+  }
+  pack_payload(samples, 2, 2, types, 8, packed);
+  packed[PAYLOAD_HEADER_SIZE+1] = PAYLOAD_MAX_VALUE_BITS + 2;
+  if (unpack_payload(packed, len, &pl) != PAYLOAD_INVALID)
+  {
+    printf("Failed: oversized delta width accepted\n");
+    return 1;
+  }
+  return 0;
+}
+
+int timestest()
+{
+  // Two records, 300 and 0 seconds before the message time, ahead of their samples
+  byte_ard timed[] = { 2, 0x2C, 0x01, 0x00, 0x00, 10, 20, 11, 21 };
+
+  if (payload_times(timed, sizeof(timed)) != 2 ||
+      payload_time_offset(timed, 0) != 300 || payload_time_offset(timed, 1) != 0 ||
+      timed[PAYLOAD_TIMES_SIZE(2)] != 10)
+  {
+    printf("Failed: record times misread\n");
+    return 1;
+  }
+  if (payload_times(timed, PAYLOAD_TIMES_SIZE(2) - 1) != -1 || payload_times(timed, 0) != -1)
+  {
+    printf("Failed: truncated record times accepted\n");
+    return 1;
+  }
+  return 0;
+}
+
+int main(int argc, char* argv[])
+{
+  int failed = 0;
+  int steps[] = { 0, 1, 2, 5, 40, 255 };
+  int records[] = { 0, 1, 2, 7, 8, 9, 10, 17, 64, 255 };
+
+  printf("Payload codec tests\n\n");
+
+  srand(1);
+  for (unsigned int s = 0; s < sizeof(steps)/sizeof(steps[0]); s++)
+    for (unsigned int r = 0; r < sizeof(records)/sizeof(records[0]); r++)
+      for (int icnt = 1; icnt <= MAX_ICNT; icnt++)
+        failed += roundtrip(icnt, records[r], steps[s], 8, records[r] == 64 && icnt == 2);
+
+  for (int valueBits = 1; valueBits <= 8; valueBits++)
+    failed += roundtrip(2, 100, 3, valueBits, false);
+
+  failed += malformedtest();
+  failed += timestest();
+
+  if (failed == 0)
+  {
+    printf("\nAll OK!\n");
+  }
+  else
+  {
+    printf("\nSome test(s) failed!\n");
+  }
+
+  return failed;
+}
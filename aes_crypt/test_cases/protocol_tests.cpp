@@ -5,6 +5,7 @@
 #include <stdlib.h>  // malloc()
 
 #include "protocol.h"
+#include "aes_batch.h"  // BATCH_LANES
 
 
 // printBytes2 KVJ
@@ -409,10 +410,7 @@ int datatest(byte_ard* data, byte_ard datalen, byte_ard* id, u_int32_ard t)
   senddata.msgtime = t;
   senddata.data_len = datalen;
 
-  //                           ↓ Everything in the crypt part ↓
-  int datablocks = ((datalen+ID_SIZE + MSGTIME_SIZE + 1)/BLOCK_BYTE_SIZE) +1; 
-  // TODO: find a way to define the needed buffer length
-  byte_ard buffer[MSGTYPE_SIZE + 1 + ID_SIZE + (datablocks*BLOCK_BYTE_SIZE)];
+  byte_ard buffer[DataMsg::headerSize + paddedSize(DataMsg::Plain::headerSize + datalen) + BLOCK_BYTE_SIZE];
   pack_data(&senddata, (const u_int32_ard*)Keys, (const u_int32_ard*)CmacKeys, (void*)buffer);
 
 
@@ -424,7 +422,9 @@ int datatest(byte_ard* data, byte_ard datalen, byte_ard* id, u_int32_ard t)
   byte_ard cmac_temp[BLOCK_BYTE_SIZE];
   aesCMac((const u_int32_ard*)CmacKeys, recvdata.ciphertext, (u_int32_ard)recvdata.cipher_len, cmac_temp);
   
-  if(recvdata.msgtime == t)
+  if(recvdata.msgtime == t && recvdata.data_len == datalen &&
+     memcmp(recvdata.data, data, datalen) == 0 &&
+     recvdata.cipher_len == paddedSize(DataMsg::Plain::headerSize + datalen))
   {
     if (strncmp((const char*)recvdata.cmac, (const char*)cmac_temp, BLOCK_BYTE_SIZE) == 0)
     //if (2 > 1)
@@ -449,6 +449,195 @@ int datatest(byte_ard* data, byte_ard datalen, byte_ard* id, u_int32_ard t)
 
 }
 
+/**
+ *
+ * Name:    MSG Code | Cipher Len | Pub ID | Nonce | Ciphertext                | Tag
+ * Bytes:   1        | 1          | 6      | 12    | Msg Time: 4, Data: Varies | 16
+ * Data:    0x02     |            |        |       | Msg Time, Data            |
+ */
+int datagcmtest(byte_ard* data, byte_ard datalen, byte_ard* id, u_int32_ard t)
+{
+  int retval = 1;
+  printf("datagcm: ");
+
+  struct data senddata;
+  memcpy(senddata.id, id, ID_SIZE);
+  senddata.data = data;
+  senddata.msgtime = t;
+  senddata.data_len = datalen;
+
+  byte_ard nonce[GCM_NONCE_SIZE] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 };
+  byte_ard buffer[DATA_GCM_FULLSIZE(datalen)];
+  pack_data_gcm(&senddata, (const u_int32_ard*)Keys, nonce, (void*)buffer);
+
+  // Unpack
+  struct data recvdata;
+  int32_ard valid = unpack_data_gcm((void*)buffer, (const u_int32_ard*)Keys, &recvdata);
+
+  if (valid == GCM_TAG_VALID && recvdata.msgtime == t &&
+      recvdata.data_len == datalen && memcmp(recvdata.data, data, datalen) == 0)
+  {
+    free(recvdata.data);
+
+    // The ID is outside the ciphertext, but it is still authenticated.
+    buffer[MSGTYPE_SIZE + 1] ^= 0x01;
+    if (unpack_data_gcm((void*)buffer, (const u_int32_ard*)Keys, &recvdata) == GCM_TAG_INVALID)
+    {
+      printf("Checks out! (Measurment 0: %d)\n", data[0]);
+      retval = 0;
+    }
+    else
+    {
+      fprintf(stderr, "Failed: accepted a changed ID.\n");
+      free(recvdata.data);
+    }
+  }
+  else
+  {
+    fprintf(stderr, "Failed: tag or data.\n");
+  }
+
+  return retval;
+}
+
+/**
+ * Packs BATCH_LANES+3 data messages, breaks the MAC of one and unpacks them
+ * all with unpack_data_batch().
+ */
+int databatchtest(byte_ard* data, byte_ard datalen, byte_ard* id, u_int32_ard t)
+{
+  int retval = 0;
+  printf("databatch: ");
+
+  const u_int32_ard n = BATCH_LANES + 3;
+  const u_int32_ard broken = 4;
+  int datablocks = ((datalen+ID_SIZE + MSGTIME_SIZE + 1)/BLOCK_BYTE_SIZE) +1;
+  int msglen = MSGTYPE_SIZE + 1 + ID_SIZE + (datablocks*BLOCK_BYTE_SIZE) + BLOCK_BYTE_SIZE;
+  byte_ard* buffer = (byte_ard*)malloc(n*msglen);
+
+  void* pStreams[n];
+  const u_int32_ard* pKeys[n];
+  const u_int32_ard* pCmacKeys[n];
+  struct data recvdata[n];
+  int32_ard valid[n];
+
+  for (u_int32_ard i = 0; i < n; i++)
+  {
+    struct data senddata;
+    memcpy(senddata.id, id, ID_SIZE);
+    senddata.data = data;
+    senddata.msgtime = t + i;
+    senddata.data_len = datalen;
+
+    pStreams[i] = buffer + i*msglen;
+    pKeys[i] = (const u_int32_ard*)Keys;
+    pCmacKeys[i] = (const u_int32_ard*)CmacKeys;
+    pack_data(&senddata, pKeys[i], pCmacKeys[i], pStreams[i]);
+  }
+  buffer[broken*msglen + MSGTYPE_SIZE + 1 + ID_SIZE] ^= 0x80;
+
+  u_int32_ard validCount = unpack_data_batch(pStreams, pKeys, pCmacKeys, recvdata, valid, n);
+
+  if (validCount != n - 1)
+  {
+    fprintf(stderr, "Failed: %d valid messages\n", validCount);
+    retval = 1;
+  }
+  for (u_int32_ard i = 0; i < n && retval == 0; i++)
+  {
+    if (i == broken)
+    {
+      if (valid[i] != CMAC_INVALID)
+      {
+        fprintf(stderr, "Failed: accepted a broken CMAC\n");
+        retval = 1;
+      }
+      continue;
+    }
+    if (valid[i] != CMAC_VALID || recvdata[i].msgtime != t + i ||
+        recvdata[i].data_len != datalen ||
+        memcmp(recvdata[i].id, id, ID_SIZE) != 0 ||
+        memcmp(recvdata[i].data, data, datalen) != 0)
+    {
+      fprintf(stderr, "Failed: message %d\n", i);
+      retval = 1;
+    }
+  }
+
+  if (retval == 0)
+  {
+    printf("Checks out! (Valid: %d of %d)\n", validCount, n);
+  }
+
+  for (u_int32_ard i = 0; i < n; i++)
+  {
+    free(recvdata[i].ciphertext);
+    if (valid[i] == CMAC_VALID)
+      free(recvdata[i].data);
+  }
+  free(buffer);
+  return retval;
+}
+
+/**
+ * Name:    MSG Code | Sensor ID | Payload length | Payload
+ * Bytes:   1        | 6         | 2              | Varies
+ * Data:    0xA1     |           |                | A full protocol message
+ */
+int gwframetest(byte_ard* id, u_int32_ard t)
+{
+  int retval = 1;
+  printf("gwframe: ");
+
+  // Wrap a rekey message in a gateway envelope
+  struct message sendmsg;
+  sendmsg.msgtype = MSG_T_REKEY_HANDSHAKE;
+  sendmsg.pID = id;
+  sendmsg.nonce = (u_int16_ard)t;
+
+  byte_ard buffer[GWFRAME_HEADER_SIZE + REKEY_FULLSIZE];
+  pack_gwframe_header(id, REKEY_FULLSIZE, buffer);
+  pack_rekey(&sendmsg, (const u_int32_ard*)Keys, (const u_int32_ard*)CmacKeys, buffer + GWFRAME_HEADER_SIZE);
+
+  byte_ard routeId[ID_SIZE+1];
+  routeId[ID_SIZE] = '\0';
+  u_int16_ard len = unpack_gwframe_header(buffer, routeId);
+
+  if (len == REKEY_FULLSIZE)
+  {
+    if (strncmp((const char*)routeId, (const char*)id, ID_SIZE) == 0)
+    {
+      if (buffer[GWFRAME_HEADER_SIZE] == MSG_T_REKEY_HANDSHAKE)
+      {
+        printf("Checks out! (Route ID: %s)\n", routeId);
+        retval = 0;
+      }
+      else
+      {
+        fprintf(stderr, "Failed: payload msgtype (0x%x)\n", buffer[GWFRAME_HEADER_SIZE]);
+      }
+    }
+    else
+    {
+      fprintf(stderr, "Failed: route ID.\n");
+    }
+  }
+  else
+  {
+    fprintf(stderr, "Failed: payload length (%d)\n", len);
+  }
+
+  // A stream not starting with an envelope must be rejected
+  buffer[0] = MSG_T_DATA_SEND;
+  if (unpack_gwframe_header(buffer, routeId) != 0)
+  {
+    fprintf(stderr, "Failed: accepted a non-gateway frame.\n");
+    retval = 1;
+  }
+
+  return retval;
+}
+
 int main(int argc, char* argv[])
 {
 
@@ -488,8 +677,17 @@ int main(int argc, char* argv[])
   int test5 = newkeytest((byte_ard*)id, 2, rand, 4);
   printf("\n");
   int test6 = datatest((byte_ard*)measurments, measurments_len, (byte_ard*)id, 2);
+  int test7 = gwframetest((byte_ard*)id, 7);
+  int test8 = databatchtest((byte_ard*)measurments, measurments_len, (byte_ard*)id, 20);
+  int test9 = datagcmtest((byte_ard*)measurments, measurments_len, (byte_ard*)id, 30);
+  printf("\n");
+  // Renewal timers wider than a byte, and data that fills whole blocks.
+  int test10 = keytosinktest(6, 3600, (byte_ard*)id);
+  test10 += keytosensetest(2, 3600, (byte_ard*)id);
+  test10 += newkeytest((byte_ard*)id, 3, rand, 0xBEEF);
+  test10 += datatest((byte_ard*)measurments, 5, (byte_ard*)id, 0x12345678);
 
-  if ((test1+test2+test3+test4+test5+test6) == 0) // SUM
+  if ((test1+test2+test3+test4+test5+test6+test7+test8+test9+test10) == 0) // SUM
   {
     printf("\nAll OK!\n");
   }
@@ -0,0 +1,238 @@
+/**
+ * Tests the framed serial link. COBS and the CRC against known values,
+ * frames through the receiver with a corrupt one and line noise between
+ * them, and two ends exchanging data over a line that loses frames, which
+ * has to arrive whole, in order and with only the lost frames sent again.
+ */
+
+#include "serial_link.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+int check(const char* name, bool ok)
+{
+  if (!ok)
+  {
+    printf("Failed: %s\n", name);
+    return 1;
+  }
+  return 0;
+}
+
+int cobstest()
+{
+  int failed = 0;
+  byte_ard out[600], back[600];
+
+  // Examples from the COBS paper
+  byte_ard z1[] = { 0x00 };
+  byte_ard e1[] = { 0x01, 0x01 };
+  failed += check("cobs one zero", cobs_encode(z1, 1, out) == 2 && memcmp(out, e1, 2) == 0);
+  byte_ard z2[] = { 0x11, 0x22, 0x00, 0x33 };
+  byte_ard e2[] = { 0x03, 0x11, 0x22, 0x02, 0x33 };
+  failed += check("cobs mixed", cobs_encode(z2, 4, out) == 5 && memcmp(out, e2, 5) == 0);
+
+  // Runs of 254 and more without a zero
+  byte_ard run[520];
+  for (int i = 0; i < (int)sizeof(run); i++)
+    run[i] = (i % 300 == 299) ? 0 : (i % 255) + 1;
+  bool ok = true;
+  for (int len = 0; len <= (int)sizeof(run); len++)
+  {
+    u_int16_ard n = cobs_encode(run, len, out);
+    ok = ok && n <= len + len/254 + 1 && memchr(out, 0, n) == NULL &&
+         cobs_decode(out, n, back) == len && memcmp(back, run, len) == 0;
+  }
+  failed += check("cobs round trip", ok);
+
+  // In place, as the receiver does it
+  u_int16_ard n = cobs_encode(z2, 4, out);
+  failed += check("cobs in place", cobs_decode(out, n, out) == 4 && memcmp(out, z2, 4) == 0);
+  byte_ard bad[] = { 0x05, 0x11, 0x22 };
+  failed += check("cobs short block", cobs_decode(bad, 3, back) == -1);
+
+  byte_ard digits[] = { '1','2','3','4','5','6','7','8','9' };
+  failed += check("crc16 check value", crc16(digits, 9) == 0x29B1);
+
+  return failed;
+}
+
+// Feeds bytes to the receiver, returns the result of the last one and the
+// number of valid frames.
+int feed(struct serial_link* link, const byte_ard* buf, int len, int* frames)
+{
+  int r = LINK_RX_NONE;
+  for (int i = 0; i < len; i++)
+  {
+    r = link_rx_byte(link, buf[i]);
+    if (r == LINK_RX_FRAME)
+      (*frames)++;
+  }
+  return r;
+}
+
+int frametest()
+{
+  int failed = 0;
+  struct serial_link rx;
+  byte_ard frame[LINK_FRAME_MAX];
+  byte_ard payload[LINK_MTU];
+  int frames = 0;
+
+  for (int i = 0; i < LINK_MTU; i++)
+    payload[i] = i & 1 ? 0 : i;
+  link_init(&rx, 115200);
+
+  u_int16_ard n = link_encode_frame(LINK_CTL_DATA, 7, payload, LINK_MTU, frame);
+  failed += check("frame fits", n <= LINK_FRAME_MAX);
+  failed += check("frame delimited", frame[0] == LINK_DELIM && frame[n-1] == LINK_DELIM &&
+                  memchr(frame+1, 0, n-2) == NULL);
+  failed += check("frame received", feed(&rx, frame, n, &frames) == LINK_RX_FRAME);
+  failed += check("frame contents", rx.rxCtl == LINK_CTL_DATA && rx.rxFrameSeq == 7 &&
+                  rx.rxLen == LINK_MTU &&
+                  memcmp(rx.frame+LINK_HEADER_SIZE, payload, LINK_MTU) == 0);
+
+  // A flipped bit, then noise, then a good frame
+  frame[n/2] ^= 0x04;
+  failed += check("corrupt frame", feed(&rx, frame, n, &frames) == LINK_RX_BAD &&
+                  rx.crcErrors == 1);
+  byte_ard noise[] = { 0x13, 0x99, 0x42 };
+  frames = 0;
+  feed(&rx, noise, sizeof(noise), &frames);
+  n = link_encode_frame(LINK_CTL_ACK, 3, NULL, 0, frame);
+  feed(&rx, frame, n, &frames);
+  failed += check("back in step after noise", frames == 1 && rx.rxCtl == LINK_CTL_ACK &&
+                  rx.rxFrameSeq == 3 && n == LINK_CTL_FRAME_SIZE);
+
+  // Longer than a frame can be
+  byte_ard longFrame[LINK_FRAME_MAX+10];
+  memset(longFrame, 0x55, sizeof(longFrame));
+  longFrame[sizeof(longFrame)-1] = LINK_DELIM;
+  failed += check("overrun", feed(&rx, longFrame, sizeof(longFrame), &frames) == LINK_RX_BAD);
+
+  failed += check("baud codes", link_baud(LINK_BAUD_9600) == 9600 &&
+                  link_baud(LINK_BAUD_115200) == 115200 && link_baud(LINK_BAUD_CODES) == 0);
+  return failed;
+}
+
+// One direction of a line: frames in flight, some of them lost.
+struct line
+{
+  byte_ard buf[8*LINK_FRAME_MAX];
+  int len;
+};
+
+void send(struct line* l, byte_ard ctl, byte_ard seq, const byte_ard* payload, int len, bool lose)
+{
+  if (lose)
+    return;
+  l->len += link_encode_frame(ctl, seq, payload, len, l->buf + l->len);
+}
+
+/*
+ * a sends size bytes to b over a line losing the frames lose() picks. Both
+ * run on the same clock, a round is a msec, so a NAK comes back long before
+ * the retry time and only the frame it names goes again.
+ */
+int arqtest(const char* name, int size, bool (*lose)(int frame))
+{
+  struct serial_link a, b;
+  struct line ab = { {0}, 0 }, ba = { {0}, 0 };
+  byte_ard* data = (byte_ard*)malloc(size);
+  byte_ard* got = (byte_ard*)malloc(size);
+  int sent = 0, gotLen = 0, frame = 0;
+  u_int32_ard now = 0;
+  int failed = 0;
+
+  for (int i = 0; i < size; i++)
+    data[i] = (i * 7) ^ (i >> 8);
+  link_init(&a, 115200);
+  link_init(&b, 115200);
+
+  for (int round = 0; round < 100000 && gotLen < size; round++)
+  {
+    while (sent < size && link_free(&a) > 0)
+    {
+      int n = size - sent < LINK_MTU ? size - sent : LINK_MTU;
+      link_queue(&a, data + sent, n);
+      sent += n;
+    }
+    struct link_slot* slot;
+    while ((slot = link_due(&a, now)) != NULL)
+      send(&ab, LINK_CTL_DATA, slot->seq, slot->data, slot->len, lose(frame++));
+
+    // b takes what came and answers every data frame
+    for (int i = 0; i < ab.len; i++)
+    {
+      if (link_rx_byte(&b, ab.buf[i]) != LINK_RX_FRAME)
+        continue;
+      link_accept(&b);
+      const byte_ard* p;
+      u_int16_ard len;
+      while ((p = link_deliver(&b, &len)) != NULL)
+      {
+        memcpy(got + gotLen, p, len);
+        gotLen += len;
+      }
+      byte_ard ctl, seq;
+      link_reply(&b, &ctl, &seq);
+      send(&ba, ctl, seq, NULL, 0, false);
+    }
+    ab.len = 0;
+
+    for (int i = 0; i < ba.len; i++)
+      if (link_rx_byte(&a, ba.buf[i]) == LINK_RX_FRAME)
+        link_control(&a);
+    ba.len = 0;
+
+    now++;
+  }
+
+  char what[100];
+  snprintf(what, sizeof(what), "%s: all in order", name);
+  failed += check(what, gotLen == size && memcmp(got, data, size) == 0 && a.drops == 0);
+  snprintf(what, sizeof(what), "%s: window drained", name);
+  failed += check(what, link_free(&a) == LINK_WINDOW);
+  int lost = 0;
+  for (int i = 0; i < frame; i++)
+    lost += lose(i);
+  snprintf(what, sizeof(what), "%s: only the lost frames resent", name);
+  failed += check(what, (int)a.retransmits == lost);
+
+  free(data);
+  free(got);
+  return failed;
+}
+
+bool loseNone(int frame)  { return false; }
+bool loseEvery5(int frame) { return frame % 5 == 2; }
+bool loseBurst(int frame)  { return frame >= 20 && frame < 22; }
+bool loseLast(int frame)   { return frame == 39; }
+
+int main()
+{
+  int failed = 0;
+
+  printf("Serial link tests\n\n");
+
+  failed += cobstest();
+  failed += frametest();
+  // Enough to wrap the sequence numbers
+  failed += arqtest("clean line", 300*LINK_MTU + 17, loseNone);
+  failed += arqtest("every fifth frame lost", 300*LINK_MTU, loseEvery5);
+  failed += arqtest("two in a row lost", 40*LINK_MTU, loseBurst);
+  // Nothing behind it to draw a NAK, resent at the retry time
+  failed += arqtest("last frame lost", 40*LINK_MTU, loseLast);
+
+  if (failed == 0)
+  {
+    printf("\nAll OK!\n");
+  }
+  else
+  {
+    printf("\nSome test(s) failed!\n");
+  }
+
+  return failed;
+}
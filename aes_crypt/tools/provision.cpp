@@ -0,0 +1,450 @@
+/*
+ * File name: provision.cpp
+ * Date:      2026-10-20 03:10
+ * Author:
+ *
+ * Provisions a lot of tsensors in one run. From a manifest of public IDs it
+ * generates a master key per device, on as many threads as asked for, each
+ * with its own CTR_DRBG (see aes_drbg.h), and writes
+ *
+ *   - an EEPROM image per device in the layout of edevdata.h, what tsburner
+ *     burns: the AES tables, then the public ID, the master key and the
+ *     manufacturer data. Intel HEX, named after the public ID, for
+ *     avrdude -U eeprom:w:<file>.eep:i.
+ *   - the keystore of the auth server (tsauthd --keystore), one device per
+ *     line.
+ *   - SQL seed rows for the sink_state table of the sink, base64 encoded as
+ *     TsDbSinkSensorProfile does it, with zero K_ST and R that the sink
+ *     overwrites at the first key exchange of the device.
+ *
+ * The images and the keystore hold the master keys and are created mode
+ * 0600. The keystore and the seed file are never overwritten, so a key that
+ * went into devices can not be lost to a second run.
+ *
+ * The manifest has one device per line, the manufacturer ID, the device ID
+ * and optionally the serial number written to the device, which is the
+ * device ID in decimal by default. A range of device IDs, first-last, stands
+ * for the devices in it. Numbers are decimal or 0x hex, '#' starts a
+ * comment:
+ *
+ *   # Lot 12
+ *   1 0x00010000-0x00014e1f
+ *   1 90001 SN-90001
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <vector>
+#include <set>
+#include <string>
+
+#include "aes_crypt.h"
+#include "aes_utils.h"
+#include "edevdata.h"
+
+using namespace std;
+
+#define HEX_RECORD_LEN 16   // Data bytes per Intel HEX record
+
+struct device {
+	byte_ard pid[DEV_ID_LEN];
+	byte_ard key[DEV_KEY_LEN];
+	char serial[DEV_SERIAL_NO_LEN+1];
+};
+
+// What a worker thread does, devices [first, last) of the lot.
+struct job {
+	vector<device> *devices;
+	size_t first, last;
+	const byte_ard *image;    // The EEPROM contents all devices share
+	const char *imageDir;     // NULL for no images
+	bool failed;
+};
+
+// Copies a string to a field of the EEPROM, space padded as tspcgen does it.
+void putString(byte_ard *field, const char *str, int len){
+	int n = strlen(str);
+	for(int i = 0; i < len; i++){
+		field[i] = i < n ? str[i] : ' ';
+	}
+}
+
+/* The part of the EEPROM that is the same in every device: the AES tables
+ * and the manufacturer name, model and date. Cells nothing is written to
+ * are left erased, 0xFF.
+ */
+void baseImage(byte_ard *image, const char *manName, const char *model,
+			   const char *date){
+	memset(image, 0xFF, EEPROM_SIZE);
+	for(int i = 0; i < S_TABLE_LEN; i++){
+		image[S_TABLE_START+i] = getSboxValue(i);
+	}
+	for(int i = 0; i < IS_TABLE_LEN; i++){
+		image[IS_TABLE_START+i] = getISboxValue(i);
+	}
+	for(int i = 0; i < RCON_TABLE_LEN; i++){
+		image[RCON_TABLE_START+i] = getRconValue(i);
+	}
+
+	byte_ard *dev = image + DEV_DATA_START;
+	putString(dev+DEV_MAN_NAME_START, manName, DEV_MAN_NAME_LEN);
+	putString(dev+DEV_MODEL_NAME_START, model, DEV_MODEL_NAME_LEN);
+	putString(dev+DEV_MAN_DATE_START, date, DEV_MAN_DATE_LEN);
+}
+
+void hexString(const byte_ard *bytes, int len, char *out){
+	for(int i = 0; i < len; i++){
+		sprintf(out + 2*i, "%.2x", bytes[i]);
+	}
+}
+
+/* Writes the image as Intel HEX to a new file, readable by the owner only.
+ * Returns false on error, or if the file is there already.
+ */
+bool writeImage(const char *path, const byte_ard *image){
+	int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, 0600);
+	if(fd < 0){
+		return false;
+	}
+
+	// 16 data bytes take 45 characters a record, with the line end.
+	char buf[(EEPROM_SIZE/HEX_RECORD_LEN + 1) * 45];
+	int pos = 0;
+	for(int addr = 0; addr < EEPROM_SIZE; addr += HEX_RECORD_LEN){
+		byte_ard sum = HEX_RECORD_LEN + (addr >> 8) + (addr & 0xFF);
+		pos += sprintf(buf+pos, ":%.2X%.4X00", HEX_RECORD_LEN, addr);
+		for(int i = 0; i < HEX_RECORD_LEN; i++){
+			pos += sprintf(buf+pos, "%.2X", image[addr+i]);
+			sum += image[addr+i];
+		}
+		pos += sprintf(buf+pos, "%.2X\n", (byte_ard)(-sum));
+	}
+	pos += sprintf(buf+pos, ":00000001FF\n");
+
+	bool ok = write(fd, buf, pos) == pos;
+	return close(fd) == 0 && ok;
+}
+
+/* Generates the keys of the devices of a job and writes their images.
+ */
+void *provisionJob(void *arg){
+	job *j = (job*)arg;
+	byte_ard image[EEPROM_SIZE];
+	memcpy(image, j->image, EEPROM_SIZE);
+
+	for(size_t i = j->first; i < j->last; i++){
+		device &d = (*j->devices)[i];
+		if(!generateKeyOfLength(d.key, DEV_KEY_LEN)){
+			j->failed = true;
+			return NULL;
+		}
+		if(j->imageDir == NULL){
+			continue;
+		}
+
+		byte_ard *dev = image + DEV_DATA_START;
+		memcpy(dev+DEV_ID_START, d.pid, DEV_ID_LEN);
+		memcpy(dev+DEV_KEY_START, d.key, DEV_KEY_LEN);
+		putString(dev+DEV_SERIAL_NO_START, d.serial, DEV_SERIAL_NO_LEN);
+
+		char path[PATH_MAX], szId[(DEV_ID_LEN)*2+1];
+		hexString(d.pid, DEV_ID_LEN, szId);
+		snprintf(path, sizeof(path), "%s/%s.eep", j->imageDir, szId);
+		if(!writeImage(path, image)){
+			fprintf(stderr, "Error - Can't write %s: %s\n", path,
+					strerror(errno));
+			j->failed = true;
+			return NULL;
+		}
+	}
+	return NULL;
+}
+
+void addDevice(vector<device> &devices, unsigned long manId,
+			   unsigned long devId, const char *serial){
+	device d;
+	d.pid[0] = (manId >> 8) & 0xFF;
+	d.pid[1] = manId & 0xFF;
+	d.pid[2] = (devId >> 24) & 0xFF;
+	d.pid[3] = (devId >> 16) & 0xFF;
+	d.pid[4] = (devId >> 8) & 0xFF;
+	d.pid[5] = devId & 0xFF;
+	if(serial != NULL){
+		snprintf(d.serial, sizeof(d.serial), "%s", serial);
+	} else {
+		snprintf(d.serial, sizeof(d.serial), "%lu", devId);
+	}
+	devices.push_back(d);
+}
+
+/* Reads the manifest into devices. Returns false, having said why, if a
+ * line is malformed or a public ID comes twice.
+ */
+bool readManifest(const char *path, vector<device> &devices){
+	FILE *f = fopen(path, "r");
+	if(f == NULL){
+		fprintf(stderr, "Error - Can't open %s: %s\n", path, strerror(errno));
+		return false;
+	}
+
+	char line[256];
+	int lineNo = 0;
+	bool ok = true;
+	while(ok && fgets(line, sizeof(line), f) != NULL){
+		lineNo++;
+		char *hash = strchr(line, '#');
+		if(hash != NULL){
+			*hash = 0;
+		}
+
+		char szMan[64], szDev[64], szSerial[64];
+		int fields = sscanf(line, "%63s %63s %63s", szMan, szDev, szSerial);
+		if(fields <= 0){
+			continue;
+		}
+
+		char *end, *end2;
+		unsigned long manId = strtoul(szMan, &end, 0);
+		unsigned long first = fields >= 2 ? strtoul(szDev, &end2, 0) : 0;
+		unsigned long last = first;
+		if(fields >= 2 && *end2 == '-'){
+			last = strtoul(end2+1, &end2, 0);
+		}
+		if(fields < 2 || *end != 0 || *end2 != 0 || manId > 0xFFFF ||
+		   first > 0xFFFFFFFFUL || last > 0xFFFFFFFFUL || last < first ||
+		   (fields == 3 && last != first)){
+			fprintf(stderr, "Error - %s:%d: malformed line.\n", path, lineNo);
+			ok = false;
+			break;
+		}
+
+		for(unsigned long devId = first; devId <= last; devId++){
+			addDevice(devices, manId, devId, fields == 3 ? szSerial : NULL);
+			if(devId == 0xFFFFFFFFUL){
+				break;
+			}
+		}
+	}
+	fclose(f);
+
+	set<string> seen;
+	for(size_t i = 0; ok && i < devices.size(); i++){
+		if(!seen.insert(string((char*)devices[i].pid, DEV_ID_LEN)).second){
+			char szId[(DEV_ID_LEN)*2+1];
+			hexString(devices[i].pid, DEV_ID_LEN, szId);
+			fprintf(stderr, "Error - %s: device %s listed twice.\n", path, szId);
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+// A new file, never one that exists. NULL, having said why, on error.
+FILE *createNew(const char *path, int mode){
+	int fd = open(path, O_WRONLY | O_CREAT | O_EXCL, mode);
+	if(fd < 0){
+		fprintf(stderr, "Error - Can't create %s: %s\n", path, strerror(errno));
+		return NULL;
+	}
+	return fdopen(fd, "w");
+}
+
+void base64(const byte_ard *in, int len, char *out){
+	const char *digits =
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	int pos = 0;
+	for(int i = 0; i < len; i += 3){
+		u_int32_ard v = in[i] << 16;
+		if(i+1 < len) v |= in[i+1] << 8;
+		if(i+2 < len) v |= in[i+2];
+		out[pos++] = digits[(v >> 18) & 0x3F];
+		out[pos++] = digits[(v >> 12) & 0x3F];
+		out[pos++] = i+1 < len ? digits[(v >> 6) & 0x3F] : '=';
+		out[pos++] = i+2 < len ? digits[v & 0x3F] : '=';
+	}
+	out[pos] = 0;
+}
+
+bool writeKeystore(FILE *f, const vector<device> &devices,
+				   const char *date){
+	fprintf(f, "# tsense keystore, %d devices provisioned %s\n",
+			(int)devices.size(), date);
+	for(size_t i = 0; i < devices.size(); i++){
+		char szId[(DEV_ID_LEN)*2+1], szKey[(DEV_KEY_LEN)*2+1];
+		hexString(devices[i].pid, DEV_ID_LEN, szId);
+		hexString(devices[i].key, DEV_KEY_LEN, szKey);
+		fprintf(f, "%s %s\n", szId, szKey);
+	}
+	return fclose(f) == 0;
+}
+
+bool writeSinkSeed(FILE *f, const vector<device> &devices){
+	byte_ard zero[KEY_BYTES];
+	char b64Zero[KEY_BYTES*2];
+	memset(zero, 0, sizeof(zero));
+	base64(zero, KEY_BYTES, b64Zero);
+
+	for(size_t i = 0; i < devices.size(); i++){
+		char b64PID[(DEV_ID_LEN)*2];
+		base64(devices[i].pid, DEV_ID_LEN, b64PID);
+		fprintf(f, "insert into sink_state (pid, KST, R) values "
+				"('%s', '%s', '%s');\n", b64PID, b64Zero, b64Zero);
+	}
+	return fclose(f) == 0;
+}
+
+void usage(){
+	fprintf(stderr, "SYNOPSIS\n");
+	fprintf(stderr, "    provision -i <Name,Model> [-o <Image dir>] [-k <Keystore>]\n"
+			"              [-s <Sink seed>] [-j <Threads>] <Manifest>\n\n");
+
+	fprintf(stderr, "DESCRIPTION\n");
+	fprintf(stderr, "    Provisions a lot of tsensors. Generates a master key for "
+			"every device\n    in the manifest and writes the EEPROM images, "
+			"the keystore of the auth\n    server and the sink_state seed "
+			"rows for the sink. See provision.cpp\n    for the manifest.\n\n");
+
+	fprintf(stderr, "OPTIONS\n");
+	fprintf(stderr, "    -i    Manufacturer name and model, as for tspcgen.py -m.\n");
+	fprintf(stderr, "    -o    Directory for the EEPROM images, one per device.\n");
+	fprintf(stderr, "    -k    Keystore to create, for tsauthd --keystore.\n");
+	fprintf(stderr, "    -s    SQL file to create with the sink_state rows.\n");
+	fprintf(stderr, "    -j    Threads generating keys. Default one per CPU.\n\n");
+}
+
+int main(int argc, char **argv) {
+
+	int c;
+	char *manInfo = NULL;
+	const char *imageDir = NULL;
+	const char *keystorePath = NULL;
+	const char *seedPath = NULL;
+	int threads = sysconf(_SC_NPROCESSORS_ONLN);
+
+	while ((c = getopt (argc, argv, "i:o:k:s:j:h")) != -1)
+	switch (c) {
+		case 'i':
+			manInfo = optarg;
+			break;
+		case 'o':
+			imageDir = optarg;
+			break;
+		case 'k':
+			keystorePath = optarg;
+			break;
+		case 's':
+			seedPath = optarg;
+			break;
+		case 'j':
+			threads = atoi(optarg);
+			break;
+		case 'h':
+			usage();
+			exit(0);
+		case '?':
+			usage();
+			exit(1);
+	}
+
+	char *model = manInfo != NULL ? strchr(manInfo, ',') : NULL;
+	if(optind != argc-1 || model == NULL || threads < 1 ||
+	   (imageDir == NULL && keystorePath == NULL && seedPath == NULL)){
+		usage();
+		exit(1);
+	}
+	*model++ = 0;
+
+	vector<device> devices;
+	if(!readManifest(argv[optind], devices)){
+		return 1;
+	}
+	if(devices.empty()){
+		fprintf(stderr, "Error - No devices in %s.\n", argv[optind]);
+		return 1;
+	}
+	if(imageDir != NULL && mkdir(imageDir, 0700) != 0 && errno != EEXIST){
+		fprintf(stderr, "Error - Can't create %s: %s\n", imageDir,
+				strerror(errno));
+		return 1;
+	}
+
+	// The date as tspcgen.py writes it.
+	char date[DEV_MAN_DATE_LEN+1];
+	time_t now = time(NULL);
+	strftime(date, sizeof(date), "%Y.%m.%d-%H:%M", localtime(&now));
+
+	byte_ard image[EEPROM_SIZE];
+	baseImage(image, manInfo, model, date);
+
+	// Before any key is made, so a run that can't keep them stops here.
+	FILE *keystore = NULL, *seed = NULL;
+	if(keystorePath != NULL && (keystore = createNew(keystorePath, 0600)) == NULL){
+		return 1;
+	}
+	if(seedPath != NULL && (seed = createNew(seedPath, 0644)) == NULL){
+		if(keystorePath != NULL){
+			unlink(keystorePath);
+		}
+		return 1;
+	}
+
+	timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if((size_t)threads > devices.size()){
+		threads = devices.size();
+	}
+	vector<job> jobs(threads);
+	vector<pthread_t> tids(threads);
+	for(int t = 0; t < threads; t++){
+		jobs[t].devices = &devices;
+		jobs[t].first = devices.size() * t / threads;
+		jobs[t].last = devices.size() * (t+1) / threads;
+		jobs[t].image = image;
+		jobs[t].imageDir = imageDir;
+		jobs[t].failed = false;
+		if(pthread_create(&tids[t], NULL, provisionJob, &jobs[t]) != 0){
+			fprintf(stderr, "Error - Can't start a thread.\n");
+			return 1;
+		}
+	}
+	bool failed = false;
+	for(int t = 0; t < threads; t++){
+		pthread_join(tids[t], NULL);
+		failed = failed || jobs[t].failed;
+	}
+	if(!failed){
+		failed = (keystore != NULL && !writeKeystore(keystore, devices, date)) ||
+				 (seed != NULL && !writeSinkSeed(seed, devices));
+	}
+	if(failed){
+		fprintf(stderr, "Error - Unable to provision the lot.\n");
+		if(imageDir != NULL){
+			fprintf(stderr, "Remove the images written to %s before trying "
+					"again.\n", imageDir);
+		}
+		if(keystorePath != NULL){
+			unlink(keystorePath);
+		}
+		if(seedPath != NULL){
+			unlink(seedPath);
+		}
+		return 1;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	printf("Provisioned %d devices in %.2f s on %d thread(s).\n",
+		   (int)devices.size(),
+		   (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec)/1e9,
+		   threads);
+
+	return 0;
+} // end main()
@@ -0,0 +1,297 @@
+/*
+ * File name: test_serial_port.cpp
+ * Date:      2026-10-20 01:05
+ * Author:
+ */
+
+#include <iostream>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "ts_serialport.h"
+#include "test_check.h"
+
+using namespace std;
+
+// What the sensor side of the pty got, -1 if nothing.
+int readCmd(int master){
+	byte_ard cmd;
+	usleep(10000);
+	return read(master, &cmd, 1) == 1 ? cmd : -1;
+}
+
+// Sends bytes from the sensor side and reads them into the port.
+void fromSensor(int master, TsSerialPort *port, const byte_ard *buf, int len){
+	write(master, buf, len);
+	usleep(10000);
+	port->read();
+}
+
+// The sensor end of a framed line: sends a frame and reads it into the port.
+void frameFromSensor(int master, TsSerialPort *port, byte_ard ctl, byte_ard seq,
+					 const byte_ard *payload, int len, int flip = -1){
+	byte_ard frame[LINK_FRAME_MAX];
+	int n = link_encode_frame(ctl, seq, payload, len, frame);
+	if(flip >= 0){
+		frame[flip] ^= 0x10;
+	}
+	fromSensor(master, port, frame, n);
+}
+
+// Reads the frames the port sent to the sensor end. Returns the payload of
+// the data frames in data, the last ACK or NAK in ctl and seq.
+int framesToSensor(int master, struct serial_link *link, byte_ard *data,
+				   byte_ard *ctl, byte_ard *seq){
+	byte_ard buf[256];
+	int len = 0;
+	usleep(10000);
+	int n = read(master, buf, sizeof(buf));
+	for(int i = 0; i < n; i++){
+		if(link_rx_byte(link, buf[i]) != LINK_RX_FRAME){
+			continue;
+		}
+		if(link->rxCtl != LINK_CTL_DATA){
+			*ctl = link->rxCtl;
+			*seq = link->rxFrameSeq;
+			continue;
+		}
+		memcpy(data+len, link->frame+LINK_HEADER_SIZE, link->rxLen);
+		len += link->rxLen;
+	}
+	return len;
+}
+
+int main() {
+	byte_ard id[ID_SIZE] = { 1, 2, 3, 4, 5, 6 };
+	byte_ard *msg;
+	int len;
+
+	//--------------------------------------------------------------------------
+	// TEST #1
+	//--------------------------------------------------------------------------
+	cout << "Message lengths:" << endl;
+	byte_ard data[2+ID_SIZE+16+BLOCK_BYTE_SIZE];
+	memset(data, 0, sizeof(data));
+	data[0] = MSG_T_DATA_SEND;
+	data[1] = 16;
+	memcpy(data+2, id, ID_SIZE);
+
+	byte_ard idResp[IDMSG_FULLSIZE];
+	memset(idResp, 0, sizeof(idResp));
+	idResp[0] = MSG_T_GET_ID_R;
+	memcpy(idResp+1, id, ID_SIZE);
+
+	byte_ard half[] = { FW_DEBUG_PACKET, 3, 'a' };
+	byte_ard junk[] = { 0x00, 0x10 };
+
+	check(TsSerialPort::messageLength(data, sizeof(data)) == sizeof(data),
+			"data message");
+	data[0] |= MSG_T_DATA_PACKED_FLAG;
+	check(TsSerialPort::messageLength(data, 2) == sizeof(data),
+			"packed data message from its header");
+	check(TsSerialPort::messageLength(idResp, 1) == IDMSG_FULLSIZE,
+			"id response from its type");
+	check(TsSerialPort::messageLength(half, sizeof(half)) == 0,
+			"debug packet without its data length");
+	check(TsSerialPort::messageLength(junk, sizeof(junk)) == -1, "no message");
+
+	//--------------------------------------------------------------------------
+	// TEST #2
+	//--------------------------------------------------------------------------
+	cout << "Probing a sensor in standby:" << endl;
+	int master = posix_openpt(O_RDWR | O_NOCTTY);
+	fcntl(master, F_SETFL, O_NONBLOCK);
+	grantpt(master);
+	unlockpt(master);
+
+	TsSerialPort *port = new TsSerialPort(ptsname(master), B9600);
+	u_int64_ard now = 1000;
+
+	check(port->tick(now), "port opened at the first tick");
+	check(port->getState() == PORT_PROBE, "probing");
+	port->tick(now + PORT_STARTUP_MS - 1);
+	check(readCmd(master) == -1, "no query while the sensor starts up");
+	now += PORT_STARTUP_MS;
+	port->tick(now);
+	check(readCmd(master) == FW_STATE_Q, "state query sent");
+
+	byte_ard standby[] = { FW_STATE_R, FW_STATE_STANDBY, 0 };
+	fromSensor(master, port, standby, sizeof(standby));
+	len = port->nextMessage(&msg);
+	check(len == sizeof(standby), "state response read");
+	check(port->message(msg, len, now) == PORT_LOCAL, "kept by the gateway");
+	check(readCmd(master) == FW_GET_ID_Q, "id query sent");
+	check(port->getState() == PORT_KEYING, "keying");
+
+	//--------------------------------------------------------------------------
+	// TEST #3
+	//--------------------------------------------------------------------------
+	cout << "Resync and forwarding:" << endl;
+	byte_ard noise[] = { 0x00, 0x66, 0x99 };
+	fromSensor(master, port, noise, sizeof(noise));
+	fromSensor(master, port, idResp, sizeof(idResp));
+	len = port->nextMessage(&msg);
+	check(len == IDMSG_FULLSIZE && msg[0] == MSG_T_GET_ID_R,
+			"id response found behind the noise");
+	check(port->resyncs == sizeof(noise), "noise counted");
+	check(port->message(msg, len, now) == PORT_FORWARD, "forwarded");
+	check(port->hasId() && memcmp(port->getId(), id, ID_SIZE) == 0,
+			"id learned");
+
+	// Split over two reads.
+	data[0] = MSG_T_DATA_SEND;
+	fromSensor(master, port, data, 10);
+	check(port->nextMessage(&msg) == 0, "half a message is not handed out");
+	fromSensor(master, port, data+10, sizeof(data)-10);
+	len = port->nextMessage(&msg);
+	check(len == sizeof(data), "rest of the message joined");
+	check(port->message(msg, len, now) == PORT_FORWARD, "data forwarded");
+	check(port->getState() == PORT_RUNNING, "running");
+
+	//--------------------------------------------------------------------------
+	// TEST #4
+	//--------------------------------------------------------------------------
+	cout << "Debug packets:" << endl;
+	byte_ard dbg[] = { FW_DEBUG_PACKET, 2, 'h', 'i', 1, 0, 0x42 };
+	fromSensor(master, port, dbg, sizeof(dbg));
+	len = port->nextMessage(&msg);
+	check(len == sizeof(dbg), "short debug packet read");
+	check(port->message(msg, len, now) == PORT_LOCAL, "kept by the gateway");
+
+	// Longer than the buffer, skipped over several reads.
+	int bigLen = 2*SERIAL_BUFSIZE;
+	byte_ard bigHead[] = { FW_DEBUG_PACKET, 0, (byte_ard)(bigLen & 0xFF),
+						   (byte_ard)(bigLen >> 8) };
+	byte_ard filler[SERIAL_BUFSIZE/2];
+	memset(filler, MSG_T_GET_ID_R, sizeof(filler));
+	fromSensor(master, port, bigHead, sizeof(bigHead));
+	int got = 0;
+	for(int i = 0; i < 4; i++){
+		fromSensor(master, port, filler, sizeof(filler));
+		got += port->nextMessage(&msg);
+	}
+	byte_ard ack[] = { FW_ACK, 0 };
+	fromSensor(master, port, ack, sizeof(ack));
+	len = port->nextMessage(&msg);
+	check(got == 0 && len == sizeof(ack) && msg[0] == FW_ACK,
+			"long debug packet skipped");
+
+	//--------------------------------------------------------------------------
+	// TEST #5
+	//--------------------------------------------------------------------------
+	cout << "Deadlines and errors:" << endl;
+	port->tick(now + PORT_SILENT_MS);
+	now += PORT_SILENT_MS;
+	check(readCmd(master) == FW_STATE_Q, "silent sensor probed");
+
+	byte_ard error[] = { FW_STATE_R, FW_STATE_ERROR, 0x02 };
+	fromSensor(master, port, error, sizeof(error));
+	len = port->nextMessage(&msg);
+	port->message(msg, len, now);
+	check(readCmd(master) == MSG_T_FINISH, "sensor in error reset");
+	check(port->getState() == PORT_PROBE, "probing again");
+
+	byte_ard running[] = { FW_STATE_R, FW_STATE_RUNNING, 0 };
+	fromSensor(master, port, running, sizeof(running));
+	len = port->nextMessage(&msg);
+	port->message(msg, len, now);
+	check(readCmd(master) == -1, "running sensor left alone");
+	check(port->getState() == PORT_RUNNING, "running");
+
+	//--------------------------------------------------------------------------
+	// TEST #6
+	//--------------------------------------------------------------------------
+	cout << "Framed link:" << endl;
+	int linkMaster = posix_openpt(O_RDWR | O_NOCTTY);
+	fcntl(linkMaster, F_SETFL, O_NONBLOCK);
+	grantpt(linkMaster);
+	unlockpt(linkMaster);
+
+	TsSerialPort *linkPort = new TsSerialPort(ptsname(linkMaster), B9600,
+											  LINK_BAUD_115200);
+	u_int64_ard linkNow = 1000;
+	linkPort->tick(linkNow);
+	linkNow += PORT_STARTUP_MS;
+	linkPort->tick(linkNow);
+	check(readCmd(linkMaster) == LINK_START_CMD &&
+		  readCmd(linkMaster) == LINK_BAUD_115200, "link offered");
+
+	// The sensor can do no more than 57600.
+	byte_ard linkStart[] = { LINK_START_R, LINK_BAUD_57600 };
+	fromSensor(linkMaster, linkPort, linkStart, sizeof(linkStart));
+	len = linkPort->nextMessage(&msg);
+	check(len == sizeof(linkStart) &&
+		  linkPort->message(msg, len, linkNow) == PORT_LOCAL &&
+		  linkPort->isFramed(), "switched to frames");
+
+	struct serial_link sensor;
+	link_init(&sensor, 57600);
+	byte_ard payload[SERIAL_BUFSIZE];
+	byte_ard ctl = 0, seq = 0;
+	len = framesToSensor(linkMaster, &sensor, payload, &ctl, &seq);
+	check(ctl == LINK_CTL_ACK && len == 1 && payload[0] == FW_STATE_Q,
+		  "confirmed and state query framed");
+	frameFromSensor(linkMaster, linkPort, LINK_CTL_ACK, 0, NULL, 0);
+
+	// The answer in two frames, the second one first.
+	frameFromSensor(linkMaster, linkPort, LINK_CTL_DATA, 1, standby+2, 1);
+	check(linkPort->nextMessage(&msg) == 0, "frame ahead held");
+	framesToSensor(linkMaster, &sensor, payload, &ctl, &seq);
+	check(ctl == LINK_CTL_NAK && seq == 0, "missing frame NAKed");
+	frameFromSensor(linkMaster, linkPort, LINK_CTL_DATA, 0, standby, 2);
+	len = linkPort->nextMessage(&msg);
+	check(len == sizeof(standby) && memcmp(msg, standby, len) == 0,
+		  "state response read in order");
+	linkPort->message(msg, len, linkNow);
+	len = framesToSensor(linkMaster, &sensor, payload, &ctl, &seq);
+	check(ctl == LINK_CTL_ACK && seq == 1, "both ACKed");
+	check(len == 1 && payload[0] == FW_GET_ID_Q, "id query framed");
+
+	frameFromSensor(linkMaster, linkPort, LINK_CTL_DATA, 2, idResp, 8, 3);
+	check(linkPort->getLink()->crcErrors == 1 &&
+		  linkPort->nextMessage(&msg) == 0, "corrupt frame dropped");
+
+	// The id query is not ACKed, so it goes again.
+	usleep(linkPort->getLink()->retryMs * 1000);
+	linkPort->tick(linkNow);
+	len = framesToSensor(linkMaster, &sensor, payload, &ctl, &seq);
+	check(len == 1 && payload[0] == FW_GET_ID_Q &&
+		  linkPort->getLink()->retransmits == 1, "unACKed frame resent");
+
+	// A sensor back on the raw line does not answer the probe.
+	linkNow += PORT_KEYING_MS;
+	linkPort->tick(linkNow);
+	framesToSensor(linkMaster, &sensor, payload, &ctl, &seq);
+	linkNow += PORT_REPLY_MS;
+	linkPort->tick(linkNow);
+	check(!linkPort->isFramed(), "back to the raw line");
+	check(readCmd(linkMaster) == LINK_START_CMD &&
+		  readCmd(linkMaster) == LINK_BAUD_115200, "link offered again");
+
+	// Firmware without the link answers an unknown message.
+	byte_ard unknown[] = { FW_ACK, 0x01 };
+	fromSensor(linkMaster, linkPort, unknown, sizeof(unknown));
+	len = linkPort->nextMessage(&msg);
+	linkPort->message(msg, len, linkNow);
+	linkPort->tick(linkNow);
+	check(readCmd(linkMaster) == FW_STATE_Q && !linkPort->isFramed(),
+		  "probed on the raw line");
+	close(linkMaster);
+	delete linkPort;
+
+	//--------------------------------------------------------------------------
+	// TEST #7
+	//--------------------------------------------------------------------------
+	cout << "Hang up:" << endl;
+	close(master);
+	check(port->read() < 0, "hang up seen");
+	port->close(now);
+	check(port->getState() == PORT_CLOSED && port->getFd() < 0, "closed");
+	check(!port->tick(now + PORT_REOPEN_MS - 1), "not reopened early");
+	delete port;
+
+	return testSummary();
+}
@@ -0,0 +1,378 @@
+/*
+   File name: ts_gateway.cpp
+   Date:      2026-10-20 00:30
+   Author:
+*/
+
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <syslog.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/epoll.h>
+
+#include "ts_gateway.h"
+
+/* Sets up a gateway for the sink's gateway port at sinkAddr:sinkPort and
+ * the sensors on portPaths, serial ports or pseudo-terminals at speed.
+ * Nothing is opened or connected before serverMain(). Throws a
+ * runtime_error if the sink address does not resolve.
+ */
+TsGateway::TsGateway(const char *sinkAddr, const char *sinkPort,
+					 const vector<string> &portPaths,
+					 int linkCount, u_int32_ard flushMs, speed_t speed,
+					 int linkCode) :
+					 TlsBaseServer(CLIENT_MODE, sinkAddr, sinkPort)
+{
+	_flushMs = flushMs;
+	framesIn = framesDown = unrouted = 0;
+	lastStats = time(NULL);
+
+	// The base class context speaks TLSv1 alone, like the sensor facing
+	// servers. The sink's gateway port takes TLS 1.2 and later, which also
+	// lets it hand the records of the session to the kernel (--ktls).
+	SSL_CTX_free(ctx);
+	ctx = setupServerCtx(CLIENT_MODE, CTX_TLS12);
+
+	resolveSink();
+
+	if((epollFd = epoll_create1(0)) < 0){
+		throw runtime_error("Unable to create the epoll instance.");
+	}
+
+	for(unsigned int i = 0; i < portPaths.size(); i++){
+		ports.push_back(new TsSerialPort(portPaths[i].c_str(), speed, linkCode));
+		portEvents.push_back(0);
+	}
+
+	for(int i = 0; i < linkCount; i++){
+		links.push_back(new TsSinkLink(ctx, (struct sockaddr*)&this->sinkAddr,
+									   sinkAddrLen, epollFd,
+									   ((u_int64_ard)GW_EV_LINK << 32) | i,
+									   flushMs));
+	}
+}
+
+TsGateway::~TsGateway(){
+	for(unsigned int i = 0; i < ports.size(); i++){
+		delete ports[i];
+	}
+	for(unsigned int i = 0; i < links.size(); i++){
+		delete links[i];
+	}
+	close(epollFd);
+}
+
+u_int64_ard TsGateway::nowMs(){
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u_int64_ard)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+void TsGateway::resolveSink(){
+	struct addrinfo hints, *res;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	if(getaddrinfo(_serverAddr, _serverListenPort, &hints, &res) != 0){
+		throw runtime_error("Unable to resolve the sink address.");
+	}
+	memcpy(&sinkAddr, res->ai_addr, res->ai_addrlen);
+	sinkAddrLen = res->ai_addrlen;
+	freeaddrinfo(res);
+}
+
+/* Watches a port for reading, and for writing while it has output
+ * waiting.
+ */
+void TsGateway::watchPort(int index){
+	TsSerialPort *port = ports[index];
+	if(port->getFd() < 0){
+		portEvents[index] = 0;
+		return;
+	}
+
+	u_int32_ard events = EPOLLIN;
+	if(port->wantsWrite()){
+		events |= EPOLLOUT;
+	}
+	if(events == portEvents[index]){
+		return;
+	}
+
+	struct epoll_event ev;
+	ev.events = events;
+	ev.data.u64 = ((u_int64_ard)GW_EV_PORT << 32) | index;
+	epoll_ctl(epollFd, portEvents[index] == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD,
+			  port->getFd(), &ev);
+	portEvents[index] = events;
+}
+
+/* The link for the messages of a port. Its own while that is up, else the
+ * next one that is. With all of them down the frames wait on its own.
+ */
+TsSinkLink *TsGateway::linkFor(int index){
+	int n = links.size();
+	int own = index % n;
+	for(int i = 0; i < n; i++){
+		TsSinkLink *link = links[(own+i) % n];
+		if(link->getState() == LINK_UP){
+			return link;
+		}
+	}
+	return links[own];
+}
+
+void TsGateway::portEvent(int index, u_int32_ard events, u_int64_ard now){
+	TsSerialPort *port = ports[index];
+	bool hungUp = false;
+
+	if(events & EPOLLOUT){
+		hungUp = port->flush() < 0;
+	}
+
+	if(!hungUp && (events & (EPOLLIN | EPOLLHUP | EPOLLERR))){
+		hungUp = port->read() < 0;
+
+		byte_ard *msg;
+		int len;
+		while((len = port->nextMessage(&msg)) > 0){
+			if(port->message(msg, len, now) == PORT_FORWARD){
+				forward(index, msg, len, now);
+			}
+		}
+	}
+
+	if(hungUp){
+		syslog(LOG_NOTICE, "%s hung up, reopening it later.", port->getPath());
+		// Closing the descriptor takes it out of the epoll set.
+		port->close(now);
+		portEvents[index] = 0;
+		return;
+	}
+
+	watchPort(index);
+}
+
+/* Queues a message of the sensor on a port for the sink, and makes sure
+ * answers to it find their way back to the port.
+ */
+void TsGateway::forward(int index, byte_ard *msg, int len, u_int64_ard now){
+	TsSerialPort *port = ports[index];
+	string id((const char*)port->getId(), ID_SIZE);
+
+	map<string, int>::iterator it = routes.find(id);
+	if(it == routes.end() || it->second != index){
+		const byte_ard *pID = port->getId();
+		syslog(LOG_NOTICE, "Sensor %d%d-%d%d%d%d on %s", pID[0], pID[1],
+			   pID[2], pID[3], pID[4], pID[5], port->getPath());
+		routes[id] = index;
+	}
+
+	framesIn++;
+	linkFor(index)->queue(port->getId(), msg, len, now);
+}
+
+/* Hands the frames the sink sent on a link to the ports of their sensors.
+ * Returns -1 if a frame is malformed.
+ */
+int TsGateway::route(TsSinkLink *link, u_int64_ard now){
+	byte_ard routeId[ID_SIZE];
+	byte_ard *plain = link->plain();
+	int plainLen = link->plainLength();
+	int offset = 0;
+
+	while(plainLen - offset >= GWFRAME_HEADER_SIZE){
+		int msgLen = unpack_gwframe_header(plain+offset, routeId);
+		if(msgLen == 0 || msgLen > LINK_FRAME_SIZE){
+			syslog(LOG_ERR, "Malformed frame from the sink.");
+			return -1;
+		}
+		if(plainLen - offset < GWFRAME_HEADER_SIZE + msgLen){
+			break;
+		}
+
+		byte_ard *msg = plain + offset + GWFRAME_HEADER_SIZE;
+		offset += GWFRAME_HEADER_SIZE + msgLen;
+
+		map<string, int>::iterator it =
+			routes.find(string((const char*)routeId, ID_SIZE));
+		if(it == routes.end() || ports[it->second]->getFd() < 0 ||
+		   ports[it->second]->write(msg, msgLen, now) < 0){
+			unrouted++;
+			continue;
+		}
+		framesDown++;
+		watchPort(it->second);
+	}
+
+	link->consume(offset);
+	return 0;
+}
+
+void TsGateway::linkEvent(int index, u_int32_ard events, u_int64_ard now){
+	TsSinkLink *link = links[index];
+	int ret = link->onEvent(events);
+
+	while(ret != LINK_FAILED){
+		if(ret == LINK_OPENED){
+			long err = postConnectionValidations(link->getSsl(), _serverAddr);
+			if(err != X509_V_OK){
+				syslog(LOG_ERR, "-Error: sink certificate: %s",
+					   X509_verify_cert_error_string(err));
+				ret = LINK_FAILED;
+				break;
+			}
+			syslog(LOG_NOTICE, "Link %d to the sink up.", index);
+		}
+
+		if(route(link, now) < 0){
+			ret = LINK_FAILED;
+			break;
+		}
+
+		// Records OpenSSL has read ahead of the socket raise no event.
+		if(link->getState() != LINK_UP || SSL_pending(link->getSsl()) == 0){
+			break;
+		}
+		ret = link->onEvent(EPOLLIN);
+	}
+
+	if(ret == LINK_FAILED){
+		syslog(LOG_ERR, "Link %d to the sink down.", index);
+		link->close(now);
+	}
+}
+
+/* Deadlines of the ports and reconnects of the links.
+ */
+void TsGateway::tick(u_int64_ard now){
+	for(unsigned int i = 0; i < ports.size(); i++){
+		ports[i]->tick(now);
+		watchPort(i);
+	}
+
+	for(unsigned int i = 0; i < links.size(); i++){
+		TsSinkLink *link = links[i];
+		if(link->getState() == LINK_DOWN && now >= link->retryAt){
+			link->connect(now);
+		}
+	}
+}
+
+void TsGateway::flushLinks(u_int64_ard now){
+	for(unsigned int i = 0; i < links.size(); i++){
+		TsSinkLink *link = links[i];
+		if(link->due(now) && link->flush() < 0){
+			syslog(LOG_ERR, "Link %d to the sink down.", i);
+			link->close(now);
+		}
+	}
+}
+
+// Waits no longer than the flush delay while frames are waiting.
+int TsGateway::nextTimeout(u_int64_ard now){
+	for(unsigned int i = 0; i < links.size(); i++){
+		if(links[i]->getState() == LINK_UP && links[i]->pending()){
+			return _flushMs < GW_TICK_MS ? _flushMs : GW_TICK_MS;
+		}
+	}
+	return GW_TICK_MS;
+}
+
+void TsGateway::logStatsIfDue(){
+	if(time(NULL) - lastStats >= GW_STATS_INTERVAL){
+		logStats();
+	}
+}
+
+void TsGateway::logStats(){
+	int running = 0, keying = 0, closed = 0, framed = 0, linksUp = 0;
+	u_int64_ard resyncs = 0, writes = 0, dropped = 0;
+	u_int64_ard badFrames = 0, resent = 0, givenUp = 0;
+
+	for(unsigned int i = 0; i < ports.size(); i++){
+		switch(ports[i]->getState()){
+			case PORT_RUNNING: running++; break;
+			case PORT_KEYING:  keying++;  break;
+			case PORT_CLOSED:  closed++;  break;
+		}
+		resyncs += ports[i]->resyncs;
+		if(ports[i]->isFramed()){
+			framed++;
+		}
+		// Counted since the link last started on the port.
+		const struct serial_link *link = ports[i]->getLink();
+		badFrames += link->crcErrors;
+		resent += link->retransmits;
+		givenUp += link->drops;
+	}
+	for(unsigned int i = 0; i < links.size(); i++){
+		if(links[i]->getState() == LINK_UP){
+			linksUp++;
+		}
+		writes += links[i]->writes;
+		dropped += links[i]->dropped;
+	}
+
+	syslog(LOG_NOTICE, "Ports: %d, %d running, %d keying, %d closed, "
+		   "%llu bytes resynced", (int)ports.size(), running, keying, closed,
+		   (unsigned long long)resyncs);
+	syslog(LOG_NOTICE, "Serial: %d framed, %llu bad frames, %llu resent, "
+		   "%llu given up", framed, (unsigned long long)badFrames,
+		   (unsigned long long)resent, (unsigned long long)givenUp);
+	syslog(LOG_NOTICE, "Links: %d of %d up, %llu frames to the sink in %llu "
+		   "writes, %llu dropped, %llu back, %llu unrouted", linksUp,
+		   (int)links.size(), (unsigned long long)framesIn,
+		   (unsigned long long)writes, (unsigned long long)dropped,
+		   (unsigned long long)framesDown, (unsigned long long)unrouted);
+
+	lastStats = time(NULL);
+}
+
+/* The epoll loop. Every round handles the events, then the deadlines, and
+ * sends the frames that are due, so the messages that came in during a
+ * round go to the sink together.
+ */
+void TsGateway::serverMain(){
+	struct epoll_event events[GW_MAX_EVENTS];
+	u_int64_ard now = nowMs();
+	u_int64_ard lastTick = 0;
+
+	// A link that breaks mid write must not take the gateway down with it.
+	signal(SIGPIPE, SIG_IGN);
+
+	syslog(LOG_NOTICE, "Gateway for %d ports on %d links to %s:%s.",
+		   (int)ports.size(), (int)links.size(), _serverAddr,
+		   _serverListenPort);
+
+	while(true){
+		if(now - lastTick >= GW_TICK_MS){
+			tick(now);
+			lastTick = now;
+		}
+
+		int n = epoll_wait(epollFd, events, GW_MAX_EVENTS, nextTimeout(now));
+		if(n < 0 && errno != EINTR){
+			log_err_exit("Error waiting for epoll events.");
+		}
+		now = nowMs();
+
+		for(int i = 0; i < n; i++){
+			int kind = events[i].data.u64 >> 32;
+			int index = events[i].data.u64 & 0xFFFFFFFF;
+
+			if(kind == GW_EV_PORT){
+				portEvent(index, events[i].events, now);
+			}else{
+				linkEvent(index, events[i].events, now);
+			}
+		}
+
+		flushLinks(now);
+		logStatsIfDue();
+	}
+}
@@ -0,0 +1,100 @@
+/*
+   File name: ts_gateway.h
+   Date:      2026-10-20 00:30
+   Author:
+*/
+
+#ifndef __TS_GATEWAY_H__
+#define __TS_GATEWAY_H__
+
+#include <map>
+#include <string>
+#include <vector>
+#include <termios.h>
+
+#include "tls_baseserver.h"
+#include "ts_serialport.h"
+#include "ts_sinklink.h"
+
+using namespace std;
+
+#define GW_LINKS    4
+#define GW_FLUSH_MS 20
+
+// Deadlines of the ports are checked this often, in msec.
+#define GW_TICK_MS 100
+
+#define GW_MAX_EVENTS 256
+
+// Seconds between the counters in the log.
+#define GW_STATS_INTERVAL 60
+
+// epoll_event.data.u64 is the kind of endpoint in the high word and its
+// index in the low one.
+#define GW_EV_PORT 1
+#define GW_EV_LINK 2
+
+/* The gateway, the production proxy client. It relays the serial traffic
+ * of many tsensors to the sink over a few persistent TLS connections to
+ * the gateway port of the sink, the messages of every sensor wrapped in a
+ * gateway frame (see pack_gwframe_header()) and answered in one.
+ *
+ * One thread serves all of it from an epoll loop, the ports (TsSerialPort)
+ * and the links (TsSinkLink) never block. The messages of a port always go
+ * on the same link while it is up, so the sink sees those of a sensor in
+ * order, and on the next link that is up while it is not. Answers from the
+ * sink find their port by the sensor ID in the frame, which the gateway
+ * learns from the messages of the port.
+ *
+ * A TLS client in the sense of TlsBaseServer: the links use a context set
+ * up in CLIENT_MODE for TLS 1.2 or later, so the gateway shows client.pem
+ * to the sink and checks the sink against root.pem.
+ */
+class TsGateway : public TlsBaseServer {
+	private:
+		int epollFd;
+		vector<TsSerialPort*> ports;
+		vector<TsSinkLink*> links;
+		struct sockaddr_storage sinkAddr;
+		socklen_t sinkAddrLen;
+		u_int32_ard _flushMs;
+
+		// Sensor IDs, as raw bytes, to the index of their port.
+		map<string, int> routes;
+
+		// Events each port is watched for, 0 while it is closed.
+		vector<u_int32_ard> portEvents;
+
+		u_int64_ard framesIn, framesDown, unrouted;
+		time_t lastStats;
+
+		void resolveSink();
+		void watchPort(int index);
+		TsSinkLink *linkFor(int index);
+
+		void portEvent(int index, u_int32_ard events, u_int64_ard now);
+		void linkEvent(int index, u_int32_ard events, u_int64_ard now);
+		void forward(int index, byte_ard *msg, int len, u_int64_ard now);
+		int route(TsSinkLink *link, u_int64_ard now);
+		void tick(u_int64_ard now);
+		void flushLinks(u_int64_ard now);
+		int nextTimeout(u_int64_ard now);
+
+		void logStatsIfDue();
+		void logStats();
+
+	public:
+		TsGateway(const char *sinkAddr, const char *sinkPort,
+				  const vector<string> &portPaths,
+				  int linkCount = GW_LINKS,
+				  u_int32_ard flushMs = GW_FLUSH_MS,
+				  speed_t speed = B9600,
+				  int linkCode = PORT_NO_LINK);
+		~TsGateway();
+
+		static u_int64_ard nowMs();
+
+		void serverMain();
+};
+
+#endif
@@ -0,0 +1,560 @@
+/*
+   File name: ts_serialport.cpp
+   Date:      2026-10-19 23:55
+   Author:
+*/
+
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <syslog.h>
+#include <time.h>
+
+#include "ts_serialport.h"
+
+// The clock of the framed line, in msec like TsGateway::nowMs().
+static u_int64_ard clockMs(){
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u_int64_ard)ts.tv_sec*1000 + ts.tv_nsec/1000000;
+}
+
+// The termios speed for a LINK_BAUD_ code, 0 for none.
+static speed_t linkSpeed(byte_ard code){
+	switch(code){
+		case LINK_BAUD_9600:   return B9600;
+		case LINK_BAUD_19200:  return B19200;
+		case LINK_BAUD_38400:  return B38400;
+		case LINK_BAUD_57600:  return B57600;
+		case LINK_BAUD_115200: return B115200;
+		case LINK_BAUD_230400: return B230400;
+		case LINK_BAUD_500000: return B500000;
+	}
+	return (speed_t)0;
+}
+
+TsSerialPort::TsSerialPort(const char *path, speed_t speed, int linkCode){
+	this->path = strdup(path);
+	this->speed = speed;
+	this->linkCode = linkCode;
+	fd = -1;
+	inLen = inDone = 0;
+	skip = 0;
+	outLen = 0;
+	idKnown = false;
+	state = PORT_CLOSED;
+	deadline = 0;
+	queryPending = false;
+	linkAsked = linkPending = framed = false;
+	wireLen = 0;
+	replyDue = false;
+	lastTx = 0;
+	resyncs = 0;
+}
+
+TsSerialPort::~TsSerialPort(){
+	if(fd >= 0){
+		::close(fd);
+	}
+	free(path);
+}
+
+/* Returns the length of the sensor message that starts msg, 0 if more of
+ * it has to be in to tell, or -1 if no message starts with that byte.
+ */
+int TsSerialPort::messageLength(const byte_ard *msg, int len){
+	if(len < 1){
+		return 0;
+	}
+
+	switch(msg[0]){
+		case MSG_T_GET_ID_R:
+			return IDMSG_FULLSIZE;
+		case MSG_T_REKEY_HANDSHAKE:
+			return REKEY_FULLSIZE;
+		case FW_ACK:
+			return 2;
+		case LINK_START_R:
+			return LINK_START_R_SIZE;
+		case FW_FREE_MEM_R:
+		case FW_STATE_R:
+			return 3;
+		case FW_VERSION_R:
+			return 4;
+		case FW_CUR_TIME_R:
+			return 5;
+		case FW_DEBUG_PACKET:
+			// Text length, text, data length (LSB first) and data.
+			if(len < 2 || len < 4 + msg[1]){
+				return 0;
+			}
+			return 4 + msg[1] + (msg[2+msg[1]] | (msg[3+msg[1]] << 8));
+	}
+
+	if(len < 2){
+		return 0;
+	}
+
+	switch(msg[0] & ~MSG_T_DATA_FLAGS){
+		case MSG_T_DATA_SEND:
+			return 2 + ID_SIZE + msg[1] + BLOCK_BYTE_SIZE;
+		case MSG_T_DATA_SEND_GCM:
+			return DATA_GCM_HEADER_SIZE + msg[1] + GCM_TAG_SIZE;
+	}
+
+	return -1;
+}
+
+/* Opens the port raw, without blocking, at the speed of the port. The
+ * sensor is probed once it had the time to start up, opening the port
+ * resets a sensor on USB. Returns false if the port can't be opened, it
+ * is then tried again after PORT_REOPEN_MS.
+ */
+bool TsSerialPort::open(u_int64_ard now){
+	fd = ::open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+	if(fd < 0){
+		syslog(LOG_ERR, "Can't open %s: %s", path, strerror(errno));
+		setState(PORT_CLOSED, now + PORT_REOPEN_MS);
+		return false;
+	}
+
+	setSpeed(speed);
+	tcflush(fd, TCIOFLUSH);
+
+	inLen = inDone = 0;
+	skip = 0;
+	outLen = 0;
+	queryPending = false;
+	linkAsked = linkPending = framed = false;
+	wireLen = 0;
+	replyDue = false;
+	setState(PORT_PROBE, now + PORT_STARTUP_MS);
+	return true;
+}
+
+void TsSerialPort::setSpeed(speed_t lineSpeed){
+	termios tio;
+	if(tcgetattr(fd, &tio) == 0){
+		cfmakeraw(&tio);
+		cfsetispeed(&tio, lineSpeed);
+		cfsetospeed(&tio, lineSpeed);
+		tio.c_cflag |= CLOCAL | CREAD;
+		tcsetattr(fd, TCSANOW, &tio);
+	}
+}
+
+/* The sensor took the offer of the framed link and has switched to the
+ * rate in code. The first frame, an ACK, confirms the link to it, the
+ * state query after it shows the link works both ways.
+ */
+void TsSerialPort::startLink(byte_ard code, u_int64_ard now){
+	speed_t lineSpeed = linkSpeed(code);
+	if(lineSpeed == (speed_t)0){
+		// Left alone the sensor goes back to the raw line by itself.
+		syslog(LOG_ERR, "%s: sensor switched to unknown rate %d", path, code);
+		return;
+	}
+
+	setSpeed(lineSpeed);
+	link_init(&link, link_baud(code));
+	framed = true;
+	outLen = wireLen = 0;
+	replyDue = true;
+	syslog(LOG_NOTICE, "%s: framed link at %ld baud", path, link_baud(code));
+	probe(now);
+}
+
+/* Back to the raw line at the speed of the port. The link is offered
+ * again at the next probe.
+ */
+void TsSerialPort::stopLink(){
+	framed = false;
+	setSpeed(speed);
+	tcflush(fd, TCIOFLUSH);
+	inLen = inDone = 0;
+	skip = 0;
+	outLen = wireLen = 0;
+	replyDue = false;
+	linkAsked = linkPending = false;
+}
+
+void TsSerialPort::close(u_int64_ard now){
+	if(fd >= 0){
+		::close(fd);
+		fd = -1;
+	}
+	setState(PORT_CLOSED, now + PORT_REOPEN_MS);
+}
+
+int TsSerialPort::getFd(){
+	return fd;
+}
+
+const char *TsSerialPort::getPath(){
+	return path;
+}
+
+int TsSerialPort::getState(){
+	return state;
+}
+
+bool TsSerialPort::isFramed(){
+	return framed;
+}
+
+const struct serial_link *TsSerialPort::getLink(){
+	return &link;
+}
+
+bool TsSerialPort::hasId(){
+	return idKnown;
+}
+
+const byte_ard *TsSerialPort::getId(){
+	return id;
+}
+
+void TsSerialPort::setState(int newState, u_int64_ard at){
+	state = newState;
+	deadline = at;
+}
+
+void TsSerialPort::probe(u_int64_ard now){
+	send(FW_STATE_Q);
+	queryPending = true;
+	setState(PORT_PROBE, now + PORT_REPLY_MS);
+}
+
+/* Reads what the port has. Returns the number of bytes read, 0 if there
+ * was nothing, or -1 if the port hung up.
+ */
+int TsSerialPort::read(){
+	// Messages handed out are done with, make room behind the rest.
+	if(inDone > 0){
+		memmove(inBuf, inBuf+inDone, inLen-inDone);
+		inLen -= inDone;
+		inDone = 0;
+	}
+
+	if(framed){
+		return readFrames();
+	}
+
+	int total = 0;
+	while(inLen < SERIAL_BUFSIZE){
+		int n = ::read(fd, inBuf+inLen, SERIAL_BUFSIZE-inLen);
+		if(n > 0){
+			inLen += n;
+			total += n;
+			continue;
+		}
+		if(n < 0 && (errno == EAGAIN || errno == EINTR)){
+			break;
+		}
+		// End of file or EIO, the device or the pty master is gone.
+		return -1;
+	}
+	return total;
+}
+
+/* read() on the framed line. The payload of the data frames goes to
+ * inBuf in order, the ACKs and NAKs for them go out at once. A frame
+ * that finds inBuf full is not taken, the sensor sends it again.
+ */
+int TsSerialPort::readFrames(){
+	byte_ard buf[LINK_FRAME_MAX];
+	int total = 0;
+
+	while(true){
+		int n = ::read(fd, buf, sizeof(buf));
+		if(n < 0 && (errno == EAGAIN || errno == EINTR)){
+			break;
+		}
+		if(n <= 0){
+			return -1;
+		}
+		total += n;
+
+		for(int i = 0; i < n; i++){
+			if(link_rx_byte(&link, buf[i]) != LINK_RX_FRAME){
+				continue;
+			}
+			if(link.rxCtl != LINK_CTL_DATA){
+				link_control(&link);
+				continue;
+			}
+			if(inLen >= SERIAL_BUFSIZE){
+				continue;
+			}
+
+			link_accept(&link);
+			const byte_ard *payload;
+			u_int16_ard len;
+			while((payload = link_deliver(&link, &len)) != NULL){
+				memcpy(inBuf+inLen, payload, len);
+				inLen += len;
+			}
+			replyDue = true;
+		}
+	}
+
+	// ACKs to send, and frames the window now has room for.
+	if(flushFrames() < 0){
+		return -1;
+	}
+	return total;
+}
+
+/* Points msg to the next complete message read and returns its length, or
+ * returns 0 if there is none. The message stays valid until the next
+ * read().
+ */
+int TsSerialPort::nextMessage(byte_ard **msg){
+	while(inDone < inLen){
+		int avail = inLen - inDone;
+
+		if(skip > 0){
+			int n = skip < (u_int32_ard)avail ? skip : avail;
+			inDone += n;
+			skip -= n;
+			continue;
+		}
+
+		int len = messageLength(inBuf+inDone, avail);
+		if(len < 0){
+			inDone++;
+			resyncs++;
+			continue;
+		}
+		if(len > SERIAL_BUFSIZE){
+			skip = len;
+			continue;
+		}
+		if(len == 0 || len > avail){
+			return 0;
+		}
+
+		*msg = inBuf + inDone;
+		inDone += len;
+		return len;
+	}
+	return 0;
+}
+
+/* Takes note of a message from the sensor. Returns PORT_FORWARD for the
+ * protocol messages the sink is to have, PORT_LOCAL for the answers to the
+ * gateway's own queries, which are acted on here.
+ */
+int TsSerialPort::message(byte_ard *msg, int len, u_int64_ard now){
+	byte_ard msgType = msg[0] & ~MSG_T_DATA_FLAGS;
+
+	if(msgType == MSG_T_DATA_SEND || msgType == MSG_T_DATA_SEND_GCM){
+		memcpy(id, msg+2, ID_SIZE);
+		idKnown = true;
+		setState(PORT_RUNNING, now + PORT_SILENT_MS);
+		return PORT_FORWARD;
+	}
+
+	if(msg[0] == LINK_START_R){
+		if(linkPending && !framed){
+			linkPending = false;
+			startLink(msg[1], now);
+		}
+		return PORT_LOCAL;
+	}
+
+	if(msg[0] == FW_STATE_R){
+		queryPending = false;
+	}
+
+	if(msg[0] == MSG_T_GET_ID_R || msg[0] == MSG_T_REKEY_HANDSHAKE){
+		memcpy(id, msg+1, ID_SIZE);
+		idKnown = true;
+		if(state != PORT_KEYING){
+			setState(PORT_KEYING, now + PORT_KEYING_MS);
+		}
+		return PORT_FORWARD;
+	}
+
+	if(msg[0] == FW_STATE_R && state == PORT_PROBE){
+		switch(msg[1]){
+			case FW_STATE_STANDBY:
+				send(FW_GET_ID_Q);
+				setState(PORT_KEYING, now + PORT_KEYING_MS);
+				break;
+			case FW_STATE_RUNNING:
+				setState(PORT_RUNNING, now + PORT_SILENT_MS);
+				break;
+			case FW_STATE_ERROR:
+				send(MSG_T_FINISH);
+				setState(PORT_PROBE, now + PORT_REPLY_MS);
+				break;
+			default:
+				// Half way through an exchange, it times out by itself.
+				setState(PORT_PROBE, now + PORT_RETRY_MS);
+				break;
+		}
+	}else if(msg[0] == FW_ACK && msg[1] != 0 && linkPending){
+		// Firmware without the framed link, the line stays raw.
+		syslog(LOG_NOTICE, "%s: no framed link on the sensor", path);
+		linkPending = false;
+		setState(PORT_PROBE, now);
+	}else if(msg[0] == FW_ACK && msg[1] != 0){
+		// A timeout or a message out of turn. Find out where it stands.
+		syslog(LOG_NOTICE, "%s: sensor error 0x%02x", path, msg[1]);
+		setState(PORT_PROBE, now + PORT_RETRY_MS);
+	}else if(msg[0] == FW_DEBUG_PACKET){
+		syslog(LOG_DEBUG, "%s: debug packet, %d bytes", path, len);
+	}
+
+	return PORT_LOCAL;
+}
+
+void TsSerialPort::send(byte_ard cmd){
+	write(&cmd, 1, 0);
+}
+
+/* Writes a message to the sensor, what the port does not take now goes on
+ * the next flush(). Returns 0, or -1 if there is no room for it.
+ */
+int TsSerialPort::write(const byte_ard *msg, int len, u_int64_ard now){
+	if(fd < 0 || outLen + len > SERIAL_BUFSIZE){
+		return -1;
+	}
+	memcpy(outBuf+outLen, msg, len);
+	outLen += len;
+
+	// The sink answers the key exchange, the sensor has all of it to reply.
+	if(now != 0 && state == PORT_KEYING){
+		deadline = now + PORT_KEYING_MS;
+	}
+
+	flush();
+	return 0;
+}
+
+/* Writes what is waiting for the port. Returns the number of bytes still
+ * waiting, or -1 if the port hung up.
+ */
+int TsSerialPort::flush(){
+	if(framed){
+		return flushFrames();
+	}
+
+	while(outLen > 0){
+		int n = ::write(fd, outBuf, outLen);
+		if(n < 0){
+			if(errno == EAGAIN || errno == EINTR){
+				break;
+			}
+			return -1;
+		}
+		memmove(outBuf, outBuf+n, outLen-n);
+		outLen -= n;
+	}
+	return outLen;
+}
+
+/* flush() on the framed line. The bytes written go into data frames as
+ * the window lets them, then the frames that are due are encoded behind
+ * any waiting: the ACK or NAK, new frames and those to send again.
+ */
+int TsSerialPort::flushFrames(){
+	u_int64_ard now = clockMs();
+
+	while(outLen > 0 && link_free(&link) > 0){
+		int n = outLen < LINK_MTU ? outLen : LINK_MTU;
+		link_queue(&link, outBuf, n);
+		memmove(outBuf, outBuf+n, outLen-n);
+		outLen -= n;
+	}
+
+	if(replyDue && wireLen + LINK_CTL_FRAME_SIZE <= SERIAL_BUFSIZE){
+		byte_ard ctl, seq;
+		link_reply(&link, &ctl, &seq);
+		wireLen += link_encode_frame(ctl, seq, NULL, 0, wireBuf+wireLen);
+		replyDue = false;
+	}
+
+	struct link_slot *slot;
+	while(wireLen + LINK_FRAME_MAX <= SERIAL_BUFSIZE &&
+		  (slot = link_due(&link, (u_int32_ard)now)) != NULL){
+		wireLen += link_encode_frame(LINK_CTL_DATA, slot->seq, slot->data,
+									 slot->len, wireBuf+wireLen);
+	}
+
+	while(wireLen > 0){
+		int n = ::write(fd, wireBuf, wireLen);
+		if(n < 0){
+			if(errno == EAGAIN || errno == EINTR){
+				break;
+			}
+			return -1;
+		}
+		memmove(wireBuf, wireBuf+n, wireLen-n);
+		wireLen -= n;
+		lastTx = now;
+	}
+	return outLen + wireLen;
+}
+
+bool TsSerialPort::wantsWrite(){
+	// On the framed line bytes the window has no room for wait for an ACK.
+	return framed ? wireLen > 0 : outLen > 0;
+}
+
+/* Acts on the deadline of the current state. Returns true if the port was
+ * opened, it then has to be watched for reading.
+ */
+bool TsSerialPort::tick(u_int64_ard now){
+	bool opened = false;
+	if(now >= deadline){
+		opened = deadlineReached(now);
+	}
+
+	// Frames not ACKed in time go again, and an idle line gets a keepalive.
+	// After the deadline, so a link just given up sends nothing more.
+	if(framed){
+		if(now - lastTx >= LINK_KEEPALIVE_MS){
+			replyDue = true;
+		}
+		flushFrames();
+	}
+	return opened;
+}
+
+/* tick() once the deadline of the current state has passed. Returns true
+ * if the port was opened.
+ */
+bool TsSerialPort::deadlineReached(u_int64_ard now){
+	switch(state){
+		case PORT_CLOSED:
+			return open(now);
+		case PORT_PROBE:
+			if(framed && queryPending){
+				syslog(LOG_NOTICE, "%s: no answer on the framed link, back "
+					   "to the raw line", path);
+				stopLink();
+			}
+			if(linkCode != PORT_NO_LINK && !framed && !linkAsked){
+				byte_ard offer[] = { LINK_START_CMD, (byte_ard)linkCode };
+				write(offer, sizeof(offer), 0);
+				linkAsked = linkPending = true;
+				setState(PORT_PROBE, now + PORT_REPLY_MS);
+				break;
+			}
+			linkPending = false;
+			probe(now);
+			break;
+		case PORT_KEYING:
+			syslog(LOG_NOTICE, "%s: key exchange timed out", path);
+			probe(now);
+			break;
+		case PORT_RUNNING:
+			probe(now);
+			break;
+	}
+	return false;
+}
@@ -0,0 +1,152 @@
+/*
+   File name: ts_serialport.h
+   Date:      2026-10-19 23:55
+   Author:
+*/
+
+#ifndef __TS_SERIALPORT_H__
+#define __TS_SERIALPORT_H__
+
+#include <termios.h>
+
+#include "protocol.h"
+#include "serial_link.h"
+
+using namespace std;
+
+// Holds the largest message a tsensor sends the gateway, a data message
+// with 255 bytes of ciphertext. Longer debug packets are skipped.
+#define SERIAL_BUFSIZE 512
+
+// The T <-> C messages of tsensor.pde the gateway uses. The rest of the
+// dialogue is in protocol.h.
+#define FW_GET_ID_Q      0x40
+#define FW_ACK           0x4F
+#define FW_FREE_MEM_R    0x51
+#define FW_STATE_Q       0x52
+#define FW_STATE_R       0x53
+#define FW_VERSION_R     0x55
+#define FW_CUR_TIME_R    0x58
+#define FW_DEBUG_PACKET  0x77
+
+// Protocol states in a FW_STATE_R.
+#define FW_STATE_STANDBY 0x00
+#define FW_STATE_RUNNING 0x10
+#define FW_STATE_ERROR   0xFF
+
+// Where the gateway is with the sensor on a port.
+#define PORT_CLOSED  0   // Not open, reopened at the deadline.
+#define PORT_PROBE   1   // State query sent or due at the deadline.
+#define PORT_KEYING  2   // Key exchange relayed, must finish by the deadline.
+#define PORT_RUNNING 3   // Sending data, probed if silent past the deadline.
+
+// What to do with a message from the sensor.
+#define PORT_FORWARD 1   // A protocol message for the sink.
+#define PORT_LOCAL   0   // Answered a query of the gateway, nothing to send.
+
+// Times in msec.
+#define PORT_STARTUP_MS  1500    // setup() on the sensor after a reset.
+#define PORT_REPLY_MS    3000    // For a FW_STATE_R.
+#define PORT_RETRY_MS    5000    // Before probing a sensor that was busy.
+#define PORT_KEYING_MS   30000   // The whole key exchange.
+#define PORT_SILENT_MS   300000  // Running sensor without data.
+#define PORT_REOPEN_MS   5000
+
+// No framed link, the line stays raw at the speed of the port.
+#define PORT_NO_LINK     -1
+
+/* One sensor on a serial port or pseudo-terminal. The port is read and
+ * written without blocking, read() takes what is there and nextMessage()
+ * hands out the sensor's messages one by one. A message is complete when
+ * as many bytes are in as its type and length fields call for, bytes that
+ * start no known message are dropped until one does.
+ *
+ * The port also leads the sensor through the key exchange. Only the
+ * messages for the sink are relayed. The gateway asks the sensor for its
+ * state first, since an id query would put a sensor that is already
+ * running into its error state: a sensor in standby is sent an id query,
+ * one in error reset with a finish message. message() keeps track of the
+ * sensor from what it sends, tick() acts on the deadlines.
+ *
+ * With a LINK_BAUD_ code the port first offers the sensor the framed link
+ * of serial_link.h at that rate. Once the sensor agrees, everything goes
+ * in frames: write() queues the bytes as data frames, read() takes the
+ * frames apart and puts their payload where the raw bytes would have gone,
+ * so the messages come out of nextMessage() the same. A sensor that does
+ * not know the link keeps the raw line. A state query that goes unanswered
+ * on the framed line takes the port back to the raw line, the sensor has
+ * gone back to it after a reset or LINK_IDLE_MS without frames.
+ */
+class TsSerialPort {
+	private:
+		char *path;
+		speed_t speed;
+		int fd;
+
+		// Room past SERIAL_BUFSIZE for the frames one delivers on the framed
+		// line, so those can always be taken in.
+		byte_ard inBuf[SERIAL_BUFSIZE + LINK_WINDOW*LINK_MTU];
+		int inLen, inDone;
+		u_int32_ard skip;          // Bytes left of a message too long to keep.
+
+		byte_ard outBuf[SERIAL_BUFSIZE];
+		int outLen;
+
+		byte_ard id[ID_SIZE];
+		bool idKnown;
+
+		int state;
+		u_int64_ard deadline;
+		bool queryPending;         // A FW_STATE_Q is unanswered.
+
+		int linkCode;              // LINK_BAUD_ code to offer, or PORT_NO_LINK.
+		bool linkAsked;            // Offered since the port was opened.
+		bool linkPending;          // The sensor has not answered the offer yet.
+		bool framed;
+		struct serial_link link;
+		byte_ard wireBuf[SERIAL_BUFSIZE];  // Frames not written yet.
+		int wireLen;
+		bool replyDue;             // An ACK or NAK to send.
+		u_int64_ard lastTx;        // Last frame written, for the keepalive.
+
+		void send(byte_ard cmd);
+		void setState(int newState, u_int64_ard at);
+		void probe(u_int64_ard now);
+		bool deadlineReached(u_int64_ard now);
+		void setSpeed(speed_t lineSpeed);
+		void startLink(byte_ard code, u_int64_ard now);
+		void stopLink();
+		int readFrames();
+		int flushFrames();
+
+	public:
+		u_int64_ard resyncs;       // Bytes dropped to find a message start.
+
+		TsSerialPort(const char *path, speed_t speed, int linkCode = PORT_NO_LINK);
+		~TsSerialPort();
+
+		static int messageLength(const byte_ard *msg, int len);
+
+		bool open(u_int64_ard now);
+		void close(u_int64_ard now);
+		int getFd();
+		const char *getPath();
+		int getState();
+		bool isFramed();
+		const struct serial_link *getLink();
+
+		int read();
+		int nextMessage(byte_ard **msg);
+		int message(byte_ard *msg, int len, u_int64_ard now);
+
+		int write(const byte_ard *msg, int len, u_int64_ard now);
+		int flush();
+		bool wantsWrite();
+
+		bool tick(u_int64_ard now);
+
+		bool hasId();
+		const byte_ard *getId();
+};
+
+#endif
@@ -0,0 +1,282 @@
+/*
+   File name: ts_sinklink.cpp
+   Date:      2026-10-20 00:10
+   Author:
+*/
+
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <syslog.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <openssl/err.h>
+
+#include "ts_sinklink.h"
+
+TsSinkLink::TsSinkLink(SSL_CTX *ctx, const struct sockaddr *addr,
+					   socklen_t addrLen, int epollFd, u_int64_ard epollData,
+					   u_int32_ard flushMs){
+	this->ctx = ctx;
+	memcpy(&this->addr, addr, addrLen);
+	this->addrLen = addrLen;
+	this->epollFd = epollFd;
+	this->epollData = epollData;
+	this->flushMs = flushMs;
+
+	fd = -1;
+	ssl = NULL;
+	state = LINK_DOWN;
+	events = 0;
+	inLen = 0;
+	outLen = outDone = 0;
+	oldest = 0;
+	retryMs = LINK_RETRY_MS;
+	retryAt = 0;
+	framesOut = writes = dropped = 0;
+}
+
+TsSinkLink::~TsSinkLink(){
+	close(0);
+}
+
+/* Starts connecting. Returns false if that failed at once, the link is then
+ * down and retried later.
+ */
+bool TsSinkLink::connect(u_int64_ard now){
+	fd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	if(fd < 0){
+		close(now);
+		return false;
+	}
+
+	// Batches are made here, the kernel must not hold them back as well.
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	if(::connect(fd, (struct sockaddr*)&addr, addrLen) < 0 &&
+	   errno != EINPROGRESS){
+		close(now);
+		return false;
+	}
+
+	state = LINK_CONNECTING;
+	events = 0;
+	watch(EPOLLOUT);
+	return true;
+}
+
+/* Drops the connection. Frames still queued are kept for the next one,
+ * unless one was half sent, and the link is retried at retryAt, backing
+ * off while the sink stays away.
+ */
+void TsSinkLink::close(u_int64_ard now){
+	if(ssl != NULL){
+		SSL_free(ssl);
+		ssl = NULL;
+	}
+	if(fd >= 0){
+		::close(fd);
+		fd = -1;
+	}
+	if(outDone > 0){
+		// Whatever the record it went in, the sink did not see all of it.
+		outLen = outDone = 0;
+	}
+	inLen = 0;
+
+	if(state == LINK_UP){
+		retryMs = LINK_RETRY_MS;
+	}else if(state != LINK_DOWN){
+		retryMs = retryMs*2 < LINK_RETRY_MAX_MS ? retryMs*2 : LINK_RETRY_MAX_MS;
+	}
+	state = LINK_DOWN;
+	events = 0;
+	retryAt = now + retryMs;
+}
+
+int TsSinkLink::getState(){
+	return state;
+}
+
+SSL *TsSinkLink::getSsl(){
+	return ssl;
+}
+
+void TsSinkLink::watch(u_int32_ard newEvents){
+	if(newEvents == events){
+		return;
+	}
+	struct epoll_event ev;
+	ev.events = newEvents;
+	ev.data.u64 = epollData;
+	epoll_ctl(epollFd, events == 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, fd, &ev);
+	events = newEvents;
+}
+
+/* Moves the link on after an epoll event. Returns LINK_OPENED once the
+ * handshake is done, LINK_FAILED if the connection failed or closed and
+ * LINK_OK otherwise.
+ */
+int TsSinkLink::onEvent(u_int32_ard ev){
+	if(state == LINK_CONNECTING){
+		int err = 0;
+		socklen_t errLen = sizeof(err);
+		getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &errLen);
+		if(err != 0){
+			syslog(LOG_ERR, "Connecting to the sink: %s", strerror(err));
+			return LINK_FAILED;
+		}
+
+		if(!(ssl = SSL_new(ctx))){
+			return LINK_FAILED;
+		}
+		SSL_set_fd(ssl, fd);
+		SSL_set_connect_state(ssl);
+		SSL_set_mode(ssl, SSL_MODE_ENABLE_PARTIAL_WRITE |
+						  SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+		state = LINK_HANDSHAKE;
+		return handshake();
+	}
+
+	if(state == LINK_HANDSHAKE){
+		return handshake();
+	}
+
+	if(state != LINK_UP){
+		return LINK_OK;
+	}
+
+	if(ev & (EPOLLIN | EPOLLHUP | EPOLLERR)){
+		if(readSsl() < 0){
+			return LINK_FAILED;
+		}
+	}
+	if(ev & EPOLLOUT){
+		if(flush() < 0){
+			return LINK_FAILED;
+		}
+	}
+	return LINK_OK;
+}
+
+int TsSinkLink::handshake(){
+	ERR_clear_error();
+	int ret = SSL_do_handshake(ssl);
+	if(ret == 1){
+		state = LINK_UP;
+		watch(outLen > 0 ? EPOLLIN | EPOLLOUT : EPOLLIN);
+		return LINK_OPENED;
+	}
+
+	switch(SSL_get_error(ssl, ret)){
+		case SSL_ERROR_WANT_READ:
+			watch(EPOLLIN);
+			return LINK_OK;
+		case SSL_ERROR_WANT_WRITE:
+			watch(EPOLLOUT);
+			return LINK_OK;
+	}
+	syslog(LOG_ERR, "TLS handshake with the sink failed.");
+	return LINK_FAILED;
+}
+
+/* Reads all the sink has sent into the input buffer. Returns -1 if the
+ * connection closed or broke.
+ */
+int TsSinkLink::readSsl(){
+	while(inLen < LINK_IN_SIZE){
+		ERR_clear_error();
+		int n = SSL_read(ssl, inBuf+inLen, LINK_IN_SIZE-inLen);
+		if(n > 0){
+			inLen += n;
+			continue;
+		}
+		int err = SSL_get_error(ssl, n);
+		if(err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE){
+			return 0;
+		}
+		return -1;
+	}
+	return 0;
+}
+
+/* Queues a frame for the sink. Returns false if it was dropped because the
+ * link has too much waiting already.
+ */
+bool TsSinkLink::queue(const byte_ard *routeId, const byte_ard *msg, int len,
+					   u_int64_ard now){
+	if(outDone == outLen){
+		outLen = outDone = 0;
+	}
+	if(len > LINK_FRAME_SIZE ||
+	   outLen + GWFRAME_HEADER_SIZE + len > LINK_OUT_SIZE){
+		dropped++;
+		return false;
+	}
+
+	if(outLen == outDone){
+		oldest = now;
+	}
+	pack_gwframe_header(routeId, len, outBuf+outLen);
+	memcpy(outBuf+outLen+GWFRAME_HEADER_SIZE, msg, len);
+	outLen += GWFRAME_HEADER_SIZE + len;
+	framesOut++;
+	return true;
+}
+
+bool TsSinkLink::pending(){
+	return outLen > outDone;
+}
+
+/* True when the link is up, nothing is being written and the frames
+ * waiting should go.
+ */
+bool TsSinkLink::due(u_int64_ard now){
+	return state == LINK_UP && outDone == 0 && outLen > 0 &&
+		   (outLen >= LINK_BATCH_BYTES || now >= oldest + flushMs);
+}
+
+/* Writes the queued frames. A write the socket does not take all of is
+ * finished when it can take more. Returns the bytes still waiting, or -1
+ * if the connection broke.
+ */
+int TsSinkLink::flush(){
+	if(state != LINK_UP){
+		return outLen - outDone;
+	}
+
+	while(outDone < outLen){
+		ERR_clear_error();
+		int n = SSL_write(ssl, outBuf+outDone, outLen-outDone);
+		if(n > 0){
+			outDone += n;
+			writes++;
+			continue;
+		}
+		int err = SSL_get_error(ssl, n);
+		if(err == SSL_ERROR_WANT_WRITE || err == SSL_ERROR_WANT_READ){
+			watch(EPOLLIN | EPOLLOUT);
+			return outLen - outDone;
+		}
+		return -1;
+	}
+
+	outLen = outDone = 0;
+	watch(EPOLLIN);
+	return 0;
+}
+
+byte_ard *TsSinkLink::plain(){
+	return inBuf;
+}
+
+int TsSinkLink::plainLength(){
+	return inLen;
+}
+
+void TsSinkLink::consume(int length){
+	memmove(inBuf, inBuf+length, inLen-length);
+	inLen -= length;
+}
@@ -0,0 +1,108 @@
+/*
+   File name: ts_sinklink.h
+   Date:      2026-10-20 00:10
+   Author:
+*/
+
+#ifndef __TS_SINKLINK_H__
+#define __TS_SINKLINK_H__
+
+#include <sys/socket.h>
+#include <openssl/ssl.h>
+
+#include "protocol.h"
+
+using namespace std;
+
+// The largest message in a frame, BUFSIZE of the sink.
+#define LINK_FRAME_SIZE 2048
+
+// Frames queue up to this much while the link is busy or down. Frames that
+// find it full are dropped.
+#define LINK_OUT_SIZE (64*1024)
+#define LINK_IN_SIZE  (16*1024)
+
+// Pending frames go out once this many bytes have collected, or once the
+// oldest has waited the flush delay of the link.
+#define LINK_BATCH_BYTES (8*1024)
+
+#define LINK_DOWN       0
+#define LINK_CONNECTING 1
+#define LINK_HANDSHAKE  2
+#define LINK_UP         3
+
+// What onEvent() did.
+#define LINK_OK     0
+#define LINK_OPENED 1   // Handshake done, the peer is to be checked.
+#define LINK_FAILED -1  // Closed or broken, close() and reconnect later.
+
+#define LINK_RETRY_MS     1000
+#define LINK_RETRY_MAX_MS 30000
+
+/* One of the persistent TLS connections of the gateway to the gateway port
+ * of the sink. The socket never blocks: connect() starts the connection,
+ * and onEvent() drives it on from epoll events, through the handshake to
+ * reading what the sink sends. Its frames collect in the input buffer,
+ * plain() and consume() as in TsUringTlsConn.
+ *
+ * queue() adds a frame for the sink to the output buffer. Frames are sent
+ * together, many to a TLS record, once enough have collected or the oldest
+ * has waited flushMs, so the sink reads them in batches as well.
+ *
+ * The link sets the events it is watched for on epollFd itself.
+ */
+class TsSinkLink {
+	private:
+		SSL_CTX *ctx;
+		struct sockaddr_storage addr;
+		socklen_t addrLen;
+		int epollFd;
+		u_int64_ard epollData;
+		u_int32_ard flushMs;
+
+		int fd;
+		SSL *ssl;
+		int state;
+		u_int32_ard events;
+
+		byte_ard inBuf[LINK_IN_SIZE];
+		int inLen;
+
+		byte_ard outBuf[LINK_OUT_SIZE];
+		int outLen, outDone;
+		u_int64_ard oldest;        // When the first pending frame was queued.
+
+		u_int32_ard retryMs;
+
+		void watch(u_int32_ard events);
+		int handshake();
+		int readSsl();
+
+	public:
+		u_int64_ard retryAt;       // When to reconnect a link that is down.
+
+		u_int64_ard framesOut, writes, dropped;
+
+		TsSinkLink(SSL_CTX *ctx, const struct sockaddr *addr,
+				   socklen_t addrLen, int epollFd, u_int64_ard epollData,
+				   u_int32_ard flushMs);
+		~TsSinkLink();
+
+		bool connect(u_int64_ard now);
+		void close(u_int64_ard now);
+		int onEvent(u_int32_ard events);
+		int getState();
+		SSL *getSsl();
+
+		bool queue(const byte_ard *routeId, const byte_ard *msg, int len,
+				   u_int64_ard now);
+		bool due(u_int64_ard now);
+		int flush();
+		bool pending();
+
+		byte_ard *plain();
+		int plainLength();
+		void consume(int length);
+};
+
+#endif
@@ -0,0 +1,308 @@
+/*
+ * File name: tsgatewaydaemon.cpp
+ * Date:      2026-10-20 00:50
+ * Author:
+ */
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <getopt.h>
+
+#include "BDaemon.h"
+#include "ts_gateway.h"
+
+#define PATHLEN 2048
+#define ADDRLEN 2048
+#define PORTLEN 6
+
+using namespace std;
+
+class TSenseGatewayDaemon: public BDaemon{
+	public:
+		TSenseGatewayDaemon(const char *daemonName,
+							const char* lockDir,
+							int daemonFlags,
+							const char* sinkAddr,	// Peer (sink) addr.
+							const char* sinkPort,	// Sink gateway port.
+							const vector<string> &portPaths,
+							int links,				// TLS links to the sink.
+							u_int32_ard flushMs,	// Batching delay.
+							speed_t speed,			// Serial line speed.
+							int linkCode);			// Framed link to offer.
+
+	protected:
+		void work();
+
+	private:
+		TsGateway *gateway;
+};
+
+TSenseGatewayDaemon::TSenseGatewayDaemon(const char *daemonName,
+								const char* lockDir,
+								int daemonFlags,
+								const char* sinkAddr,	// Peer (sink) addr.
+								const char* sinkPort,	// Sink gateway port.
+								const vector<string> &portPaths,
+								int links,				// TLS links to the sink.
+								u_int32_ard flushMs,	// Batching delay.
+								speed_t speed,			// Serial line speed.
+								int linkCode)			// Framed link to offer.
+					: BDaemon(daemonName, lockDir, daemonFlags)
+{
+	gateway = new TsGateway(sinkAddr, sinkPort, portPaths, links, flushMs,
+							speed, linkCode);
+}
+
+void TSenseGatewayDaemon::work(){
+	gateway->serverMain();
+}
+
+/* Reads the ports to serve from a file, one path per line. Empty lines and
+ * lines starting with '#' are skipped.
+ */
+void readPortFile(const char *path, vector<string> &portPaths){
+	ifstream in(path);
+	if(!in){
+		throw runtime_error(string("Unable to read port file ") + path);
+	}
+
+	string line;
+	while(getline(in, line)){
+		istringstream fields(line);
+		string port;
+		if(fields >> port && port[0] != '#'){
+			portPaths.push_back(port);
+		}
+	}
+}
+
+speed_t toSpeed(int baud){
+	switch(baud){
+		case 1200:   return B1200;
+		case 2400:   return B2400;
+		case 4800:   return B4800;
+		case 9600:   return B9600;
+		case 19200:  return B19200;
+		case 38400:  return B38400;
+		case 57600:  return B57600;
+		case 115200: return B115200;
+	}
+	return (speed_t)0;
+}
+
+// The LINK_BAUD_ code for a rate, PORT_NO_LINK if there is none.
+int toLinkCode(long baud){
+	for(int code = 0; code < LINK_BAUD_CODES; code++){
+		if(link_baud(code) == baud){
+			return code;
+		}
+	}
+	return PORT_NO_LINK;
+}
+
+void usage(){
+    fprintf(stderr, "SYNOPSIS\n");
+
+	fprintf(stderr, "    tsgatewayd --workdir  <Work dir> \n");
+    fprintf(stderr, "               --lockdir  <Lock file dir>\n");
+    fprintf(stderr, "               --sinkaddr <Sink server addr>\n");
+    fprintf(stderr, "               --sinkport <Sink gateway port>\n");
+    fprintf(stderr, "               [--ports <Port file>]\n");
+    fprintf(stderr, "               [--links <TLS links>]\n");
+    fprintf(stderr, "               [--flushms <Batching delay>]\n");
+    fprintf(stderr, "               [--baud <Serial speed>]\n");
+    fprintf(stderr, "               [--linkbaud <Framed link speed>]\n");
+    fprintf(stderr, "               [<Serial port> ...]\n");
+
+    fprintf(stderr, "\n");
+
+    fprintf(stderr, "DESCRIPTION\n");
+    fprintf(stderr,
+	"    The proxy client for a box full of tsensors. Watches the serial\n"
+	"    ports (or pseudo-terminals) of the sensors, takes each through\n"
+	"    the key exchange and relays its protocol messages to the gateway\n"
+	"    port of the sink, over a few persistent TLS connections shared by\n"
+	"    all the sensors. Messages that arrive close together go to the\n"
+	"    sink together.\n");
+
+    fprintf(stderr, "\n");
+
+    fprintf(stderr, "OPTIONS\n");
+	fprintf(stderr, "    --workdir  Abs. path to working directory.\n");
+    fprintf(stderr, "    --lockdir  Abs. path to  lock file directory.\n");
+    fprintf(stderr, "    --sinkaddr Sink server FQDN or IP.\n");
+    fprintf(stderr, "    --sinkport Sink gateway session port.\n");
+    fprintf(stderr, "    --ports    File with serial ports, one per line, in\n");
+    fprintf(stderr, "               addition to those on the command line.\n");
+    fprintf(stderr, "    --links    TLS connections to the sink. Default %d.\n",
+			GW_LINKS);
+    fprintf(stderr, "    --flushms  How long a message may wait for others\n");
+    fprintf(stderr, "               to go with it, in msec. Default %d.\n",
+			GW_FLUSH_MS);
+    fprintf(stderr, "    --baud     Serial line speed. Default 9600.\n");
+    fprintf(stderr, "    --linkbaud Offer the sensors the framed link at up to\n");
+    fprintf(stderr, "               this speed: 9600, 19200, 38400, 57600,\n");
+    fprintf(stderr, "               115200, 230400 or 500000. Sensors without\n");
+    fprintf(stderr, "               it stay on the raw line. Default off.\n");
+}
+
+
+int main(int argc, char **argv)
+{
+
+	char lockDir[PATHLEN];
+	char workDir[PATHLEN];
+
+	static struct option long_options[] =
+	{
+		{"sinkaddr",  required_argument, 0, 'a'},
+		{"sinkport",  required_argument, 0, 'b'},
+		{"workdir",  required_argument, 0, 'e'},
+		{"lockdir",  required_argument, 0, 'f'},
+		{"ports",  required_argument, 0, 'p'},
+		{"links",  required_argument, 0, 'l'},
+		{"flushms",  required_argument, 0, 'm'},
+		{"baud",  required_argument, 0, 's'},
+		{"linkbaud",  required_argument, 0, 'k'},
+		{"help",     no_argument,       0, 'h'},
+		{0, 0, 0, 0}
+	};
+
+	int option_index = 0;
+
+	bool wDirPassed = false;
+
+	bool isSinkAddr, isSinkPort, isLockDir;
+	isSinkAddr = isSinkPort = isLockDir = false;
+
+	char sinkAddr[ADDRLEN];
+	char sinkPort[PORTLEN];
+	vector<string> portPaths;
+	int links = GW_LINKS;
+	u_int32_ard flushMs = GW_FLUSH_MS;
+	speed_t speed = B9600;
+	int linkCode = PORT_NO_LINK;
+	bool linkBad = false;
+
+	int c;
+	while ((c = getopt_long (argc, argv, "a:b:e:f:hk:l:m:p:s:",
+                            long_options, &option_index)) != -1){
+
+		switch (c) {
+			case 'a':
+				strncpy(sinkAddr, optarg, ADDRLEN);
+				cout << "    sinkaddr=" << sinkAddr << endl;
+				isSinkAddr = true;
+				break;
+
+			case 'b':
+				strncpy(sinkPort, optarg, PORTLEN);
+				cout << "    sinkport=" << sinkPort << endl;
+				isSinkPort = true;
+				break;
+
+			case 'e':
+				strncpy(workDir, optarg, PATHLEN);
+				cout << "    workDir=" << workDir << endl;
+				wDirPassed = true;
+				break;
+
+			case 'f':
+				strncpy(lockDir, optarg, PATHLEN);
+				cout << "    lockDir=" << lockDir << endl;
+				isLockDir = true;
+				break;
+
+			case 'p':
+				try{
+					readPortFile(optarg, portPaths);
+				}
+				catch(runtime_error e){
+					cout<<"exiting: "<<e.what()<<endl;
+					exit(1);
+				}
+				cout << "    ports=" << optarg << endl;
+				break;
+
+			case 'l':
+				links = atoi(optarg);
+				cout << "    links=" << links << endl;
+				break;
+
+			case 'm':
+				flushMs = atoi(optarg);
+				cout << "    flushms=" << flushMs << endl;
+				break;
+
+			case 's':
+				speed = toSpeed(atoi(optarg));
+				cout << "    baud=" << optarg << endl;
+				break;
+
+			case 'k':
+				linkCode = toLinkCode(atol(optarg));
+				linkBad = linkCode == PORT_NO_LINK;
+				cout << "    linkbaud=" << optarg << endl;
+				break;
+
+			case 'h':
+				usage();
+				exit(0);
+
+			case '?':
+				usage();
+				exit(0);
+		}
+	}
+
+	for(int i = optind; i < argc; i++){
+		portPaths.push_back(argv[i]);
+	}
+
+	if(!(isSinkAddr && isSinkPort && isLockDir) || portPaths.empty() ||
+	   links < 1 || speed == (speed_t)0 || linkBad){
+		usage();
+		exit(1);
+	}
+
+	try{
+		TSenseGatewayDaemon gatewayDaemon("tsensegatewayd",
+			lockDir,
+			SINGLETON|NO_DTTY,
+			sinkAddr,
+			sinkPort,
+			portPaths,
+			links,
+			flushMs,
+			speed,
+			linkCode);
+
+		// The default working directory for BDaemon is /tmp, set it to
+		// the location of the daemon or what ever is specified by option.
+		if(wDirPassed){
+			gatewayDaemon.setWorkDir( workDir );
+		} else {
+			char cwd[PATHLEN];
+			getcwd(cwd, PATHLEN);
+			gatewayDaemon.setWorkDir(cwd);
+		}
+
+		cout << "Running gateway daemon for " << portPaths.size()
+			 << " ports" << endl;
+		gatewayDaemon.run();
+	}
+
+	catch(DaemonException e){
+		cout<<"exiting: "<<e.what()<<endl;
+	}
+
+	catch(runtime_error e){
+		cout<<"exiting: "<<e.what()<<endl;
+	}
+
+	return 0;
+} // end main()
@@ -0,0 +1,38 @@
+/*
+ * File name: test_check.h
+ * Date:      2026-10-20 04:05
+ * Author:
+ *
+ * Checks for the unit tests here and in client/tsgateway/test_cases. Each
+ * check prints a line and counts the failures, testSummary() ends main():
+ *
+ *   check(rt->checkNonce(id, 100) == REPLAY_OK, "first nonce accepted");
+ *   ...
+ *   return testSummary();
+ */
+
+#ifndef __TEST_CHECK_H__
+#define __TEST_CHECK_H__
+
+#include <iostream>
+
+static int failures = 0;
+
+static void check(bool ok, const char *what){
+	std::cout << (ok ? "  ok:     " : "  FAILED: ") << what << std::endl;
+	if(!ok){
+		failures++;
+	}
+}
+
+// Prints the verdict and returns the number of failed checks.
+static int testSummary(){
+	if(failures == 0){
+		std::cout << std::endl << "All OK!" << std::endl;
+	} else {
+		std::cout << std::endl << failures << " test(s) failed!" << std::endl;
+	}
+	return failures;
+}
+
+#endif
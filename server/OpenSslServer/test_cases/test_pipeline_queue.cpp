@@ -0,0 +1,140 @@
+/*
+ * File name: test_pipeline_queue.cpp
+ * Date:      2026-10-19 21:40
+ * Author:
+ */
+
+#include <iostream>
+#include <string.h>
+#include <pthread.h>
+
+#include "ts_pipelinequeue.h"
+#include "test_check.h"
+
+#define PRODUCERS 4
+#define CONSUMERS 4
+#define PER_PRODUCER 100000
+
+using namespace std;
+
+// The queue only passes pointers, so the test brings items of its own.
+struct pipelineItem {
+	int producer;
+	int seq;
+};
+
+TsPipelineQueue *queue;
+pipelineItem items[PRODUCERS][PER_PRODUCER];
+
+// Per consumer: items seen from each producer and whether they came in the
+// order the producer pushed them.
+int seen[CONSUMERS][PRODUCERS];
+bool inOrder[CONSUMERS];
+
+void *produce(void *arg){
+	int p = (int)(long)arg;
+	for(int i = 0; i < PER_PRODUCER; i++){
+		items[p][i].producer = p;
+		items[p][i].seq = i;
+		queue->push(&items[p][i]);
+	}
+	return NULL;
+}
+
+void *consume(void *arg){
+	int c = (int)(long)arg;
+	int last[PRODUCERS];
+	for(int p = 0; p < PRODUCERS; p++){
+		last[p] = -1;
+	}
+	inOrder[c] = true;
+
+	pipelineItem *item;
+	while((item = queue->pop()) != NULL){
+		if(item->seq <= last[item->producer]){
+			inOrder[c] = false;
+		}
+		last[item->producer] = item->seq;
+		seen[c][item->producer]++;
+	}
+	return NULL;
+}
+
+int main() {
+	pipelineItem a, b, c;
+	pipelineItem *item;
+
+	//--------------------------------------------------------------------------
+	// TEST #1
+	//--------------------------------------------------------------------------
+	cout << "Single thread:" << endl;
+	queue = new TsPipelineQueue(3);
+	check(queue->capacity() == 4, "depth rounded up to a power of two");
+	check(!queue->tryPop(&item), "empty queue gives nothing");
+
+	queue->push(&a);
+	queue->push(&b);
+	queue->push(NULL);
+	check(queue->depth() == 3, "depth counts queued items");
+	check(queue->pop() == &a && queue->pop() == &b, "first in, first out");
+	check(queue->tryPop(&item) && item == NULL, "shutdown marker passed on");
+
+	// Round the ring a few times.
+	bool wrapped = true;
+	for(int i = 0; i < 10; i++){
+		queue->push(&a);
+		queue->push(&b);
+		queue->push(&c);
+		wrapped = wrapped && queue->pop() == &a && queue->pop() == &b &&
+				  queue->pop() == &c;
+	}
+	check(wrapped, "order kept around the ring");
+	check(queue->depth() == 0, "empty again");
+	delete queue;
+
+	//--------------------------------------------------------------------------
+	// TEST #2
+	//--------------------------------------------------------------------------
+	// Producers and consumers at once on a small queue, so that both block
+	// on it. Every item arrives once and each producer's items in order.
+	cout << "Many producers and consumers:" << endl;
+	queue = new TsPipelineQueue(64);
+	memset(seen, 0, sizeof(seen));
+
+	pthread_t producers[PRODUCERS], consumers[CONSUMERS];
+	for(long i = 0; i < CONSUMERS; i++){
+		pthread_create(&consumers[i], NULL, consume, (void*)i);
+	}
+	for(long i = 0; i < PRODUCERS; i++){
+		pthread_create(&producers[i], NULL, produce, (void*)i);
+	}
+	for(int i = 0; i < PRODUCERS; i++){
+		pthread_join(producers[i], NULL);
+	}
+	for(int i = 0; i < CONSUMERS; i++){
+		queue->push(NULL);
+	}
+	for(int i = 0; i < CONSUMERS; i++){
+		pthread_join(consumers[i], NULL);
+	}
+
+	bool allSeen = true;
+	for(int p = 0; p < PRODUCERS; p++){
+		int total = 0;
+		for(int i = 0; i < CONSUMERS; i++){
+			total += seen[i][p];
+		}
+		allSeen = allSeen && total == PER_PRODUCER;
+	}
+	check(allSeen, "every item popped once");
+
+	bool ordered = true;
+	for(int i = 0; i < CONSUMERS; i++){
+		ordered = ordered && inOrder[i];
+	}
+	check(ordered, "each producer's items in order");
+	check(queue->depth() == 0, "queue empty after shutdown");
+	delete queue;
+
+	return testSummary();
+}
@@ -0,0 +1,129 @@
+/*
+ * File name: test_replay_table.cpp
+ * Date:      2026-10-19 11:02
+ * Author:
+ */
+
+#include <iostream>
+#include <string>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "ts_replaytable.h"
+#include "test_check.h"
+
+#define SNAPSHOT "test_replay.snapshot"
+
+using namespace std;
+
+int main() {
+	byte_ard idA[ID_SIZE] = {0x00, 0x01, 0x00, 0x00, 0x00, 0x0a};
+	byte_ard idB[ID_SIZE] = {0x00, 0x01, 0x00, 0x00, 0x00, 0x02};
+
+	unlink(SNAPSHOT);
+
+	//--------------------------------------------------------------------------
+	// TEST #1
+	//--------------------------------------------------------------------------
+	// Nonce window: forward moves, duplicates, late but unseen nonces and
+	// nonces that fell out of the window.
+	cout << "Nonce window:" << endl;
+	TsReplayTable *rt = new TsReplayTable(SNAPSHOT, 64, 3600);
+
+	check(rt->checkNonce(idA, 100) == REPLAY_OK, "first nonce accepted");
+	check(rt->checkNonce(idA, 100) == REPLAY_REJECT, "duplicate rejected");
+	check(rt->checkNonce(idA, 105) == REPLAY_OK, "forward nonce accepted");
+	check(rt->checkNonce(idA, 103) == REPLAY_OK, "late unseen nonce accepted");
+	check(rt->checkNonce(idA, 103) == REPLAY_REJECT, "late duplicate rejected");
+	check(rt->checkNonce(idA, 105 - REPLAY_NONCE_WINDOW) == REPLAY_REJECT,
+			"nonce behind the window rejected");
+	check(rt->checkNonce(idB, 100) == REPLAY_OK, "devices are independent");
+	check(rt->checkNonce(idA, 200) == REPLAY_OK, "large forward jump accepted");
+	check(rt->checkNonce(idA, 105) == REPLAY_REJECT, "old window forgotten");
+
+	// Wrap around of the 16 bit counter.
+	check(rt->checkNonce(idB, 65530) == REPLAY_REJECT,
+			"nonce far behind after wrap distance rejected");
+	rt->resetDevice(idB);
+	check(rt->checkNonce(idB, 65535) == REPLAY_OK, "reset device accepted");
+	check(rt->checkNonce(idB, 2) == REPLAY_OK, "nonce after wrap accepted");
+	check(rt->checkNonce(idB, 65535) == REPLAY_REJECT,
+			"duplicate before wrap rejected");
+
+	//--------------------------------------------------------------------------
+	// TEST #2
+	//--------------------------------------------------------------------------
+	// Message times must increase.
+	cout << "Message time:" << endl;
+	check(rt->checkMsgTime(idA, 1000) == REPLAY_OK, "first time accepted");
+	check(rt->checkMsgTime(idA, 1000) == REPLAY_REJECT, "same time rejected");
+	check(rt->checkMsgTime(idA, 999) == REPLAY_REJECT, "older time rejected");
+	check(rt->checkMsgTime(idA, 1010) == REPLAY_OK, "newer time accepted");
+
+	//--------------------------------------------------------------------------
+	// TEST #3
+	//--------------------------------------------------------------------------
+	// Updates made in a forked child are visible to the parent.
+	cout << "Shared between processes:" << endl;
+	pid_t pid = fork();
+	if(pid == 0){
+		rt->checkMsgTime(idA, 2000);
+		exit(0);
+	}
+	waitpid(pid, NULL, 0);
+	check(rt->checkMsgTime(idA, 1500) == REPLAY_REJECT,
+			"child update seen by parent");
+
+	//--------------------------------------------------------------------------
+	// TEST #4
+	//--------------------------------------------------------------------------
+	// The table survives a restart through its snapshot, also into a table
+	// of a different size.
+	cout << "Snapshot:" << endl;
+	rt->snapshot();
+	delete rt;
+
+	rt = new TsReplayTable(SNAPSHOT, 256, 3600);
+	check(rt->checkMsgTime(idA, 2000) == REPLAY_REJECT, "message time restored");
+	check(rt->checkNonce(idA, 200) == REPLAY_REJECT, "nonce window restored");
+	check(rt->checkNonce(idA, 201) == REPLAY_OK, "window still slides");
+	delete rt;
+
+	//--------------------------------------------------------------------------
+	// TEST #5
+	//--------------------------------------------------------------------------
+	// A full table makes room for new devices, and the messages of the one
+	// dropped are still refused.
+	cout << "Full table:" << endl;
+	unlink(SNAPSHOT);
+	rt = new TsReplayTable(SNAPSHOT, 8, 3600);
+	byte_ard id[ID_SIZE] = {0x00, 0x02, 0x00, 0x00, 0x00, 0x00};
+	for(int i = 0; i < 6; i++){
+		id[5] = i;
+		check(rt->checkMsgTime(id, 10) == REPLAY_OK, "device added");
+	}
+	id[5] = 6;
+	check(rt->checkMsgTime(id, 20) == REPLAY_OK, "new device let in");
+	bool replayed = false;
+	for(int i = 0; i < 6; i++){
+		id[5] = i;
+		replayed = replayed || rt->checkMsgTime(id, 10) == REPLAY_OK;
+	}
+	check(!replayed, "old messages still refused");
+	id[5] = 7;
+	check(rt->checkMsgTime(id, 10) == REPLAY_REJECT,
+			"new device held to the floor");
+	check(rt->checkMsgTime(id, 21) == REPLAY_OK, "and let in above it");
+	rt->snapshot();
+	delete rt;
+
+	rt = new TsReplayTable(SNAPSHOT, 8, 3600);
+	id[5] = 8;
+	check(rt->checkMsgTime(id, 10) == REPLAY_REJECT, "floor restored");
+	delete rt;
+
+	unlink(SNAPSHOT);
+
+	return testSummary();
+}
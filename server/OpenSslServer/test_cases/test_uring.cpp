@@ -0,0 +1,122 @@
+/*
+ * File name: test_uring.cpp
+ * Date:      2026-10-19 22:50
+ * Author:
+ */
+
+#include <iostream>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+
+#include "ts_uring.h"
+#include "test_check.h"
+
+using namespace std;
+
+// Waits for a completion of op, the only one expected.
+int32_ard waitFor(TsUring *ring, uringOp *op){
+	uringCompletion c;
+	while(ring->wait(&c, 1) != 1);
+	return c.op == op ? c.result : -1000;
+}
+
+int main() {
+	TsUring *ring = new TsUring(8);
+
+	//--------------------------------------------------------------------------
+	// TEST #1
+	//--------------------------------------------------------------------------
+	cout << "Send and recv:" << endl;
+	int sv[2];
+	socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+
+	uringOp sendOp = { URING_OP_SEND, NULL };
+	uringOp recvOp = { URING_OP_RECV, NULL };
+	char out[] = "tsense";
+	char in[16];
+
+	ring->prepSend(sv[0], out, sizeof(out), &sendOp);
+	check(waitFor(ring, &sendOp) == sizeof(out), "send completed");
+	ring->prepRecv(sv[1], in, sizeof(in), &recvOp);
+	check(waitFor(ring, &recvOp) == sizeof(out) && strcmp(in, out) == 0,
+			"recv got what was sent");
+
+	// A recv queued first completes once the data is there.
+	ring->prepRecv(sv[1], in, sizeof(in), &recvOp);
+	ring->submit();
+	ring->prepSend(sv[0], out, sizeof(out), &sendOp);
+	uringCompletion c[2];
+	int n = ring->wait(c, 2);
+	if(n == 1){
+		n += ring->wait(c+1, 1);
+	}
+	check(n == 2 && c[0].result == sizeof(out) && c[1].result == sizeof(out),
+			"recv waits for the send");
+
+	close(sv[0]);
+	ring->prepRecv(sv[1], in, sizeof(in), &recvOp);
+	check(waitFor(ring, &recvOp) == 0, "recv sees the hang up");
+	close(sv[1]);
+
+	//--------------------------------------------------------------------------
+	// TEST #2
+	//--------------------------------------------------------------------------
+	cout << "Accept:" << endl;
+	int listenFd = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in addr;
+	socklen_t addrLen = sizeof(addr);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	bind(listenFd, (struct sockaddr*)&addr, sizeof(addr));
+	getsockname(listenFd, (struct sockaddr*)&addr, &addrLen);
+	listen(listenFd, 4);
+
+	uringOp acceptOp = { URING_OP_ACCEPT, NULL };
+	ring->prepAccept(listenFd, &acceptOp);
+	ring->submit();
+
+	int clientFd = socket(AF_INET, SOCK_STREAM, 0);
+	connect(clientFd, (struct sockaddr*)&addr, sizeof(addr));
+	int accepted = waitFor(ring, &acceptOp);
+	check(accepted >= 0, "connection accepted");
+
+	write(clientFd, out, sizeof(out));
+	ring->prepRecv(accepted, in, sizeof(in), &recvOp);
+	check(waitFor(ring, &recvOp) == sizeof(out), "accepted socket readable");
+	close(accepted);
+	close(clientFd);
+	close(listenFd);
+
+	//--------------------------------------------------------------------------
+	// TEST #3
+	//--------------------------------------------------------------------------
+	// A read of an eventfd waits for a write to it from another thread or
+	// process, which is how work done off the ring reports back.
+	cout << "Eventfd read:" << endl;
+	int efd = eventfd(0, 0);
+	uringOp readOp = { URING_OP_READ, NULL };
+	u_int64_ard count = 0, one = 1;
+
+	write(efd, &one, sizeof(one));
+	write(efd, &one, sizeof(one));
+	ring->prepRead(efd, &count, sizeof(count), &readOp);
+	check(waitFor(ring, &readOp) == sizeof(count) && count == 2,
+			"writes before the read add up");
+
+	ring->prepRead(efd, &count, sizeof(count), &readOp);
+	ring->submit();
+	write(efd, &one, sizeof(one));
+	check(waitFor(ring, &readOp) == sizeof(count) && count == 1,
+			"read waits for the next write");
+	close(efd);
+
+	delete ring;
+
+	return testSummary();
+}
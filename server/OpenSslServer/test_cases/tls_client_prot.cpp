@@ -1,7 +1,26 @@
 /*
- * File name: TlsClientBIO.c
+ * File name: tls_client_prot.cpp
  * Date:      2010-08-14 10:53
  * Author:    Kristjn Rnarsson
+ *
+ * Load generator for a sink and auth server pair. Simulates a fleet of
+ * tsensors, each with its own public ID and master key, and runs each of
+ * them through the whole protocol lifecycle:
+ *
+ *   idresponse -> keytosens (K_ST)
+ *   rekey handshake -> newkey (K_STe)
+ *   a number of data messages
+ *
+ * Every message is sent on a connection of its own, as the proxy client
+ * does. The sensors are spread over a number of threads and the rate at
+ * which lifecycles are started can be capped. At the end the throughput and
+ * the latency percentiles of every step are reported. The sink does not
+ * answer data messages, so their latency only covers connect, write and
+ * close.
+ *
+ * The IDs and master keys of the sensors are derived from a seed. Run with
+ * -p first to write them to a keystore file and start the auth server with
+ * --keystore pointing to it.
  */
 
 #include "common.h"
@@ -9,366 +28,455 @@
 #include "aes_constants.h"
 #include "aes_utils.h"
 #include <iostream>
+#include <vector>
+#include <algorithm>
+#include <time.h>
+#include <unistd.h>
 
-#define I_BUF_LEN 80
-#define O_BUF_LEN 80
+#define ADDRLEN 1024
+#define MAX_DATA_LEN 200
 
 using namespace std;
 
-void printBytes2(unsigned char* pBytes, unsigned long dLength, int textWidth=16)
-{
-    int bytecount=0;
-    for(unsigned long i=0;i<dLength;i++)
-    {
-        printf("%.2x ",pBytes[i]);
-        if ( ++bytecount == textWidth )
-        {
-            printf("\n");
-            bytecount=0;
-        }
-    }
-    if ( bytecount != 0 )
-        printf("\n");
+// The steps of a lifecycle, latencies are kept for each.
+enum { STEP_IDRESPONSE, STEP_REKEY, STEP_DATA, STEPS };
+const char *stepNames[STEPS] = { "idresponse", "rekey", "data" };
+
+struct vsensor {
+	byte_ard id[ID_SIZE];
+	byte_ard masterKey[KEY_BYTES];
+	u_int16_ard nonce;
+	u_int32_ard msgtime;
+	u_int32_ard gcmCounter;
+};
+
+struct worker {
+	THREAD_TYPE tid;
+	int index;
+	vector<double> latency[STEPS];  // Microseconds
+	long failed[STEPS];
+	long lifecycles;
+};
+
+// Settings, fixed before the workers start.
+char sinkAddr[ADDRLEN];
+int sensorCount = 1;
+int threadCount = 1;
+int lifecycleCount = 1;
+int dataCount = 1;
+int dataLen = 20;
+double rate = 0.0;
+bool useGcm = false;
+
+vsensor *sensors;
+double startTime;
+
+double now(){
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec/1e9;
 }
 
-TSenseKeyPair *K_st;
-TSenseKeyPair *K_ste;
+/* Derives the public ID and master key of sensor number index. The key is
+ * the ID encrypted under a key made from the seed.
+ */
+void makeSensor(vsensor *s, int index, unsigned int seed){
+	byte_ard seedKey[KEY_BYTES];
+	byte_ard seedKeySched[KEY_BYTES*11];
+
+	memset(seedKey, 0, KEY_BYTES);
+	memcpy(seedKey, "tsload", 6);
+	memcpy(seedKey+6, &seed, sizeof(seed));
+	KeyExpansion(seedKey, seedKeySched);
+
+	s->id[0] = 0x7e;
+	s->id[1] = seed & 0xFF;
+	s->id[2] = (index >> 24) & 0xFF;
+	s->id[3] = (index >> 16) & 0xFF;
+	s->id[4] = (index >> 8) & 0xFF;
+	s->id[5] = index & 0xFF;
+
+	memset(s->masterKey, 0, KEY_BYTES);
+	memcpy(s->masterKey, s->id, ID_SIZE);
+	EncryptBlock(s->masterKey, (const u_int32_ard*)seedKeySched);
+
+	s->nonce = index & 0xFFFF;
+	s->msgtime = time(NULL);
+	s->gcmCounter = 0;
+}
 
-void do_client_loop(BIO *conn, byte_ard *keyBuf, byte_ard *idBuf, int sink_port){
-    int err;
+/* Writes the sensors to a keystore file for tsauthd --keystore. */
+int writeKeystore(const char *path){
+	FILE *f = fopen(path, "w");
+	if(f == NULL){
+		perror(path);
+		return -1;
+	}
 
-	// Pack idresponse message -------------------------------------------------
+	fprintf(f, "# %d simulated tsensors, <public ID> <K_AT>\n", sensorCount);
+	for(int i = 0; i < sensorCount; i++){
+		for(int j = 0; j < ID_SIZE; j++)
+			fprintf(f, "%.2x", sensors[i].id[j]);
+		fprintf(f, " ");
+		for(int j = 0; j < KEY_BYTES; j++)
+			fprintf(f, "%.2x", sensors[i].masterKey[j]);
+		fprintf(f, "\n");
+	}
+	fclose(f);
+	return 0;
+}
+
+/* Connects to the sink, writes a message and, if recvLen > 0, reads the 
+ * reply. Returns 0 on success.
+ */
+int exchange(byte_ard *sendBuf, int sendLen, byte_ard *recvBuf, int recvLen){
+	BIO *conn = BIO_new_connect(sinkAddr);
+	if(!conn){
+		return -1;
+	}
+	if(BIO_do_connect(conn) <= 0){
+		BIO_free(conn);
+		return -1;
+	}
 
-	printf("Packing and sending idresponse message\n");
+	int err = 0;
+	for(int done = 0; done < sendLen && err == 0; ){
+		int n = BIO_write(conn, sendBuf+done, sendLen-done);
+		if(n <= 0)
+			err = -1;
+		else
+			done += n;
+	}
+	for(int done = 0; done < recvLen && err == 0; ){
+		int n = BIO_read(conn, recvBuf+done, recvLen-done);
+		if(n <= 0)
+			err = -1;
+		else
+			done += n;
+	}
 
-	// Expand the masterkey (temporarily) to get encryption and authentication 
-	// schedules. Use the public constant for derivation of authentication key.
-	TSenseKeyPair masterKeys(keyBuf,cAlpha);
+	BIO_free(conn);
+	return err;
+}
 
-	u_int16_ard idNonce = 518;
+/* idresponse -> keytosens. Verifies the reply and derives K_ST. */
+int doIdResponse(vsensor *s, TSenseKeyPair **K_st){
+	TSenseKeyPair masterKeys(s->masterKey, &cAlphaKey);
 
-	// Create the input struct and populate  
 	message msg;
-	msg.msgtype=0x10;
-	msg.pID=idBuf;
-	msg.nonce=idNonce;   
+	msg.msgtype = MSG_T_GET_ID_R;
+	msg.pID = s->id;
+	msg.nonce = ++s->nonce;
 
 	byte_ard idResponseBuf[IDMSG_FULLSIZE];
-
-	// Pack ID response. See protocol.cpp for details. Encrypts and MACs the 
-	// message and returns in pBuffer.
-	pack_idresponse( &msg, 
+	pack_idresponse(&msg,
 					(const u_int32_ard *)masterKeys.getCryptoKeySched(),
 					(const u_int32_ard *)masterKeys.getMacKeySched(),
-					(void *)idResponseBuf);
-
-	// Done packing idresponse message -----------------------------------------
-
-	// Write idresponse messsage to sink server
-    err = BIO_write(conn, (void*)idResponseBuf, IDMSG_FULLSIZE);
-
-    printf("Done writing idresponse packet\n");
-
-    byte_ard keyToSensBuf[KEYTOSENS_FULLSIZE];
-
-	// Read keytosense message from sink server.
-    err = BIO_read(conn, (void*)keyToSensBuf, KEYTOSENS_FULLSIZE);
+					idResponseBuf);
 
-	printf("\n");
-
-	// Unpack keytosens message ------------------------------------------------
-    
-	printf("Unpacking a keytosens message\n");
+	byte_ard keyToSensBuf[KEYTOSENS_FULLSIZE];
+	if(exchange(idResponseBuf, IDMSG_FULLSIZE, 
+				keyToSensBuf, KEYTOSENS_FULLSIZE) != 0){
+		return -1;
+	}
 
-	// Allocate memory for the unpacked message
-	struct message senserecv;
-	senserecv.key = (byte_ard*)malloc(KEY_BYTES);
-	senserecv.ciphertext = (byte_ard*)malloc(KEYTOSINK_CRYPTSIZE);
+	message senserecv;
+	byte_ard key[KEY_BYTES];
+	byte_ard ciphertext[KEYTOSINK_CRYPTSIZE];
+	senserecv.key = key;
+	senserecv.ciphertext = ciphertext;
 
-	// Unpack
-	unpack_keytosens((void*)keyToSensBuf,
+	unpack_keytosens(keyToSensBuf,
 					 (const u_int32_ard *)masterKeys.getCryptoKeySched(), 
 					 &senserecv);
 
-	// Validate the MAC  
-	int validMac = verifyAesCMac( 
-						(const u_int32_ard *)masterKeys.getMacKeySched(), 
-						senserecv.ciphertext, 
-						KEYTOSINK_CRYPTSIZE, 
-						senserecv.cmac );
-
-	if ( validMac==0 ) {
-		printf("MAC failed");
-		return;     
-	} else {
-		printf("MAC OK\n");
-	}
-
-	// Validate the nonce
-	if ( senserecv.nonce != idNonce ) {
-		printf("Nonce failed");
-		return;  
-	} else {
-		printf("Nonce %d matches", idNonce);
+	if(verifyAesCMac((const u_int32_ard *)masterKeys.getMacKeySched(),
+					 senserecv.ciphertext, KEYTOSINK_CRYPTSIZE, 
+					 senserecv.cmac) != CMAC_VALID ||
+	   senserecv.nonce != msg.nonce){
+		return -1;
 	}
 
-	printf("Recieved an encrypted keytoens package:\n");
-	printf("---------------------------------------\n");
-	printf("senserecv.msgtype: %x\n", senserecv.msgtype);
-	printf("senserecv.nonce: %x\n", senserecv.nonce);
-	printf("senserecv.key:\n");
-	printBytes2(senserecv.key, KEY_BYTES); 
-	printf("senserecv.cmac:\n");
-	printBytes2(senserecv.cmac, KEY_BYTES); 
-
-	K_st = new TSenseKeyPair(senserecv.key, cBeta);
-
-	free(senserecv.ciphertext);
-	free(senserecv.key);
-
-	// Done unpacking keytosens message ----------------------------------------
-
-	// The server disconnects after each request so we reconnect.
-	char szConnstr[1024];
-	sprintf(szConnstr,"sink.tsense.sudo.is:%d",sink_port);
-	conn = BIO_new_connect(szConnstr);
-
-	// Pack rekey message ------------------------------------------------------
-
-	u_int16_ard rekeyNonce = 765;
-
-	printf("\n");
-	printf("Packing rekey message:\n");
-	printf("----------------------\n");
-
-	struct message rekeymsg;
-	rekeymsg.pID = idBuf;
-	rekeymsg.nonce = rekeyNonce;
+	*K_st = new TSenseKeyPair(senserecv.key, &cBetaKey);
+	return 0;
+}
 
-	// Set the correct MSG type if you are doing a handshake
+/* rekey handshake -> newkey. Verifies the reply and derives K_STe. */
+int doRekey(vsensor *s, TSenseKeyPair *K_st, TSenseKeyPair **K_ste){
+	message rekeymsg;
 	rekeymsg.msgtype = MSG_T_REKEY_HANDSHAKE;
+	rekeymsg.pID = s->id;
+	rekeymsg.nonce = ++s->nonce;
 
-    // Generate the buffer to write the packet into
-    byte_ard reKeyBuf[REKEY_FULLSIZE];
-	pack_rekey(	&rekeymsg, 
-				(const u_int32_ard*) (K_st->getCryptoKeySched()),
-				(const u_int32_ard*) (K_st->getMacKeySched()),
-				reKeyBuf);
-
-	printf("K_st crypto key schedule:\n");
-	printByteArd(K_st->getCryptoKeySched(), KEY_BYTES*11, 16);
-	printf("\n");
-	
-	printf("K_st MAC key schedule:\n");
-	printByteArd(K_st->getMacKeySched(), KEY_BYTES*11, 16);
-	printf("\n");
-
-	printf("Rekey buffer:\n");
-	printByteArd(reKeyBuf, REKEY_FULLSIZE, 16);
+	byte_ard reKeyBuf[REKEY_FULLSIZE];
+	pack_rekey(&rekeymsg,
+			   (const u_int32_ard*)K_st->getCryptoKeySched(),
+			   (const u_int32_ard*)K_st->getMacKeySched(),
+			   reKeyBuf);
 
-	// Done packing rekey message ----------------------------------------------
-
-    err = BIO_write(conn, (void*)reKeyBuf, REKEY_FULLSIZE);
+	byte_ard newkeybuf[NEWKEY_FULLSIZE];
+	if(exchange(reKeyBuf, REKEY_FULLSIZE, newkeybuf, NEWKEY_FULLSIZE) != 0){
+		return -1;
+	}
 
-    printf("Done writing rekey packet: %d\n", err);
+	message newkeyresp;
+	byte_ard pID[ID_SIZE];
+	byte_ard ciphertext[NEWKEY_CRYPTSIZE];
+	newkeyresp.pID = pID;
+	newkeyresp.ciphertext = ciphertext;
 
-	// unpacking newkey  message -----------------------------------------------
+	unpack_newkey(newkeybuf, (const u_int32_ard *)K_st->getCryptoKeySched(),
+				  &newkeyresp);
 
-	printf("\n");
-	printf("Read newkey packet\n");
-	printf("-------------------\n\n");
+	if(verifyAesCMac((const u_int32_ard *)K_st->getMacKeySched(),
+					 newkeyresp.ciphertext, NEWKEY_CRYPTSIZE,
+					 newkeyresp.cmac) != CMAC_VALID ||
+	   memcmp(newkeyresp.pID, s->id, ID_SIZE) != 0 ||
+	   newkeyresp.nonce != rekeymsg.nonce){
+		return -1;
+	}
 
-	byte_ard newkeybuf[NEWKEY_FULLSIZE];
-	err = BIO_read(conn, (void*)newkeybuf, NEWKEY_FULLSIZE);
-
-	// Unpack the raw buffer into a message struct
-	message newkeyresp; 
-	newkeyresp.ciphertext = (byte_ard*)malloc(NEWKEY_CRYPTSIZE);
-	newkeyresp.pID = (byte_ard*)malloc(6);
-  
-  	unpack_newkey(newkeybuf,
-				  (const u_int32_ard *)K_st->getCryptoKeySched(),
-				  &newkeyresp);
+	// K_STe is the CMAC of the key material R under gamma.
+	byte_ard K_STe[KEY_BYTES];
+	deriveKey(&cGammaKey, newkeyresp.rand, K_STe);
 
-	// Check the MAC against the encrypted data
+	*K_ste = new TSenseKeyPair(K_STe, &cEpsilonKey);
+	return 0;
+}
 
-	validMac = verifyAesCMac((const u_int32_ard *)K_st->getMacKeySched(),
-							 newkeyresp.ciphertext, 
-							 NEWKEY_CRYPTSIZE,
-							 newkeyresp.cmac );
+/* Sends one data message, CBC and CMAC or GCM. */
+int doData(vsensor *s, TSenseKeyPair *K_ste){
+	byte_ard measurements[MAX_DATA_LEN];
+	for(int i = 0; i < dataLen; i++){
+		measurements[i] = (s->msgtime + i) & 0xFF;
+	}
 
-	if ( validMac = 0) {
-		printf("MAC failed\n");
-		return;     
+	struct data msg;
+	memcpy(msg.id, s->id, ID_SIZE);
+	msg.msgtime = ++s->msgtime;  // Must increase, see the replay table.
+	msg.data_len = dataLen;
+	msg.data = measurements;
+
+	byte_ard databuf[DATA_GCM_FULLSIZE(MAX_DATA_LEN) + 2*BLOCK_BYTE_SIZE];
+	int len;
+
+	if(useGcm){
+		byte_ard nonce[GCM_NONCE_SIZE];
+		memset(nonce, 0, GCM_NONCE_SIZE);
+		u_int32_ard counter = ++s->gcmCounter;
+		for(int i = 0; i < 4; i++)
+			nonce[GCM_NONCE_SIZE-1-i] = (counter >> (8*i)) & 0xFF;
+
+		pack_data_gcm(&msg, (const u_int32_ard*)K_ste->getCryptoKeySched(),
+					  nonce, databuf);
+		len = DATA_GCM_FULLSIZE(dataLen);
 	} else {
-		printf("MAC OK\n");
+		pack_data(&msg, (const u_int32_ard*)K_ste->getCryptoKeySched(), 
+				  (const u_int32_ard*)K_ste->getMacKeySched(), databuf);
+		len = MSGTYPE_SIZE + 1 + ID_SIZE + msg.cipher_len + BLOCK_BYTE_SIZE;
 	}
-    
-	// Get the data available from the rekey message
-  
-	// Get the device id in the message and compare with my own
-	if (strncmp((const char *)newkeyresp.pID,
-		(const char *)idBuf,ID_SIZE) != 0 )
-	{
-		printf("ID mismatch in rekey\n");
-		return;         
+
+	return exchange(databuf, len, NULL, 0);
+}
+
+/* Runs one lifecycle of a sensor and records the latency of each step. 
+ * Stops at the first step that fails.
+ */
+void runLifecycle(worker *w, vsensor *s){
+	TSenseKeyPair *K_st = NULL;
+	TSenseKeyPair *K_ste = NULL;
+	double t;
+	int failedStep = -1;
+
+	t = now();
+	if(doIdResponse(s, &K_st) != 0){
+		failedStep = STEP_IDRESPONSE;
 	} else {
-		printf("ID %d%d-%d%d%d%d matches\n",
-				newkeyresp.pID[0],newkeyresp.pID[1],newkeyresp.pID[2],
-				newkeyresp.pID[3],newkeyresp.pID[4],newkeyresp.pID[5]);
+		w->latency[STEP_IDRESPONSE].push_back((now() - t)*1e6);
+
+		t = now();
+		if(doRekey(s, K_st, &K_ste) != 0){
+			failedStep = STEP_REKEY;
+		} else {
+			w->latency[STEP_REKEY].push_back((now() - t)*1e6);
+
+			for(int i = 0; i < dataCount && failedStep < 0; i++){
+				t = now();
+				if(doData(s, K_ste) != 0){
+					failedStep = STEP_DATA;
+				} else {
+					w->latency[STEP_DATA].push_back((now() - t)*1e6);
+				}
+			}
+		}
 	}
 
-	// Compare the nonce with my current one
-	if ( newkeyresp.nonce != rekeyNonce ) {
-		printf("Nonce mismatch on rekey");
-		return;         
+	if(failedStep >= 0){
+		w->failed[failedStep]++;
 	} else {
-		printf("Nonce %d matches\n", rekeyNonce);
+		w->lifecycles++;
 	}
 
-	printf("Random number (key material):\n");
-	printBytes2(newkeyresp.rand,16);
-
-	// Derive K_ste ------------------------------------------------------------
-
-	byte_ard K_STe[KEY_BYTES];
-
-	byte_ard gammaKeySched[KEY_BYTES*11];
-
-	KeyExpansion(cGamma, gammaKeySched);
-
-    // Derive K_STe using AES cMAC. The constant is the key and the 
-    // R is the message M that will be cMAC'ed.
-    aesCMac((u_int32_ard*) gammaKeySched,
-        newkeyresp.rand,
-        KEY_BYTES,
-        K_STe);
-
-	K_ste = new TSenseKeyPair(K_STe, cEpsilon);
-
-	// Done deriving K_ste -----------------------------------------------------
-  
-	printf("Encryption keys:\n");
-	printf("Kste:\n");
-	printByteArd(K_ste->getCryptoKey(),16,16);
-	printf("Kstea:\n");
-	printByteArd(K_ste->getMacKey(),16,16);
-
-
-	free(newkeyresp.ciphertext);
-	free(newkeyresp.pID);
-
-	printf("Done handling newkey message from sink\n\n");
+	delete K_st;
+	delete K_ste;
 }
 
-void senddata(BIO *conn, byte_ard *deviceId, int sink_port)
-{
-	printf("\n\nData transmit test\n");
-	printf("==================\n\n");
-
-	printf("Transmission keys:\n");
-	printf("K_STe: ");
-	printByteArd(K_ste->getCryptoKeySched(), 16, 16);
-	printf("K_STea ");
-	printByteArd(K_ste->getMacKeySched(), 16, 16);
-	
-	static unsigned char counter=0;
-
-	data msg;  // Struct to hold the data messages
-	memcpy(msg.id,deviceId,6);
-	time_t t;
-	time(&t);
-	msg.msgtime = t;
-	msg.data_len = 20;
-	msg.data = (byte_ard*)malloc(msg.data_len);
-
-	printf("My time is %ld\n",t);
-
-	byte_ard measBuffer[20];
-	for (int i=0; i<20; i++){
-		measBuffer[i] = counter++;
-		counter %= 0xFF;
+/* Worker thread. Runs the sensors index, index+threadCount, ... in turn. 
+ * With a rate set, lifecycle k of the fleet is started no earlier than
+ * k/rate seconds after the start.
+ */
+void *workerMain(void *arg){
+	worker *w = (worker*)arg;
+	long k = 0;
+
+	for(int l = 0; l < lifecycleCount; l++){
+		for(int i = w->index; i < sensorCount; i += threadCount, k++){
+			if(rate > 0.0){
+				double due = startTime + (k*threadCount + w->index)/rate;
+				double wait = due - now();
+				if(wait > 0.0){
+					usleep((useconds_t)(wait*1e6));
+				}
+			}
+			runLifecycle(w, &sensors[i]);
+		}
 	}
-	memcpy(msg.data,measBuffer,msg.data_len);
-	printf("Data buffer:\n");
-	for( int i=0; i<msg.data_len; i++) 
-		printf("%d ", msg.data[i]);
-	printf("\n\n");
-
-	u_int16_ard plainsize = ID_SIZE+MSGTIME_SIZE+1+msg.data_len;
-	u_int16_ard cipher_len = (1+(plainsize/BLOCK_BYTE_SIZE)) * BLOCK_BYTE_SIZE;
-	u_int16_ard bufsize = cipher_len+8+16; // 8 plaintext bytes + cmac
-	byte_ard* databuf = (byte_ard*)malloc(bufsize);
-    
-	// Use the K_ste derived above to encrypt and mack the data package.
-	pack_data( &msg, (const u_int32_ard*)K_ste->getCryptoKeySched(), 
-			   (const u_int32_ard*)K_ste->getMacKeySched(), databuf );
-
-	// The server disconnects after each request so we reconnect.
-	char szConnstr[1024];
-	sprintf(szConnstr,"sink.tsense.sudo.is:%d",sink_port);
-	conn = BIO_new_connect(szConnstr);
-
-	int err;
-	err = BIO_write(conn, (void*)databuf, bufsize);
-
-  	cout << endl;
- 	cout << "Wrote data to socket:" << endl;
-	printByteArd(databuf,bufsize,16);
 
-	BIO_free(conn);
-  
-	// Free
-	free(databuf);
-	free(msg.data);
+	return NULL;
 }
 
+double percentile(vector<double> &sorted, double p){
+	if(sorted.empty())
+		return 0.0;
+	size_t i = (size_t)(p/100.0*(sorted.size()-1) + 0.5);
+	return sorted[i];
+}
 
-int main(int argc, char *argv[]){
+void report(worker *workers, double elapsed){
+	long lifecycles = 0;
+	long messages = 0;
+
+	printf("\n%-12s %8s %7s %10s %10s %10s %10s %10s  (usec)\n", "step", "ok",
+		   "failed", "p50", "p90", "p99", "p99.9", "max");
+
+	for(int s = 0; s < STEPS; s++){
+		vector<double> all;
+		long failed = 0;
+		for(int t = 0; t < threadCount; t++){
+			all.insert(all.end(), workers[t].latency[s].begin(), 
+					   workers[t].latency[s].end());
+			failed += workers[t].failed[s];
+		}
+		sort(all.begin(), all.end());
+		messages += all.size();
+
+		printf("%-12s %8ld %7ld %10.0f %10.0f %10.0f %10.0f %10.0f\n", 
+			   stepNames[s], (long)all.size(), failed, percentile(all, 50),
+			   percentile(all, 90), percentile(all, 99), percentile(all, 99.9),
+			   all.empty() ? 0.0 : all.back());
+	}
 
-	printf("\n\nEnd-to-end protocol test begins\n");
-	printf("===============================\n\n");
+	for(int t = 0; t < threadCount; t++){
+		lifecycles += workers[t].lifecycles;
+	}
 
-    BIO *conn;
+	printf("\nElapsed:     %.2f s\n", elapsed);
+	printf("Lifecycles:  %ld of %ld, %.1f/s\n", lifecycles, 
+		   (long)sensorCount*lifecycleCount, lifecycles/elapsed);
+	printf("Messages:    %ld, %.1f/s\n", messages, messages/elapsed);
+}
 
-	byte_ard deviceid[] = {0x00,0x01,0x00,0x00,0x00,0x0a};
+void usage(){
+	fprintf(stderr, "Usage: cliprot -P <sink port> [options]\n");
+	fprintf(stderr, "       cliprot -p <keystore file> [-n sensors] [-s seed]\n\n");
+	fprintf(stderr, "    -H  Sink host (localhost)\n");
+	fprintf(stderr, "    -P  Sink port\n");
+	fprintf(stderr, "    -n  Number of simulated sensors (1)\n");
+	fprintf(stderr, "    -t  Number of threads (1)\n");
+	fprintf(stderr, "    -l  Lifecycles per sensor (1)\n");
+	fprintf(stderr, "    -d  Data messages per lifecycle (1)\n");
+	fprintf(stderr, "    -b  Data bytes per message, at most %d (20)\n", 
+			MAX_DATA_LEN);
+	fprintf(stderr, "    -r  Lifecycles started per second, 0 for no limit (0)\n");
+	fprintf(stderr, "    -g  Send AES-GCM data messages\n");
+	fprintf(stderr, "    -s  Seed for the sensor IDs and keys (1)\n");
+	fprintf(stderr, "    -p  Write the sensors' keys to a keystore file for\n");
+	fprintf(stderr, "        tsauthd --keystore and exit\n");
+}
 
-	// Set the private key for device 00 01 - 00 00 00 0A
-	byte_ard masterKeyBuf[KEY_BYTES] = 
-		{ 0x0c, 0xbb, 0x0a, 0x6f, 0xe8, 0x1b, 0x20, 0x17, 
-		  0x14, 0xa1, 0xae, 0x4b, 0xb2, 0xea, 0x5e, 0x00 };
+int main(int argc, char *argv[]){
+	const char *host = "localhost";
+	const char *port = NULL;
+	const char *keystorePath = NULL;
+	unsigned int seed = 1;
+	int c;
+
+	while((c = getopt(argc, argv, "H:P:n:t:l:d:b:r:gs:p:h")) != -1){
+		switch(c){
+			case 'H': host = optarg; break;
+			case 'P': port = optarg; break;
+			case 'n': sensorCount = atoi(optarg); break;
+			case 't': threadCount = atoi(optarg); break;
+			case 'l': lifecycleCount = atoi(optarg); break;
+			case 'd': dataCount = atoi(optarg); break;
+			case 'b': dataLen = atoi(optarg); break;
+			case 'r': rate = atof(optarg); break;
+			case 'g': useGcm = true; break;
+			case 's': seed = strtoul(optarg, NULL, 0); break;
+			case 'p': keystorePath = optarg; break;
+			default:
+				usage();
+				return -1;
+		}
+	}
 
-	if ( argc < 2 )
-	{
-		printf("Sink port required\n");
+	if(sensorCount < 1 || threadCount < 1 || lifecycleCount < 1 || 
+	   dataCount < 0 || dataLen < 1 || dataLen > MAX_DATA_LEN ||
+	   (port == NULL && keystorePath == NULL)){
+		usage();
 		return -1;
 	}
+	if(threadCount > sensorCount){
+		threadCount = sensorCount;
+	}
 
-	int sink_port = atoi(argv[1]);
-	printf("Using sink port %d\n\n",sink_port);
-
-    init_OpenSSL();
-	
-	char szConnstr[1024];
-	sprintf(szConnstr,"sink.tsense.sudo.is:%d",sink_port);
-	conn = BIO_new_connect(szConnstr);
-
-    if(!conn){
-        int_error("Error createing connection BIO");
-    }
-
-    if(BIO_do_connect(conn) <= 0){
-        int_error("Error connecting to remote machine");
-    }
+	sensors = new vsensor[sensorCount];
+	for(int i = 0; i < sensorCount; i++){
+		makeSensor(&sensors[i], i, seed);
+	}
 
-    fprintf(stderr, "Connection opened\n");
-    do_client_loop(conn,masterKeyBuf,deviceid,sink_port);
-    fprintf(stderr, "Connection closed\n");
+	if(keystorePath != NULL){
+		if(writeKeystore(keystorePath) != 0){
+			return -1;
+		}
+		printf("Wrote the keys of %d sensors to %s\n", sensorCount, 
+			   keystorePath);
+		return 0;
+	}
 
-	senddata(conn,deviceid,sink_port);
+	snprintf(sinkAddr, ADDRLEN, "%s:%s", host, port);
+	printf("Running %d sensors x %d lifecycles on %d threads against %s\n",
+		   sensorCount, lifecycleCount, threadCount, sinkAddr);
+
+	init_OpenSSL();
+
+	worker *workers = new worker[threadCount];
+	startTime = now();
+	for(int t = 0; t < threadCount; t++){
+		workers[t].index = t;
+		workers[t].lifecycles = 0;
+		memset(workers[t].failed, 0, sizeof(workers[t].failed));
+		if(THREAD_CREATE(workers[t].tid, workerMain, &workers[t]) != 0){
+			int_error("Error creating a worker thread");
+		}
+	}
+	for(int t = 0; t < threadCount; t++){
+		pthread_join(workers[t].tid, NULL);
+	}
 
-    BIO_free(conn);
+	report(workers, now() - startTime);
 
-    return 0;
+	delete [] workers;
+	delete [] sensors;
+	return 0;
 }
-
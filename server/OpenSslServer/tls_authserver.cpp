@@ -7,32 +7,113 @@
 #include "tls_authserver.h"
 #include <syslog.h>
 #include <string.h>
+#include <stdio.h>
+#include <unistd.h>
 
 using namespace std;
 
 #define BUFSIZE 2048
 
+// Completions taken off the io_uring per round.
+#define URING_ROUND 64
+
 /* This class implements a simple authorization server for TSense. It 
  * constructs a set of profiles for each authorized sensor. Arguments
  * are:
  *   - sinkServerAddr, the FQDN of the sink server.
  *   - serverAddr, the authorization servers own FQDN.
  *   - serverListenPort, the port on which the authorization server listens.
+ *   - keystorePath, optional file with the master keys of provisioned 
+ *     sensors, see loadKeystore().
+ *   - uring, serve all connections from one process on an io_uring rather
+ *     than with a process each, see uringMain().
  */
 TlsAuthServer::TlsAuthServer( 	const char* sinkServerAddr,
 				const char *serverAddr,
-				const char *serverListenPort) : 
+				const char *serverListenPort,
+				const char *keystorePath,
+				bool uring) : 
 				TlsBaseServer(	SERVER_MODE,
 						serverAddr, 
 						serverListenPort)
 {
 	_sinkServerAddr = sinkServerAddr;
+	_uring = uring;
+	K_at = NULL;
+
+	if(!arenaInit(&msgArena, ARENA_DEFAULT_SIZE)){
+		throw runtime_error("Unable to allocate the message arena.");
+	}
+
+	if(keystorePath != NULL){
+		loadKeystore(keystorePath);
+	}
 }
 
 TlsAuthServer::~TlsAuthServer(){
 	delete K_at;
 }
 
+/* Reads the master keys K_AT of provisioned sensors. One sensor per line,
+ * the public ID as 12 hex digits and the key as 32 hex digits separated by
+ * white space. Empty lines and lines starting with '#' are skipped. Throws 
+ * a runtime_error if the file can't be read or a line is malformed.
+ */
+void TlsAuthServer::loadKeystore(const char *keystorePath){
+	FILE *f = fopen(keystorePath, "r");
+	if(f == NULL){
+		throw runtime_error("Unable to open the keystore.");
+	}
+
+	char line[256];
+	while(fgets(line, sizeof(line), f) != NULL){
+		char szId[64], szKey[64];
+		byte_ard pID[ID_SIZE], key[KEY_BYTES];
+		unsigned int b;
+		const char *hex = "0123456789abcdefABCDEF";
+
+		int fields = sscanf(line, "%63s %63s", szId, szKey);
+		if(fields < 1 || szId[0] == '#'){
+			continue;
+		}
+		if(fields != 2 || strlen(szId) != ID_SIZE*2 || 
+		   strlen(szKey) != KEY_BYTES*2 || strspn(szId, hex) != ID_SIZE*2 ||
+		   strspn(szKey, hex) != KEY_BYTES*2){
+			fclose(f);
+			throw runtime_error("Malformed line in the keystore.");
+		}
+		for(int i = 0; i < ID_SIZE; i++){
+			sscanf(szId + 2*i, "%2x", &b);
+			pID[i] = (byte_ard)b;
+		}
+		for(int i = 0; i < KEY_BYTES; i++){
+			sscanf(szKey + 2*i, "%2x", &b);
+			key[i] = (byte_ard)b;
+		}
+
+		keystore[string((char*)pID, ID_SIZE)] = string((char*)key, KEY_BYTES);
+	}
+	fclose(f);
+
+	syslog(LOG_NOTICE, "Loaded %d keys from %s", (int)keystore.size(), 
+		   keystorePath);
+}
+
+/* Copies the master key of a provisioned sensor to K_AT. Returns false if 
+ * the sensor is not in the keystore.
+ */
+bool TlsAuthServer::lookupKeystore(const byte_ard *sensorId, byte_ard *K_AT){
+	map<string, string>::iterator it = 
+		keystore.find(string((const char*)sensorId, ID_SIZE));
+
+	if(it == keystore.end()){
+		return false;
+	}
+
+	memcpy(K_AT, it->second.data(), KEY_BYTES);
+	return true;
+}
+
 /* A simple generic messge handling method that calls a specialized message 
  * routine after examining the first byte of an incoming message packet that
  * should contain the message ID.
@@ -47,14 +128,33 @@ void TlsAuthServer::handleMessage(SSL *ssl) {
 
 	// Now call the appropriate handler.
 	if(readBuf[0] == 0x10){
-		handleIdResponse(ssl, readBuf, readLen);
+		byte_ard keyToSinkBuf[KEYTOSINK_FULLSIZE];
+
+		if(handleIdResponse(readBuf, readLen, keyToSinkBuf)){
+			// Dispatch ketosink message to sink.
+			writeToSink(ssl, keyToSinkBuf, KEYTOSINK_FULLSIZE);
+
+			int status = (SSL_get_shutdown(ssl) & SSL_RECEIVED_SHUTDOWN)? 1 : 0;
+
+			if(status){
+				SSL_shutdown(ssl);
+			} else { 
+				SSL_clear(ssl);
+			}
+		}
 	}else{
 		log_err_exit("Error, unsupported protocol message.");
 	}
+
+	arenaReset(&msgArena);
 }
 
-void TlsAuthServer::handleIdResponse(SSL *ssl, byte_ard *idResponseBuf, 
-										int readLen) 
+/* Checks an idresponse and packs the keytosink message that answers it into
+ * keyToSinkBuf. Returns false if the sensor is unknown or the message does 
+ * not check out, then there is no answer.
+ */
+bool TlsAuthServer::handleIdResponse(byte_ard *idResponseBuf, int readLen,
+									 byte_ard *keyToSinkBuf) 
 {
 	// Start sensor identification -----------------------------------------
 
@@ -72,11 +172,6 @@ void TlsAuthServer::handleIdResponse(SSL *ssl, byte_ard *idResponseBuf,
 
 	byte_ard K_AT[KEY_BYTES];
 
-	// This is the alpha for deriving the MAC key.
-	// FIXME Can be removed once the key derivation header has been included.
-	byte_ard alpha[] = {0x65, 0xa4, 0x56, 0x5d, 0x09, 0xd6, 0x7e, 0xfa, 
-						0xb5, 0x9d, 0x6f, 0x1c, 0xc1, 0xc5, 0x79, 0x9d };
-
 	//
 	// Here are some hardcoded encryption keys -- private sensor IDs.
 	// FIXME Eventually read from file or database. 
@@ -90,8 +185,12 @@ void TlsAuthServer::handleIdResponse(SSL *ssl, byte_ard *idResponseBuf,
 	byte_ard K_AT_000A[] = {0x0c, 0xbb, 0x0a, 0x6f, 0xe8, 0x1b, 0x20, 0x17, 
 							0x14, 0xa1, 0xae, 0x4b, 0xb2, 0xea, 0x5e, 0x00 };
 
-	// For now, using the last byte as unique sensor identifier does the trick.
-	switch(sensorId[5])
+	// Provisioned sensors first, then the hardcoded ones. For those, using 
+	// the last byte as unique sensor identifier does the trick.
+	if(lookupKeystore(sensorId, K_AT)){
+		syslog(LOG_NOTICE,"Using keystore key");
+	}
+	else switch(sensorId[5])
 	{
 		case 0x02:
 			syslog(LOG_NOTICE,"Using keyset 2");
@@ -107,18 +206,19 @@ void TlsAuthServer::handleIdResponse(SSL *ssl, byte_ard *idResponseBuf,
 			break;
 		default:
 			syslog(LOG_ERR,"UNKNOWN TSENSOR");
-			return; // TODO: Handle better
+			return false; // TODO: Handle better
 	}
 
 	// Construct the encryption and MAC key pair.
-	K_at = new TSenseKeyPair(K_AT, alpha);
+	delete K_at;
+	K_at = new TSenseKeyPair(K_AT, &cAlphaKey);
 	
 	// Start unpack idresponse -------------------------------------------------
 	
 	// Allocate memory for the ID and '\0'	
 	struct message recv_id;
-	recv_id.pID = (byte_ard*)malloc(ID_SIZE+1);
-	recv_id.ciphertext = (byte_ard*)malloc(IDMSG_CRYPTSIZE);
+	recv_id.pID = (byte_ard*)arenaAlloc(&msgArena, ID_SIZE+1);
+	recv_id.ciphertext = (byte_ard*)arenaAlloc(&msgArena, IDMSG_CRYPTSIZE);
 	// Unpack and decrypt the message
 	unpack_idresponse((void*) idResponseBuf,
 			  (const u_int32_ard*) (K_at->getCryptoKeySched()),
@@ -164,7 +264,8 @@ void TlsAuthServer::handleIdResponse(SSL *ssl, byte_ard *idResponseBuf,
 	// either an error in the protocol or that the sender does not have the
 	// proper key to encrypt the message.
 	if ( strncmp( (char *)sensorId, (char *)recv_id.pID, 6 ) != 0 ) {
-		log_err_exit("Plaintext and ciphered IDs did not match!");
+		syslog(LOG_ERR, "Plaintext and ciphered IDs did not match!");
+		return false;
 	}
 
 	// Generate the session key ------------------------------------------------
@@ -189,37 +290,22 @@ void TlsAuthServer::handleIdResponse(SSL *ssl, byte_ard *idResponseBuf,
 	struct message sendmsg;
 	sendmsg.renewal_timer = 0; 				// Not using this at present.
 	sendmsg.nonce = recv_id.nonce;	// Pass on the nonce from T.
-        sendmsg.pID = (byte_ard*)malloc(ID_SIZE);
+        sendmsg.pID = (byte_ard*)arenaAlloc(&msgArena, ID_SIZE);
 
 	memcpy(sendmsg.pID,recv_id.pID,ID_SIZE);
 
 	sendmsg.key =  K_ST;
 
-	byte_ard keyToSinkBuf[KEYTOSINK_FULLSIZE];
-
 	pack_keytosink(	&sendmsg,
 					(const u_int32_ard*) (K_at->getCryptoKeySched()),
 					(const u_int32_ard*) (K_at->getMacKeySched()), 
 					keyToSinkBuf);
 
-   	free(recv_id.ciphertext); // Remember to clean up all malloced
-	free(recv_id.pID);
-
 	// Done packing the keytosink message --------------------------------------
 
-	// Dispatch ketosink message to sink.
-	writeToSink(ssl, keyToSinkBuf, KEYTOSINK_FULLSIZE);
-
 	syslog(LOG_NOTICE,
-			"Session key package for sensor %s dispatched to sink", szSensorId);
-
-	int status = (SSL_get_shutdown(ssl) & SSL_RECEIVED_SHUTDOWN)? 1 : 0;
-
-	if(status){
-		SSL_shutdown(ssl);
-	} else { 
-		SSL_clear(ssl);
-	}
+			"Session key package for sensor %s ready for the sink", szSensorId);
+	return true;
 }
 
 /* Writes a message to the sink server over SSL/TLS and returns the number of
@@ -307,6 +393,11 @@ void TlsAuthServer::serverMain(){
 	SSL *ssl;
 	//SSL_CTX *ctx;
 
+	if(_uring){
+		uringMain();
+		return;
+	}
+
 	// Creates a BIO object and returns it as an accept BIO object.
 	sinkServerAcceptBio = BIO_new_accept((char*) _serverListenPort);
 
@@ -348,3 +439,132 @@ void TlsAuthServer::serverMain(){
 	SSL_CTX_free(ctx);
 	BIO_free(sinkServerAcceptBio);
 }
+
+/* Event driven auth server. All connections from the sink are served by this
+ * one process on an io_uring, as the gateway sessions of the sink are, see
+ * TlsSinkServer::gatewayUringMain(). An idresponse is answered in the loop:
+ * the keys are in memory, so checking it and packing the answer never 
+ * blocks. The sink hangs up once it has the answer, and a connection that
+ * fails its checks or sends anything else is closed without ending the 
+ * others.
+ */
+void TlsAuthServer::uringMain(){
+	BIO *sinkServerAcceptBio;
+	int listenFd;
+	TsUring *ring;
+	uringOp acceptOp;
+	uringCompletion completions[URING_ROUND];
+
+	sinkServerAcceptBio = BIO_new_accept((char*) _serverListenPort);
+
+	if(!sinkServerAcceptBio){
+		log_err_exit("Error creating server socket.");
+	}
+
+	if(BIO_do_accept(sinkServerAcceptBio) <= 0){
+		log_err_exit("Error binding server socket.");
+	}
+	BIO_get_fd(sinkServerAcceptBio, &listenFd);
+
+	try {
+		ring = new TsUring();
+	} catch(runtime_error rex) {
+		log_err_exit(rex.what());
+	}
+
+	syslog(LOG_NOTICE, "Listening for the sink on %s, io_uring", 
+				_serverListenPort);
+
+	acceptOp.kind = URING_OP_ACCEPT;
+	acceptOp.owner = NULL;
+	ring->prepAccept(listenFd, &acceptOp);
+
+	while(true){
+		int count = ring->wait(completions, URING_ROUND);
+		if(count < 0){
+			log_err_exit("Error waiting for io_uring completions.");
+		}
+
+		for(int i = 0; i < count; i++){
+			uringOp *op = completions[i].op;
+			int32_ard result = completions[i].result;
+			TsUringTlsConn *conn = (TsUringTlsConn*)op->owner;
+			int status;
+
+			switch(op->kind){
+				case URING_OP_ACCEPT:
+					if(result >= 0){
+						try {
+							conn = new TsUringTlsConn(ring, result, ctx);
+							conn->start();
+						} catch(runtime_error rex) {
+							syslog(LOG_ERR, "%s", rex.what());
+							close(result);
+						}
+					}else{
+						syslog(LOG_ERR, "Error accepting connection: %s",
+								strerror(-result));
+					}
+					ring->prepAccept(listenFd, &acceptOp);
+					continue;
+
+				case URING_OP_RECV:
+					status = conn->received(result);
+					while(status == URING_TLS_OK){
+						status = conn->read();
+						if(status == URING_TLS_OK && uringMessage(conn) < 0){
+							status = URING_TLS_ERROR;
+						}
+					}
+					conn->flush();
+					if(status != URING_TLS_WANT_READ){
+						conn->close();
+					}
+					break;
+
+				case URING_OP_SEND:
+					conn->sent(result);
+					break;
+			}
+
+			if(conn->idle()){
+				delete conn;
+			}
+		}
+	}
+}
+
+/* Answers the idresponse in the plaintext of conn once all of it is there,
+ * as handleMessage() does. Returns 0, or -1 if the connection is to be 
+ * closed.
+ */
+int TlsAuthServer::uringMessage(TsUringTlsConn *conn){
+	byte_ard *readBuf = conn->plain();
+	byte_ard keyToSinkBuf[KEYTOSINK_FULLSIZE];
+
+	if(readBuf[0] != MSG_T_GET_ID_R){
+		syslog(LOG_ERR, "Error, unsupported protocol message.");
+		return -1;
+	}
+	if(conn->plainLength() < IDMSG_FULLSIZE){
+		return 0;
+	}
+
+	if(postConnectionValidations(conn->getSsl(), _sinkServerAddr) 
+	   != X509_V_OK){
+		syslog(LOG_ERR, "Error checking SSL object after connection");
+		return -1;
+	}
+
+	bool answered = handleIdResponse(readBuf, IDMSG_FULLSIZE, keyToSinkBuf);
+	arenaReset(&msgArena);
+	conn->consume(conn->plainLength());
+
+	if(!answered){
+		return -1;
+	}
+
+	// Goes out with the next flush.
+	BIO_write(conn->bio(), keyToSinkBuf, KEYTOSINK_FULLSIZE);
+	return 0;
+}
@@ -11,7 +11,11 @@
 #include "tsense_keypair.h"
 #include "protocol.h"
 #include "aes_utils.h"
+#include "msg_arena.h"
+#include "ts_uring.h"
 #include <stdexcept>
+#include <map>
+#include <string>
 
 using namespace std;
 
@@ -21,19 +25,35 @@ class TlsAuthServer : public TlsBaseServer{
 		TSenseKeyPair *K_at;
 
 		const char *_sinkServerAddr;
+
+		// Serve all connections from one process on an io_uring.
+		bool _uring;
+
+		// Memory for the message being handled, reset once it is answered.
+		struct msg_arena msgArena;
+
+		// Master keys K_AT by public sensor ID, both as raw bytes.
+		map<string, string> keystore;
+		void loadKeystore(const char *keystorePath);
+		bool lookupKeystore(const byte_ard *sensorId, byte_ard *K_AT);
 		void serverFork(void *arg, BIO* proxyClientRequestBio);
 
 		void handleMessage(SSL *ssl);
+		void uringMain();
+		int uringMessage(TsUringTlsConn *conn);
 
 		int writeToSink(SSL *ssl, byte_ard* writeBuf, int len);
 		int readFromSink(SSL *ssl, byte_ard* readBuf, int len);
 
-		void handleIdResponse(SSL *ssl, byte_ard *readBuf, int readLen);
+		bool handleIdResponse(byte_ard *readBuf, int readLen, 
+							  byte_ard *keyToSinkBuf);
 
     public:
 		TlsAuthServer(	const char* sinkServerAddr, 
 						const char *hostName, 
-						const char *listenPort);
+						const char *listenPort,
+						const char *keystorePath = NULL,
+						bool uring = false);
 		~TlsAuthServer();
 		void serverMain();
 };
@@ -194,7 +194,16 @@ err_occured:
 }
 
 
-SSL_CTX *TlsBaseServer::setupServerCtx(int mode){
+/* Sets up a context for the given mode. Without options it speaks TLSv1 
+ * alone, as the sensor facing servers always have. With CTX_TLS12 it 
+ * negotiates the highest version both ends have, at least TLS 1.2. With
+ * CTX_KTLS, which needs TLS 1.2 as well, connections on it hand their 
+ * record layer to the kernel (kTLS) once the handshake is done, so records
+ * are encrypted and decrypted in the socket rather than through OpenSSL.
+ * Where kTLS cannot be had, a cipher or a kernel without it, OpenSSL keeps
+ * the records itself.
+ */
+SSL_CTX *TlsBaseServer::setupServerCtx(int mode, int options){
 
     SSL_CTX *ctx;
 	const char *certFile;
@@ -214,14 +223,16 @@ SSL_CTX *TlsBaseServer::setupServerCtx(int mode){
 	//      handshake to fail if no client certificate is sent in reply by the 
 	//		client. Failure to validate the certificate will of course also 
 	//      cause the SSL handshake to terminate.
+	bool tls12 = (options & (CTX_TLS12 | CTX_KTLS)) != 0;
+
 	if(mode == SERVER_MODE){
 		certFile = "server.pem";
-		ctx = SSL_CTX_new(TLSv1_server_method());
+		ctx = SSL_CTX_new(tls12 ? SSLv23_server_method() : TLSv1_server_method());
 		SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER|SSL_VERIFY_FAIL_IF_NO_PEER_CERT,
 						   verify_callback);
 	} else if (mode == CLIENT_MODE) {
 		certFile="client.pem";
-		ctx=SSL_CTX_new(TLSv1_client_method());
+		ctx=SSL_CTX_new(tls12 ? SSLv23_client_method() : TLSv1_client_method());
 		SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, verify_callback);
 	} else {
 		log_err_exit("Unsupported mode.");
@@ -232,6 +243,24 @@ SSL_CTX *TlsBaseServer::setupServerCtx(int mode){
 	// one or the chain is longer than 4 verification will fail.
 	SSL_CTX_set_verify_depth(ctx,4);
 
+	if(tls12){
+		// TLS 1.2 at least, whatever else the OpenSSL build allows.
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+		SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+#else
+		SSL_CTX_set_options(ctx, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3 |
+							SSL_OP_NO_TLSv1 | SSL_OP_NO_TLSv1_1);
+#endif
+	}
+
+	if(options & CTX_KTLS){
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+		SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#else
+		syslog(LOG_NOTICE, "OpenSSL was built without kTLS, not enabled.");
+#endif
+	}
+
     if(SSL_CTX_load_verify_locations(ctx, CAFILE, CADIR) !=1){
         log_err_exit("Error loading CA file and/or directory.");
     }
@@ -25,6 +25,10 @@ using namespace std;
 #define CLIENT_MODE 0x1
 #define SERVER_MODE 0x2
 
+// Context options, see setupServerCtx().
+#define CTX_TLS12 0x1   // TLS 1.2 or later instead of TLSv1 alone
+#define CTX_KTLS  0x2   // Records in the kernel where it can, implies CTX_TLS12
+
 #define log_err_exit(msg) handleError(__FILE__, __LINE__, msg);
 
 int verify_callback(int ok, X509_STORE_CTX *store);
@@ -38,7 +42,7 @@ class TlsBaseServer {
 		void handleError(const char *file, int lineno, const char * msg);
 		void initOpenSsl(void);
 		void seedPrng(void);
-		SSL_CTX *setupServerCtx(int mode);
+		SSL_CTX *setupServerCtx(int mode, int options = 0);
 		void doVerify(SSL *ssl, const char* peer);
 		long postConnectionValidations(SSL *ssl, const char *peer);
 
@@ -6,25 +6,25 @@
 
 #include <syslog.h>
 #include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/eventfd.h>
+#include <mysql.h>
 
 #include "tls_sinkserver.h"
+#include "aes_batch.h"
+#include "payload_codec.h"
 
 
 using namespace std;
 
 #define BUFSIZE 2048
 
-// The constant used to derive K_STa from K_ST.
-byte_ard cBeta[KEY_BYTES] = { 0x10, 0x9b, 0x58, 0xba, 0x59, 0xe0, 0xd6, 0x6e,
-							  0xe9, 0xf7, 0x35, 0xab, 0x6a, 0x99, 0xe3, 0x61 };
-
-// The constant used to derive K_STe from K_ST.
-byte_ard cGamma[KEY_BYTES] = { 0xf1, 0x15, 0x3e, 0xb6, 0xb0, 0x1f, 0xa8, 0xc7,
-							   0xa2, 0x3b, 0x9f, 0x9b, 0x95, 0x2d, 0xcc, 0x06 };
-
-// The constant  used to derive K_STea from K_STe.
-byte_ard cEpsilon[KEY_BYTES] = { 0x3c, 0xdd, 0x2d, 0x67, 0xdf, 0x88, 0xef, 0xb2,
-					           0xe1, 0x31, 0x33, 0xe7, 0xc9, 0x3a, 0x63, 0xeb };
+// How long a gateway session waits on the auth server for an idresponse 
+// relay before the message is dropped. The sensor asks again.
+#define AUTH_TIMEOUT_SEC 5
 
 /* Parameters:
  *  - authServerAddr, IP/FQDN for the authentication server.
@@ -32,17 +32,62 @@ byte_ard cEpsilon[KEY_BYTES] = { 0x3c, 0xdd, 0x2d, 0x67, 0xdf, 0x88, 0xef, 0xb2,
  *  - serverAddr, Our own IP/FQDN.
  *  - serverListenPort, The port this server listens for connections
  *                      from the proxy client.
+ *  - gatewayListenPort, The port this server listens for gateway sessions
+ *                       on. NULL disables gateway sessions.
+ *  - pipelineThreads, Crypto threads of the gateway session pipeline. 0
+ *                     handles data messages in the session thread, or
+ *                     with gatewayUring gives PIPELINE_CRYPTO_THREADS.
+ *  - pipelineDepth, Depth of each of the pipeline queues.
+ *  - gatewayUring, Serve gateway sessions event driven on an io_uring
+ *                  rather than with a process each.
+ *  - ktls, Hand the record layer of gateway sessions to the kernel after
+ *          the handshake where it can take it.
+ *  - replaySlots, Slots of the replay table, at most three quarters of 
+ *                 them hold a device at a time.
  */
 TlsSinkServer::TlsSinkServer(	const char *authServerAddr,
 								const char *authServerPort, 
 					 			const char *serverAddr,
-								const char *serverListenPort) :
+								const char *serverListenPort,
+								const char *gatewayListenPort,
+								int pipelineThreads,
+								u_int32_ard pipelineDepth,
+								bool gatewayUring,
+								bool ktls,
+								u_int32_ard replaySlots) :
 								TlsBaseServer(	CLIENT_MODE, serverAddr, 
 												serverListenPort )
 {
 	_authServerAddr = authServerAddr;
 	_authServerPort = authServerPort;
 
+	_gatewayListenPort = gatewayListenPort;
+	_gatewayRouteId = NULL;
+	gatewayCtx = NULL;
+
+	_pipelineThreads = pipelineThreads;
+	_pipelineDepth = pipelineDepth;
+
+	_gatewayUring = gatewayUring;
+	uringPipeline = NULL;
+	gatewayKtlsFd = -1;
+
+	// Created in serverMain(), once the daemon is in its working directory.
+	replayTable = NULL;
+	_replaySlots = replaySlots;
+
+	if(!arenaInit(&msgArena, ARENA_DEFAULT_SIZE)){
+		throw runtime_error("Unable to allocate the message arena.");
+	}
+
+	// Gateways are TLS clients of the sink, so gateway sessions need a
+	// server side context that insists on a client certificate. Gateways
+	// are newer than the sensor protocol and speak TLS 1.2 or later.
+	if(_gatewayListenPort != NULL){
+		gatewayCtx = setupServerCtx(SERVER_MODE, 
+									ktls ? CTX_KTLS : CTX_TLS12);
+	}
+
 	//R = (byte_ard*)malloc(KEY_BYTES);  // REM?
 
 	dbcd.hostName ="localhost";
@@ -60,7 +105,7 @@ int TlsSinkServer::writeToAuth(SSL *ssl, byte_ard* writeBuf, int len){
 	int err = SSL_write(ssl, writeBuf, len);
 
 	if(err <= 0){
-        log_err_exit("Error writing to auth-server.");
+		return rejectMessage(__LINE__, "Error writing to auth-server.");
 	}
 
 	return err;
@@ -74,7 +119,7 @@ int TlsSinkServer::readFromAuth(SSL *ssl, byte_ard* readBuf, int len){
 	int err = SSL_read(ssl, readBuf, len);
 
 	if(err <= 0){
-        log_err_exit("Error reading from auth-server.");
+		return rejectMessage(__LINE__, "Error reading from auth-server.");
 	}
 
 	return err;
@@ -82,24 +127,46 @@ int TlsSinkServer::readFromAuth(SSL *ssl, byte_ard* readBuf, int len){
 
 /* A simple generic messge handling method that calls a specialized message 
  * routine after examining the first byte of an incoming message packet that
- * should contain the message ID.
+ * should contain the message ID. Returns 0, or -1 if a message on a gateway
+ * session was rejected, see rejectMessage().
  */
 int TlsSinkServer::handleMessage(SSL *ssl, BIO* proxyClientRequestBio,
 								 byte_ard *readBuf, int readLen)
 {
+	int status = 0;
 	
 	//syslog(LOG_NOTICE, "%x", readBuf[0]);
 
 	if(readBuf[0] == 0x10){
-		handleIdResponse(ssl, proxyClientRequestBio, readBuf, readLen);
+		status = handleIdResponse(ssl, proxyClientRequestBio, readBuf, readLen);
 	}else if(readBuf[0] == 0x31){ 
 		// Handshake message, regular rekey is ox30.
-		handleRekey(ssl, proxyClientRequestBio, readBuf, readLen);
-	}else if(readBuf[0] == 0x01){ 
+		status = handleRekey(ssl, proxyClientRequestBio, readBuf, readLen);
+	}else if((readBuf[0] & ~MSG_T_DATA_FLAGS) == MSG_T_DATA_SEND){ 
 		handleData(ssl, proxyClientRequestBio, readBuf, readLen);
+	}else if((readBuf[0] & ~MSG_T_DATA_FLAGS) == MSG_T_DATA_SEND_GCM){ 
+		status = handleDataGcm(ssl, proxyClientRequestBio, readBuf, readLen);
 	}else{
-        log_err_exit("Error, unsupported protocol message.");
+		status = rejectMessage(__LINE__, "Error, unsupported protocol message.");
 	}
+
+	// The response is out, everything the handler allocated goes at once.
+	arenaReset(&msgArena);
+	return status;
+}
+
+/* A message that failed its checks. The one-shot process of a proxy client
+ * request ends here as it always has. A gateway session carries the messages
+ * of many sensors, so there the message is only logged and dropped, and -1
+ * returned for the handler to pass on. The sensor times out and tries again.
+ */
+int TlsSinkServer::rejectMessage(int lineno, const char *msg){
+	if(_gatewayRouteId == NULL){
+		handleError(__FILE__, lineno, msg);
+	}
+
+	syslog(LOG_ERR, "** %s:%i %s, message dropped.", __FILE__, lineno, msg);
+	return -1;
 }
 
 /* Recieves a buffer containin a message fromt the prxy client and forwards
@@ -108,7 +175,7 @@ int TlsSinkServer::handleMessage(SSL *ssl, BIO* proxyClientRequestBio,
  * message the message is unpacked. The session key K_ST is stored locally. 
  * The encrypted palyoad is then sent on to the proxy client.
  */
-void  TlsSinkServer::handleIdResponse(SSL *ssl, BIO* proxyClientRequestBio, 
+int  TlsSinkServer::handleIdResponse(SSL *ssl, BIO* proxyClientRequestBio, 
 									  byte_ard* readBuf, int readLen)
 {
 	char szPid[20];
@@ -121,11 +188,15 @@ void  TlsSinkServer::handleIdResponse(SSL *ssl, BIO* proxyClientRequestBio,
 
 	// Forward the idresponse to the auth server.
 	// ------------------------------------------
-	writeToAuth(ssl, readBuf, readLen);
+	if(writeToAuth(ssl, readBuf, readLen) <= 0){
+		return -1;
+	}
 
 	// Read the response from the auth server.
 	// ---------------------------------------
-	int err = readFromAuth(ssl, keyToSinkBuf, KEYTOSINK_FULLSIZE);
+	if(readFromAuth(ssl, keyToSinkBuf, KEYTOSINK_FULLSIZE) <= 0){
+		return -1;
+	}
 
     int status = (SSL_get_shutdown(ssl) & SSL_RECEIVED_SHUTDOWN)? 1 : 0;
 
@@ -138,14 +209,16 @@ void  TlsSinkServer::handleIdResponse(SSL *ssl, BIO* proxyClientRequestBio,
 	// Unpack the key to sink message ------------------------------------------
 
 	struct message keyToSinkMsg;
-	keyToSinkMsg.key = (byte_ard*)malloc(KEY_BYTES);
-	keyToSinkMsg.ciphertext = (byte_ard*)malloc(KEYTOSINK_CRYPTSIZE);
-	keyToSinkMsg.pID=(byte_ard*)malloc(ID_SIZE);
+	keyToSinkMsg.key = (byte_ard*)arenaAlloc(&msgArena, KEY_BYTES);
+	keyToSinkMsg.ciphertext = (byte_ard*)arenaAlloc(&msgArena, 
+													KEYTOSINK_CRYPTSIZE);
+	keyToSinkMsg.pID=(byte_ard*)arenaAlloc(&msgArena, ID_SIZE);
  
 	unpack_keytosink((void*)keyToSinkBuf, &keyToSinkMsg);
 
 	if (keyToSinkMsg.msgtype != 0x11) {
-		log_err_exit("Authentication server didn't accept the ID/Cipher!");
+		return rejectMessage(__LINE__, 
+						"Authentication server didn't accept the ID/Cipher!");
 	}
 
 	syslog(LOG_NOTICE,"Authentication server accepted sensor with ID %s",szPid);
@@ -161,9 +234,12 @@ void  TlsSinkServer::handleIdResponse(SSL *ssl, BIO* proxyClientRequestBio,
 		tssp.persist();
 
 	} catch(runtime_error rex) {
-		log_err_exit(rex.what());
+		return rejectMessage(__LINE__, rex.what());
 	}
 
+	// New session key, the device starts its nonces and clock afresh.
+	replayTable->resetDevice(tmpID);
+
 	// Pack keytosense message -------------------------------------------------
 
 	byte_ard keyToSenseBuf[KEYTOSENS_FULLSIZE];
@@ -177,17 +253,11 @@ void  TlsSinkServer::handleIdResponse(SSL *ssl, BIO* proxyClientRequestBio,
 	writeToProxyClient(proxyClientRequestBio, keyToSenseBuf, 
 		KEYTOSENS_FULLSIZE);
 
-	free (keyToSinkMsg.ciphertext);
-	free (keyToSinkMsg.key);
-
 	// Done packing key to sense message ---------------------------------------
-
-	// Close connection to proxy client.
-	BIO_free(proxyClientRequestBio);
-	ERR_remove_state(0);
+	return 0;
 }
 
-void TlsSinkServer::handleRekey(SSL *ssl, BIO* proxyClientRequestBio,
+int TlsSinkServer::handleRekey(SSL *ssl, BIO* proxyClientRequestBio,
                                       byte_ard* readBuf, int readLen)
 {
 	
@@ -201,15 +271,16 @@ void TlsSinkServer::handleRekey(SSL *ssl, BIO* proxyClientRequestBio,
 	syslog(LOG_NOTICE,"Rekey request received from device %s",szPid);
 
 	try {
-		TsDbSinkSensorProfile *tssp = new TsDbSinkSensorProfile(tmpID, dbcd);
+		TsDbSinkSensorProfile *tssp = 
+			new (&msgArena) TsDbSinkSensorProfile(tmpID, dbcd);
 
 
 		// Unpack rekey message -----------------------------------------------
 
-		// Create the struct the recieve the packet to and malloc memory.
+		// Create the struct the recieve the packet to and allocate memory.
 		struct message rekeymsg;
-		rekeymsg.pID = (byte_ard*)malloc(ID_SIZE+1);  // Null term.
-		rekeymsg.ciphertext = (byte_ard*)malloc(REKEY_CRYPTSIZE);
+		rekeymsg.pID = (byte_ard*)arenaAlloc(&msgArena, ID_SIZE+1); // Null term.
+		rekeymsg.ciphertext = (byte_ard*)arenaAlloc(&msgArena, REKEY_CRYPTSIZE);
 
 		byte_ard K_ST[KEY_BYTES];
 		memcpy(K_ST,tssp->getKstSched(),KEY_BYTES);
@@ -229,8 +300,6 @@ void TlsSinkServer::handleRekey(SSL *ssl, BIO* proxyClientRequestBio,
 						&rekeymsg);
 		
 		syslog(LOG_NOTICE, "nonce:  %x", rekeymsg.nonce);		
-		// TODO: Make the nonce part of the device profile. 
-		// Keep track to prevent replays and fiddling.
 		
 		char szCryptedPid[20];
 		sprintf(szCryptedPid,"%d%d-%d%d%d%d",
@@ -247,11 +316,18 @@ void TlsSinkServer::handleRekey(SSL *ssl, BIO* proxyClientRequestBio,
 										REKEY_CRYPTSIZE,
 										rekeymsg.cmac);
 		if(validMac == 0){
-			log_err_exit("Mac of incoming rekey message did not match");
+			return rejectMessage(__LINE__, 
+							"Mac of incoming rekey message did not match");
 		}
 		else {
 			syslog(LOG_NOTICE,"MAC checked out ok");
 		}
+
+		// Only authenticated nonces may move the replay window.
+		if(replayTable->checkNonce(tmpID, rekeymsg.nonce) != REPLAY_OK){
+			return rejectMessage(__LINE__, 
+							"Replayed nonce in incoming rekey message");
+		}
 		
 		// Done unpacking rekey message ---------------------------------------
 
@@ -336,17 +412,11 @@ void TlsSinkServer::handleRekey(SSL *ssl, BIO* proxyClientRequestBio,
        	// ----------------------------------
 		writeToProxyClient(proxyClientRequestBio, newkeybuf, NEWKEY_FULLSIZE);
 
-		// Close connection to proxy client.
-		BIO_free(proxyClientRequestBio);
-		ERR_remove_state(0);
-
-		delete tssp;
-		free (rekeymsg.pID);
-		free (rekeymsg.ciphertext);
-
 	} catch(runtime_error rex) {
-		log_err_exit(rex.what());
+		return rejectMessage(__LINE__, rex.what());
 	}
+
+	return 0;
 }
 
 void TlsSinkServer::handleData(SSL *ssl, BIO* proxyClientRequestBio,
@@ -371,7 +441,7 @@ void TlsSinkServer::handleData(SSL *ssl, BIO* proxyClientRequestBio,
 	// Get the database profile based on the plaintext id
 	TsDbSinkSensorProfile *tssp;
 	try {
-		tssp = new TsDbSinkSensorProfile(plainId, dbcd);
+		tssp = new (&msgArena) TsDbSinkSensorProfile(plainId, dbcd);
 
 	} catch(runtime_error rex) {
 		log_err_exit(rex.what());
@@ -396,8 +466,8 @@ void TlsSinkServer::handleData(SSL *ssl, BIO* proxyClientRequestBio,
 	}
 		
 	// Print the unpacked ID and some other stuff for debugging
-	char szUnpackId[10];
-	sprintf(szUnpackId, "%d%d-%d%d%d%d", 
+	char szUnpackId[20];  // Up to three digits per byte and the dash.
+	snprintf(szUnpackId, sizeof(szUnpackId), "%d%d-%d%d%d%d", 
 			sensorData.id[0], sensorData.id[1], sensorData.id[2], 
 			sensorData.id[3], sensorData.id[4], sensorData.id[5]);
 	syslog(LOG_NOTICE, "Unpacked device id is %s", szUnpackId);
@@ -411,23 +481,187 @@ void TlsSinkServer::handleData(SSL *ssl, BIO* proxyClientRequestBio,
 	if( strncmp((char *)plainId,(char *)sensorData.id,6)!=0 )
 		log_err_exit("The plain and ciphered IDs did not match!");
 
-	// TODO: Store and check the timestamp for a (weak) replay check.
-	// This check will be weak since the client can reset the tsensor
-	// time at will.
+	// A (weak) replay check, the client can reset the tsensor time at will.
+	// The time must still increase within a session.
+	if(replayTable->checkMsgTime(plainId, sensorData.msgtime) != REPLAY_OK){
+		log_err_exit("Replayed or stale incoming data message");
+	}
+
+	storeData(&sensorData);
+}
+
+/* Handles a data message encrypted with AES-GCM. The tag covers the 
+ * plaintext header as well, so a valid tag also vouches for the device id
+ * the key was looked up with. GCM data messages are not batched, on a 
+ * gateway session one that fails its checks is dropped by rejectMessage() 
+ * like a bad message in a CBC batch.
+ */
+int TlsSinkServer::handleDataGcm(SSL *ssl, BIO* proxyClientRequestBio,
+								  byte_ard* readBuf, int readLen)
+{
+	syslog(LOG_NOTICE, "handleDataGcm()");
+
+	if(readLen < DATA_GCM_FULLSIZE(0) || 
+	   readLen < DATA_GCM_HEADER_SIZE + readBuf[1] + GCM_TAG_SIZE){
+		return rejectMessage(__LINE__, "Truncated GCM data message");
+	}
+
+	// The plaintext id follows the message type and crypto length.
+	TsDbSinkSensorProfile *tssp;
+	try {
+		tssp = new (&msgArena) TsDbSinkSensorProfile(readBuf+2, dbcd);
+	} catch(runtime_error rex) {
+		return rejectMessage(__LINE__, rex.what());
+	}
+
+	struct data sensorData;
+	int validTag = unpack_data_gcm(readBuf, 
+								   (const u_int32_ard*)(tssp->getKsteSched()),
+								   &sensorData);
+	if(validTag != GCM_TAG_VALID){
+		return rejectMessage(__LINE__, 
+						"Tag of incoming GCM data message did not match");
+	}
+	syslog(LOG_NOTICE,"GCM tag checked out ok");
+
+	if(replayTable->checkMsgTime(sensorData.id, sensorData.msgtime) 
+	   != REPLAY_OK){
+		return rejectMessage(__LINE__, 
+						"Replayed or stale incoming data message");
+	}
+
+	storeData(&sensorData);
+	return 0;
+}
+
+/* A data message is only batched if the frame holds the ciphertext and 
+ * CMAC its header announces, unpack_data_batch() takes the lengths from the
+ * message itself. A short one is logged and dropped.
+ */
+bool TlsSinkServer::dataMessageComplete(const byte_ard *readBuf, int readLen){
+	if(readLen < DataMsg::headerSize ||
+	   readLen < DataMsg::headerSize + readBuf[1] + BLOCK_BYTE_SIZE){
+		syslog(LOG_ERR, "Dropped data message, truncated");
+		return false;
+	}
+	return true;
+}
+
+/* Handles a batch of data messages that arrived back to back on a gateway
+ * session, each checked by dataMessageComplete(). The MACs of the whole 
+ * batch are verified and the valid messages decrypted together by 
+ * unpack_data_batch(). Unlike handleData() a bad message does not end the
+ * process, since the rest of the batch comes from other sensors. It is 
+ * logged and dropped.
+ */
+void TlsSinkServer::handleDataBatch(byte_ard **readBufs, int count){
+	TsDbSinkSensorProfile *tssp[BATCH_LANES];
+	const u_int32_ard *pKeys[BATCH_LANES];
+	const u_int32_ard *pCmacKeys[BATCH_LANES];
+	byte_ard *lanes[BATCH_LANES];
+	struct data sensorData[BATCH_LANES];
+	int32_ard valid[BATCH_LANES];
+	int n = 0;
+
+	syslog(LOG_NOTICE, "handleDataBatch(), %d messages", count);
+
+	// A message whose sensor can not be looked up is left out of the batch.
+	for(int i = 0; i < count; i++){
+		// The plaintext id follows the message type and crypto length.
+		try {
+			tssp[n] = new (&msgArena) TsDbSinkSensorProfile(readBufs[i]+2, 
+															 dbcd);
+		} catch(runtime_error rex) {
+			syslog(LOG_ERR, "Dropped data message %d, %s", i, rex.what());
+			continue;
+		}
+
+		pKeys[n] = (const u_int32_ard*)(tssp[n]->getKsteSched());
+		pCmacKeys[n] = (const u_int32_ard*)(tssp[n]->getKsteaSched());
+		lanes[n] = readBufs[i];
+		n++;
+	}
+	if(n == 0){
+		arenaReset(&msgArena);
+		return;
+	}
+
+	int validCount = unpack_data_batch((void**)lanes, pKeys, pCmacKeys,
+									   sensorData, valid, n);
+	syslog(LOG_NOTICE, "%d of %d MACs checked out ok", validCount, n);
+
+	for(int i = 0; i < n; i++){
+		byte_ard *plainId = lanes[i]+2;
+
+		if(valid[i] != CMAC_VALID){
+			syslog(LOG_ERR, "Dropped data message %d, MAC did not match", i);
+		}else if(memcmp(plainId, sensorData[i].id, ID_SIZE) != 0){
+			syslog(LOG_ERR, "Dropped data message %d, IDs did not match", i);
+		}else if(replayTable->checkMsgTime(plainId, sensorData[i].msgtime) 
+				 != REPLAY_OK){
+			syslog(LOG_ERR, "Dropped data message %d, replayed or stale", i);
+		}else{
+			storeData(&sensorData[i]);
+		}
+	}
+
+	arenaReset(&msgArena);
+}
+
+/* Appends an unpacked and verified data message to the data log. Packed 
+ * payloads are unpacked first and logged like plain ones, the samples 
+ * interleaved by record. The record times of adaptive sampling follow the
+ * samples, after a '@', as the time each record was sampled.
+ */
+void TlsSinkServer::storeData(struct data *sensorData){
+	const byte_ard *samples = sensorData->data;
+	int samplesLen = sensorData->data_len;
+	int timed = -1;
+	if(sensorData->msgtype & MSG_T_DATA_TIMED_FLAG){
+		timed = payload_times(sensorData->data, sensorData->data_len);
+		if(timed < 0){
+			syslog(LOG_ERR, "Dropped data message, malformed record times");
+			return;
+		}
+		samples += PAYLOAD_TIMES_SIZE(timed);
+		samplesLen -= PAYLOAD_TIMES_SIZE(timed);
+	}
+
+	struct payload pl;
+	pl.values = NULL;
+	if(sensorData->msgtype & MSG_T_DATA_PACKED_FLAG){
+		if(unpack_payload(samples, samplesLen, &pl) != PAYLOAD_VALID ||
+		   (timed >= 0 && pl.records != timed)){
+			msgFree(pl.values);
+			syslog(LOG_ERR, "Dropped data message, malformed packed payload");
+			return;
+		}
+	}
+
+	char szUnpackId[20];  // Up to three digits per byte and the dash.
+	snprintf(szUnpackId, sizeof(szUnpackId), "%d%d-%d%d%d%d", 
+			sensorData->id[0], sensorData->id[1], sensorData->id[2], 
+			sensorData->id[3], sensorData->id[4], sensorData->id[5]);
 
-	// Write to file
 	FILE *pFile;
 	pFile = fopen("data.log","a");
-	fprintf(pFile,"[%s,%d]:",szUnpackId,sensorData.msgtime);
-	for (int i=0; i<sensorData.data_len; i++)
-		fprintf(pFile,"%d;",sensorData.data[i]);
+	fprintf(pFile,"[%s,%d]:",szUnpackId,sensorData->msgtime);
+	if(pl.values != NULL){
+		for (int i=0; i<pl.records*pl.icnt; i++)
+			fprintf(pFile,"%d;",pl.values[i]);
+		msgFree(pl.values);
+	}else{
+		for (int i=0; i<samplesLen; i++)
+			fprintf(pFile,"%d;",samples[i]);
+	}
+	if(timed > 0){
+		fputc('@',pFile);
+		for (int i=0; i<timed; i++)
+			fprintf(pFile,"%u;",sensorData->msgtime - 
+					payload_time_offset(sensorData->data, i));
+	}
 	fputc('\n',pFile);
 	fclose(pFile);
-
-	// Free all resources
-	delete tssp;
-	free(sensorData.ciphertext);
-	free(sensorData.data);
 }
 
 /* This method is called after a BIO channel connection from the proxy client 
@@ -448,6 +682,52 @@ void TlsSinkServer::serverFork(BIO *proxyClientRequestBio, BIO* authServerBio){
 	// Read theincoming message from the proxy client.
 	int readLen = readFromProxyClient(proxyClientRequestBio, readBuf, BUFSIZE);
 
+	ssl = connectToAuth();
+
+	// Fork a child process that should be an exact copy of the parent.
+	// it will continue servicing the proxy client's request while the.
+	// parent exits and waits for a new request.
+	pid_t pid = fork();
+    if(pid < 0){ //Fork a child process.
+        log_err_exit("Unable to fork TLS server process.");
+        throw runtime_error("A call to fork() failed.");
+        exit(0);
+    } else if(pid!=0){ // The parent exits method here.
+        return;
+    }
+
+	// FIXME: What if messageSize > bufsize?
+	// Contact the Auth server.
+	handleMessage(ssl, proxyClientRequestBio, readBuf, readLen);
+
+	replayTable->snapshotIfDue();
+
+	// Close connection to proxy client.
+	BIO_free(proxyClientRequestBio);
+
+    syslog(LOG_NOTICE, "SSL Connection to auth-server closed.\n");
+
+    SSL_free(ssl);
+    ERR_remove_state(0);
+
+
+    if(pid ==  0){ // The child terminates execution here.
+		syslog(LOG_ERR, "Child is exiting.");
+        exit(0);
+    }
+}
+
+/* Opens a new SSL/TLS connection to the auth server and performs the post 
+ * connection verifications on it. The auth server handles a single message
+ * per connection so one is needed for every idresponse forwarded. On a 
+ * gateway session a failure drops the idresponse (see rejectMessage()) and 
+ * NULL is returned, and the connection waits at most AUTH_TIMEOUT_SEC for
+ * each read and write, as the other sensors wait with it.
+ */
+SSL *TlsSinkServer::connectToAuth(){
+	BIO *authServerBio;
+    SSL *ssl;
+
 	// Construct connection string to connect to auth-server.
 	string hostPort = _authServerAddr;
 	hostPort.append(":");
@@ -460,24 +740,38 @@ void TlsSinkServer::serverFork(BIO *proxyClientRequestBio, BIO* authServerBio){
 	authServerBio = BIO_new_connect((char*)hostPort.c_str());
 
 	if(!authServerBio){
-		log_err_exit("Error createing connection BIO");
+		rejectMessage(__LINE__, "Error createing connection BIO");
+		return NULL;
 	}
 
 	// Connect the auth-server BIO channel.
 	if(BIO_do_connect(authServerBio) <= 0){
-		log_err_exit("Error connecting to remote machine");
+		BIO_free(authServerBio);
+		rejectMessage(__LINE__, "Error connecting to remote machine");
+		return NULL;
+	}
+
+	if(_gatewayRouteId != NULL){
+		struct timeval timeout = { AUTH_TIMEOUT_SEC, 0 };
+		int fd = BIO_get_fd(authServerBio, NULL);
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
 	}
 
 	// Get a new SSL structure for this auth-server connection.
 	if(!(ssl = SSL_new(ctx))){
-		log_err_exit("Error creating an SSL context.");
+		BIO_free(authServerBio);
+		rejectMessage(__LINE__, "Error creating an SSL context.");
+		return NULL;
 	}
 
 	// Connect the SSL server with the BIOs it will use.
 	SSL_set_bio(ssl, authServerBio, authServerBio);
 
 	if(SSL_connect(ssl) <= 0){
-        log_err_exit("Error connecting SSL object.");
+		SSL_free(ssl);
+		rejectMessage(__LINE__, "Error connecting SSL object.");
+		return NULL;
     }		
 
 	// Post connection verification, does things like:
@@ -488,32 +782,563 @@ void TlsSinkServer::serverFork(BIO *proxyClientRequestBio, BIO* authServerBio){
 
     syslog(LOG_NOTICE, "SSL Connection auth-server opened.");
 
-	// Fork a child process that should be an exact copy of the parent.
-	// it will continue servicing the proxy client's request while the.
-	// parent exits and waits for a new request.
+	return ssl;
+}
+
+/* Gateway session loop. Reads enveloped messages off the gateway connection
+ * until the gateway hangs up and handles each one in turn. While a message is
+ * being handled _gatewayRouteId points at the sensor ID from its envelope, 
+ * which makes writeToProxyClient() wrap the response in an envelope for the 
+ * same sensor, and a message that fails its checks is dropped rather than 
+ * ending the session, see rejectMessage(). A malformed frame still ends it,
+ * the gateway is then expected to reconnect.
+ *
+ * Data messages need no response, so consecutive ones are collected while
+ * more frames are already buffered on the connection, up to BATCH_LANES of 
+ * them, and handed to handleDataBatch() together. A batch is never held back
+ * waiting for the gateway to send more.
+ */
+void TlsSinkServer::gatewaySession(BIO *gatewaySslBio){
+	byte_ard frameHeader[GWFRAME_HEADER_SIZE];
+	byte_ard routeId[ID_SIZE];
+	byte_ard readBufs[BATCH_LANES][BUFSIZE];
+	byte_ard *pBatch[BATCH_LANES];
+	int batchCount = 0;
+	int messageCount = 0;
+
+	for(int i = 0; i < BATCH_LANES; i++){
+		pBatch[i] = readBufs[i];
+	}
+
+	while(true){
+		// Zero bytes at a frame boundary is the gateway closing the session.
+		if(readFullyFromGateway(gatewaySslBio, frameHeader, 
+									GWFRAME_HEADER_SIZE) <= 0){
+			break;
+		}
+
+		int readLen = unpack_gwframe_header(frameHeader, routeId);
+
+		if(readLen == 0 || readLen > BUFSIZE){
+			log_err_exit("Malformed gateway frame.");
+		}
+
+		// Frames are read into the next free batch slot.
+		byte_ard *readBuf = readBufs[batchCount];
+
+		if(readFullyFromGateway(gatewaySslBio, readBuf, readLen) <= 0){
+			log_err_exit("Gateway closed the session mid frame.");
+		}
+
+		messageCount++;
+
+		if((readBuf[0] & ~MSG_T_DATA_FLAGS) == MSG_T_DATA_SEND){
+			if(dataMessageComplete(readBuf, readLen)){
+				batchCount++;
+			}
+			if(batchCount == BATCH_LANES || (batchCount > 0 &&
+			   BIO_pending(gatewaySslBio) < GWFRAME_HEADER_SIZE)){
+				handleDataBatch(pBatch, batchCount);
+				batchCount = 0;
+				replayTable->snapshotIfDue();
+			}
+			continue;
+		}
+
+		// Data messages ahead of this one are handled first, in order.
+		if(batchCount > 0){
+			handleDataBatch(pBatch, batchCount);
+			batchCount = 0;
+		}
+
+		handleGatewayMessage(gatewaySslBio, routeId, readBuf, readLen);
+
+		replayTable->snapshotIfDue();
+	}
+
+	syslog(LOG_NOTICE, "Gateway session closed after %d messages.", 
+			messageCount);
+}
+
+/* Handles a message from a gateway session other than a batched data 
+ * message. An idresponse is relayed to the auth server over a connection of
+ * its own. Returns the status of handleMessage(), -1 for a message that was
+ * dropped.
+ */
+int TlsSinkServer::handleGatewayMessage(BIO *gatewaySslBio, byte_ard *routeId,
+										byte_ard *readBuf, int readLen){
+	int status = -1;
+
+	_gatewayRouteId = routeId;
+
+	SSL *ssl = NULL;
+	if(readBuf[0] == MSG_T_GET_ID_R){
+		ssl = connectToAuth();
+	}
+
+	if(readBuf[0] != MSG_T_GET_ID_R || ssl != NULL){
+		status = handleMessage(ssl, gatewaySslBio, readBuf, readLen);
+	}
+
+	if(ssl != NULL){
+		SSL_free(ssl);
+	}
+
+	_gatewayRouteId = NULL;
+	return status;
+}
+
+/* Gateway session loop with a TsSinkPipeline. The session thread only reads
+ * frames and hands data messages, CBC and GCM, to the pipeline, which checks,
+ * decrypts and stores them on threads of its own while the next frames are 
+ * read. Frames are read straight into pipeline items.
+ *
+ * Other messages change or hand out keys, so the pipeline is drained before
+ * one is handled, inline as in gatewaySession(). The data messages of a 
+ * device that follow a rekey are then always checked with the new keys.
+ * Unlike the inline path a data message that fails its checks is logged and
+ * dropped, the session carries on.
+ */
+void TlsSinkServer::gatewayPipelineSession(BIO *gatewaySslBio){
+	byte_ard frameHeader[GWFRAME_HEADER_SIZE];
+	byte_ard routeId[ID_SIZE];
+	int messageCount = 0;
+
+	TsSinkPipeline *pipeline;
+	try {
+		pipeline = new TsSinkPipeline(dbcd, replayTable, _pipelineThreads,
+									  _pipelineDepth);
+	} catch(runtime_error rex) {
+		log_err_exit(rex.what());
+	}
+
+	while(true){
+		// Zero bytes at a frame boundary is the gateway closing the session.
+		if(readFullyFromGateway(gatewaySslBio, frameHeader, 
+									GWFRAME_HEADER_SIZE) <= 0){
+			break;
+		}
+
+		int readLen = unpack_gwframe_header(frameHeader, routeId);
+
+		if(readLen == 0 || readLen > BUFSIZE){
+			log_err_exit("Malformed gateway frame.");
+		}
+
+		pipelineItem *item = pipeline->getItem();
+		byte_ard *readBuf = item->frame;
+
+		if(readFullyFromGateway(gatewaySslBio, readBuf, readLen) <= 0){
+			log_err_exit("Gateway closed the session mid frame.");
+		}
+		item->length = readLen;
+
+		messageCount++;
+
+		byte_ard msgType = readBuf[0] & ~MSG_T_DATA_FLAGS;
+		if(msgType == MSG_T_DATA_SEND || msgType == MSG_T_DATA_SEND_GCM){
+			pipeline->submit(item);
+		}else{
+			pipeline->drain();
+			handleGatewayMessage(gatewaySslBio, routeId, readBuf, readLen);
+			pipeline->putItem(item);
+		}
+
+		replayTable->snapshotIfDue();
+		pipeline->logStatsIfDue();
+	}
+
+	// Drains the pipeline and logs its final metrics.
+	delete pipeline;
+
+	syslog(LOG_NOTICE, "Gateway session closed after %d messages.", 
+			messageCount);
+}
+
+/* Called after a gateway connection has been accepted. A child process is
+ * forked that completes the TLS handshake, checks the gateway certificate and
+ * then services the session for as long as the gateway keeps it open. The
+ * parent drops its copy of the connection and returns to accepting.
+ */
+void TlsSinkServer::gatewayFork(BIO *gatewayBio){
 	pid_t pid = fork();
-    if(pid < 0){ //Fork a child process.
-        log_err_exit("Unable to fork TLS server process.");
-        throw runtime_error("A call to fork() failed.");
-        exit(0);
-    } else if(pid!=0){ // The parent exits method here.
+    if(pid < 0){
+        log_err_exit("Unable to fork gateway session process.");
+    } else if(pid!=0){
+		BIO_free(gatewayBio);
         return;
     }
 
-	// FIXME: What if messageSize > bufsize?
-	// Contact the Auth server.
-	handleMessage(ssl, proxyClientRequestBio, readBuf, readLen);
+	SSL *ssl;
+	if(!(ssl = SSL_new(gatewayCtx))){
+		log_err_exit("Error creating an SSL context.");
+	}
 
-    syslog(LOG_NOTICE, "SSL Connection to auth-server closed.\n");
+	SSL_set_bio(ssl, gatewayBio, gatewayBio);
 
-    SSL_free(ssl);
+	if(SSL_accept(ssl) <= 0){
+		log_err_exit("Error accepting gateway SSL connection.");
+	}
+
+	// The handshake already required a certificate, make sure it verified.
+	long err = SSL_get_verify_result(ssl);
+	if(err != X509_V_OK){
+		syslog(LOG_ERR, "-Error: gateway certificate: %s",
+			X509_verify_cert_error_string(err));
+		log_err_exit("Gateway failed certificate verification.");
+	}
+
+    syslog(LOG_NOTICE, "Gateway session opened.");
+
+	// Where OpenSSL handed the record layer to the kernel the frames can be
+	// read straight off the socket, see readFullyFromGateway().
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+	if(BIO_get_ktls_recv(SSL_get_rbio(ssl))){
+		gatewayKtlsFd = SSL_get_rfd(ssl);
+	}
+	syslog(LOG_NOTICE, "kTLS send %s, receive %s.", 
+			BIO_get_ktls_send(SSL_get_wbio(ssl)) ? "on" : "off",
+			gatewayKtlsFd >= 0 ? "on" : "off");
+#endif
+
+	// Wrap the SSL object in a BIO so the message handlers can treat the
+	// gateway exactly like a proxy client connection.
+	BIO *gatewaySslBio = BIO_new(BIO_f_ssl());
+	BIO_set_ssl(gatewaySslBio, ssl, BIO_CLOSE);
+
+	if(_pipelineThreads > 0){
+		gatewayPipelineSession(gatewaySslBio);
+	}else{
+		gatewaySession(gatewaySslBio);
+	}
+
+	SSL_shutdown(ssl);
+	BIO_free(gatewaySslBio);
     ERR_remove_state(0);
 
+	exit(0);
+}
 
-    if(pid ==  0){ // The child terminates execution here.
-		syslog(LOG_ERR, "Child is exiting.");
-        exit(0);
+/* Accept loop for gateway sessions, runs in its own process next to the
+ * proxy client accept loop in serverMain().
+ */
+void TlsSinkServer::gatewayMain(){
+	BIO *gatewayAcceptBio, *gatewayBio;
+
+    gatewayAcceptBio = BIO_new_accept((char*) _gatewayListenPort);
+
+    if(!gatewayAcceptBio){
+        log_err_exit("Error creating gateway listener socket.");
+    }
+
+    if(BIO_do_accept(gatewayAcceptBio) <= 0){
+        log_err_exit("Error binding gateway listener socket.");
+    }
+
+	syslog(LOG_NOTICE, "Listening for gateway sessions on %s", 
+				_gatewayListenPort);
+
+	while(true){
+		if(BIO_do_accept(gatewayAcceptBio) <= 0){
+			log_err_exit("Error accepting gateway connection");
+		}
+
+		gatewayBio = BIO_pop(gatewayAcceptBio);
+
+		gatewayFork(gatewayBio);
+	}
+}
+
+/* Adds job to the end of the list head..tail. */
+static void appendJob(uringJob **head, uringJob **tail, uringJob *job){
+	job->next = NULL;
+	if(*tail == NULL){
+		*head = job;
+	}else{
+		(*tail)->next = job;
+	}
+	*tail = job;
+}
+
+/* Deletes conn once nothing is in flight or held for it any more. */
+static void endIfIdle(TsUringTlsConn *conn, int *sessions){
+	if(conn->idle()){
+		delete conn;
+		(*sessions)--;
+		syslog(LOG_NOTICE, "Gateway session closed, %d open.", *sessions);
+	}
+}
+
+/* Event driven gateway sessions. All of them are served by this one process
+ * on an io_uring: accepts, reads and writes of every session are queued on
+ * the ring, submitted together and their completions handled in rounds, so
+ * a round costs one system call however many sessions were active in it. 
+ * TLS runs over memory BIOs, see TsUringTlsConn.
+ *
+ * Nothing that blocks runs in the loop. Data messages, CBC and GCM, go to a
+ * TsSinkPipeline whose threads look up the profiles, check and decrypt them
+ * and append them to the data log. The other messages go as jobs to the 
+ * control thread, see uringControlLoop(), which relays idresponses to the
+ * auth server and handles rekeys, and the responses come back to the loop
+ * through doneFd. While all pipeline items are taken the loop waits for 
+ * one, so a pipeline that falls behind slows the reads down.
+ *
+ * A malformed frame or a failed handshake closes only its own session and a
+ * message that fails its checks is dropped, see rejectMessage(). The records
+ * go through memory BIOs here, so kTLS does not apply.
+ */
+void TlsSinkServer::gatewayUringMain(){
+	BIO *gatewayAcceptBio;
+	int listenFd;
+	TsUring *ring;
+	uringOp acceptOp, doneOp;
+	u_int64_ard doneCount;
+	uringCompletion completions[BATCH_LANES*8];
+	int sessions = 0;
+
+    gatewayAcceptBio = BIO_new_accept((char*) _gatewayListenPort);
+
+    if(!gatewayAcceptBio){
+        log_err_exit("Error creating gateway listener socket.");
+    }
+
+    if(BIO_do_accept(gatewayAcceptBio) <= 0){
+        log_err_exit("Error binding gateway listener socket.");
     }
+	BIO_get_fd(gatewayAcceptBio, &listenFd);
+
+	jobs = jobsTail = doneJobs = doneJobsTail = NULL;
+	pthread_mutex_init(&jobLock, NULL);
+	pthread_cond_init(&jobReady, NULL);
+
+	doneFd = eventfd(0, 0);
+	if(doneFd < 0){
+		log_err_exit("Unable to create the control thread eventfd.");
+	}
+
+	try {
+		ring = new TsUring();
+		uringPipeline = new TsSinkPipeline(dbcd, replayTable,
+					_pipelineThreads > 0 ? _pipelineThreads : PIPELINE_CRYPTO_THREADS,
+					_pipelineDepth);
+	} catch(runtime_error rex) {
+		log_err_exit(rex.what());
+	}
+
+	if(pthread_create(&uringControlTid, NULL, uringControlMain, this) != 0){
+		log_err_exit("Unable to start the control thread.");
+	}
+
+	syslog(LOG_NOTICE, "Listening for gateway sessions on %s, io_uring", 
+				_gatewayListenPort);
+
+	acceptOp.kind = URING_OP_ACCEPT;
+	acceptOp.owner = NULL;
+	ring->prepAccept(listenFd, &acceptOp);
+
+	doneOp.kind = URING_OP_READ;
+	doneOp.owner = NULL;
+	ring->prepRead(doneFd, &doneCount, sizeof(doneCount), &doneOp);
+
+	while(true){
+		int count = ring->wait(completions, BATCH_LANES*8);
+		if(count < 0){
+			log_err_exit("Error waiting for io_uring completions.");
+		}
+
+		for(int i = 0; i < count; i++){
+			uringOp *op = completions[i].op;
+			int32_ard result = completions[i].result;
+			TsUringTlsConn *conn = (TsUringTlsConn*)op->owner;
+			uringJob *job;
+			int status;
+
+			switch(op->kind){
+				case URING_OP_ACCEPT:
+					if(result >= 0){
+						try {
+							conn = new TsUringTlsConn(ring, result, gatewayCtx);
+							conn->start();
+							sessions++;
+							syslog(LOG_NOTICE, "Gateway session opened, %d open.",
+									sessions);
+						} catch(runtime_error rex) {
+							syslog(LOG_ERR, "%s", rex.what());
+							close(result);
+						}
+					}else{
+						syslog(LOG_ERR, "Error accepting gateway connection: %s",
+								strerror(-result));
+					}
+					ring->prepAccept(listenFd, &acceptOp);
+					continue;
+
+				case URING_OP_READ:
+					// The control thread has answered jobs. A session that
+					// closed meanwhile only lets go of them.
+					pthread_mutex_lock(&jobLock);
+					job = doneJobs;
+					doneJobs = doneJobsTail = NULL;
+					pthread_mutex_unlock(&jobLock);
+
+					while(job != NULL){
+						uringJob *next = job->next;
+						char *response;
+						long responseLen = BIO_get_mem_data(job->response, 
+															&response);
+
+						conn = job->conn;
+						if(responseLen > 0 && !conn->closed()){
+							BIO_write(conn->bio(), response, responseLen);
+							conn->flush();
+						}
+						BIO_free(job->response);
+						delete job;
+
+						conn->release();
+						endIfIdle(conn, &sessions);
+						job = next;
+					}
+
+					ring->prepRead(doneFd, &doneCount, sizeof(doneCount), 
+								   &doneOp);
+					continue;
+
+				case URING_OP_RECV:
+					status = conn->received(result);
+					while(status == URING_TLS_OK){
+						status = conn->read();
+						if(status == URING_TLS_OK && 
+						   gatewayUringFrames(conn) < 0){
+							status = URING_TLS_ERROR;
+						}
+					}
+					conn->flush();
+					if(status == URING_TLS_ERROR){
+						syslog(LOG_ERR, "Gateway session failed.");
+					}
+					if(status != URING_TLS_WANT_READ){
+						conn->close();
+					}
+					break;
+
+				case URING_OP_SEND:
+					conn->sent(result);
+					break;
+			}
+
+			endIfIdle(conn, &sessions);
+		}
+
+		replayTable->snapshotIfDue();
+		uringPipeline->logStatsIfDue();
+	}
+}
+
+/* Takes the complete frames out of the plaintext of conn and leaves a 
+ * partial one for the next read. Data messages are submitted to the 
+ * pipeline, the others queued for the control thread together with the
+ * pipeline mark() of their device. Returns 0, or -1 if a frame is malformed.
+ */
+int TlsSinkServer::gatewayUringFrames(TsUringTlsConn *conn){
+	byte_ard routeId[ID_SIZE];
+	byte_ard *plain = conn->plain();
+	int plainLen = conn->plainLength();
+	int offset = 0;
+	bool queuedJobs = false;
+
+	while(plainLen - offset >= GWFRAME_HEADER_SIZE){
+		int readLen = unpack_gwframe_header(plain+offset, routeId);
+
+		if(readLen == 0 || readLen > BUFSIZE){
+			syslog(LOG_ERR, "Malformed gateway frame.");
+			return -1;
+		}
+		if(plainLen - offset < GWFRAME_HEADER_SIZE + readLen){
+			break;
+		}
+
+		byte_ard *readBuf = plain + offset + GWFRAME_HEADER_SIZE;
+		offset += GWFRAME_HEADER_SIZE + readLen;
+
+		byte_ard msgType = readBuf[0] & ~MSG_T_DATA_FLAGS;
+		if(msgType == MSG_T_DATA_SEND || msgType == MSG_T_DATA_SEND_GCM){
+			pipelineItem *item = uringPipeline->getItem();
+			memcpy(item->frame, readBuf, readLen);
+			item->length = readLen;
+			uringPipeline->submit(item);
+			continue;
+		}
+
+		// The data messages of the device ahead of this one are checked 
+		// before it is handled.
+		uringJob *job = new uringJob;
+		job->conn = conn;
+		memcpy(job->routeId, routeId, ID_SIZE);
+		memcpy(job->frame, readBuf, readLen);
+		job->length = readLen;
+		job->mark = uringPipeline->mark(routeId);
+		job->response = NULL;
+		conn->hold();
+
+		pthread_mutex_lock(&jobLock);
+		appendJob(&jobs, &jobsTail, job);
+		pthread_mutex_unlock(&jobLock);
+		queuedJobs = true;
+	}
+
+	if(queuedJobs){
+		pthread_cond_signal(&jobReady);
+	}
+
+	conn->consume(offset);
+	return 0;
+}
+
+void *TlsSinkServer::uringControlMain(void *arg){
+	((TlsSinkServer*)arg)->uringControlLoop();
+	return NULL;
+}
+
+/* The control thread of the io_uring loop. Handles the jobs one at a time,
+ * in the order they came, as gatewaySession() would handle the messages, 
+ * with the response collected in a memory BIO for the loop to send. The 
+ * relay to the auth server and the profile lookups block only this thread.
+ * The handlers share the message arena and _gatewayRouteId of the server,
+ * which is why there is one control thread.
+ */
+void TlsSinkServer::uringControlLoop(){
+	u_int64_ard one = 1;
+
+	arenaUse(&msgArena);
+	mysql_thread_init();
+
+	while(true){
+		pthread_mutex_lock(&jobLock);
+		while(jobs == NULL){
+			pthread_cond_wait(&jobReady, &jobLock);
+		}
+		uringJob *job = jobs;
+		jobs = job->next;
+		if(jobs == NULL){
+			jobsTail = NULL;
+		}
+		pthread_mutex_unlock(&jobLock);
+
+		uringPipeline->waitChecked(job->routeId, job->mark);
+
+		job->response = BIO_new(BIO_s_mem());
+		handleGatewayMessage(job->response, job->routeId, job->frame, 
+							 job->length);
+
+		pthread_mutex_lock(&jobLock);
+		appendJob(&doneJobs, &doneJobsTail, job);
+		pthread_mutex_unlock(&jobLock);
+
+		if(write(doneFd, &one, sizeof(one)) != sizeof(one)){
+			syslog(LOG_ERR, "Unable to wake the io_uring loop.");
+		}
+	}
 }
 
 /* Reads a message from the proxy client over a BIO cannel  and returns the 
@@ -532,15 +1357,93 @@ int  TlsSinkServer::readFromProxyClient(BIO *proxyClientRequestBio,
 	return err;
 }
 
+/* Reads exactly len bytes from the proxy client, looping over short reads.
+ * Returns len, or the value of the failing BIO_read() call. 
+ */
+int  TlsSinkServer::readFullyFromProxyClient(BIO *proxyClientRequestBio, 
+						byte_ard *readBuf, int len)
+{
+	int readLen = 0;
+
+	while(readLen < len){
+		int err = BIO_read(proxyClientRequestBio, readBuf+readLen, 
+							len-readLen);
+		if(err <= 0){
+			if(BIO_should_retry(proxyClientRequestBio)){
+				continue;
+			}
+			return err;
+		}
+		readLen += err;
+	}
+
+	return readLen;
+}
+
+/* Reads exactly len bytes from a gateway session. When the kernel decrypts
+ * the records (kTLS) a frame is read with plain recv() calls on the socket,
+ * usually one, without going through OpenSSL. What OpenSSL still holds from
+ * before the handover, and records other than application data, an alert or
+ * a key update on which recv() fails with EIO, are left to OpenSSL.
+ */
+int  TlsSinkServer::readFullyFromGateway(BIO *gatewaySslBio, 
+						byte_ard *readBuf, int len)
+{
+	int readLen = 0;
+
+#if defined(SSL_OP_ENABLE_KTLS) && !defined(OPENSSL_NO_KTLS)
+	SSL *ssl;
+	BIO_get_ssl(gatewaySslBio, &ssl);
+
+	if(gatewayKtlsFd >= 0 && !SSL_has_pending(ssl)){
+		while(readLen < len){
+			int err = recv(gatewayKtlsFd, readBuf+readLen, len-readLen,
+						   MSG_WAITALL);
+			if(err > 0){
+				readLen += err;
+			}else if(err == 0){
+				return 0;
+			}else if(errno != EINTR){
+				break;
+			}
+		}
+		if(readLen == len){
+			return len;
+		}
+	}
+#endif
+
+	int err = readFullyFromProxyClient(gatewaySslBio, readBuf+readLen,
+									   len-readLen);
+	return err <= 0 ? err : len;
+}
+
 /* Writes a message to the proxy client over a BIO channel  and returns the 
  * number of bytes written or 0 if the call was not sucessuful. Returns <0 if
- * an error occurred.
+ * an error occurred. On a gateway session the message is wrapped in an 
+ * envelope addressed to the sensor the current request came from.
  */
 int TlsSinkServer::writeToProxyClient(BIO *proxyClientRequestBio, byte_ard *writeBuf,
 									  int len)
 {
+	int err;
+
+	if(_gatewayRouteId != NULL){
+		byte_ard frameBuf[GWFRAME_HEADER_SIZE + BUFSIZE];
 
-	int err = BIO_write(proxyClientRequestBio, writeBuf, len);
+		if(len > BUFSIZE){
+			syslog(LOG_ERR, "Gateway response too long: %d", len);
+			return -1;
+		}
+
+		// Header and payload go out in one write, i.e. one TLS record.
+		pack_gwframe_header(_gatewayRouteId, len, frameBuf);
+		memcpy(frameBuf+GWFRAME_HEADER_SIZE, writeBuf, len);
+		err = BIO_write(proxyClientRequestBio, frameBuf, 
+						GWFRAME_HEADER_SIZE+len);
+	} else {
+		err = BIO_write(proxyClientRequestBio, writeBuf, len);
+	}
 
 	if(err <= 0){
 		syslog(LOG_ERR, "Write error: %d", err);
@@ -559,6 +1462,30 @@ void TlsSinkServer::serverMain(){
 
 	initOpenSsl();
 
+	// The children forked below inherit the arena along with the thread.
+	arenaUse(&msgArena);
+
+	// Shared by all the children forked below.
+	try {
+		replayTable = new TsReplayTable(REPLAY_SNAPSHOT_FILE, _replaySlots);
+	} catch(runtime_error rex) {
+		log_err_exit(rex.what());
+	}
+
+	// Gateway sessions get their own accept loop in a separate process.
+	if(_gatewayListenPort != NULL){
+		pid_t pid = fork();
+		if(pid < 0){
+			log_err_exit("Unable to fork gateway listener process.");
+		} else if(pid == 0 && _gatewayUring){
+			gatewayUringMain();
+			exit(0);
+		} else if(pid == 0){
+			gatewayMain();
+			exit(0);
+		}
+	}
+
 	// Creates a BIO object and returns it as an accept BIO object.
     proxyClientAcceptBio = BIO_new_accept((char*) _serverListenPort);
 
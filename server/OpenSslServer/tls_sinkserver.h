@@ -11,14 +11,63 @@
 #include "protocol.h"
 #include "tls_baseserver.h"
 #include "ts_db_sinksensorprofile.h"
+#include "ts_replaytable.h"
+#include "ts_pipeline.h"
+#include "ts_uring.h"
+#include "msg_arena.h"
 #include "tsense_keypair.h"
 #include "aes_utils.h"
 
 using namespace std;
 
+/* A gateway message the io_uring loop hands to its control thread, and the
+ * response it gets back, see gatewayUringMain().
+ */
+struct uringJob {
+	TsUringTlsConn *conn;
+	byte_ard routeId[ID_SIZE];
+	byte_ard frame[PIPELINE_FRAME_SIZE];
+	int length;
+	u_int64_ard mark;          // See TsSinkPipeline::mark().
+	BIO *response;             // What the handler wrote, a memory BIO.
+	uringJob *next;
+};
+
 class TlsSinkServer : public TlsBaseServer{
     private:
 		const char *_authServerAddr, *_authServerPort;
+
+		// Gateway sessions. A gateway authenticates with a client certificate
+		// and then multiplexes many sensors over one TLS connection.
+		const char *_gatewayListenPort;
+		SSL_CTX *gatewayCtx;
+		byte_ard *_gatewayRouteId; // Envelope ID of the message being handled.
+
+		// Staged processing of gateway data messages, see TsSinkPipeline.
+		// Zero crypto threads handles them in the session thread.
+		int _pipelineThreads;
+		u_int32_ard _pipelineDepth;
+
+		// Serve all gateway sessions from one process on an io_uring. The
+		// loop hands data messages to uringPipeline and the others to a
+		// control thread as jobs. Answered jobs come back on doneJobs, with
+		// a write to the eventfd doneFd.
+		bool _gatewayUring;
+		TsSinkPipeline *uringPipeline;
+		pthread_t uringControlTid;
+		pthread_mutex_t jobLock;
+		pthread_cond_t jobReady;
+		uringJob *jobs, *jobsTail;
+		uringJob *doneJobs, *doneJobsTail;
+		int doneFd;
+
+		// Socket of this gateway session process when the kernel decrypts
+		// its records (kTLS receive), otherwise -1.
+		int gatewayKtlsFd;
+
+		// Memory for the message being handled: its profiles and the
+		// buffers protocol.cpp unpacks into. Reset once the response is out.
+		struct msg_arena msgArena;
 		
 		/*
 		TSenseKeyPair *K_st;
@@ -31,8 +80,20 @@ class TlsSinkServer : public TlsBaseServer{
 		*/
 
 		dbConnectData dbcd;
+		TsReplayTable *replayTable;
+		u_int32_ard _replaySlots;
 
         void serverFork(BIO *proxyClientReplyBio, BIO* authServerBio);
+		SSL *connectToAuth();
+
+		void gatewayMain();
+		void gatewayFork(BIO *gatewayBio);
+		void gatewaySession(BIO *gatewaySslBio);
+		void gatewayPipelineSession(BIO *gatewaySslBio);
+		void gatewayUringMain();
+		int gatewayUringFrames(TsUringTlsConn *conn);
+		static void *uringControlMain(void *arg);
+		void uringControlLoop();
 
 		void acceptProxyClientListenBio();
 
@@ -41,29 +102,47 @@ class TlsSinkServer : public TlsBaseServer{
 
 		int readFromProxyClient(BIO *clientReplyBio, byte_ard *readBuf, 
 								int len);
+		int readFullyFromProxyClient(BIO *clientReplyBio, byte_ard *readBuf,
+								int len);
+		int readFullyFromGateway(BIO *gatewaySslBio, byte_ard *readBuf,
+								int len);
 		int writeToProxyClient(BIO *clientReplyBio, byte_ard *writeBuf, 
 								int len);
         int sendReceiveToAuth(SSL *ssl, byte_ard* readBuf, int readLen, 
 								byte_ard* writeBuf);
 
-		void handleIdResponse(SSL *ssl, BIO* proxyClientReqestBio,
+		int handleIdResponse(SSL *ssl, BIO* proxyClientReqestBio,
 								byte_ard* readBuf, int readLen);
 		void initKeys(byte_ard *K_ST);
 
-		void handleRekey(SSL *ssl, BIO* proxyClientRequestBio,
+		int handleRekey(SSL *ssl, BIO* proxyClientRequestBio,
 								byte_ard* readBuf, int readLen);
 		void handleData(SSL *ssl, BIO* proxyClientRequestBio,
 								byte_ard* readBuf, int readLen);
+		bool dataMessageComplete(const byte_ard *readBuf, int readLen);
+		void handleDataBatch(byte_ard **readBufs, int count);
+		int handleDataGcm(SSL *ssl, BIO* proxyClientRequestBio,
+								byte_ard* readBuf, int readLen);
+		void storeData(struct data *sensorData);
 
 		int handleMessage(SSL *ssl, BIO* proxyClientRequestBio,
 						  byte_ard *readBuf, int readLen);
+		int rejectMessage(int lineno, const char *msg);
+		int handleGatewayMessage(BIO *gatewaySslBio, byte_ard *routeId,
+								 byte_ard *readBuf, int readLen);
 
     public:
         //TlsSinkServer(const char *hostName, const char *listenPort);
 		TlsSinkServer(const char *authServerAddr, // Auths serv. IP/FQDN
 					  const char *authServerPort, 
 					  const char *serverAddr,	 // Own IP/FQDN
-					  const char *serverListenPort);
+					  const char *serverListenPort,
+					  const char *gatewayListenPort = NULL,
+					  int pipelineThreads = 0,
+					  u_int32_ard pipelineDepth = PIPELINE_QUEUE_DEPTH,
+					  bool gatewayUring = false,
+					  bool ktls = false,
+					  u_int32_ard replaySlots = REPLAY_TABLE_SLOTS);
         void serverMain();
 };
 
@@ -75,10 +75,11 @@ int TsDbSensorProfile::base64Decode(char *input, int inlen,
 
 /* Given a single key:
  *  1) Expand the key schedule for that key.
- *  2) Derive a corresponding CMAC key using a constant.
+ *  2) Derive a corresponding CMAC key using a constant, one of the
+ *     precomputed constant keys of aes_constants.h.
  *  3) Expand the CMAC keyschedule.
  */
-void TsDbSensorProfile::deriveKeyScheds(byte_ard *key, byte_ard *constant, 
+void TsDbSensorProfile::deriveKeyScheds(byte_ard *key, const struct cmac_key *constant, 
 									    byte_ard *cryptoKeySched,
 									    byte_ard *macKeySched) {
 
@@ -90,16 +91,9 @@ void TsDbSensorProfile::deriveKeyScheds(byte_ard *key, byte_ard *constant,
     // Expand crypto key schedule.
     KeyExpansion(key, cryptoKeySched);
 
-    // Expand constant key schedule which we will need to generate the mac key.
-    byte_ard constKeySched[BLOCK_BYTE_SIZE*11];
-    KeyExpansion(constant, constKeySched);
-
     // Derive the mac key using AES cMAC. The constant is the key and the 
     // key is the message M that will be cMAC'ed.
-    aesCMac((u_int32_ard*) constKeySched,
-        cryptoKey,
-        BLOCK_BYTE_SIZE,
-        macKey);
+    deriveKey(constant, cryptoKey, macKey);
 
     //Key schedule for the mac key
     KeyExpansion(macKey, macKeySched);
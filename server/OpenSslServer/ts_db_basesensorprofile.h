@@ -9,9 +9,12 @@
 
 #include <iostream>
 #include <stdexcept>
+#include <new>
 
 #include "aes_crypt.h"
 #include "aes_cmac.h"
+#include "aes_constants.h"
+#include "msg_arena.h"
 
 #include <mysql.h>
 
@@ -52,9 +55,29 @@ protected:
 public:
     TsDbSensorProfile(byte_ard * pID, dbConnectData dbcd);
 
-	~TsDbSensorProfile();
-
-	void deriveKeyScheds(byte_ard *key, byte_ard *constant, 
+	// The pipeline deletes sink profiles through the heap forms below.
+	virtual ~TsDbSensorProfile();
+
+	// Profiles for a single message are allocated in the message arena and
+	// go with its reset, they are not deleted. The plain forms have to be
+	// declared again next to it.
+	static void *operator new(size_t size){
+		return ::operator new(size);
+	}
+	static void operator delete(void *p){
+		::operator delete(p);
+	}
+	static void *operator new(size_t size, struct msg_arena *arena){
+		void *p = arenaAlloc(arena, size);
+		if(p == NULL){
+			throw bad_alloc();
+		}
+		return p;
+	}
+	static void operator delete(void *p, struct msg_arena *arena){
+	}
+
+	void deriveKeyScheds(byte_ard *key, const struct cmac_key *constant, 
 						 byte_ard *cryptoKeySched,
 						 byte_ard *macKeySched);
 
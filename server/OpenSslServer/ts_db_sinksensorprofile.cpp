@@ -91,26 +91,19 @@ byte_ard *TsDbSinkSensorProfile::getR(){
  */
 void TsDbSinkSensorProfile::generateKeyScheds(){
 
-	byte_ard gammaKeySched[KEY_BYTES*11];
-
 	// Create a  K_ST object and use Beta to derive K_STa. Both
 	// will then be stored in the key schedule list.
-    deriveKeyScheds(Kst, cBeta, Kst_Sched, Ksta_Sched);
-
+    deriveKeyScheds(Kst, &cBetaKey, Kst_Sched, Ksta_Sched);
 
-    KeyExpansion(cGamma, gammaKeySched);
 
 	byte_ard K_STe[KEY_BYTES];
     // Derive K_STe using AES cMAC. The constant is the key and the 
     // R is the message M that will be cMAC'ed.
-    aesCMac((u_int32_ard*) gammaKeySched,
-        R,
-        KEY_BYTES,
-        K_STe);
+    deriveKey(&cGammaKey, R, K_STe);
 
     // Create a K_STe object wich derives K_STea using gamma. Both
 	// will then be stored in the key schedule list..
-    deriveKeyScheds(K_STe, cEpsilon, Kste_Sched, Kstea_Sched);
+    deriveKeyScheds(K_STe, &cEpsilonKey, Kste_Sched, Kstea_Sched);
 }
 
 /* Retrieves the sensor profile corresponding to devicePublicId from the
@@ -0,0 +1,548 @@
+/*
+ * File name: ts_pipeline.cpp
+ * Date:      2026-10-19 20:55
+ * Author:
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <syslog.h>
+#include <time.h>
+#include <mysql.h>
+
+#include "ts_pipeline.h"
+#include "aes_batch.h"
+#include "aes_cmac.h"
+#include "aes_gcm.h"
+
+using namespace std;
+
+static u_int64_ard nowNs(){
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u_int64_ard)ts.tv_sec*1000000000ull + ts.tv_nsec;
+}
+
+/* FNV-1a over the public device id, picks the crypto thread of a device. */
+static u_int32_ard hashId(const byte_ard *pID){
+	u_int32_ard h = 2166136261u;
+	for(int i = 0; i < ID_SIZE; i++){
+		h ^= pID[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static void statAdd(u_int64_ard *counter, u_int64_ard value){
+	__atomic_fetch_add(counter, value, __ATOMIC_RELAXED);
+}
+
+static void statMax64(u_int64_ard *counter, u_int64_ard value){
+	u_int64_ard old = __atomic_load_n(counter, __ATOMIC_RELAXED);
+	while(value > old &&
+		  !__atomic_compare_exchange_n(counter, &old, value, true,
+									   __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static void statMax32(u_int32_ard *counter, u_int32_ard value){
+	u_int32_ard old = __atomic_load_n(counter, __ATOMIC_RELAXED);
+	while(value > old &&
+		  !__atomic_compare_exchange_n(counter, &old, value, true,
+									   __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+//------------------------------------------------------------------------------
+// TsSinkPipeline
+//------------------------------------------------------------------------------
+
+/* Sets up the queues and items and starts the stage threads. Parameters:
+ *  - dbcd, the sensor profile database.
+ *  - replayTable, shared with the rest of the sink.
+ *  - cryptoThreads, threads in the crypto stage.
+ *  - queueDepth, depth of each queue. There are as many items as the crypto
+ *    and storage queues hold together.
+ *  - storeBatch, most messages written to the data log per flush.
+ *  - dataLogPath, the data log.
+ */
+TsSinkPipeline::TsSinkPipeline(dbConnectData dbcd, TsReplayTable *replayTable,
+							   int cryptoThreads, u_int32_ard queueDepth,
+							   int storeBatch, const char *dataLogPath) :
+							dbcd(dbcd), replayTable(replayTable),
+							_cryptoThreads(cryptoThreads > 0 ? cryptoThreads : 1),
+							_storeBatch(storeBatch > 0 ? storeBatch : 1)
+{
+	dataLog = fopen(dataLogPath, "a");
+	if(dataLog == NULL){
+		throw runtime_error("Unable to open the data log.");
+	}
+
+	// Before any thread looks up a profile.
+	mysql_library_init(0, NULL, NULL);
+
+	cryptoQueues = new TsPipelineQueue*[_cryptoThreads];
+	for(int i = 0; i < _cryptoThreads; i++){
+		cryptoQueues[i] = new TsPipelineQueue(queueDepth);
+	}
+	storeQueue = new TsPipelineQueue(queueDepth);
+
+	// Every item fits in a queue whatever stage it is in, so only the free
+	// list can run dry.
+	itemCount = cryptoQueues[0]->capacity() + storeQueue->capacity();
+	items = new pipelineItem[itemCount];
+	freeItems = new TsPipelineQueue(itemCount);
+	for(u_int32_ard i = 0; i < itemCount; i++){
+		freeItems->push(&items[i]);
+	}
+
+	inFlight = 0;
+	pthread_mutex_init(&drainLock, NULL);
+	pthread_cond_init(&drained, NULL);
+
+	laneSubmitted = new u_int64_ard[_cryptoThreads];
+	laneChecked = new u_int64_ard[_cryptoThreads];
+	memset(laneSubmitted, 0, _cryptoThreads*sizeof(u_int64_ard));
+	memset(laneChecked, 0, _cryptoThreads*sizeof(u_int64_ard));
+	checkWaiters = 0;
+
+	memset(&cryptoStats, 0, sizeof(cryptoStats));
+	memset(&storeStats, 0, sizeof(storeStats));
+	lastStats = time(NULL);
+
+	cryptoTids = new pthread_t[_cryptoThreads];
+	cryptoArgs = new cryptoArg[_cryptoThreads];
+	for(int i = 0; i < _cryptoThreads; i++){
+		cryptoArgs[i].pipeline = this;
+		cryptoArgs[i].index = i;
+		if(pthread_create(&cryptoTids[i], NULL, cryptoMain, &cryptoArgs[i]) != 0){
+			throw runtime_error("Unable to start a crypto thread.");
+		}
+	}
+	if(pthread_create(&storeTid, NULL, storeMain, this) != 0){
+		throw runtime_error("Unable to start the storage thread.");
+	}
+
+	syslog(LOG_NOTICE, "Pipeline started, %d crypto threads, queues of %u, "
+			"%u items", _cryptoThreads, storeQueue->capacity(), itemCount);
+}
+
+/* Stores everything submitted so far and stops the stage threads. A NULL
+ * item tells a thread to finish.
+ */
+TsSinkPipeline::~TsSinkPipeline(){
+	drain();
+
+	for(int i = 0; i < _cryptoThreads; i++){
+		cryptoQueues[i]->push(NULL);
+	}
+	for(int i = 0; i < _cryptoThreads; i++){
+		pthread_join(cryptoTids[i], NULL);
+	}
+	storeQueue->push(NULL);
+	pthread_join(storeTid, NULL);
+
+	logStats();
+	fclose(dataLog);
+
+	for(int i = 0; i < _cryptoThreads; i++){
+		delete cryptoQueues[i];
+	}
+	delete [] cryptoQueues;
+	delete storeQueue;
+	delete freeItems;
+	delete [] items;
+	delete [] cryptoTids;
+	delete [] cryptoArgs;
+	delete [] laneSubmitted;
+	delete [] laneChecked;
+	pthread_mutex_destroy(&drainLock);
+	pthread_cond_destroy(&drained);
+}
+
+/* A free item to read a frame into, waits for one if they are all in the
+ * pipeline.
+ */
+pipelineItem *TsSinkPipeline::getItem(){
+	return freeItems->pop();
+}
+
+/* Gives back an item that was not submitted. */
+void TsSinkPipeline::putItem(pipelineItem *item){
+	freeItems->push(item);
+}
+
+/* Hands a data message to the crypto thread of its device. */
+void TsSinkPipeline::submit(pipelineItem *item){
+	__atomic_fetch_add(&inFlight, 1, __ATOMIC_RELAXED);
+
+	// The plaintext id follows the message type and crypto length.
+	u_int32_ard lane = hashId(item->frame+2) % _cryptoThreads;
+	__atomic_fetch_add(&laneSubmitted[lane], 1, __ATOMIC_RELAXED);
+	queued(item, cryptoQueues[lane], &cryptoStats);
+}
+
+/* Waits until every message submitted so far has been stored or dropped.
+ * The session does this before a message that changes keys is handled, so
+ * data sent under the old keys is checked with them.
+ */
+void TsSinkPipeline::drain(){
+	pthread_mutex_lock(&drainLock);
+	while(__atomic_load_n(&inFlight, __ATOMIC_ACQUIRE) != 0){
+		pthread_cond_wait(&drained, &drainLock);
+	}
+	pthread_mutex_unlock(&drainLock);
+}
+
+/* Where the messages of device pID submitted so far end, to waitChecked()
+ * for later. Called by the thread that submits.
+ */
+u_int64_ard TsSinkPipeline::mark(const byte_ard *pID){
+	u_int32_ard lane = hashId(pID) % _cryptoThreads;
+	return __atomic_load_n(&laneSubmitted[lane], __ATOMIC_RELAXED);
+}
+
+/* Waits until the messages of device pID submitted before mark have been
+ * checked, which is all a message that changes its keys has to wait for.
+ * Unlike drain() it does not wait for other devices, nor for the disk, so
+ * it ends however busy the pipeline is kept meanwhile.
+ */
+void TsSinkPipeline::waitChecked(const byte_ard *pID, u_int64_ard mark){
+	u_int32_ard lane = hashId(pID) % _cryptoThreads;
+
+	pthread_mutex_lock(&drainLock);
+	__atomic_fetch_add(&checkWaiters, 1, __ATOMIC_SEQ_CST);
+	while(__atomic_load_n(&laneChecked[lane], __ATOMIC_SEQ_CST) < mark){
+		pthread_cond_wait(&drained, &drainLock);
+	}
+	__atomic_fetch_sub(&checkWaiters, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&drainLock);
+}
+
+void TsSinkPipeline::queued(pipelineItem *item, TsPipelineQueue *queue,
+							stageStats *stats){
+	item->queuedAt = nowNs();
+	queue->push(item);
+	statMax32(&stats->depthMax, queue->depth());
+}
+
+void TsSinkPipeline::dequeued(pipelineItem **batch, int count,
+							  stageStats *stats){
+	u_int64_ard now = nowNs();
+	for(int i = 0; i < count; i++){
+		u_int64_ard wait = now - batch[i]->queuedAt;
+		statAdd(&stats->waitNs, wait);
+		statMax64(&stats->waitMaxNs, wait);
+	}
+	statAdd(&stats->items, count);
+	statAdd(&stats->batches, 1);
+}
+
+void *TsSinkPipeline::cryptoMain(void *arg){
+	cryptoArg *a = (cryptoArg*)arg;
+
+	mysql_thread_init();
+	a->pipeline->cryptoLoop(a->index);
+	mysql_thread_end();
+	return NULL;
+}
+
+void *TsSinkPipeline::storeMain(void *arg){
+	((TsSinkPipeline*)arg)->storeLoop();
+	return NULL;
+}
+
+/* Takes whatever is waiting, up to BATCH_LANES messages, so the batch grows
+ * with the load but a lone message is not held back.
+ */
+void TsSinkPipeline::cryptoLoop(int lane){
+	TsPipelineQueue *queue = cryptoQueues[lane];
+	pipelineItem *batch[BATCH_LANES];
+	bool stop = false;
+
+	while(!stop){
+		int count = 0;
+
+		batch[count] = queue->pop();
+		if(batch[count] == NULL){
+			break;
+		}
+		count++;
+		while(count < BATCH_LANES && queue->tryPop(&batch[count])){
+			if(batch[count] == NULL){
+				stop = true;
+				break;
+			}
+			count++;
+		}
+
+		dequeued(batch, count, &cryptoStats);
+		u_int64_ard start = nowNs();
+		cryptoBatch(batch, count);
+		statAdd(&cryptoStats.serviceNs, nowNs() - start);
+
+		for(int i = 0; i < count; i++){
+			queued(batch[i], storeQueue, &storeStats);
+		}
+
+		// Either a waiter sees the new count or it is counted here.
+		__atomic_add_fetch(&laneChecked[lane], count, __ATOMIC_SEQ_CST);
+		if(__atomic_load_n(&checkWaiters, __ATOMIC_SEQ_CST) > 0){
+			pthread_mutex_lock(&drainLock);
+			pthread_cond_broadcast(&drained);
+			pthread_mutex_unlock(&drainLock);
+		}
+	}
+}
+
+/* The checks of TlsSinkServer::handleDataBatch() and handleDataGcm(). CBC
+ * messages are verified and decrypted together, GCM ones one at a time. A
+ * message that fails a check is logged and passed on with valid unset, the
+ * storage stage then only recycles it.
+ */
+void TsSinkPipeline::cryptoBatch(pipelineItem **batch, int count){
+	TsDbSinkSensorProfile *tssp[BATCH_LANES];
+	const u_int32_ard *pKeys[BATCH_LANES];
+	const u_int32_ard *pCmacKeys[BATCH_LANES];
+	void *pStreams[BATCH_LANES];
+	pipelineItem *lanes[BATCH_LANES];
+	struct data sensorData[BATCH_LANES];
+	int32_ard valid[BATCH_LANES];
+	int n = 0;
+
+	for(int i = 0; i < count; i++){
+		pipelineItem *item = batch[i];
+		item->valid = 0;
+		item->pl.values = NULL;
+		item->sensorData.data = NULL;
+
+		if((item->frame[0] & ~MSG_T_DATA_FLAGS) == MSG_T_DATA_SEND_GCM){
+			cryptoGcm(item);
+			continue;
+		}
+
+		if(item->length < DataMsg::headerSize + item->frame[1] + BLOCK_BYTE_SIZE){
+			syslog(LOG_ERR, "Dropped data message, truncated");
+			continue;
+		}
+
+		try {
+			tssp[n] = new TsDbSinkSensorProfile(item->frame+2, dbcd);
+		} catch(runtime_error rex) {
+			syslog(LOG_ERR, "Dropped data message, %s", rex.what());
+			continue;
+		}
+
+		pKeys[n] = (const u_int32_ard*)(tssp[n]->getKsteSched());
+		pCmacKeys[n] = (const u_int32_ard*)(tssp[n]->getKsteaSched());
+		pStreams[n] = item->frame;
+		lanes[n] = item;
+		n++;
+	}
+	if(n == 0){
+		return;
+	}
+
+	unpack_data_batch(pStreams, pKeys, pCmacKeys, sensorData, valid, n);
+
+	for(int i = 0; i < n; i++){
+		pipelineItem *item = lanes[i];
+
+		delete tssp[i];
+		free(sensorData[i].ciphertext);
+		if(valid[i] != CMAC_VALID){
+			syslog(LOG_ERR, "Dropped data message, MAC did not match");
+			continue;
+		}
+
+		item->sensorData = sensorData[i];
+		if(memcmp(item->frame+2, sensorData[i].id, ID_SIZE) != 0){
+			syslog(LOG_ERR, "Dropped data message, IDs did not match");
+			continue;
+		}
+		accept(item);
+	}
+}
+
+/* A GCM tag covers the plaintext header, so a valid one also vouches for
+ * the id the key was looked up with.
+ */
+void TsSinkPipeline::cryptoGcm(pipelineItem *item){
+	TsDbSinkSensorProfile *tssp;
+
+	if(item->length < DATA_GCM_FULLSIZE(0) ||
+	   item->length < DATA_GCM_HEADER_SIZE + item->frame[1] + GCM_TAG_SIZE){
+		syslog(LOG_ERR, "Dropped GCM data message, truncated");
+		return;
+	}
+
+	try {
+		tssp = new TsDbSinkSensorProfile(item->frame+2, dbcd);
+	} catch(runtime_error rex) {
+		syslog(LOG_ERR, "Dropped GCM data message, %s", rex.what());
+		return;
+	}
+
+	int validTag = unpack_data_gcm(item->frame,
+								   (const u_int32_ard*)(tssp->getKsteSched()),
+								   &item->sensorData);
+	delete tssp;
+	if(validTag != GCM_TAG_VALID){
+		syslog(LOG_ERR, "Dropped GCM data message, tag did not match");
+		return;
+	}
+	accept(item);
+}
+
+/* The checks left once a message is authentic: the replay check, the
+ * record times of adaptive sampling and, for a packed payload, unpacking it.
+ */
+void TsSinkPipeline::accept(pipelineItem *item){
+	struct data *sensorData = &item->sensorData;
+	int timed = -1;
+	if(sensorData->msgtype & MSG_T_DATA_TIMED_FLAG){
+		timed = payload_times(sensorData->data, sensorData->data_len);
+	}
+	int timesSize = timed >= 0 ? PAYLOAD_TIMES_SIZE(timed) : 0;
+
+	if(replayTable->checkMsgTime(sensorData->id, sensorData->msgtime) 
+	   != REPLAY_OK){
+		syslog(LOG_ERR, "Dropped data message, replayed or stale");
+	}else if((sensorData->msgtype & MSG_T_DATA_TIMED_FLAG) && timed < 0){
+		syslog(LOG_ERR, "Dropped data message, malformed record times");
+	}else if((sensorData->msgtype & MSG_T_DATA_PACKED_FLAG) &&
+			 (unpack_payload(sensorData->data + timesSize, 
+							 sensorData->data_len - timesSize,
+							 &item->pl) != PAYLOAD_VALID ||
+			  (timed >= 0 && item->pl.records != timed))){
+		free(item->pl.values);
+		item->pl.values = NULL;
+		syslog(LOG_ERR, "Dropped data message, malformed packed payload");
+	}else{
+		item->valid = 1;
+	}
+}
+
+/* Writes up to storeBatch messages with one flush, then recycles them. */
+void TsSinkPipeline::storeLoop(){
+	pipelineItem **batch = new pipelineItem*[_storeBatch];
+	bool stop = false;
+
+	while(!stop){
+		int count = 0;
+
+		batch[count] = storeQueue->pop();
+		if(batch[count] == NULL){
+			break;
+		}
+		count++;
+		while(count < _storeBatch && storeQueue->tryPop(&batch[count])){
+			if(batch[count] == NULL){
+				stop = true;
+				break;
+			}
+			count++;
+		}
+
+		dequeued(batch, count, &storeStats);
+		u_int64_ard start = nowNs();
+		for(int i = 0; i < count; i++){
+			if(batch[i]->valid){
+				storeItem(batch[i]);
+			}
+		}
+		fflush(dataLog);
+		statAdd(&storeStats.serviceNs, nowNs() - start);
+
+		for(int i = 0; i < count; i++){
+			recycle(batch[i]);
+		}
+	}
+
+	delete [] batch;
+}
+
+/* The data log format of TlsSinkServer::storeData(). */
+void TsSinkPipeline::storeItem(pipelineItem *item){
+	struct data *sensorData = &item->sensorData;
+
+	char szUnpackId[20];  // Up to three digits per byte and the dash.
+	snprintf(szUnpackId, sizeof(szUnpackId), "%d%d-%d%d%d%d", 
+			sensorData->id[0], sensorData->id[1], sensorData->id[2], 
+			sensorData->id[3], sensorData->id[4], sensorData->id[5]);
+
+	// accept() has checked the record times.
+	int timed = 0, timesSize = 0;
+	if(sensorData->msgtype & MSG_T_DATA_TIMED_FLAG){
+		timed = sensorData->data[0];
+		timesSize = PAYLOAD_TIMES_SIZE(timed);
+	}
+
+	fprintf(dataLog,"[%s,%d]:",szUnpackId,sensorData->msgtime);
+	if(item->pl.values != NULL){
+		for (int i=0; i<item->pl.records*item->pl.icnt; i++)
+			fprintf(dataLog,"%d;",item->pl.values[i]);
+	}else{
+		for (int i=timesSize; i<sensorData->data_len; i++)
+			fprintf(dataLog,"%d;",sensorData->data[i]);
+	}
+	if(timed > 0){
+		fputc('@',dataLog);
+		for (int i=0; i<timed; i++)
+			fprintf(dataLog,"%u;",sensorData->msgtime - 
+					payload_time_offset(sensorData->data, i));
+	}
+	fputc('\n',dataLog);
+}
+
+void TsSinkPipeline::recycle(pipelineItem *item){
+	free(item->pl.values);
+	free(item->sensorData.data);
+	item->pl.values = NULL;
+	item->sensorData.data = NULL;
+	freeItems->push(item);
+
+	if(__atomic_sub_fetch(&inFlight, 1, __ATOMIC_RELEASE) == 0){
+		pthread_mutex_lock(&drainLock);
+		pthread_cond_broadcast(&drained);
+		pthread_mutex_unlock(&drainLock);
+	}
+}
+
+void TsSinkPipeline::logStatsIfDue(){
+	if(time(NULL) - lastStats >= PIPELINE_STATS_INTERVAL){
+		logStats();
+	}
+}
+
+/* Logs, per stage, the messages and batches handled, the current and
+ * deepest queue, the average and worst time in the queue and the average
+ * time spent on a message.
+ */
+void TsSinkPipeline::logStats(){
+	stageStats *stats[2] = { &cryptoStats, &storeStats };
+	const char *names[2] = { "crypto", "storage" };
+	u_int32_ard depth[2] = { 0, storeQueue->depth() };
+
+	for(int i = 0; i < _cryptoThreads; i++){
+		depth[0] += cryptoQueues[i]->depth();
+	}
+
+	for(int s = 0; s < 2; s++){
+		u_int64_ard items = __atomic_load_n(&stats[s]->items, __ATOMIC_RELAXED);
+		u_int64_ard batches = __atomic_load_n(&stats[s]->batches, __ATOMIC_RELAXED);
+		u_int64_ard div = items > 0 ? items : 1;
+
+		syslog(LOG_NOTICE, "Pipeline %s: %llu messages in %llu batches, "
+				"depth %u (max %u), wait avg %llu us (max %llu us), "
+				"service avg %llu us",
+				names[s], (unsigned long long)items,
+				(unsigned long long)batches, depth[s],
+				__atomic_load_n(&stats[s]->depthMax, __ATOMIC_RELAXED),
+				(unsigned long long)(__atomic_load_n(&stats[s]->waitNs, 
+					__ATOMIC_RELAXED)/div/1000),
+				(unsigned long long)(__atomic_load_n(&stats[s]->waitMaxNs,
+					__ATOMIC_RELAXED)/1000),
+				(unsigned long long)(__atomic_load_n(&stats[s]->serviceNs,
+					__ATOMIC_RELAXED)/div/1000));
+	}
+	lastStats = time(NULL);
+}
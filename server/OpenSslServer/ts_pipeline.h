@@ -0,0 +1,150 @@
+/*
+   File name: ts_pipeline.h
+   Date:      2026-10-19 20:55
+   Author:
+*/
+
+#ifndef __TS_PIPELINE_H__
+#define __TS_PIPELINE_H__
+
+#include <stdio.h>
+#include <pthread.h>
+
+#include "protocol.h"
+#include "payload_codec.h"
+#include "ts_db_sinksensorprofile.h"
+#include "ts_replaytable.h"
+#include "ts_pipelinequeue.h"
+
+using namespace std;
+
+// The largest message a frame can carry, BUFSIZE of the sink.
+#define PIPELINE_FRAME_SIZE 2048
+
+// Default sizing. Queue depths are rounded up to a power of two.
+#define PIPELINE_CRYPTO_THREADS 2
+#define PIPELINE_QUEUE_DEPTH    256
+#define PIPELINE_STORE_BATCH    64
+
+// Seconds between the stage metrics in the log.
+#define PIPELINE_STATS_INTERVAL 60
+
+#define PIPELINE_DATA_LOG "data.log"
+
+/* A data message on its way through the pipeline. Items are allocated up
+ * front and recycled, so the pipeline never holds more messages than it has
+ * items. The pipeline threads use no message arena, the buffers unpacked
+ * into an item come from the heap and are freed when it is recycled.
+ */
+struct pipelineItem {
+	byte_ard frame[PIPELINE_FRAME_SIZE];
+	int length;
+	u_int64_ard queuedAt;      // When it entered its current queue, in ns.
+	struct data sensorData;
+	struct payload pl;         // Unpacked payload if the message was packed.
+	int32_ard valid;           // Verified and to be stored.
+};
+
+/* Counters for one stage. Updated by all the threads of the stage, read by
+ * logStats() without stopping them.
+ */
+struct stageStats {
+	u_int64_ard items;
+	u_int64_ard batches;
+	u_int64_ard waitNs;        // Total time items spent in the queue.
+	u_int64_ard waitMaxNs;
+	u_int64_ard serviceNs;     // Total time spent handling batches.
+	u_int32_ard depthMax;      // Deepest the queue has been.
+};
+
+/* Staged processing of data messages for gateway sessions, so that reading
+ * TLS, checking and decrypting messages and writing them to the data log
+ * each go at their own pace:
+ *
+ *    network --> crypto (cryptoThreads) --> storage (one thread)
+ *
+ * The network stage is the session thread, or the io_uring loop of the
+ * sink. It reads frames into free items and submit()s data messages. Each crypto thread has a queue of its own and
+ * a device always goes to the same one, so the messages of a device stay in
+ * order and the replay check sees their times in order. The crypto threads
+ * look up the keys, verify and decrypt up to BATCH_LANES messages at a time
+ * with unpack_data_batch() (GCM messages one by one) and unpack packed
+ * payloads. The storage thread appends up to storeBatch messages to the data
+ * log per write and flush, and recycles the items.
+ *
+ * A full queue blocks the stage feeding it, so a slow disk backs up into
+ * the storage queue first and only stalls the reads once the items run out.
+ */
+class TsSinkPipeline {
+	private:
+		dbConnectData dbcd;
+		TsReplayTable *replayTable;
+		int _cryptoThreads;
+		int _storeBatch;
+
+		pipelineItem *items;
+		u_int32_ard itemCount;
+		TsPipelineQueue *freeItems;
+		TsPipelineQueue **cryptoQueues;
+		TsPipelineQueue *storeQueue;
+
+		pthread_t *cryptoTids;
+		pthread_t storeTid;
+		FILE *dataLog;
+
+		// Items submitted and not yet stored or dropped, for drain().
+		u_int32_ard inFlight;
+		pthread_mutex_t drainLock;
+		pthread_cond_t drained;
+
+		// Per crypto thread, the items submitted to it and those it has
+		// checked, for waitChecked(). Threads waiting there are counted so
+		// the crypto threads only wake them when there are any.
+		u_int64_ard *laneSubmitted;
+		u_int64_ard *laneChecked;
+		u_int32_ard checkWaiters;
+
+		stageStats cryptoStats;
+		stageStats storeStats;
+		time_t lastStats;
+
+		struct cryptoArg {
+			TsSinkPipeline *pipeline;
+			int index;
+		};
+		cryptoArg *cryptoArgs;
+
+		static void *cryptoMain(void *arg);
+		static void *storeMain(void *arg);
+		void cryptoLoop(int lane);
+		void storeLoop();
+		void cryptoBatch(pipelineItem **batch, int count);
+		void cryptoGcm(pipelineItem *item);
+		void accept(pipelineItem *item);
+		void storeItem(pipelineItem *item);
+		void recycle(pipelineItem *item);
+
+		void queued(pipelineItem *item, TsPipelineQueue *queue,
+					stageStats *stats);
+		void dequeued(pipelineItem **batch, int count, stageStats *stats);
+
+	public:
+		TsSinkPipeline(dbConnectData dbcd, TsReplayTable *replayTable,
+					   int cryptoThreads = PIPELINE_CRYPTO_THREADS,
+					   u_int32_ard queueDepth = PIPELINE_QUEUE_DEPTH,
+					   int storeBatch = PIPELINE_STORE_BATCH,
+					   const char *dataLogPath = PIPELINE_DATA_LOG);
+		~TsSinkPipeline();
+
+		pipelineItem *getItem();
+		void putItem(pipelineItem *item);
+		void submit(pipelineItem *item);
+		void drain();
+		u_int64_ard mark(const byte_ard *pID);
+		void waitChecked(const byte_ard *pID, u_int64_ard mark);
+
+		void logStatsIfDue();
+		void logStats();
+};
+
+#endif
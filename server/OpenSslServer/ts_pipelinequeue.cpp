@@ -0,0 +1,145 @@
+/*
+ * File name: ts_pipelinequeue.cpp
+ * Date:      2026-10-19 20:55
+ * Author:
+ */
+
+#include <errno.h>
+#include <sched.h>
+#include <stdexcept>
+
+#include "ts_pipelinequeue.h"
+
+using namespace std;
+
+static void semWait(sem_t *sem){
+	while(sem_wait(sem) != 0 && errno == EINTR);
+}
+
+TsPipelineQueue::TsPipelineQueue(u_int32_ard depth){
+	u_int32_ard n = 2;
+	while(n < depth){
+		n <<= 1;
+	}
+
+	cells = new cell[n];
+	mask = n - 1;
+	for(u_int32_ard i = 0; i < n; i++){
+		cells[i].seq = i;
+		cells[i].item = NULL;
+	}
+	head = tail = 0;
+
+	if(sem_init(&freeCells, 0, n) != 0 || sem_init(&filledCells, 0, 0) != 0){
+		throw runtime_error("Unable to initialize the queue semaphores.");
+	}
+}
+
+TsPipelineQueue::~TsPipelineQueue(){
+	sem_destroy(&freeCells);
+	sem_destroy(&filledCells);
+	delete [] cells;
+}
+
+/* Claims the tail cell and publishes the item in it. A cell is free for
+ * position pos when its sequence number is pos. The caller holds a free
+ * cell from the semaphore, so the claim only has to retry when another
+ * producer got the same position first.
+ */
+void TsPipelineQueue::enqueue(pipelineItem *item){
+	u_int64_ard pos = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+	cell *c;
+
+	while(true){
+		c = &cells[pos & mask];
+		u_int64_ard seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+		int64_t diff = (int64_t)(seq - pos);
+		if(diff == 0){
+			if(__atomic_compare_exchange_n(&tail, &pos, pos + 1, true,
+										   __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+				break;
+			}
+		}else{
+			// The cell is still being emptied, or another producer moved the
+			// tail on.
+			pos = __atomic_load_n(&tail, __ATOMIC_RELAXED);
+		}
+	}
+
+	c->item = item;
+	__atomic_store_n(&c->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+/* Claims the head cell and takes the item out of it. A cell holds the item
+ * for position pos when its sequence number is pos + 1, and is handed back
+ * to the producers for the next lap as pos + capacity. Returns false if the
+ * head cell has not been published yet.
+ */
+bool TsPipelineQueue::dequeue(pipelineItem **item){
+	u_int64_ard pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+	cell *c;
+
+	while(true){
+		c = &cells[pos & mask];
+		u_int64_ard seq = __atomic_load_n(&c->seq, __ATOMIC_ACQUIRE);
+		int64_t diff = (int64_t)(seq - (pos + 1));
+		if(diff == 0){
+			if(__atomic_compare_exchange_n(&head, &pos, pos + 1, true,
+										   __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+				break;
+			}
+		}else if(diff < 0){
+			return false;
+		}else{
+			pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+		}
+	}
+
+	*item = c->item;
+	__atomic_store_n(&c->seq, pos + mask + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+void TsPipelineQueue::push(pipelineItem *item){
+	semWait(&freeCells);
+	enqueue(item);
+	sem_post(&filledCells);
+}
+
+/* Takes the oldest item, waiting for one if the queue is empty. */
+pipelineItem *TsPipelineQueue::pop(){
+	pipelineItem *item;
+
+	semWait(&filledCells);
+	// The semaphore counts published items, but a producer that claimed an
+	// earlier position may not have published its cell yet.
+	while(!dequeue(&item)){
+		sched_yield();
+	}
+	sem_post(&freeCells);
+	return item;
+}
+
+/* Takes the oldest item if there is one. The item itself may be NULL, the
+ * shutdown marker, so it comes back through item.
+ */
+bool TsPipelineQueue::tryPop(pipelineItem **item){
+	if(sem_trywait(&filledCells) != 0){
+		return false;
+	}
+	while(!dequeue(item)){
+		sched_yield();
+	}
+	sem_post(&freeCells);
+	return true;
+}
+
+u_int32_ard TsPipelineQueue::depth(){
+	return (u_int32_ard)(__atomic_load_n(&tail, __ATOMIC_RELAXED) -
+						 __atomic_load_n(&head, __ATOMIC_RELAXED));
+}
+
+u_int32_ard TsPipelineQueue::capacity(){
+	return (u_int32_ard)(mask + 1);
+}
+
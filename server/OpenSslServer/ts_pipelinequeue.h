@@ -0,0 +1,63 @@
+/*
+   File name: ts_pipelinequeue.h
+   Date:      2026-10-19 20:55
+   Author:
+*/
+
+#ifndef __TS_PIPELINEQUEUE_H__
+#define __TS_PIPELINEQUEUE_H__
+
+#include <semaphore.h>
+
+#include "tstypes.h"
+
+// See ts_pipeline.h. The queue only passes pointers around.
+struct pipelineItem;
+
+/* Bounded lock free multi producer, multi consumer queue of items. An array
+ * of cells with sequence numbers (D. Vyukov's design): a producer claims a
+ * position with one compare and swap on the tail and publishes the cell by
+ * bumping its sequence number, consumers do the same on the head. Producers
+ * and consumers only meet in a cell, never on a lock.
+ *
+ * push() and pop() block, on a pair of semaphores counting the free and
+ * the filled cells, when the queue is full or empty. Uncontended these are
+ * a single atomic operation each and only sleep in the kernel when a stage
+ * actually has to wait for its neighbour.
+ */
+class TsPipelineQueue {
+	private:
+		struct cell {
+			u_int64_ard seq;
+			pipelineItem *item;
+		};
+
+		cell *cells;
+		u_int64_ard mask;
+
+		// Head and tail on cache lines of their own.
+		char pad0[64];
+		u_int64_ard tail;
+		char pad1[64];
+		u_int64_ard head;
+		char pad2[64];
+
+		sem_t freeCells;
+		sem_t filledCells;
+
+		void enqueue(pipelineItem *item);
+		bool dequeue(pipelineItem **item);
+
+	public:
+		TsPipelineQueue(u_int32_ard depth);
+		~TsPipelineQueue();
+
+		void push(pipelineItem *item);
+		pipelineItem *pop();
+		bool tryPop(pipelineItem **item);
+
+		u_int32_ard depth();
+		u_int32_ard capacity();
+};
+
+#endif
@@ -0,0 +1,403 @@
+/*
+ * File name: ts_replaytable.cpp
+ * Date:      2026-10-19 10:12
+ * Author:
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "ts_replaytable.h"
+
+using namespace std;
+
+#define SNAPSHOT_MAGIC   0x50525354  // "TSRP"
+#define SNAPSHOT_VERSION 2
+
+// Version 1 ends before msgTimeFloor.
+struct snapshotHeader {
+	u_int32_ard magic;
+	u_int32_ard version;
+	u_int32_ard slots;
+	u_int32_ard count;
+	u_int32_ard msgTimeFloor;
+};
+#define SNAPSHOT_V1_HEADER_SIZE (4*sizeof(u_int32_ard))
+
+/* FNV-1a over the public device id. */
+static u_int32_ard hashId(const byte_ard *pID){
+	u_int32_ard h = 2166136261u;
+	for(int i = 0; i < ID_SIZE; i++){
+		h ^= pID[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+/* Maps the table into memory shared with all child processes forked after
+ * construction and loads the last snapshot if one exists. Parameters:
+ *  - snapshotPath, the file the table is persisted to.
+ *  - slots, table size, rounded up to a power of two.
+ *  - snapshotInterval, minimum seconds between snapshots.
+ */
+TsReplayTable::TsReplayTable(const char *snapshotPath, u_int32_ard slots,
+							 int snapshotInterval) :
+							_snapshotPath(snapshotPath),
+							_snapshotInterval(snapshotInterval)
+{
+	u_int32_ard n = 1;
+	while(n < slots){
+		n <<= 1;
+	}
+
+	mapSize = sizeof(tableHeader) + n*sizeof(replayEntry);
+
+	void *map = mmap(NULL, mapSize, PROT_READ|PROT_WRITE,
+					 MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if(map == MAP_FAILED){
+		throw runtime_error("Unable to map the replay table.");
+	}
+
+	// The mapping is zero filled, i.e. every slot starts out unused.
+	header = (tableHeader*)map;
+	entries = (replayEntry*)((byte_ard*)map + sizeof(tableHeader));
+	header->slots = n;
+	header->count = 0;
+	header->msgTimeFloor = 0;
+	header->lastSnapshot = time(NULL);
+
+	// The lock is shared between processes. It is robust so a child that
+	// dies while holding it does not wedge the sink.
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	if(pthread_mutex_init(&header->lock, &attr) != 0){
+		throw runtime_error("Unable to initialize the replay table lock.");
+	}
+	pthread_mutexattr_destroy(&attr);
+
+	load();
+}
+
+TsReplayTable::~TsReplayTable(){
+	munmap(header, mapSize);
+}
+
+void TsReplayTable::lock(){
+	if(pthread_mutex_lock(&header->lock) == EOWNERDEAD){
+		// Updates are made one field at a time, so the worst a dead owner
+		// can leave behind is one half updated entry.
+		pthread_mutex_consistent(&header->lock);
+	}
+}
+
+void TsReplayTable::unlock(){
+	pthread_mutex_unlock(&header->lock);
+}
+
+/* Linear probing lookup. Returns the slot of the device, a fresh slot for it
+ * if create is set, or NULL if the device is unknown or no room could be
+ * made for it. A device new to the table starts at the message time floor.
+ * Must be called with the lock held.
+ */
+replayEntry *TsReplayTable::findSlot(const byte_ard *pID, bool create){
+	u_int32_ard mask = header->slots - 1;
+	u_int32_ard i = hashId(pID) & mask;
+
+	while(entries[i].used){
+		if(memcmp(entries[i].pID, pID, ID_SIZE) == 0){
+			return &entries[i];
+		}
+		i = (i + 1) & mask;
+	}
+
+	if(!create){
+		return NULL;
+	}
+	if(header->count >= header->slots - (header->slots >> 2)){
+		// The entries move, so the probe starts over.
+		return reclaim() ? findSlot(pID, create) : NULL;
+	}
+
+	memset(&entries[i], 0, sizeof(replayEntry));
+	memcpy(entries[i].pID, pID, ID_SIZE);
+	entries[i].used = 1;
+	entries[i].lastMsgTime = header->msgTimeFloor;
+	header->count++;
+
+	return &entries[i];
+}
+
+/* Makes room in a full table. The devices not seen for REPLAY_IDLE_SECONDS
+ * are dropped, or if there are none the least recently seen one, and the
+ * rest rehashed. The message time floor goes up to the highest message time
+ * dropped, so messages of a dropped device can not be replayed once it is 
+ * back. Its rekey nonce window starts over. Returns false if no room could
+ * be made. Must be called with the lock held.
+ */
+bool TsReplayTable::reclaim(){
+	u_int32_ard now = (u_int32_ard)time(NULL);
+	u_int32_ard idleBefore = now > REPLAY_IDLE_SECONDS ? 
+							 now - REPLAY_IDLE_SECONDS : 0;
+	u_int32_ard idle = 0, oldest = 0;
+
+	for(u_int32_ard i = 0; i < header->slots; i++){
+		if(!entries[i].used){
+			continue;
+		}
+		if(entries[i].lastSeen < idleBefore){
+			idle++;
+		}
+		if(!entries[oldest].used || 
+		   entries[i].lastSeen < entries[oldest].lastSeen){
+			oldest = i;
+		}
+	}
+
+	size_t tableSize = header->slots*sizeof(replayEntry);
+	replayEntry *copy = (replayEntry*)malloc(tableSize);
+	if(copy == NULL){
+		syslog(LOG_ERR, "Out of memory making room in the replay table.");
+		return false;
+	}
+	memcpy(copy, entries, tableSize);
+	memset(entries, 0, tableSize);
+	header->count = 0;
+
+	for(u_int32_ard i = 0; i < header->slots; i++){
+		if(!copy[i].used){
+			continue;
+		}
+		if(idle > 0 ? copy[i].lastSeen < idleBefore : i == oldest){
+			if(copy[i].lastMsgTime > header->msgTimeFloor){
+				header->msgTimeFloor = copy[i].lastMsgTime;
+			}
+			continue;
+		}
+		memcpy(findSlot(copy[i].pID, true), &copy[i], sizeof(replayEntry));
+	}
+	free(copy);
+
+	if(idle == 0){
+		syslog(LOG_WARNING, "Replay table full, dropped the least recently "
+			   "seen device. Consider a larger table.");
+	} else {
+		syslog(LOG_NOTICE, "Replay table full, dropped %d idle devices.", 
+			   idle);
+	}
+	return true;
+}
+
+/* Checks the nonce of a rekey message. Nonces are 16 bit counters that wrap
+ * around. A nonce ahead of the highest one seen slides the window forward,
+ * one behind it is accepted once if it is still inside the window. Returns
+ * REPLAY_OK if the message should be accepted, REPLAY_REJECT otherwise.
+ */
+int TsReplayTable::checkNonce(const byte_ard *pID, u_int16_ard nonce){
+	int result = REPLAY_REJECT;
+
+	lock();
+
+	replayEntry *e = findSlot(pID, true);
+
+	if(e == NULL){
+		syslog(LOG_ERR, "Replay table full, rejecting new device.");
+	} else if(!e->hasNonce){
+		e->hasNonce = 1;
+		e->highNonce = nonce;
+		e->nonceBitmap = 1;
+		result = REPLAY_OK;
+	} else {
+		int16_ard diff = (int16_ard)(nonce - e->highNonce);
+
+		if(diff > 0){
+			e->nonceBitmap = (diff >= REPLAY_NONCE_WINDOW) ?
+								0 : e->nonceBitmap << diff;
+			e->nonceBitmap |= 1;
+			e->highNonce = nonce;
+			result = REPLAY_OK;
+		} else if(-diff < REPLAY_NONCE_WINDOW){
+			u_int64_ard bit = (u_int64_ard)1 << (-diff);
+			if(!(e->nonceBitmap & bit)){
+				e->nonceBitmap |= bit;
+				result = REPLAY_OK;
+			}
+		}
+	}
+
+	if(e != NULL && result == REPLAY_OK){
+		e->lastSeen = (u_int32_ard)time(NULL);
+	}
+
+	unlock();
+
+	return result;
+}
+
+/* Checks the time stamp of a data message. The time must be strictly later
+ * than that of the last data message accepted from the device. Returns
+ * REPLAY_OK if the message should be accepted, REPLAY_REJECT otherwise.
+ */
+int TsReplayTable::checkMsgTime(const byte_ard *pID, u_int32_ard msgTime){
+	int result = REPLAY_REJECT;
+
+	lock();
+
+	replayEntry *e = findSlot(pID, true);
+
+	if(e == NULL){
+		syslog(LOG_ERR, "Replay table full, rejecting new device.");
+	} else if(msgTime > e->lastMsgTime){
+		e->lastMsgTime = msgTime;
+		e->lastSeen = (u_int32_ard)time(NULL);
+		result = REPLAY_OK;
+	}
+
+	unlock();
+
+	return result;
+}
+
+/* Forgets the nonce window and message time of a device. Called when the
+ * device is issued a new session key. Messages under the old key no longer
+ * verify, and the device is free to restart its counters.
+ */
+void TsReplayTable::resetDevice(const byte_ard *pID){
+	lock();
+
+	replayEntry *e = findSlot(pID, false);
+
+	if(e != NULL){
+		e->hasNonce = 0;
+		e->highNonce = 0;
+		e->nonceBitmap = 0;
+		e->lastMsgTime = 0;
+		e->lastSeen = (u_int32_ard)time(NULL);
+	}
+
+	unlock();
+}
+
+/* Writes a snapshot if more than the snapshot interval has passed since the
+ * last one. Cheap enough to call after every message.
+ */
+void TsReplayTable::snapshotIfDue(){
+	time_t now = time(NULL);
+
+	lock();
+	bool due = (now - header->lastSnapshot) >= _snapshotInterval;
+	if(due){
+		header->lastSnapshot = now;
+	}
+	unlock();
+
+	if(due){
+		writeSnapshot();
+	}
+}
+
+/* Writes a snapshot now. */
+void TsReplayTable::snapshot(){
+	lock();
+	header->lastSnapshot = time(NULL);
+	unlock();
+
+	writeSnapshot();
+}
+
+/* Copies the table out under the lock and writes the copy to a temporary
+ * file outside of it, which is then renamed over the previous snapshot so a
+ * crash never leaves a half written one behind.
+ */
+void TsReplayTable::writeSnapshot(){
+	size_t tableSize = header->slots*sizeof(replayEntry);
+	byte_ard *copy = (byte_ard*)malloc(tableSize);
+
+	if(copy == NULL){
+		syslog(LOG_ERR, "Out of memory writing replay snapshot.");
+		return;
+	}
+
+	snapshotHeader sh;
+	sh.magic = SNAPSHOT_MAGIC;
+	sh.version = SNAPSHOT_VERSION;
+
+	lock();
+	sh.slots = header->slots;
+	sh.count = header->count;
+	sh.msgTimeFloor = header->msgTimeFloor;
+	memcpy(copy, entries, tableSize);
+	unlock();
+
+	char tmpPath[1024];
+	snprintf(tmpPath, sizeof(tmpPath), "%s.%d", _snapshotPath, getpid());
+
+	FILE *pFile = fopen(tmpPath, "wb");
+	if(pFile == NULL){
+		syslog(LOG_ERR, "Unable to open %s for writing.", tmpPath);
+		free(copy);
+		return;
+	}
+
+	bool ok = fwrite(&sh, sizeof(sh), 1, pFile) == 1 &&
+			  fwrite(copy, tableSize, 1, pFile) == 1;
+	ok = (fclose(pFile) == 0) && ok;
+	free(copy);
+
+	if(!ok || rename(tmpPath, _snapshotPath) != 0){
+		syslog(LOG_ERR, "Writing replay snapshot %s failed.", _snapshotPath);
+		unlink(tmpPath);
+		return;
+	}
+
+	syslog(LOG_NOTICE, "Replay snapshot written, %d devices.", sh.count);
+}
+
+/* Loads the snapshot written by a previous run, if any. A snapshot taken
+ * with a different table size is rehashed into the current table.
+ */
+void TsReplayTable::load(){
+	FILE *pFile = fopen(_snapshotPath, "rb");
+	if(pFile == NULL){
+		return;
+	}
+
+	snapshotHeader sh;
+	sh.msgTimeFloor = 0;
+	if(fread(&sh, SNAPSHOT_V1_HEADER_SIZE, 1, pFile) != 1 || 
+	   sh.magic != SNAPSHOT_MAGIC || sh.version < 1 ||
+	   sh.version > SNAPSHOT_VERSION ||
+	   (sh.version >= 2 && fread(&sh.msgTimeFloor, 
+								 sizeof(sh.msgTimeFloor), 1, pFile) != 1)){
+		syslog(LOG_ERR, "Ignoring unreadable replay snapshot %s.",
+				_snapshotPath);
+		fclose(pFile);
+		return;
+	}
+	header->msgTimeFloor = sh.msgTimeFloor;
+
+	replayEntry e;
+	for(u_int32_ard i = 0; i < sh.slots; i++){
+		if(fread(&e, sizeof(e), 1, pFile) != 1){
+			break;
+		}
+		if(!e.used){
+			continue;
+		}
+		// A snapshot larger than the table keeps the devices seen last.
+		replayEntry *slot = findSlot(e.pID, true);
+		if(slot == NULL){
+			break;
+		}
+		memcpy(slot, &e, sizeof(e));
+	}
+
+	fclose(pFile);
+
+	syslog(LOG_NOTICE, "Loaded replay snapshot, %d devices.", header->count);
+}
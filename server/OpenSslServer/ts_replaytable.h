@@ -0,0 +1,96 @@
+/*
+   File name: ts_replaytable.h
+   Date:      2026-10-19 10:12
+   Author:    
+*/
+
+#ifndef __TS_REPLAYTABLE_H__
+#define __TS_REPLAYTABLE_H__
+
+#include <stdexcept>
+#include <pthread.h>
+#include <time.h>
+
+#include "protocol.h"
+
+using namespace std;
+
+// Default number of slots in the table, rounded up to a power of two. Once
+// the table is three quarters full, to keep probe chains short, a new device
+// takes the place of those idle for REPLAY_IDLE_SECONDS, or of the least
+// recently seen one.
+#define REPLAY_TABLE_SLOTS 16384
+#define REPLAY_IDLE_SECONDS (7*24*3600)
+
+// Rekey nonces up to this far behind the highest one seen are still
+// accepted, provided they have not been seen before.
+#define REPLAY_NONCE_WINDOW 64
+
+// Seconds between snapshots of the table to disk.
+#define REPLAY_SNAPSHOT_INTERVAL 60
+#define REPLAY_SNAPSHOT_FILE "replay.snapshot"
+
+#define REPLAY_OK     1
+#define REPLAY_REJECT 0
+
+/* One slot per device. 32 bytes, so two slots share a cache line and a probe
+ * sequence usually stays within one or two lines.
+ */
+struct replayEntry {
+	byte_ard pID[ID_SIZE];
+	byte_ard used;
+	byte_ard hasNonce;
+	u_int16_ard highNonce;        // Highest rekey nonce accepted.
+	u_int16_ard reserved;
+	u_int32_ard lastMsgTime;      // Highest data message time accepted.
+	u_int32_ard lastSeen;         // Wall clock time of the last update.
+	u_int64_ard nonceBitmap;      // Bit i set: nonce highNonce-i was seen.
+};
+
+/* Replay protection for the sink. Keeps, per device, the last accepted data
+ * message time and a sliding bitmap of recently accepted rekey nonces in an
+ * open addressed (linear probing) table.
+ *
+ * The table lives in an anonymous shared mapping so the per message child
+ * processes forked by the sink all update the same table. It is periodically
+ * written to disk and reloaded on start so replays are still caught across
+ * restarts.
+ */
+class TsReplayTable {
+	private:
+		struct tableHeader {
+			pthread_mutex_t lock;
+			u_int32_ard slots;
+			u_int32_ard count;
+			u_int32_ard msgTimeFloor;  // Highest message time dropped.
+			time_t lastSnapshot;
+		};
+
+		tableHeader *header;
+		replayEntry *entries;
+		size_t mapSize;
+		const char *_snapshotPath;
+		int _snapshotInterval;
+
+		void lock();
+		void unlock();
+		replayEntry *findSlot(const byte_ard *pID, bool create);
+		bool reclaim();
+		void load();
+		void writeSnapshot();
+
+	public:
+		TsReplayTable(const char *snapshotPath = REPLAY_SNAPSHOT_FILE,
+					  u_int32_ard slots = REPLAY_TABLE_SLOTS,
+					  int snapshotInterval = REPLAY_SNAPSHOT_INTERVAL);
+		~TsReplayTable();
+
+		int checkNonce(const byte_ard *pID, u_int16_ard nonce);
+		int checkMsgTime(const byte_ard *pID, u_int32_ard msgTime);
+		void resetDevice(const byte_ard *pID);
+
+		void snapshotIfDue();
+		void snapshot();
+};
+
+#endif
@@ -0,0 +1,407 @@
+/*
+ * File name: ts_uring.cpp
+ * Date:      2026-10-19 22:05
+ * Author:
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <stdexcept>
+
+#include "ts_uring.h"
+
+using namespace std;
+
+//------------------------------------------------------------------------------
+// TsUring
+//------------------------------------------------------------------------------
+
+/* Sets up the ring and maps its queues. Throws runtime_error if the kernel
+ * has no io_uring or refuses one.
+ */
+TsUring::TsUring(u_int32_ard entries){
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+
+	ringFd = (int)syscall(__NR_io_uring_setup, entries, &p);
+	if(ringFd < 0){
+		throw runtime_error("Unable to set up an io_uring.");
+	}
+
+	sqRingSize = p.sq_off.array + p.sq_entries*sizeof(u_int32_ard);
+	cqRingSize = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+
+	// Newer kernels map both rings in one go.
+	if(p.features & IORING_FEAT_SINGLE_MMAP){
+		if(cqRingSize > sqRingSize){
+			sqRingSize = cqRingSize;
+		}
+		cqRingSize = sqRingSize;
+	}
+
+	sqRing = mmap(NULL, sqRingSize, PROT_READ|PROT_WRITE,
+				  MAP_SHARED|MAP_POPULATE, ringFd, IORING_OFF_SQ_RING);
+	if(sqRing == MAP_FAILED){
+		::close(ringFd);
+		throw runtime_error("Unable to map the io_uring submission queue.");
+	}
+
+	if(p.features & IORING_FEAT_SINGLE_MMAP){
+		cqRing = sqRing;
+	}else{
+		cqRing = mmap(NULL, cqRingSize, PROT_READ|PROT_WRITE,
+					  MAP_SHARED|MAP_POPULATE, ringFd, IORING_OFF_CQ_RING);
+		if(cqRing == MAP_FAILED){
+			munmap(sqRing, sqRingSize);
+			::close(ringFd);
+			throw runtime_error("Unable to map the io_uring completion queue.");
+		}
+	}
+
+	sqesSize = p.sq_entries*sizeof(struct io_uring_sqe);
+	sqes = (struct io_uring_sqe*)mmap(NULL, sqesSize, PROT_READ|PROT_WRITE,
+									  MAP_SHARED|MAP_POPULATE, ringFd,
+									  IORING_OFF_SQES);
+	if(sqes == MAP_FAILED){
+		if(cqRing != sqRing){
+			munmap(cqRing, cqRingSize);
+		}
+		munmap(sqRing, sqRingSize);
+		::close(ringFd);
+		throw runtime_error("Unable to map the io_uring entries.");
+	}
+
+	byte_ard *sq = (byte_ard*)sqRing;
+	sqHead = (u_int32_ard*)(sq + p.sq_off.head);
+	sqTail = (u_int32_ard*)(sq + p.sq_off.tail);
+	sqMask = (u_int32_ard*)(sq + p.sq_off.ring_mask);
+	sqArray = (u_int32_ard*)(sq + p.sq_off.array);
+	sqEntries = p.sq_entries;
+
+	byte_ard *cq = (byte_ard*)cqRing;
+	cqHead = (u_int32_ard*)(cq + p.cq_off.head);
+	cqTail = (u_int32_ard*)(cq + p.cq_off.tail);
+	cqMask = (u_int32_ard*)(cq + p.cq_off.ring_mask);
+	cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+	queued = 0;
+}
+
+TsUring::~TsUring(){
+	munmap(sqes, sqesSize);
+	if(cqRing != sqRing){
+		munmap(cqRing, cqRingSize);
+	}
+	munmap(sqRing, sqRingSize);
+	::close(ringFd);
+}
+
+/* The next free submission queue entry, cleared and filled in with what
+ * every operation has. A full queue is submitted first, which the kernel
+ * takes in right away.
+ */
+struct io_uring_sqe *TsUring::getSqe(byte_ard opcode, int fd, uringOp *op){
+	u_int32_ard tail = *sqTail;
+
+	if(tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) == sqEntries){
+		submit();
+	}
+
+	u_int32_ard index = tail & *sqMask;
+	struct io_uring_sqe *sqe = &sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->user_data = (u_int64_ard)(unsigned long)op;
+
+	sqArray[index] = index;
+	__atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+	queued++;
+
+	return sqe;
+}
+
+void TsUring::prepAccept(int listenFd, uringOp *op){
+	getSqe(IORING_OP_ACCEPT, listenFd, op);
+}
+
+void TsUring::prepRecv(int fd, void *buf, u_int32_ard len, uringOp *op){
+	struct io_uring_sqe *sqe = getSqe(IORING_OP_RECV, fd, op);
+	sqe->addr = (u_int64_ard)(unsigned long)buf;
+	sqe->len = len;
+}
+
+void TsUring::prepSend(int fd, const void *buf, u_int32_ard len, uringOp *op){
+	struct io_uring_sqe *sqe = getSqe(IORING_OP_SEND, fd, op);
+	sqe->addr = (u_int64_ard)(unsigned long)buf;
+	sqe->len = len;
+	sqe->msg_flags = MSG_NOSIGNAL;
+}
+
+/* Reads at the file position, for an eventfd or a pipe the next that is
+ * written to it.
+ */
+void TsUring::prepRead(int fd, void *buf, u_int32_ard len, uringOp *op){
+	struct io_uring_sqe *sqe = getSqe(IORING_OP_READ, fd, op);
+	sqe->addr = (u_int64_ard)(unsigned long)buf;
+	sqe->len = len;
+	sqe->off = (u_int64_ard)-1;
+}
+
+int TsUring::enter(u_int32_ard minComplete){
+	u_int32_ard flags = minComplete > 0 ? IORING_ENTER_GETEVENTS : 0;
+	int ret;
+
+	do {
+		ret = (int)syscall(__NR_io_uring_enter, ringFd, queued, minComplete,
+						   flags, NULL, 0);
+	} while(ret < 0 && errno == EINTR);
+
+	if(ret > 0){
+		queued -= ret;
+	}
+	return ret;
+}
+
+/* Submits everything prepared so far without waiting. Returns the number of
+ * operations submitted, or <0 on error.
+ */
+int TsUring::submit(){
+	if(queued == 0){
+		return 0;
+	}
+	return enter(0);
+}
+
+/* Submits everything prepared so far, waits for at least one completion and
+ * returns up to max of them. Returns the number of completions, or <0 on
+ * error.
+ */
+int TsUring::wait(uringCompletion *completions, int max){
+	u_int32_ard head = *cqHead;
+
+	// Completions already waiting need no waiting for.
+	u_int32_ard minComplete =
+		__atomic_load_n(cqTail, __ATOMIC_ACQUIRE) == head ? 1 : 0;
+	if((queued > 0 || minComplete > 0) && enter(minComplete) < 0){
+		return -1;
+	}
+
+	u_int32_ard tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+	int n = 0;
+	while(head != tail && n < max){
+		struct io_uring_cqe *cqe = &cqes[head & *cqMask];
+		completions[n].op = (uringOp*)(unsigned long)cqe->user_data;
+		completions[n].result = cqe->res;
+		n++;
+		head++;
+	}
+	__atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+
+	return n;
+}
+
+//------------------------------------------------------------------------------
+// TsUringTlsConn
+//------------------------------------------------------------------------------
+
+/* Takes over the accepted socket fd. The handshake happens as data comes
+ * in, in the first calls to read().
+ */
+TsUringTlsConn::TsUringTlsConn(TsUring *ring, int fd, SSL_CTX *ctx){
+	this->ring = ring;
+	this->fd = fd;
+
+	if(!(ssl = SSL_new(ctx))){
+		throw runtime_error("Error creating an SSL context.");
+	}
+
+	rbio = BIO_new(BIO_s_mem());
+	wbio = BIO_new(BIO_s_mem());
+	SSL_set_bio(ssl, rbio, wbio);
+	SSL_set_accept_state(ssl);
+
+	sslBio = BIO_new(BIO_f_ssl());
+	BIO_set_ssl(sslBio, ssl, BIO_NOCLOSE);
+
+	recvOp.kind = URING_OP_RECV;
+	recvOp.owner = this;
+	sendOp.kind = URING_OP_SEND;
+	sendOp.owner = this;
+
+	plainLen = 0;
+	sendBuf = NULL;
+	sendLen = sendDone = sendSize = 0;
+	recving = sending = closing = verified = false;
+	holds = 0;
+}
+
+TsUringTlsConn::~TsUringTlsConn(){
+	BIO_free(sslBio);
+	SSL_free(ssl);        // And the memory BIOs with it.
+	free(sendBuf);
+	::close(fd);
+}
+
+void TsUringTlsConn::start(){
+	startRecv();
+}
+
+void TsUringTlsConn::startRecv(){
+	recving = true;
+	ring->prepRecv(fd, recvBuf, URING_RECV_SIZE, &recvOp);
+}
+
+/* Completion of a recv. Hands the bytes to the SSL object and starts the
+ * next recv, the plaintext is then taken out with read(). Returns
+ * URING_TLS_OK, URING_TLS_CLOSED if the peer hung up or URING_TLS_ERROR.
+ */
+int TsUringTlsConn::received(int32_ard result){
+	recving = false;
+
+	if(closing || result == 0){
+		return URING_TLS_CLOSED;
+	}
+	if(result < 0){
+		return URING_TLS_ERROR;
+	}
+
+	BIO_write(rbio, recvBuf, result);
+	startRecv();
+	return URING_TLS_OK;
+}
+
+/* Adds what plaintext there is room for to plain(). Returns URING_TLS_OK if
+ * some was added, URING_TLS_WANT_READ if there is no more until the next
+ * recv (or no room), URING_TLS_CLOSED on a TLS close or URING_TLS_ERROR.
+ * The peer's certificate is checked as soon as the handshake is done.
+ */
+int TsUringTlsConn::read(){
+	if(plainLen == URING_PLAIN_SIZE){
+		return URING_TLS_WANT_READ;
+	}
+
+	int n = SSL_read(ssl, plainBuf + plainLen, URING_PLAIN_SIZE - plainLen);
+	int err = n > 0 ? SSL_ERROR_NONE : SSL_get_error(ssl, n);
+
+	if(!verified && SSL_is_init_finished(ssl)){
+		if(SSL_get_verify_result(ssl) != X509_V_OK){
+			return URING_TLS_ERROR;
+		}
+		verified = true;
+	}
+
+	switch(err){
+		case SSL_ERROR_NONE:
+			plainLen += n;
+			return URING_TLS_OK;
+		case SSL_ERROR_WANT_READ:
+			return URING_TLS_WANT_READ;
+		case SSL_ERROR_ZERO_RETURN:
+			return URING_TLS_CLOSED;
+		default:
+			return URING_TLS_ERROR;
+	}
+}
+
+/* Sends what the SSL object has written, handshake messages, alerts and
+ * responses, unless a send is in flight, in which case sent() carries on.
+ */
+void TsUringTlsConn::flush(){
+	if(sending || closing){
+		return;
+	}
+
+	int pending = BIO_ctrl_pending(wbio);
+	if(pending <= 0){
+		return;
+	}
+
+	if(pending > sendSize){
+		sendSize = pending;
+		sendBuf = (byte_ard*)realloc(sendBuf, sendSize);
+	}
+	sendLen = BIO_read(wbio, sendBuf, pending);
+	sendDone = 0;
+	startSend();
+}
+
+void TsUringTlsConn::startSend(){
+	sending = true;
+	ring->prepSend(fd, sendBuf + sendDone, sendLen - sendDone, &sendOp);
+}
+
+/* Completion of a send. A short one is continued. A failed one closes the
+ * connection, the recv then ends with it.
+ */
+void TsUringTlsConn::sent(int32_ard result){
+	sending = false;
+
+	if(result <= 0){
+		close();
+		return;
+	}
+
+	sendDone += result;
+	if(sendDone < sendLen){
+		startSend();
+	}else{
+		flush();
+	}
+}
+
+/* Stops the connection. A recv still in flight ends when the socket is shut
+ * down, so the connection soon becomes idle().
+ */
+void TsUringTlsConn::close(){
+	if(!closing){
+		closing = true;
+		shutdown(fd, SHUT_RDWR);
+	}
+}
+
+bool TsUringTlsConn::closed(){
+	return closing;
+}
+
+bool TsUringTlsConn::idle(){
+	return !recving && !sending && holds == 0;
+}
+
+void TsUringTlsConn::hold(){
+	holds++;
+}
+
+/* Drops a hold(). A connection that closed in the meantime may be idle()
+ * now.
+ */
+void TsUringTlsConn::release(){
+	holds--;
+}
+
+byte_ard *TsUringTlsConn::plain(){
+	return plainBuf;
+}
+
+int TsUringTlsConn::plainLength(){
+	return plainLen;
+}
+
+/* Drops the first length bytes of plain(). */
+void TsUringTlsConn::consume(int length){
+	memmove(plainBuf, plainBuf + length, plainLen - length);
+	plainLen -= length;
+}
+
+BIO *TsUringTlsConn::bio(){
+	return sslBio;
+}
+
+SSL *TsUringTlsConn::getSsl(){
+	return ssl;
+}
@@ -0,0 +1,149 @@
+/*
+   File name: ts_uring.h
+   Date:      2026-10-19 22:05
+   Author:
+*/
+
+#ifndef __TS_URING_H__
+#define __TS_URING_H__
+
+#include <linux/io_uring.h>
+#include <openssl/bio.h>
+#include <openssl/ssl.h>
+
+#include "tstypes.h"
+
+using namespace std;
+
+// Submission queue entries. The completion queue is twice as deep and every
+// connection has at most two operations in flight.
+#define URING_ENTRIES 1024
+
+// Per connection buffers. Plaintext the buffer has no room for stays in the
+// SSL object until the next read, so it only has to hold the largest
+// message the server reads whole.
+#define URING_RECV_SIZE  (16*1024)
+#define URING_PLAIN_SIZE (8*1024)
+
+#define URING_OP_ACCEPT 1
+#define URING_OP_RECV   2
+#define URING_OP_SEND   3
+#define URING_OP_READ   4
+
+#define URING_TLS_OK        1
+#define URING_TLS_WANT_READ 2
+#define URING_TLS_CLOSED    0
+#define URING_TLS_ERROR     -1
+
+/* What an operation was for. The address of one goes along with every
+ * submission and comes back with its completion.
+ */
+struct uringOp {
+	int kind;         // URING_OP_*
+	void *owner;      // The connection, ... the operation belongs to.
+};
+
+struct uringCompletion {
+	uringOp *op;
+	int32_ard result; // As the system call would return it, -errno on error.
+};
+
+/* An io_uring on the raw system calls. Operations are only queued by the
+ * prep*() calls, and all that queued since the last time are submitted
+ * together with a single io_uring_enter() in wait(), which also waits for
+ * and collects completions. A busy server thus makes one system call per
+ * round of events instead of one per read or write.
+ */
+class TsUring {
+	private:
+		int ringFd;
+
+		void *sqRing, *cqRing;
+		size_t sqRingSize, cqRingSize;
+		struct io_uring_sqe *sqes;
+		size_t sqesSize;
+
+		u_int32_ard *sqHead, *sqTail, *sqMask, *sqArray;
+		u_int32_ard sqEntries;
+		u_int32_ard *cqHead, *cqTail, *cqMask;
+		struct io_uring_cqe *cqes;
+
+		u_int32_ard queued;   // Prepared, not yet submitted.
+
+		struct io_uring_sqe *getSqe(byte_ard opcode, int fd, uringOp *op);
+		int enter(u_int32_ard minComplete);
+
+	public:
+		TsUring(u_int32_ard entries = URING_ENTRIES);
+		~TsUring();
+
+		void prepAccept(int listenFd, uringOp *op);
+		void prepRecv(int fd, void *buf, u_int32_ard len, uringOp *op);
+		void prepSend(int fd, const void *buf, u_int32_ard len, uringOp *op);
+		void prepRead(int fd, void *buf, u_int32_ard len, uringOp *op);
+
+		int submit();
+		int wait(uringCompletion *completions, int max);
+};
+
+/* A TLS server connection driven by a TsUring. The socket is read and
+ * written by the ring, and the TLS records go through a pair of memory BIOs,
+ * so OpenSSL never touches the socket and never blocks: received() feeds
+ * what a recv brought to the SSL object, read() takes out the plaintext it
+ * yields and flush() sends what the SSL object wrote.
+ *
+ * Plaintext is written through bio(), an SSL BIO on the connection, so
+ * code written for blocking BIOs can respond on it unchanged. Written
+ * plaintext goes out on the next flush().
+ *
+ * A connection has at most one recv and one send in flight and must not be
+ * deleted before idle(). Work done for it elsewhere, such as a message
+ * handled on another thread, hold()s it until release()d, so it stays
+ * around for the response.
+ */
+class TsUringTlsConn {
+	private:
+		TsUring *ring;
+		int fd;
+		SSL *ssl;
+		BIO *rbio, *wbio, *sslBio;
+
+		byte_ard recvBuf[URING_RECV_SIZE];
+		byte_ard plainBuf[URING_PLAIN_SIZE];
+		int plainLen;
+		byte_ard *sendBuf;
+		int sendLen, sendDone, sendSize;
+
+		bool recving, sending, closing;
+		int holds;
+		bool verified;            // Handshake done and peer checked.
+
+		void startRecv();
+		void startSend();
+
+	public:
+		uringOp recvOp, sendOp;
+
+		TsUringTlsConn(TsUring *ring, int fd, SSL_CTX *ctx);
+		~TsUringTlsConn();
+
+		void start();
+		int received(int32_ard result);
+		int read();
+		void sent(int32_ard result);
+		void flush();
+		void close();
+		bool closed();
+		bool idle();
+		void hold();
+		void release();
+
+		byte_ard *plain();
+		int plainLength();
+		void consume(int length);
+
+		BIO *bio();
+		SSL *getSsl();
+};
+
+#endif
@@ -26,7 +26,9 @@ class TSenseAuthDaemon: public BDaemon{
 							int daemonFlags,
                             const char* addr,       // My address
                             const char* port,       // My port
-                            const char* sinkAddr);   // Peer (sink) addr.
+                            const char* sinkAddr,    // Peer (sink) addr.
+                            const char* keystore,    // Provisioned keys.
+                            bool uring);             // On an io_uring.
 	protected:
 		void work();
 
@@ -39,7 +41,9 @@ TSenseAuthDaemon::TSenseAuthDaemon(const char *daemonName,
 						int daemonFlags,
 						const char* addr,       // My address
 						const char* port,       // My port
-						const char* sinkAddr)   // Peer (sink) addr.
+						const char* sinkAddr,   // Peer (sink) addr.
+						const char* keystore,   // Provisioned keys.
+						bool uring)             // On an io_uring.
 				: BDaemon(daemonName, lockDir, daemonFlags)
 {
 	// The need for the sink server address may not be immediately apparent
@@ -48,7 +52,8 @@ TSenseAuthDaemon::TSenseAuthDaemon(const char *daemonName,
 	// FIXME: To make allowance for multiple skinks the sink address register
 	//        should be put in a database and this parameter shoudl be delted..
 	tlsa = new TlsAuthServer(sinkAddr,		// Peer (sink) addr.
-							 addr, port);	// Me.
+							 addr, port,	// Me.
+							 keystore, uring);
 
 	//tlsa = new TlsAuthServer("sink.tsense.sudo.is",				// Peer.,
 	//						 "auth.tsense.sudo.is", "6001");	// Me.
@@ -67,6 +72,8 @@ void usage(){
 	fprintf(stderr, "            --addr    <Auth server addr>\n");
 	fprintf(stderr, "            --port    <Auth server port>\n");
 	fprintf(stderr, "            --siaddr  <Sink server address>\n");
+	fprintf(stderr, "            [--keystore <Sensor key file>]\n");
+	fprintf(stderr, "            [--uring]\n");
 
 	fprintf(stderr, "\n");
 
@@ -85,6 +92,11 @@ void usage(){
 	fprintf(stderr, "    --addr    Auth server FQDN or IP.\n");
 	fprintf(stderr, "    --port    Auth server listening port.\n");
 	fprintf(stderr, "    --siaddr  Sink server FQDN or IP.\n");
+	fprintf(stderr, "    --keystore File with the master keys of provisioned sensors,\n");
+	fprintf(stderr, "              one '<ID, 12 hex digits> <key, 32 hex digits>'\n");
+	fprintf(stderr, "              per line.\n");
+	fprintf(stderr, "    --uring   Serve all connections from one process on an\n");
+	fprintf(stderr, "              io_uring instead of a process each.\n");
 }
 
 
@@ -107,6 +119,8 @@ int main(int argc, char **argv)
 		{"siaddr",  required_argument, 0, 'c'},
 		{"workdir",  required_argument, 0, 'e'},
 		{"lockdir",  required_argument, 0, 'f'},
+		{"keystore",  required_argument, 0, 'k'},
+		{"uring",  no_argument,       0, 'u'},
 		{"help",     no_argument,       0, 'h'},
 		{0, 0, 0, 0}
 	};
@@ -123,13 +137,16 @@ int main(int argc, char **argv)
 	char addr[ADDRLEN];
 	char port[PORTLEN];
 	char sinkAddr[ADDRLEN];
+	char keystore[PATHLEN];
+	bool isKeystore = false;
+	bool uring = false;
 
 	if(argc < 0){
 		cout << "options:" << endl;
 	}
 
 	int c;
-    while ((c = getopt_long (argc, argv, "a:b:c:d:e:f:h",
+    while ((c = getopt_long (argc, argv, "a:b:c:d:e:f:k:uh",
                             long_options, &option_index)) != -1){
 
 		switch (c) {
@@ -163,6 +180,17 @@ int main(int argc, char **argv)
 				isLockDir = true;
 				break;
 
+			case 'k':
+				strncpy(keystore, optarg, PATHLEN);
+				cout << "    keystore=" << keystore << endl;
+				isKeystore = true;
+				break;
+
+			case 'u':
+				uring = true;
+				cout << "    uring" << endl;
+				break;
+
 			case 'h':
 				usage();
 				exit(0);
@@ -184,7 +212,9 @@ int main(int argc, char **argv)
 			SINGLETON|NO_DTTY,
 			addr,
 			port,
-			sinkAddr);
+			sinkAddr,
+			isKeystore ? keystore : NULL,
+			uring);
 
 		if(wDirPassed){
 			cout << "wDirPassed" << endl;
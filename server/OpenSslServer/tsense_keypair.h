@@ -10,6 +10,7 @@
 #include <iostream>
 #include "aes_crypt.h"
 #include "aes_cmac.h"
+#include "aes_constants.h"
 
 class TSenseKeyPair {
 private:
@@ -19,7 +20,7 @@ private:
 	byte_ard macKeySched[BLOCK_BYTE_SIZE*11];
 
 public:
-	TSenseKeyPair(byte_ard * key, byte_ard *constant);
+	TSenseKeyPair(byte_ard * key, const struct cmac_key *constant);
 	byte_ard * getCryptoKey();
 	byte_ard * getCryptoKeySched();
 	byte_ard * getMacKey();
@@ -27,7 +27,13 @@ class TSenseSinkDaemon: public BDaemon{
 							const char* addr,		// My address
 							const char* port,		// My port
 							const char* authAddr,	// Peer (auth) addr.
-							const char* authPort);	// Peer (auth) port.
+							const char* authPort,	// Peer (auth) port.
+							const char* gwPort,		// Gateway port or NULL.
+							int plThreads,			// Pipeline crypto threads.
+							u_int32_ard plDepth,	// Pipeline queue depth.
+							bool gwUring,			// Gateways on an io_uring.
+							bool ktls,				// Gateway records in kernel.
+							u_int32_ard rtSlots);	// Replay table slots.
 
 	protected:
 		void work();
@@ -42,7 +48,13 @@ TSenseSinkDaemon::TSenseSinkDaemon(const char *daemonName,
 								const char* addr,		// My address
 								const char* port,		// My port
 								const char* authAddr,	// Peer (auth) addr.
-								const char *authPort)	// Peer (auth) port.
+								const char *authPort,	// Peer (auth) port.
+								const char *gwPort,		// Gateway port or NULL.
+								int plThreads,			// Pipeline crypto threads.
+								u_int32_ard plDepth,	// Pipeline queue depth.
+								bool gwUring,			// Gateways on an io_uring.
+								bool ktls,				// Gateway records in kernel.
+								u_int32_ard rtSlots)	// Replay table slots.
 					   
 					: BDaemon(daemonName, lockDir, daemonFlags)
 {
@@ -50,7 +62,11 @@ TSenseSinkDaemon::TSenseSinkDaemon(const char *daemonName,
 	
 
 	tlss = new TlsSinkServer(authAddr, authPort, 	// Peer, auth.
-							 addr, port);			// Me, sink.
+							 addr, port,			// Me, sink.
+							 gwPort,				// Me, gateway sessions.
+							 plThreads, plDepth,
+							 gwUring, ktls,
+							 rtSlots);
 
 	//tlss = new TlsSinkServer("auth.tsense.sudo.is", "6001", 	// Peer, auth.
 	//						 "sink.tsense.sudo.is", "6002");	// Me, sink.
@@ -69,6 +85,12 @@ void usage(){
     fprintf(stderr, "            --auport  <Auth server port>\n");
     fprintf(stderr, "            --addr    <Sink server address>\n");
     fprintf(stderr, "            --port    <Sink server port>\n");
+    fprintf(stderr, "            [--gwport <Gateway session port>]\n");
+    fprintf(stderr, "            [--plthreads <Pipeline crypto threads>]\n");
+    fprintf(stderr, "            [--pldepth <Pipeline queue depth>]\n");
+    fprintf(stderr, "            [--gwuring]\n");
+    fprintf(stderr, "            [--ktls]\n");
+    fprintf(stderr, "            [--replayslots <Replay table slots>]\n");
 
     fprintf(stderr, "\n");
 
@@ -77,7 +99,12 @@ void usage(){
 	"    A data sink that relays session key requests from a set of secure \n"
 	"    tamper proof sensors to an authorization server. Once the session \n"
 	"    key exchange complete the sink will recieve sensor data from each \n"
-	"    sensor and store this in a database.\n");
+	"    sensor and store this in a database.\n"
+	"\n"
+	"    Gateways that serve many sensors can instead hold one long lived\n"
+	"    TLS session with the sink and multiplex their sensors over it.\n"
+	"    Their data messages can be checked and stored by a pipeline of\n"
+	"    threads while the session keeps reading.\n");
 
     fprintf(stderr, "\n");
 
@@ -88,6 +115,23 @@ void usage(){
     fprintf(stderr, "    --auport  Auth server listening port.\n");
     fprintf(stderr, "    --addr    Sink server FQDN or IP.\n");
     fprintf(stderr, "    --port    Sink server listening port.\n");
+    fprintf(stderr, "    --gwport  Gateway session listening port. Optional.\n");
+    fprintf(stderr, "    --plthreads Crypto threads per gateway session. 0, the\n");
+    fprintf(stderr, "              default, handles data in the session thread.\n");
+    fprintf(stderr, "              With --gwuring those of its pipeline, default %d.\n",
+			PIPELINE_CRYPTO_THREADS);
+    fprintf(stderr, "    --pldepth Depth of the pipeline queues. Default %d.\n",
+			PIPELINE_QUEUE_DEPTH);
+    fprintf(stderr, "    --gwuring Serve all gateway sessions from one process on\n");
+    fprintf(stderr, "              an io_uring instead of a process each. Not\n");
+    fprintf(stderr, "              with --ktls.\n");
+    fprintf(stderr, "    --ktls    Let the kernel encrypt and decrypt the TLS\n");
+    fprintf(stderr, "              records of gateway sessions where it can.\n");
+    fprintf(stderr, "              Gateways must then speak TLS 1.2 or later.\n");
+    fprintf(stderr, "    --replayslots Slots of the replay table, three quarters\n");
+    fprintf(stderr, "              of them hold a device. Once they are taken the\n");
+    fprintf(stderr, "              devices idle longest make room. Default %d.\n",
+			REPLAY_TABLE_SLOTS);
 }
 
 
@@ -111,6 +155,12 @@ int main(int argc, char **argv)
 		{"auport",  required_argument, 0, 'd'},
 		{"workdir",  required_argument, 0, 'e'},
 		{"lockdir",  required_argument, 0, 'f'},
+		{"gwport",  required_argument, 0, 'g'},
+		{"plthreads",  required_argument, 0, 'i'},
+		{"pldepth",  required_argument, 0, 'j'},
+		{"gwuring",  no_argument,       0, 'k'},
+		{"ktls",  no_argument,       0, 'l'},
+		{"replayslots",  required_argument, 0, 'm'},
 		{"help",     no_argument,       0, 'h'},
 		{0, 0, 0, 0}
 	};
@@ -126,6 +176,13 @@ int main(int argc, char **argv)
 	char port[PORTLEN];
 	char authAddr[ADDRLEN];
 	char authPort[PORTLEN];
+	char gwPort[PORTLEN];
+	bool isGwPort = false;
+	int plThreads = 0;
+	u_int32_ard plDepth = PIPELINE_QUEUE_DEPTH;
+	bool gwUring = false;
+	bool ktls = false;
+	u_int32_ard rtSlots = REPLAY_TABLE_SLOTS;
 	
 
 	if(argc < 0){
@@ -133,7 +190,7 @@ int main(int argc, char **argv)
 	}
 
 	int c;
-	while ((c = getopt_long (argc, argv, "a:b:c:d:e:f:h",
+	while ((c = getopt_long (argc, argv, "a:b:c:d:e:f:g:hi:j:klm:",
                             long_options, &option_index)) != -1){
 
 		switch (c) {
@@ -173,6 +230,37 @@ int main(int argc, char **argv)
 				isLockDir = true;
 				break;
 
+			case 'g':
+				strncpy(gwPort, optarg, PORTLEN);
+				cout << "    gwport=" << gwPort << endl;
+				isGwPort = true;
+				break;
+
+			case 'i':
+				plThreads = atoi(optarg);
+				cout << "    plthreads=" << plThreads << endl;
+				break;
+
+			case 'j':
+				plDepth = atoi(optarg);
+				cout << "    pldepth=" << plDepth << endl;
+				break;
+
+			case 'k':
+				gwUring = true;
+				cout << "    gwuring" << endl;
+				break;
+
+			case 'l':
+				ktls = true;
+				cout << "    ktls" << endl;
+				break;
+
+			case 'm':
+				rtSlots = atoi(optarg);
+				cout << "    replayslots=" << rtSlots << endl;
+				break;
+
 			case 'h':
 				usage();
 				exit(0);
@@ -187,6 +275,13 @@ int main(int argc, char **argv)
 		usage();
 	}
 
+	// The records of the io_uring loop go through memory BIOs, so it has
+	// no kTLS.
+	if(gwUring && ktls){
+		fprintf(stderr, "--gwuring can not be combined with --ktls.\n");
+		exit(1);
+	}
+
 	try{
 		TSenseSinkDaemon sinkDaemon("tsensesinkd", 
 			lockDir,
@@ -195,7 +290,13 @@ int main(int argc, char **argv)
 			addr,
 			port,
 			authAddr,
-			authPort);
+			authPort,
+			isGwPort ? gwPort : NULL,
+			plThreads,
+			plDepth,
+			gwUring,
+			ktls,
+			rtSlots);
 
 		// The default working directory for BDaemon is /tmp, set it to
 		// the location of the daemon or what ever is specified by option.
@@ -4,8 +4,15 @@ ln -s ../aes_crypt/lib/aes_cmac.cpp .
 ln -s ../aes_crypt/lib/aes_cmac.h .
 ln -s ../aes_crypt/lib/aes_crypt.cpp .
 ln -s ../aes_crypt/lib/aes_crypt.h .
+ln -s ../aes_crypt/lib/aes_tables.h .
+ln -s ../aes_crypt/lib/aes_gcm.cpp .
+ln -s ../aes_crypt/lib/aes_gcm.h .
 ln -s ../aes_crypt/lib/protocol.cpp .
 ln -s ../aes_crypt/lib/protocol.h .
+ln -s ../aes_crypt/lib/payload_codec.cpp .
+ln -s ../aes_crypt/lib/payload_codec.h .
 ln -s ../aes_crypt/lib/tstypes.h .
 ln -s ../aes_crypt/lib/aes_constants.cpp .
 ln -s ../aes_crypt/lib/aes_constants.h .
+ln -s ../aes_crypt/lib/serial_link.cpp .
+ln -s ../aes_crypt/lib/serial_link.h .
@@ -0,0 +1,15 @@
+/*
+ * File name: EEPROM.h
+ * Date:      2026-10-19 16:35
+ * Author:
+ *
+ * Stands in for the Arduino EEPROM library header included by tsensor.pde.
+ * The EEPROM itself is a member of ArduinoShim.
+ */
+
+#ifndef __SIM_EEPROM_H__
+#define __SIM_EEPROM_H__
+
+#include "arduino_shim.h"
+
+#endif // __SIM_EEPROM_H__
@@ -0,0 +1,363 @@
+/*
+ * File name: arduino_shim.cpp
+ * Date:      2026-10-19 16:35
+ * Author:
+ */
+
+#include "arduino_shim.h"
+#include "aes_crypt.h"
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#if defined(__i386__) || defined(__x86_64__)
+  #include <x86intrin.h>
+#endif
+
+u_int64_ard simCycles()
+{
+#if defined(__i386__) || defined(__x86_64__)
+  return __rdtsc();
+#else
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (u_int64_ard)ts.tv_sec*1000000000 + ts.tv_nsec;
+#endif
+}
+
+static double nowMs()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec*1000.0 + ts.tv_nsec/1000000.0;
+}
+
+static u_int64_ard threadCpuNs()
+{
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (u_int64_ard)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+//
+// SimClock
+//
+
+SimClock::SimClock() : waitCycles(0), _speed(1.0), _startMs(0)
+{
+}
+
+void SimClock::start(double speed)
+{
+  _speed = speed;
+  _startMs = nowMs();
+}
+
+unsigned long SimClock::millis()
+{
+  return (unsigned long)((nowMs() - _startMs) * _speed);
+}
+
+void SimClock::sleep(double msec, int wakeFd)
+{
+  u_int64_ard start = simCycles();
+  double ns = msec * 1000000.0 / _speed;
+  if ( wakeFd >= 0 )
+  {
+    // Rounded up, so a sleep to a deadline does not spin just short of it
+    pollfd pfd;
+    pfd.fd = wakeFd;
+    pfd.events = POLLIN;
+    poll(&pfd, 1, (int)(ns / 1000000.0) + 1);
+  }
+  else
+  {
+    timespec ts;
+    ts.tv_sec = (time_t)(ns / 1000000000.0);
+    ts.tv_nsec = (long)(ns - ts.tv_sec*1000000000.0);
+    while ( nanosleep(&ts, &ts) == -1 && errno == EINTR )
+      ;
+  }
+  waitCycles += simCycles() - start;
+}
+
+//
+// SimSerial
+//
+
+SimSerial::SimSerial(SimClock *clock) : bytesIn(0), bytesOut(0), bytesDropped(0),
+                                        _clock(clock), _fd(-1), _baud(0),
+                                        _head(0), _count(0), _wrote(false)
+{
+}
+
+void SimSerial::attach(int fd)
+{
+  _fd = fd;
+  fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL) | O_NONBLOCK);
+}
+
+void SimSerial::begin(long baud)
+{
+  _baud = baud;
+}
+
+// Moves what has arrived on the line into the receive buffer. What does not
+// fit stays in the kernel, where a real UART would have lost it; the hosts
+// talking to the firmware never depend on that.
+void SimSerial::fill()
+{
+  if ( _fd < 0 || _count == SIM_SERIAL_BUFFER )
+    return;
+  uint8_t buf[SIM_SERIAL_BUFFER];
+  ssize_t n = ::read(_fd, buf, SIM_SERIAL_BUFFER - _count);
+  for ( ssize_t i = 0; i < n; i++ )
+    _rx[(_head + _count++) % SIM_SERIAL_BUFFER] = buf[i];
+  if ( n > 0 )
+    bytesIn += n;
+}
+
+int SimSerial::available()
+{
+  _wrote = false;
+  fill();
+  return _count;
+}
+
+int SimSerial::read()
+{
+  _wrote = false;
+  fill();
+  if ( _count == 0 )
+    return -1;
+  uint8_t b = _rx[_head];
+  _head = (_head + 1) % SIM_SERIAL_BUFFER;
+  _count--;
+  return b;
+}
+
+// Discards the received bytes. Anything the host sent in answer to the last
+// write has not arrived yet on the device, so the line is not read again.
+void SimSerial::flush()
+{
+  if ( !_wrote )
+    fill();
+  _head = 0;
+  _count = 0;
+}
+
+void SimSerial::wait(double msec)
+{
+  _wrote = false;
+  fill();
+  if ( _count == 0 )
+    _clock->sleep(msec, _fd);
+}
+
+size_t SimSerial::write(uint8_t b)
+{
+  return write(&b, 1);
+}
+
+size_t SimSerial::write(const uint8_t *buf, size_t len)
+{
+  if ( _fd < 0 )
+    return 0;
+  // The UART is written a byte at a time, so the call returns when the last
+  // byte is on the wire. Start bit, 8 data bits and a stop bit per byte.
+  if ( _baud > 0 )
+    _clock->sleep(len * 10 * 1000.0 / _baud);
+  fill();
+  _wrote = true;
+  ssize_t n = ::write(_fd, buf, len);
+  if ( n < 0 )
+    n = 0;
+  bytesOut += n;
+  bytesDropped += len - n;
+  return len;
+}
+
+void SimSerial::print(const char *s)
+{
+  write((const uint8_t *)s, strlen(s));
+}
+
+void SimSerial::print(int val, int base)
+{
+  char buf[16];
+  snprintf(buf, sizeof(buf), base == HEX ? "%X" : "%d", val);
+  print(buf);
+}
+
+//
+// SimEEPROM
+//
+
+SimEEPROM::SimEEPROM()
+{
+  memset(_mem, 0xFF, EEPROM_SIZE);  // Erased cells read 0xFF
+}
+
+uint8_t SimEEPROM::read(int address)
+{
+  if ( address < 0 || address >= EEPROM_SIZE )
+    return 0xFF;
+  return _mem[address];
+}
+
+void SimEEPROM::write(int address, uint8_t value)
+{
+  if ( address >= 0 && address < EEPROM_SIZE )
+    _mem[address] = value;
+}
+
+// Burns the device the way tsburner does: the AES tables, then the public
+// id and the master key.
+void SimEEPROM::provision(const byte_ard *id, const byte_ard *key)
+{
+  for ( int i = 0; i < S_TABLE_LEN; i++ )
+    _mem[S_TABLE_START+i] = getSboxValue(i);
+  for ( int i = 0; i < IS_TABLE_LEN; i++ )
+    _mem[IS_TABLE_START+i] = getISboxValue(i);
+  for ( int i = 0; i < RCON_TABLE_LEN; i++ )
+    _mem[RCON_TABLE_START+i] = getRconValue(i);
+  memcpy(_mem+DEV_DATA_START+DEV_ID_START, id, DEV_ID_LEN);
+  memcpy(_mem+DEV_DATA_START+DEV_KEY_START, key, DEV_KEY_LEN);
+}
+
+//
+// ArduinoShim
+//
+
+ArduinoShim::ArduinoShim() : Serial(&clock), wakeups(0), sleptMs(0), _rand(1), _stepCount(0)
+{
+  memset(&heap, 0, sizeof(heap));
+  memset(pins, 0, sizeof(pins));
+}
+
+void ArduinoShim::run(double speed, volatile bool *stop)
+{
+  simCurrentHeap = &heap;
+  clock.start(speed);
+  setup();
+  while ( !*stop )
+    loop();
+  simCurrentHeap = NULL;
+}
+
+unsigned long ArduinoShim::millis()
+{
+  return clock.millis();
+}
+
+void ArduinoShim::delay(unsigned long msec)
+{
+  clock.sleep(msec);
+}
+
+// Pin noise, good enough for randomSeed(). The firmware samples test
+// counters rather than the inputs.
+int ArduinoShim::analogRead(int pin)
+{
+  return rand_r(&_rand) & 0x3FF;
+}
+
+void ArduinoShim::pinMode(int pin, int mode)
+{
+}
+
+void ArduinoShim::digitalWrite(int pin, int value)
+{
+  if ( pin >= 0 && pin < SIM_PIN_COUNT )
+    pins[pin] = value ? HIGH : LOW;
+}
+
+long ArduinoShim::random(long howbig)
+{
+  if ( howbig == 0 )
+    return 0;
+  return rand_r(&_rand) % howbig;
+}
+
+long ArduinoShim::random(long howsmall, long howbig)
+{
+  if ( howsmall >= howbig )
+    return howsmall;
+  return howsmall + random(howbig - howsmall);
+}
+
+void ArduinoShim::randomSeed(unsigned int seed)
+{
+  if ( seed != 0 )
+    _rand = seed;
+}
+
+// RAM left with the heap in its current state. Static data and the stack
+// are not modelled.
+int ArduinoShim::freeMemory()
+{
+  return SIM_RAM_SIZE - heap.current;
+}
+
+void ArduinoShim::sleepUntil(unsigned long deadline)
+{
+  unsigned long start = millis();
+  long msec = (long)(deadline - start);
+  if ( msec <= 0 )
+    return;
+  Serial.wait(msec);
+  sleptMs += millis() - start;
+  wakeups++;
+}
+
+SimStepStats* ArduinoShim::stepStats(const char *name)
+{
+  for ( int i = 0; i < _stepCount; i++ )
+    if ( strcmp(_steps[i].name, name) == 0 )
+      return &_steps[i];
+  if ( _stepCount == SIM_MAX_STEPS )
+    return NULL;
+  SimStepStats *s = &_steps[_stepCount++];
+  memset(s, 0, sizeof(*s));
+  s->name = name;
+  return s;
+}
+
+//
+// SimProfileScope
+//
+
+SimProfileScope::SimProfileScope(ArduinoShim *dev, const char *name) : _dev(dev), _name(name)
+{
+  _heapStart = dev->heap.current;
+  _outerScopePeak = dev->heap.scopePeak;
+  dev->heap.scopePeak = dev->heap.current;
+  _waitStart = dev->clock.waitCycles;
+  _cpuStart = threadCpuNs();
+  _start = simCycles();
+}
+
+SimProfileScope::~SimProfileScope()
+{
+  u_int64_ard cycles = simCycles() - _start - (_dev->clock.waitCycles - _waitStart);
+  u_int64_ard cpu = threadCpuNs() - _cpuStart;
+  long peak = _dev->heap.scopePeak;
+  if ( _outerScopePeak > peak )
+    _dev->heap.scopePeak = _outerScopePeak;
+
+  SimStepStats *s = _dev->stepStats(_name);
+  if ( s == NULL )
+    return;
+  if ( s->count == 0 || cycles < s->minCycles )
+    s->minCycles = cycles;
+  if ( cycles > s->maxCycles )
+    s->maxCycles = cycles;
+  s->count++;
+  s->cycles += cycles;
+  s->cpuNs += cpu;
+  if ( peak - _heapStart > s->heapPeak )
+    s->heapPeak = peak - _heapStart;
+}
@@ -0,0 +1,191 @@
+/*
+ * File name: arduino_shim.h
+ * Date:      2026-10-19 16:35
+ * Author:
+ *
+ * The part of the Arduino core used by tsensor.pde, for the host simulator.
+ *
+ * The firmware is compiled as the body of a class derived from ArduinoShim
+ * (see tsensor_sim.cpp), so Serial, EEPROM, millis() and the rest resolve to
+ * members and every simulated device has its own. The serial port is a file
+ * descriptor, the master side of a pseudo-terminal or one end of a socket
+ * pair. It behaves like the pre 1.0 HardwareSerial: a 128 byte receive
+ * buffer, flush() discards received bytes and writes take the time the bytes
+ * need on the wire at the configured baud rate. Bytes the other side does not
+ * pick up are dropped, as on a UART with nothing attached.
+ *
+ * Time runs at a configurable multiple of real time, so a fleet can go
+ * through its sampling intervals faster. Delays, serial timeouts, the wire
+ * time and millis() all scale together.
+ *
+ * sleepUntil() stands in for the sleep of the MCU between deadlines. It
+ * returns early when a byte arrives, as the serial receive interrupt wakes
+ * the device, and counts the wakeups and the time asleep.
+ */
+
+#ifndef __ARDUINO_SHIM_H__
+#define __ARDUINO_SHIM_H__
+
+#include "tstypes.h"
+#include "edevdata.h"
+#include "sim_heap.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define HIGH 0x1
+#define LOW  0x0
+#define INPUT  0x0
+#define OUTPUT 0x1
+
+#define DEC 10
+#define HEX 16
+
+#define lowByte(w) ((uint8_t)((w) & 0xff))
+#define highByte(w) ((uint8_t)((w) >> 8))
+
+#define SIM_SERIAL_BUFFER 128   // The receive buffer of HardwareSerial
+#define SIM_PIN_COUNT     20    // Digital and analog pins of the Duemilanove
+#define SIM_RAM_SIZE      2048  // SRAM of the ATmega328
+
+/**
+ *  SimClock
+ *
+ *  Device time. Runs speed times faster than real time from when the
+ *  device is started.
+ */
+class SimClock
+{
+public:
+  SimClock();
+  void start(double speed);
+  unsigned long millis();
+  void sleep(double msec, int wakeFd = -1);  // Sleeps msec device time, or until wakeFd is readable
+  u_int64_ard waitCycles;     // Cycles spent in sleep(), see SimProfileScope
+private:
+  double _speed;
+  double _startMs;
+};
+
+class SimSerial
+{
+public:
+  SimSerial(SimClock *clock);
+  void attach(int fd);
+  void begin(long baud);
+  int available();
+  int read();
+  void flush();
+  void wait(double msec);     // Waits up to msec device time for received bytes
+  size_t write(uint8_t b);
+  size_t write(const uint8_t *buf, size_t len);
+  void print(const char *s);
+  void print(int val, int base = DEC);
+  long bytesIn;
+  long bytesOut;
+  long bytesDropped;
+private:
+  void fill();
+  SimClock *_clock;
+  int _fd;
+  long _baud;
+  uint8_t _rx[SIM_SERIAL_BUFFER];
+  int _head;
+  int _count;
+  bool _wrote;   // Nothing read since the last write
+};
+
+class SimEEPROM
+{
+public:
+  SimEEPROM();
+  uint8_t read(int address);
+  void write(int address, uint8_t value);
+  void provision(const byte_ard *id, const byte_ard *key);
+private:
+  uint8_t _mem[EEPROM_SIZE];
+};
+
+// Cost of one protocol step, over all the times it ran.
+struct SimStepStats
+{
+  const char *name;
+  long count;
+  u_int64_ard cycles;      // Sum of cycles, not counting waits
+  u_int64_ard minCycles;
+  u_int64_ard maxCycles;
+  u_int64_ard cpuNs;       // Sum of thread CPU time
+  long heapPeak;           // Most heap the step took on top of what was in use
+};
+
+#define SIM_MAX_STEPS 16
+
+class ArduinoShim
+{
+public:
+  ArduinoShim();
+  virtual ~ArduinoShim() {}
+
+  // Runs setup() and then loop() until *stop becomes true.
+  void run(double speed, volatile bool *stop);
+
+  SimStepStats* stepStats(const char *name);
+  int stepCount() const { return _stepCount; }
+  SimStepStats* step(int i) { return &_steps[i]; }
+  SimHeap heap;
+
+protected:
+  virtual void setup(void) = 0;
+  virtual void loop(void) = 0;
+
+public:
+  SimClock clock;
+  SimSerial Serial;
+  SimEEPROM EEPROM;
+
+  unsigned long millis();
+  void delay(unsigned long msec);
+  int analogRead(int pin);
+  void pinMode(int pin, int mode);
+  void digitalWrite(int pin, int value);
+  long random(long howbig);
+  long random(long howsmall, long howbig);
+  void randomSeed(unsigned int seed);
+  int freeMemory();
+  void sleepUntil(unsigned long deadline);
+
+  long wakeups;               // Returns from sleepUntil()
+  unsigned long sleptMs;      // Device time spent in sleepUntil()
+
+  int pins[SIM_PIN_COUNT];
+
+private:
+  unsigned int _rand;
+  SimStepStats _steps[SIM_MAX_STEPS];
+  int _stepCount;
+};
+
+/**
+ *  SimProfileScope
+ *
+ *  Measures one run of a protocol step, from construction to the end of the
+ *  enclosing block. Time the device spends waiting (delays and the serial
+ *  wire time) is left out of the cycles. Steps may nest.
+ */
+class SimProfileScope
+{
+public:
+  SimProfileScope(ArduinoShim *dev, const char *name);
+  ~SimProfileScope();
+private:
+  ArduinoShim *_dev;
+  const char *_name;
+  u_int64_ard _start;
+  u_int64_ard _waitStart;
+  u_int64_ard _cpuStart;
+  long _heapStart;
+  long _outerScopePeak;
+};
+
+u_int64_ard simCycles();
+
+#endif // __ARDUINO_SHIM_H__
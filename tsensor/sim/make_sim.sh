@@ -0,0 +1,13 @@
+#!/bin/sh
+# Builds tssim, the host simulator for the tsensor firmware. sim_malloc.h is
+# included into every source so the allocations of the firmware and the
+# library are accounted for.
+
+LIB=../../aes_crypt/lib
+
+g++ -Wall -O2 -D_INTEL_64 -include sim_malloc.h -I. -I.. -I$LIB \
+    tssim.cpp tsensor_sim.cpp arduino_shim.cpp sim_heap.cpp ../tsense_keypair.cpp \
+    $LIB/aes_crypt.cpp $LIB/aes_cmac.cpp $LIB/protocol.cpp $LIB/aes_constants.cpp \
+    $LIB/aes_batch.cpp $LIB/aes_bitslice.cpp $LIB/aes_gcm.cpp $LIB/payload_codec.cpp $LIB/msg_arena.cpp \
+    $LIB/serial_link.cpp \
+    -o tssim -lpthread
@@ -0,0 +1,87 @@
+/*
+ * File name: sim_heap.cpp
+ * Date:      2026-10-19 16:20
+ * Author:
+ */
+
+#include "sim_heap.h"
+#include <stdlib.h>
+#include <new>
+
+// This file is built with sim_malloc.h too; the real allocator is used here.
+#undef malloc
+#undef free
+
+__thread SimHeap* simCurrentHeap = NULL;
+
+// Room for the size in front of every block, keeping the alignment of malloc.
+#define SIM_BLOCK_HEADER 16
+
+void* simMalloc(size_t size)
+{
+  char* p = (char*)malloc(size + SIM_BLOCK_HEADER);
+  if ( p == NULL )
+    return NULL;
+  *(size_t*)p = size;
+
+  SimHeap* heap = simCurrentHeap;
+  if ( heap != NULL )
+  {
+    heap->current += size + SIM_MALLOC_OVERHEAD;
+    heap->allocs++;
+    if ( heap->current > heap->peak )
+      heap->peak = heap->current;
+    if ( heap->current > heap->scopePeak )
+      heap->scopePeak = heap->current;
+  }
+  return p + SIM_BLOCK_HEADER;
+}
+
+void simFree(void* ptr)
+{
+  if ( ptr == NULL )
+    return;
+  char* p = (char*)ptr - SIM_BLOCK_HEADER;
+
+  // Blocks are freed by the device that allocated them, except at teardown
+  // which runs on the main thread and is not charged.
+  SimHeap* heap = simCurrentHeap;
+  if ( heap != NULL )
+    heap->current -= *(size_t*)p + SIM_MALLOC_OVERHEAD;
+  free(p);
+}
+
+// new and delete go through the same accounting. The firmware allocates its
+// key pairs with new.
+void* operator new(size_t size)
+{
+  void* p = simMalloc(size);
+  if ( p == NULL )
+    throw std::bad_alloc();
+  return p;
+}
+
+void* operator new[](size_t size)
+{
+  return operator new(size);
+}
+
+void operator delete(void* ptr) throw()
+{
+  simFree(ptr);
+}
+
+void operator delete[](void* ptr) throw()
+{
+  simFree(ptr);
+}
+
+void operator delete(void* ptr, size_t) throw()
+{
+  simFree(ptr);
+}
+
+void operator delete[](void* ptr, size_t) throw()
+{
+  simFree(ptr);
+}
@@ -0,0 +1,38 @@
+/*
+ * File name: sim_heap.h
+ * Date:      2026-10-19 16:20
+ * Author:
+ *
+ * Heap accounting for the simulated sensors. All allocations made by the
+ * firmware and the crypto library go through simMalloc()/simFree() (see
+ * sim_malloc.h), which charge them to the heap of the device running on the
+ * calling thread, if any.
+ *
+ * The charge is the requested size plus the two byte block header of the
+ * avr-libc malloc, so current and peak are what the ATmega328 would see.
+ */
+
+#ifndef __SIM_HEAP_H__
+#define __SIM_HEAP_H__
+
+#include <stddef.h>
+
+// Per allocation overhead of the avr-libc malloc (the block length).
+#define SIM_MALLOC_OVERHEAD 2
+
+struct SimHeap
+{
+  long current;      // Bytes in use
+  long peak;         // High-water mark of current
+  long scopePeak;    // High-water mark since the innermost profile scope began
+  long allocs;       // Number of allocations
+};
+
+// The heap charged by allocations on this thread. NULL for threads which are
+// not running a device.
+extern __thread SimHeap* simCurrentHeap;
+
+void* simMalloc(size_t size);
+void simFree(void* ptr);
+
+#endif // __SIM_HEAP_H__
@@ -0,0 +1,20 @@
+/*
+ * File name: sim_malloc.h
+ * Date:      2026-10-19 16:20
+ * Author:
+ *
+ * Force included (g++ -include) into every source of the simulator, so the
+ * malloc() and free() calls of the firmware and the library are accounted
+ * for. See sim_heap.h.
+ */
+
+#ifndef __SIM_MALLOC_H__
+#define __SIM_MALLOC_H__
+
+#include <stdlib.h>
+#include "sim_heap.h"
+
+#define malloc(size) simMalloc(size)
+#define free(ptr) simFree(ptr)
+
+#endif // __SIM_MALLOC_H__
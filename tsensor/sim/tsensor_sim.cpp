@@ -0,0 +1,53 @@
+/*
+ * File name: tsensor_sim.cpp
+ * Date:      2026-10-19 16:50
+ * Author:
+ *
+ * Builds the firmware as the body of the TSensorSim class, so its globals
+ * are members and each simulated device has its own. The function local
+ * statics are thread local; every device runs on its own thread.
+ *
+ * All headers the firmware includes are included here first, so that the
+ * includes in the class body are empty.
+ */
+
+#include <EEPROM.h>
+#include <stdlib.h>
+#include <string.h>
+#include "aes_cmac.h"
+#include "aes_crypt.h"
+#include "protocol.h"
+#include "payload_codec.h"
+#include "serial_link.h"
+#include "tstypes.h"
+#include "edevdata.h"
+#include "devinfo.h"
+#include "memoryFree.h"
+#include "tsense_keypair.h"
+#include "aes_constants.h"
+#include "tsensor_sim.h"
+
+#define FW_STATIC static __thread
+#define FW_PROFILE(step) SimProfileScope fwProfileScope(this, step)
+
+class TSensorSim : public ArduinoShim
+{
+public:
+  ~TSensorSim()
+  {
+    delete sessionKeys;
+    delete transportKeys;
+    free(measBuffer);
+  }
+
+#include "../tsensor.pde"
+};
+
+ArduinoShim* newTSensor(const byte_ard *id, const byte_ard *key)
+{
+  // Value initialized, so the firmware state starts out zeroed like the
+  // globals on the device.
+  TSensorSim *dev = new TSensorSim();
+  dev->EEPROM.provision(id, key);
+  return dev;
+}
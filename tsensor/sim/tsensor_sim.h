@@ -0,0 +1,18 @@
+/*
+ * File name: tsensor_sim.h
+ * Date:      2026-10-19 16:50
+ * Author:
+ *
+ * A simulated tsensor: the firmware of ../tsensor.pde on the Arduino shim.
+ */
+
+#ifndef __TSENSOR_SIM_H__
+#define __TSENSOR_SIM_H__
+
+#include "arduino_shim.h"
+
+// Creates a device with the given public id and master key burned into its
+// EEPROM. Attach the serial port and run() it on a thread of its own.
+ArduinoShim* newTSensor(const byte_ard *id, const byte_ard *key);
+
+#endif // __TSENSOR_SIM_H__
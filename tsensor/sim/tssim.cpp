@@ -0,0 +1,901 @@
+/*
+ * File name: tssim.cpp
+ * Date:      2026-10-19 17:10
+ * Author:
+ *
+ * Host simulator for the tsensor firmware. Runs any number of simulated
+ * devices in one process, each on a thread of its own, executing the
+ * firmware of ../tsensor.pde against the shim in arduino_shim.h.
+ *
+ * By default every device gets a pseudo-terminal and the path of its slave
+ * side is printed. Point a client (tsclient, or anything else which talks to
+ * a sensor over a serial port) at it and the device behaves like one on a
+ * USB port, down to the 9600 baud wire time. The fleet can thus be run
+ * against the real auth and sink servers, with the devices' IDs and keys
+ * from a keystore file (see cliprot -p and tsauthd --keystore).
+ *
+ * With -l the devices are driven in-process over socket pairs instead: a
+ * host thread per device plays client, auth server and sink, runs the device
+ * through the key exchange and verifies the data it sends. With -f it first
+ * switches the line to the framed link of serial_link.h at the given rate,
+ * and -e then corrupts that share of the bytes on the line in both
+ * directions, which the link has to recover from. With -a the devices sample
+ * adaptively: a sample is kept only when it moved past the deadband, and a
+ * data message goes out when the buffer is full or the device has been
+ * silent for the given time. The test counters of the firmware step by one
+ * per sample, so a deadband of n keeps every n+1st sample. The record times
+ * the messages then carry are checked to be in order, and the mean time
+ * between the samples kept is reported.
+ *
+ * On exit the cost of every protocol step on the device is reported: the
+ * cycles it took (waits for the serial line and delays left out), thread
+ * CPU time and the heap it needed on top of what was already in use. Heap
+ * sizes count the avr-libc block header, so they are what the ATmega328
+ * would need; the cycles are host cycles and only good for comparing steps
+ * and versions of the firmware. The share of device time the firmware
+ * spent asleep, and how often it woke up, show its duty cycle.
+ *
+ * Usage: tssim [-n devices] [-k keystore] [-x speed] [-t seconds]
+ *              [-l [-d data messages] [-b samples] [-i interval]
+ *                  [-f baud [-e error rate]]
+ *                  [-a deadband,silence,max interval]]
+ */
+
+#ifndef _XOPEN_SOURCE
+  #define _XOPEN_SOURCE 600  // posix_openpt()
+#endif
+#ifndef _DEFAULT_SOURCE
+  #define _DEFAULT_SOURCE    // cfmakeraw()
+#endif
+
+#include "tsensor_sim.h"
+#include "tsense_keypair.h"
+#include "aes_constants.h"
+#include "protocol.h"
+#include "payload_codec.h"
+#include "serial_link.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <termios.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+// The firmware command codes used by the host. See tsensor.pde.
+#define FW_ACK                     0x4F
+#define FW_GET_ID_Q                0x40
+#define FW_SET_SAMPLE_INTERVAL_CMD 0x75
+#define FW_SET_SAMPLE_BUF_SIZE_CMD 0x76
+#define FW_SET_DEADBAND_CMD        0x78
+#define FW_SET_ADAPTIVE_CMD        0x79
+
+#define MAX_DEVICES 1024
+
+extern byte_ard IV[];  // protocol.cpp
+
+// One simulated device and the host side of its serial line.
+struct simdevice
+{
+  ArduinoShim *dev;
+  byte_ard id[ID_SIZE];
+  byte_ard key[KEY_BYTES];
+  int hostFd;       // Loopback: the host end of the socket pair
+  int slaveFd;      // Pty: kept open, so the master does not see a hangup
+  char ptyName[64];
+  pthread_t devThread;
+  pthread_t hostThread;
+  unsigned int rnd;
+  long sessions;
+  long dataOk;
+  long dataBad;
+  long dataPacked;  // Valid data messages with a packed payload
+  long records;     // Samples per interface in the valid ones
+  long timedGaps;   // Adaptive sampling: seconds between the records of a message, summed
+  long timedPairs;  // and the record pairs they are over
+  long oldestRecord;  // The most seconds a record was sampled before its message
+  long failures;
+  // Loopback on the framed link
+  bool framed;
+  serial_link link;
+  byte_ard in[1024];  // Payload received, not read yet
+  int inLen;
+  int inPos;
+  u_int32_ard lastTx; // Device time of the last frame sent
+  unsigned int errRnd;
+  long lineErrors;    // Bytes corrupted
+};
+
+// Settings, fixed before the devices start.
+int deviceCount = 1;
+double speed = 1.0;
+int seconds = 0;
+bool loopback = false;
+int dataCount = 0;
+int bufSize = 0;
+int interval = 0;
+int deadband = 0;    // Adaptive sampling with -a, off while silence is 0
+int silence = 0;
+int maxInterval = 0;
+int linkCode = -1;   // LINK_BAUD_ code asked for with -f
+double errorRate = 0;
+
+volatile bool stop = false;
+simdevice *devices;
+
+double now()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+void onSignal(int sig)
+{
+  stop = true;
+}
+
+/**
+ *  loadKeystore
+ *
+ *  Reads the IDs and keys of the devices from a keystore file in the format
+ *  of tsauthd --keystore, one device per line. Returns the number read.
+ */
+int loadKeystore(const char *path)
+{
+  FILE *f = fopen(path, "r");
+  if ( f == NULL )
+  {
+    perror(path);
+    return -1;
+  }
+  char line[256];
+  int n = 0;
+  while ( n < deviceCount && fgets(line, sizeof(line), f) != NULL )
+  {
+    char szId[64], szKey[64];
+    unsigned int b;
+    int fields = sscanf(line, "%63s %63s", szId, szKey);
+    if ( fields < 1 || szId[0] == '#' )
+      continue;
+    if ( fields != 2 || strlen(szId) != ID_SIZE*2 || strlen(szKey) != KEY_BYTES*2 )
+    {
+      fprintf(stderr, "%s: malformed line %s", path, line);
+      fclose(f);
+      return -1;
+    }
+    for ( int i = 0; i < ID_SIZE; i++ )
+    {
+      sscanf(szId + 2*i, "%2x", &b);
+      devices[n].id[i] = b;
+    }
+    for ( int i = 0; i < KEY_BYTES; i++ )
+    {
+      sscanf(szKey + 2*i, "%2x", &b);
+      devices[n].key[i] = b;
+    }
+    n++;
+  }
+  fclose(f);
+  return n;
+}
+
+/**
+ *  openPty
+ *
+ *  Creates a raw pseudo-terminal for a device. Returns the master side.
+ */
+int openPty(simdevice *d)
+{
+  int master = posix_openpt(O_RDWR | O_NOCTTY);
+  if ( master < 0 || grantpt(master) != 0 || unlockpt(master) != 0 )
+    return -1;
+  snprintf(d->ptyName, sizeof(d->ptyName), "%s", ptsname(master));
+  d->slaveFd = open(d->ptyName, O_RDWR | O_NOCTTY);
+  if ( d->slaveFd < 0 )
+    return -1;
+  termios tio;
+  tcgetattr(d->slaveFd, &tio);
+  cfmakeraw(&tio);
+  cfsetspeed(&tio, B9600);
+  tcsetattr(d->slaveFd, TCSANOW, &tio);
+  return master;
+}
+
+//
+// The loopback host
+//
+
+/**
+ *  corrupt
+ *
+ *  Flips a bit in errorRate of the bytes, on the framed line only.
+ */
+void corrupt(simdevice *d, byte_ard *buf, int len)
+{
+  if ( !d->framed || errorRate <= 0 )
+    return;
+  for ( int i = 0; i < len; i++ )
+  {
+    if ( rand_r(&d->errRnd) < errorRate * RAND_MAX )
+    {
+      buf[i] ^= 1 << (rand_r(&d->errRnd) % 8);
+      d->lineErrors++;
+    }
+  }
+}
+
+// Device time in msec, the clock the link on both ends runs on.
+u_int32_ard deviceMs()
+{
+  return (u_int32_ard)(now() * 1000.0 * speed);
+}
+
+void writeFrame(simdevice *d, byte_ard ctl, byte_ard seq, const byte_ard *payload, int len)
+{
+  byte_ard frame[LINK_FRAME_MAX];
+  int n = link_encode_frame(ctl, seq, payload, len, frame);
+  corrupt(d, frame, n);
+  write(d->hostFd, frame, n);
+  d->lastTx = deviceMs();
+}
+
+/**
+ *  pumpLink
+ *
+ *  Serves the framed line for up to timeout msec: takes the frames from the
+ *  device, acknowledges data frames and collects their payload in d->in,
+ *  and sends the data frames that are due. Returns false if the line
+ *  closed.
+ */
+bool pumpLink(simdevice *d, int timeout)
+{
+  pollfd pfd = { d->hostFd, POLLIN, 0 };
+  if ( poll(&pfd, 1, timeout) > 0 )
+  {
+    byte_ard buf[256];
+    ssize_t n = read(d->hostFd, buf, sizeof(buf));
+    if ( n <= 0 )
+      return false;
+    corrupt(d, buf, n);
+    for ( ssize_t i = 0; i < n; i++ )
+    {
+      if ( link_rx_byte(&d->link, buf[i]) != LINK_RX_FRAME )
+        continue;
+      if ( d->link.rxCtl != LINK_CTL_DATA )
+      {
+        link_control(&d->link);
+        continue;
+      }
+      link_accept(&d->link);
+      const byte_ard *payload;
+      u_int16_ard len;
+      while ( (payload = link_deliver(&d->link, &len)) != NULL )
+      {
+        if ( d->inPos > 0 )
+        {
+          memmove(d->in, d->in + d->inPos, d->inLen - d->inPos);
+          d->inLen -= d->inPos;
+          d->inPos = 0;
+        }
+        if ( d->inLen + len > (int)sizeof(d->in) )
+          return false;
+        memcpy(d->in + d->inLen, payload, len);
+        d->inLen += len;
+      }
+      byte_ard ctl, seq;
+      link_reply(&d->link, &ctl, &seq);
+      writeFrame(d, ctl, seq, NULL, 0);
+    }
+  }
+
+  u_int32_ard t = deviceMs();
+  link_slot *slot;
+  while ( (slot = link_due(&d->link, t)) != NULL )
+    writeFrame(d, LINK_CTL_DATA, slot->seq, slot->data, slot->len);
+  if ( t - d->lastTx > LINK_KEEPALIVE_MS )
+    writeFrame(d, LINK_CTL_ACK, d->link.rxSeq - 1, NULL, 0);
+  return true;
+}
+
+/**
+ *  recvBytes
+ *
+ *  Reads exactly len bytes from the device within timeout msec. Returns
+ *  false on a timeout, a closed line or when the simulator stops.
+ */
+bool recvBytes(simdevice *d, byte_ard *buf, int len, int timeout)
+{
+  double deadline = now() + timeout/1000.0;
+  int pos = 0;
+  while ( pos < len )
+  {
+    if ( stop || now() > deadline )
+      return false;
+    if ( d->framed )
+    {
+      int n = d->inLen - d->inPos;
+      if ( n == 0 )
+      {
+        if ( !pumpLink(d, 10) )
+          return false;
+        continue;
+      }
+      if ( n > len - pos )
+        n = len - pos;
+      memcpy(buf + pos, d->in + d->inPos, n);
+      d->inPos += n;
+      pos += n;
+      continue;
+    }
+    pollfd pfd = { d->hostFd, POLLIN, 0 };
+    if ( poll(&pfd, 1, 100) <= 0 )
+      continue;
+    ssize_t n = read(d->hostFd, buf + pos, len - pos);
+    if ( n <= 0 )
+      return false;
+    pos += n;
+  }
+  return true;
+}
+
+/**
+ *  sendBytes
+ *
+ *  Writes to the device, on the framed line in frames of at most LINK_MTU
+ *  bytes as the window allows.
+ */
+bool sendBytes(simdevice *d, const byte_ard *buf, int len)
+{
+  if ( !d->framed )
+    return write(d->hostFd, buf, len) == len;
+  while ( len > 0 )
+  {
+    int n = len < LINK_MTU ? len : LINK_MTU;
+    while ( !link_queue(&d->link, buf, n) )
+    {
+      if ( stop || !pumpLink(d, 10) )
+        return false;
+    }
+    buf += n;
+    len -= n;
+  }
+  return pumpLink(d, 0);
+}
+
+// Time the device needs to put len bytes on the wire, plus a margin, in
+// real msec.
+int wireTimeout(int len)
+{
+  return (int)(len*10*1000.0/9600/speed) + 1000;
+}
+
+/**
+ *  recvAck
+ *
+ *  Waits for an ACK from the device and returns its code, or -1. Data
+ *  messages sent before the device saw the last command are skipped.
+ */
+int recvAck(simdevice *d, int timeout)
+{
+  byte_ard buf[2+ID_SIZE+256+BLOCK_BYTE_SIZE];
+  for ( ;; )
+  {
+    if ( !recvBytes(d, buf, 1, timeout) )
+      return -1;
+    if ( buf[0] == FW_ACK )
+      return recvBytes(d, buf, 1, timeout) ? buf[0] : -1;
+    if ( (buf[0] & ~MSG_T_DATA_FLAGS) != MSG_T_DATA_SEND || !recvBytes(d, buf+1, 1, timeout) ||
+         !recvBytes(d, buf+2, ID_SIZE+buf[1]+BLOCK_BYTE_SIZE, timeout) )
+      return -1;
+  }
+}
+
+/**
+ *  runSession
+ *
+ *  Runs the device through one key exchange and then receives and verifies
+ *  its data, dataCount messages or until the simulator stops. Returns false
+ *  if the device does not follow the protocol.
+ */
+bool runSession(simdevice *d)
+{
+  int timeout = wireTimeout(256);
+
+  // Device id query and the idresponse, checked with the master key as the
+  // auth server does.
+  byte_ard cmd = FW_GET_ID_Q;
+  byte_ard idBuf[IDMSG_FULLSIZE];
+  if ( !sendBytes(d, &cmd, 1) || !recvBytes(d, idBuf, IDMSG_FULLSIZE, timeout) ||
+       idBuf[0] != MSG_T_GET_ID_R )
+    return false;
+  TSenseKeyPair masterKeys(d->key, &cAlphaKey);
+  byte_ard rID[ID_SIZE+1];
+  byte_ard idCipher[IDMSG_CRYPTSIZE];
+  message idMsg;
+  idMsg.pID = rID;
+  idMsg.ciphertext = idCipher;
+  unpack_idresponse(idBuf, (const u_int32_ard*)masterKeys.getCryptoKeySched(), &idMsg);
+  if ( !verifyAesCMac((const u_int32_ard*)masterKeys.getMacKeySched(), idCipher,
+                      IDMSG_CRYPTSIZE, idMsg.cmac) ||
+       memcmp(rID, d->id, ID_SIZE) != 0 )
+    return false;
+
+  // Session key K_ST to the device in a keytosense message. The auth server
+  // encrypts nonce, key and timer under the master key.
+  byte_ard sessionKey[KEY_BYTES];
+  for ( int i = 0; i < KEY_BYTES; i++ )
+    sessionKey[i] = rand_r(&d->rnd);
+  byte_ard plain[NONCE_SIZE+KEY_BYTES+TIMER_SIZE];
+  memset(plain, 0, sizeof(plain));
+  plain[0] = idMsg.nonce & 0xFF;
+  plain[1] = idMsg.nonce >> 8;
+  memcpy(plain+NONCE_SIZE, sessionKey, KEY_BYTES);
+  byte_ard ktsBuf[KEYTOSENS_FULLSIZE];
+  ktsBuf[0] = MSG_T_KEY_TO_SENSE;
+  CBCEncrypt(plain, ktsBuf+MSGTYPE_SIZE, sizeof(plain), AUTOPAD,
+             (const u_int32_ard*)masterKeys.getCryptoKeySched(), (const u_int16_ard*)IV);
+  aesCMac((const u_int32_ard*)masterKeys.getMacKeySched(), ktsBuf+MSGTYPE_SIZE,
+          KEYTOSINK_CRYPTSIZE, ktsBuf+MSGTYPE_SIZE+KEYTOSINK_CRYPTSIZE);
+  if ( !sendBytes(d, ktsBuf, KEYTOSENS_FULLSIZE) || recvAck(d, timeout) != 0 )
+    return false;
+
+  // The device follows up with a rekey handshake, answered by the sink with
+  // the random R for the transport key.
+  byte_ard rkBuf[REKEY_FULLSIZE];
+  if ( !recvBytes(d, rkBuf, REKEY_FULLSIZE, timeout) || rkBuf[0] != MSG_T_REKEY_HANDSHAKE )
+    return false;
+  TSenseKeyPair sessionKeys(sessionKey, &cBetaKey);
+  byte_ard rkID[ID_SIZE+1];
+  byte_ard rkCipher[REKEY_CRYPTSIZE];
+  message rkMsg;
+  rkMsg.pID = rkID;
+  rkMsg.ciphertext = rkCipher;
+  unpack_rekey(rkBuf, (const u_int32_ard*)sessionKeys.getCryptoKeySched(), &rkMsg);
+  if ( !verifyAesCMac((const u_int32_ard*)sessionKeys.getMacKeySched(), rkCipher,
+                      REKEY_CRYPTSIZE, rkMsg.cmac) ||
+       memcmp(rkID, d->id, ID_SIZE) != 0 )
+    return false;
+
+  message nkMsg;
+  nkMsg.pID = d->id;
+  nkMsg.nonce = rkMsg.nonce;
+  nkMsg.renewal_timer = 0;
+  for ( int i = 0; i < KEY_BYTES; i++ )
+    nkMsg.rand[i] = rand_r(&d->rnd);
+  byte_ard nkBuf[NEWKEY_FULLSIZE];
+  pack_newkey(&nkMsg, (const u_int32_ard*)sessionKeys.getCryptoKeySched(),
+              (const u_int32_ard*)sessionKeys.getMacKeySched(), nkBuf);
+  if ( !sendBytes(d, nkBuf, NEWKEY_FULLSIZE) || recvAck(d, timeout) != 0 )
+    return false;
+
+  // K_STe = CMAC(gamma, R), as the device derives it.
+  byte_ard transportKey[KEY_BYTES];
+  deriveKey(&cGammaKey, nkMsg.rand, transportKey);
+  TSenseKeyPair transportKeys(transportKey, &cEpsilonKey);
+
+  // Data. One message per buffer full of samples, a second apart each.
+  int samples = bufSize > 0 ? bufSize : 10;
+  int dataTimeout = (int)(samples * (interval > 0 ? interval : 1) * 1000 / speed) + timeout;
+  if ( silence > 0 )
+    dataTimeout += (int)(silence * 1000 / speed);
+  for ( int n = 0; (dataCount == 0 || n < dataCount) && !stop; n++ )
+  {
+    byte_ard buf[2+ID_SIZE+256+BLOCK_BYTE_SIZE];
+    if ( !recvBytes(d, buf, 2, dataTimeout) )
+      return stop;
+    if ( (buf[0] & ~MSG_T_DATA_FLAGS) != MSG_T_DATA_SEND ||
+         !recvBytes(d, buf+2, ID_SIZE+buf[1]+BLOCK_BYTE_SIZE, timeout) )
+      return false;
+
+    data msg;
+    int records = 0;
+    unpack_data(buf, (const u_int32_ard*)transportKeys.getCryptoKeySched(), &msg);
+    bool valid = verifyAesCMac((const u_int32_ard*)transportKeys.getMacKeySched(),
+                               msg.ciphertext, msg.cipher_len, msg.cmac) &&
+                 memcmp(msg.id, d->id, ID_SIZE) == 0;
+
+    // Adaptive sampling times the records, oldest first, and they are sampled in order
+    const byte_ard *samplesAt = msg.data;
+    u_int16_ard samplesLen = msg.data_len;
+    int timed = -1;
+    if ( valid && (msg.msgtype & MSG_T_DATA_TIMED_FLAG) )
+    {
+      timed = payload_times(msg.data, msg.data_len);
+      valid = silence > 0 && timed > 0;
+      for ( int i = 1; valid && i < timed; i++ )
+        valid = payload_time_offset(msg.data, i) <= payload_time_offset(msg.data, i-1);
+      if ( valid )
+      {
+        samplesAt += PAYLOAD_TIMES_SIZE(timed);
+        samplesLen -= PAYLOAD_TIMES_SIZE(timed);
+        d->timedGaps += payload_time_offset(msg.data, 0) - payload_time_offset(msg.data, timed-1);
+        d->timedPairs += timed - 1;
+        if ( payload_time_offset(msg.data, 0) > d->oldestRecord )
+          d->oldestRecord = payload_time_offset(msg.data, 0);
+      }
+    }
+    else if ( valid )
+      valid = silence == 0;
+
+    if ( valid && (msg.msgtype & MSG_T_DATA_PACKED_FLAG) )
+    {
+      payload pl;
+      valid = unpack_payload(samplesAt, samplesLen, &pl) == PAYLOAD_VALID;
+      if ( valid )
+      {
+        // Adaptive sampling sends what it has when the device was silent too long
+        records = pl.records;
+        valid = pl.icnt == 2 && (pl.records == samples || (silence > 0 && pl.records < samples));
+        free(pl.values);
+        d->dataPacked++;
+      }
+    }
+    else if ( valid )
+    {
+      records = samplesLen / 2;
+      valid = samplesLen == samples*2 ||
+              (silence > 0 && samplesLen % 2 == 0 && samplesLen > 0 && records < samples);
+    }
+    if ( timed >= 0 && timed != records )
+      valid = false;
+    if ( valid )
+    {
+      d->dataOk++;
+      d->records += records;
+    }
+    else
+      d->dataBad++;
+    free(msg.ciphertext);
+    free(msg.data);
+  }
+
+  cmd = MSG_T_FINISH;
+  if ( !sendBytes(d, &cmd, 1) || recvAck(d, timeout) != 0 )
+    return stop;
+  d->sessions++;
+  return true;
+}
+
+void* hostMain(void *arg)
+{
+  simdevice *d = (simdevice*)arg;
+  int timeout = wireTimeout(256);
+  byte_ard cmd[2];
+
+  // Give the device the time setup() takes.
+  usleep((useconds_t)(1100000 / speed));
+
+  if ( linkCode >= 0 )
+  {
+    // The answer still comes raw, then both ends switch and the host
+    // confirms with a frame.
+    cmd[0] = LINK_START_CMD;
+    cmd[1] = linkCode;
+    byte_ard resp[LINK_START_R_SIZE];
+    if ( !sendBytes(d, cmd, 2) || !recvBytes(d, resp, LINK_START_R_SIZE, timeout) ||
+         resp[0] != LINK_START_R || link_baud(resp[1]) == 0 )
+    {
+      d->failures++;
+      return NULL;
+    }
+    d->framed = true;
+    link_init(&d->link, link_baud(resp[1]));
+    writeFrame(d, LINK_CTL_ACK, d->link.rxSeq - 1, NULL, 0);
+  }
+
+  if ( bufSize > 0 )
+  {
+    cmd[0] = FW_SET_SAMPLE_BUF_SIZE_CMD;
+    cmd[1] = bufSize;
+    if ( !sendBytes(d, cmd, 2) || recvAck(d, timeout) != 0 )
+      d->failures++;
+  }
+  if ( interval > 0 )
+  {
+    cmd[0] = FW_SET_SAMPLE_INTERVAL_CMD;
+    cmd[1] = interval;
+    if ( !sendBytes(d, cmd, 2) || recvAck(d, timeout) != 0 )
+      d->failures++;
+  }
+  if ( silence > 0 )
+  {
+    byte_ard adapt[4] = { FW_SET_DEADBAND_CMD, (byte_ard)deadband, (byte_ard)deadband };
+    if ( !sendBytes(d, adapt, 3) || recvAck(d, timeout) != 0 )
+      d->failures++;
+    adapt[0] = FW_SET_ADAPTIVE_CMD;
+    adapt[1] = silence & 0xFF;
+    adapt[2] = silence >> 8;
+    adapt[3] = maxInterval;
+    if ( !sendBytes(d, adapt, 4) || recvAck(d, timeout) != 0 )
+      d->failures++;
+  }
+
+  while ( !stop )
+  {
+    if ( runSession(d) )
+      continue;
+    // Out of step with the device. Let it time out its protocol state, drop
+    // what it sent and start over.
+    d->failures++;
+    byte_ard junk[256];
+    usleep((useconds_t)(1000000 / speed));
+    while ( recvBytes(d, junk, 1, 100) )
+      ;
+    cmd[0] = MSG_T_FINISH;
+    sendBytes(d, cmd, 1);
+    recvAck(d, timeout);
+  }
+  return NULL;
+}
+
+void* deviceMain(void *arg)
+{
+  simdevice *d = (simdevice*)arg;
+  d->dev->run(speed, &stop);
+  return NULL;
+}
+
+/**
+ *  report
+ *
+ *  Prints the cost of each protocol step over all devices, the heap high
+ *  water marks and what went over the serial lines.
+ */
+void report(double elapsed)
+{
+  printf("\nDevices:     %d, %.1f s (%.0f s device time)\n", deviceCount, elapsed,
+         elapsed*speed);
+
+  printf("\n%-12s %8s %12s %12s %12s %10s %10s\n", "step", "count", "cycles",
+         "min", "max", "cpu us", "heap");
+  ArduinoShim *first = devices[0].dev;
+  for ( int s = 0; s < first->stepCount(); s++ )
+  {
+    const char *name = first->step(s)->name;
+    long count = 0, heapPeak = 0;
+    u_int64_ard cycles = 0, cpuNs = 0, minCycles = 0, maxCycles = 0;
+    for ( int i = 0; i < deviceCount; i++ )
+    {
+      SimStepStats *st = devices[i].dev->stepStats(name);
+      if ( st == NULL || st->count == 0 )
+        continue;
+      if ( count == 0 || st->minCycles < minCycles )
+        minCycles = st->minCycles;
+      if ( st->maxCycles > maxCycles )
+        maxCycles = st->maxCycles;
+      if ( st->heapPeak > heapPeak )
+        heapPeak = st->heapPeak;
+      count += st->count;
+      cycles += st->cycles;
+      cpuNs += st->cpuNs;
+    }
+    if ( count == 0 )
+      continue;
+    printf("%-12s %8ld %12llu %12llu %12llu %10.1f %10ld\n", name, count,
+           (unsigned long long)(cycles/count), (unsigned long long)minCycles,
+           (unsigned long long)maxCycles, cpuNs/1000.0/count, heapPeak);
+  }
+
+  long heapPeak = 0, heapSum = 0, allocs = 0, in = 0, out = 0, dropped = 0, wakeups = 0;
+  double slept = 0;
+  for ( int i = 0; i < deviceCount; i++ )
+  {
+    ArduinoShim *dev = devices[i].dev;
+    if ( dev->heap.peak > heapPeak )
+      heapPeak = dev->heap.peak;
+    heapSum += dev->heap.peak;
+    allocs += dev->heap.allocs;
+    in += dev->Serial.bytesIn;
+    out += dev->Serial.bytesOut;
+    dropped += dev->Serial.bytesDropped;
+    wakeups += dev->wakeups;
+    slept += dev->sleptMs;
+  }
+  printf("\nHeap peak:   %ld bytes (mean %ld), %ld allocations\n", heapPeak,
+         heapSum/deviceCount, allocs);
+  printf("Serial:      %ld bytes in, %ld out, %ld dropped\n", in, out, dropped);
+  double deviceMs = elapsed*speed*1000.0*deviceCount;
+  if ( deviceMs > 0 )
+    printf("Sleep:       %.1f%% of device time, %.2f wakeups per device second\n",
+           100.0*slept/deviceMs, wakeups*1000.0/deviceMs);
+
+  if ( loopback )
+  {
+    long sessions = 0, ok = 0, bad = 0, packed = 0, failures = 0, records = 0;
+    long gaps = 0, pairs = 0, oldest = 0;
+    for ( int i = 0; i < deviceCount; i++ )
+    {
+      gaps += devices[i].timedGaps;
+      pairs += devices[i].timedPairs;
+      if ( devices[i].oldestRecord > oldest )
+        oldest = devices[i].oldestRecord;
+      sessions += devices[i].sessions;
+      ok += devices[i].dataOk;
+      bad += devices[i].dataBad;
+      packed += devices[i].dataPacked;
+      failures += devices[i].failures;
+      records += devices[i].records;
+    }
+    printf("Sessions:    %ld completed, %ld failed\n", sessions, failures);
+    printf("Data:        %ld valid (%ld packed), %ld invalid\n", ok, packed, bad);
+    if ( ok > 0 )
+      printf("Samples:     %ld sent, %.1f per message\n", records, (double)records/ok);
+    if ( silence > 0 && ok > 0 )
+      printf("Times:       %.1f s between samples kept, the oldest %ld s before its message\n",
+             pairs > 0 ? (double)gaps/pairs : 0.0, oldest);
+    if ( linkCode >= 0 )
+    {
+      long errors = 0, crc = 0, resent = 0, drops = 0;
+      for ( int i = 0; i < deviceCount; i++ )
+      {
+        errors += devices[i].lineErrors;
+        crc += devices[i].link.crcErrors;
+        resent += devices[i].link.retransmits;
+        drops += devices[i].link.drops;
+      }
+      printf("Link:        %ld baud, %ld bytes corrupted, %ld bad frames from the devices,\n"
+             "             %ld frames resent and %ld given up by the hosts\n",
+             link_baud(linkCode), errors, crc, resent, drops);
+    }
+  }
+}
+
+void usage()
+{
+  fprintf(stderr, "Usage: tssim [options]\n\n");
+  fprintf(stderr, "    -n  Number of devices, at most %d (1)\n", MAX_DEVICES);
+  fprintf(stderr, "    -k  Keystore with the device IDs and keys, one line per\n");
+  fprintf(stderr, "        device. Without it all devices are 00010000000A.\n");
+  fprintf(stderr, "    -x  Speed of device time relative to real time (1)\n");
+  fprintf(stderr, "    -t  Seconds to run, 0 until interrupted (0)\n");
+  fprintf(stderr, "    -l  Drive the devices in-process instead of over ptys\n");
+  fprintf(stderr, "    -d  Loopback: data messages per session, 0 for no limit (0)\n");
+  fprintf(stderr, "    -b  Loopback: samples per data message (firmware default)\n");
+  fprintf(stderr, "    -i  Loopback: sampling interval in seconds (firmware default)\n");
+  fprintf(stderr, "    -f  Loopback: switch to the framed link at this baud rate\n");
+  fprintf(stderr, "    -e  Loopback, framed: share of the bytes corrupted on the line (0)\n");
+  fprintf(stderr, "    -a  Loopback: adaptive sampling with this deadband for both\n");
+  fprintf(stderr, "        interfaces, longest silence and widest sampling interval\n");
+  fprintf(stderr, "        in seconds, e.g. -a 4,60,8\n");
+}
+
+int main(int argc, char *argv[])
+{
+  const char *keystorePath = NULL;
+  int c;
+
+  long baud = 0;
+  while ( (c = getopt(argc, argv, "n:k:x:t:ld:b:i:f:e:a:h")) != -1 )
+  {
+    switch ( c )
+    {
+      case 'n': deviceCount = atoi(optarg); break;
+      case 'k': keystorePath = optarg; break;
+      case 'x': speed = atof(optarg); break;
+      case 't': seconds = atoi(optarg); break;
+      case 'l': loopback = true; break;
+      case 'd': dataCount = atoi(optarg); break;
+      case 'b': bufSize = atoi(optarg); break;
+      case 'i': interval = atoi(optarg); break;
+      case 'f': baud = atol(optarg); break;
+      case 'e': errorRate = atof(optarg); break;
+      case 'a':
+        if ( sscanf(optarg, "%d,%d,%d", &deadband, &silence, &maxInterval) != 3 || silence <= 0 )
+          silence = -1;
+        break;
+      default:
+        usage();
+        return -1;
+    }
+  }
+  for ( int i = 0; i < LINK_BAUD_CODES; i++ )
+    if ( link_baud(i) == baud )
+      linkCode = i;
+  // The firmware takes the data length in one byte, two bytes per sample.
+  if ( deviceCount < 1 || deviceCount > MAX_DEVICES || speed <= 0 || seconds < 0 ||
+       dataCount < 0 || bufSize < 0 || bufSize > 100 || interval < 0 || interval > 255 ||
+       silence < 0 || silence > 65535 || deadband < 0 || deadband > 255 ||
+       maxInterval < 0 || maxInterval > 255 || (silence > 0 && !loopback) ||
+       (baud != 0 && (linkCode < 0 || !loopback)) || errorRate < 0 || errorRate >= 1 ||
+       (errorRate > 0 && linkCode < 0) )
+  {
+    usage();
+    return -1;
+  }
+
+  devices = new simdevice[deviceCount];
+  memset(devices, 0, sizeof(simdevice)*deviceCount);
+  if ( keystorePath != NULL )
+  {
+    int n = loadKeystore(keystorePath);
+    if ( n < 0 )
+      return -1;
+    if ( n < deviceCount )
+    {
+      fprintf(stderr, "%s: keys for %d devices only\n", keystorePath, n);
+      return -1;
+    }
+  }
+  else
+  {
+    byte_ard id[] = { 0x00, 0x01, 0x00, 0x00, 0x00, 0x0A };
+    byte_ard key[] = { 0x0c, 0xbb, 0x0a, 0x6f, 0xe8, 0x1b, 0x20, 0x17,
+                       0x14, 0xa1, 0xae, 0x4b, 0xb2, 0xea, 0x5e, 0x00 };
+    for ( int i = 0; i < deviceCount; i++ )
+    {
+      memcpy(devices[i].id, id, ID_SIZE);
+      memcpy(devices[i].key, key, KEY_BYTES);
+    }
+  }
+
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+  signal(SIGPIPE, SIG_IGN);
+
+  for ( int i = 0; i < deviceCount; i++ )
+  {
+    simdevice *d = &devices[i];
+    d->dev = newTSensor(d->id, d->key);
+    d->rnd = i + 1;
+    d->errRnd = i + 1;
+    int fd;
+    if ( loopback )
+    {
+      int sv[2];
+      if ( socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0 )
+      {
+        perror("socketpair");
+        return -1;
+      }
+      fd = sv[0];
+      d->hostFd = sv[1];
+    }
+    else
+    {
+      fd = openPty(d);
+      if ( fd < 0 )
+      {
+        perror("pty");
+        return -1;
+      }
+      printf("%02x%02x%02x%02x%02x%02x %s\n", d->id[0], d->id[1], d->id[2], d->id[3],
+             d->id[4], d->id[5], d->ptyName);
+    }
+    d->dev->Serial.attach(fd);
+  }
+  fflush(stdout);
+
+  double start = now();
+  for ( int i = 0; i < deviceCount; i++ )
+  {
+    if ( pthread_create(&devices[i].devThread, NULL, deviceMain, &devices[i]) != 0 ||
+         (loopback && pthread_create(&devices[i].hostThread, NULL, hostMain, &devices[i]) != 0) )
+    {
+      fprintf(stderr, "Error creating the threads of device %d\n", i);
+      return -1;
+    }
+  }
+
+  while ( !stop && (seconds == 0 || now() - start < seconds) )
+    usleep(100000);
+  stop = true;
+
+  for ( int i = 0; i < deviceCount; i++ )
+  {
+    pthread_join(devices[i].devThread, NULL);
+    if ( loopback )
+      pthread_join(devices[i].hostThread, NULL);
+  }
+
+  report(now() - start);
+
+  for ( int i = 0; i < deviceCount; i++ )
+    delete devices[i].dev;
+  delete [] devices;
+  return 0;
+}
@@ -15,23 +15,17 @@
  * This constructor takes as it's argument K_AT and alpha, derives
  * K_AT,a and then expands they key schedules for K_AT and K_AT,a.
  */
-TSenseKeyPair::TSenseKeyPair(byte_ard *key, byte_ard *constant){
+TSenseKeyPair::TSenseKeyPair(byte_ard *key, const struct cmac_key *constant){
 
 	memcpy(cryptoKey, (void*) key, BLOCK_BYTE_SIZE);
 
 	// Expand crypto key schedule.
 	KeyExpansion(key, cryptoKeySched);
 
-	// Expand constant key schedule which we will need to generate the mac key.
-	byte_ard constKeySched[BLOCK_BYTE_SIZE*11];
-	KeyExpansion(constant, constKeySched);
-
 	// Derive the mac key using AES cMAC. The constant is the key and the 
-	// key is the message M that will be cMAC'ed.
-	aesCMac((u_int32_ard*) constKeySched,
-		cryptoKey,
-		BLOCK_BYTE_SIZE,
-		macKey);
+	// key is the message M that will be cMAC'ed. The constant's schedule 
+	// and subkeys are precomputed, see aes_constants.h.
+	deriveKey(constant, cryptoKey, macKey);
 
 	//Key schedule for the mac key
 	KeyExpansion(macKey, macKeySched);
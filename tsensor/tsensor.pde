@@ -50,21 +50,43 @@
 //
 #define MAJOR_VERSION   0
 #define MINOR_VERSION   2
-#define REVISION       42
+#define REVISION       46
 
 #include <EEPROM.h>
 #include <stdlib.h>
 #include "aes_cmac.h"
 #include "aes_crypt.h"
 #include "protocol.h"
+#include "payload_codec.h"
+#include "serial_link.h"
 #include "tstypes.h"
+#include "devinfo.h"        // Interface types and sample bit widths
 #include "edevdata.h"       // The EEPROM data layout
 #include "memoryFree.h"
 #include "tsense_keypair.h"
 #include "aes_constants.h"
 
+#ifdef _ARDUINO_DUEMILANOVE
+#include <avr/sleep.h>
+#include <avr/power.h>
+#include <avr/interrupt.h>
+
 void* operator new(size_t size) { return malloc(size); }
 void operator delete(void* ptr) { free(ptr); }
+#endif
+
+//
+// Hooks for the host simulator in sim/, which builds this file once per simulated
+// device. FW_STATIC marks the function local statics, which must not be shared between
+// devices, and FW_PROFILE marks the protocol steps whose cost the simulator measures.
+// Both are plain statics and nothing at all on the device.
+//
+#ifndef FW_STATIC
+#define FW_STATIC static
+#endif
+#ifndef FW_PROFILE
+#define FW_PROFILE(step)
+#endif
 
 //
 // The debug defines
@@ -88,8 +110,8 @@ void operator delete(void* ptr) { free(ptr); }
 #define AI_UNCONNECTED  5  // This pin is used to create randomness -- do not connect!
 #define AI_CUT_BITS     2  // The number of LSBs cut off the 10 bit value for more efficient packing
 
-#define INTERFACE_COUNT 2   // The number of sampled interfaces
 #define VAL_BYTE_SIZE   1   // The number of bytes allocated per sample. Must be an integer.
+#define PACK_PAYLOAD        // Delta and bit pack the data payload when it comes out smaller
 
 //
 // T <-> C protocol messages. Common protocol message definitons are included in protocol.h
@@ -117,6 +139,9 @@ void operator delete(void* ptr) { free(ptr); }
 #define MSG_T_SET_SAMLPLE_INTERVAL_CMD 0x75
 #define MSG_T_SET_SAMPLE_BUF_SIZE_CMD  0x76
 #define MSG_T_DEBUG_PACKET             0x77
+#define MSG_T_SET_DEADBAND_CMD         0x78  // Adaptive sampling: the change per interface worth reporting
+#define MSG_T_SET_ADAPTIVE_CMD         0x79  // Adaptive sampling: the longest silence and widest interval
+// LINK_START_CMD (0x60) and LINK_START_R (0x61) are in serial_link.h
 //
 #define MSG_ACK_NORMAL           0x00
 #define MSG_ACK_UNKNOWN_MESSAGE  0x01
@@ -171,7 +196,10 @@ void operator delete(void* ptr) { free(ptr); }
 #define DEFAULT_REKEY_INTERVAL 0   // The default re-keying interval. Used if t=0 delivered from sink. 0: no key expiration.
 
 
-#define SHORT_DELAY 100  // The short delay used when the sensor is not in sampling mode.
+#define BLINK_FAST        200      // Status LED blink period in msec in the intermediary protocol states
+#define BLINK_SLOW        1000     // and in standby.
+#define MAX_SLEEP         4000     // The longest single sleep in msec. Timer1 wraps after 4.19 sec.
+#define ADAPT_STABLE_SAMPLES 4     // Samples in a row within the deadband before the interval doubles
 
 //
 // Sensor state variables
@@ -187,6 +215,24 @@ u_int32_ard *pMsgTime=NULL;                 // Pointer to the time field in the
 byte_ard headerByteSize=0;                  // The size of the header portion of measBuffer
 byte_ard recordByteSize;                    // The size of a single record in measBuffer -- one record is one sample per interface
 
+//
+// Adaptive sampling, off while adaptMaxSilence is 0. A sample is stored only when an interface
+// moved more than its deadband since the last one stored, and the buffer goes out when full or
+// after adaptMaxSilence seconds without a message, whichever comes first. While the readings
+// hold still the sampling interval doubles every ADAPT_STABLE_SAMPLES samples, up to
+// adaptMaxInterval, and drops back to samplingInterval at the first change. The data messages
+// carry the time of each record, see payload_codec.h.
+//
+byte_ard adaptDeadband[INTERFACE_COUNT];    // In sample units, in the order of a record
+u_int16_ard adaptMaxSilence=0;              // Seconds
+byte_ard adaptMaxInterval=0;                // Seconds
+byte_ard adaptInterval=1;                   // The sampling interval in use
+byte_ard adaptLast[INTERFACE_COUNT];        // The last record stored
+bool adaptHaveLast=false;
+byte_ard adaptStable=0;                     // Samples in a row within the deadband
+u_int32_ard adaptLastSend=0;                // currentTime of the last data message
+u_int16_ard *recordTimes=NULL;              // currentTime, low 16 bits, each record in measBuffer was kept
+
 u_int16_ard idNonce=0;         // Use separate nonces for each message type. The nonces are counters w. wrap around
 u_int16_ard rekeyNonce=0;      // and start at some randomly chosen initial value.
 
@@ -199,6 +245,23 @@ u_int16_ard transportKeyUseCounter=0;    // Transport key usage counter
 u_int16_ard sessionRekeyInterval=DEFAULT_REKEY_INTERVAL; // The re-keying interval for the session key
 u_int16_ard transportRekeyInterval=DEFAULT_REKEY_INTERVAL; // The re-keying interval for the transport key
 
+//
+// The framed link to the host, see serial_link.h. The line starts out raw at 9600 baud
+// and the host may switch it to frames at up to LINK_MAX_BAUD. The buffers and the
+// frames in flight take some 350 bytes of RAM.
+//
+#define LINK_MAX_BAUD  LINK_BAUD_115200  // 2.1% off at 16 MHz. LINK_BAUD_500000 is exact.
+
+struct serial_link serialLink;
+bool linkFramed=false;         // The line carries frames
+u_int32_ard linkLastRx=0;      // millis() of the last valid frame
+u_int32_ard linkIdleLimit=0;   // Back to the raw line after this long without one
+byte_ard linkIn[LINK_MTU];     // Payload received, read by the command handlers
+byte_ard linkInLen=0;
+byte_ard linkInPos=0;
+byte_ard linkOut[LINK_MTU];    // Bytes written, until they fill a frame or the loop pass ends
+byte_ard linkOutLen=0;
+
 /**
  *  setup
  *
@@ -223,36 +286,111 @@ void setup(void)
   pinMode(LED_SIGNAL_4,OUTPUT);
   digitalWrite(LED_STATUS,LOW);
    
+  #ifdef _ARDUINO_DUEMILANOVE
+  // Power down the peripherals the sensor does not use
+  power_spi_disable();
+  power_twi_disable();
+  power_timer2_disable();
+  #endif
+
   // Initialize the serial port
   Serial.begin(9600);
   Serial.flush();
   delay(1000);
 }
 
+#ifdef _ARDUINO_DUEMILANOVE
+extern volatile unsigned long timer0_millis;   // The millis() counter in wiring.c
+
+// Wakes the MCU at the end of sleepUntil(). Nothing else to do here, the loop
+// takes over when the sleep returns.
+ISR(TIMER1_COMPA_vect)
+{
+}
+
+/**
+ *  sleepUntil
+ *
+ *  Puts the MCU in idle sleep until the deadline (in millis() time) or until a byte
+ *  arrives on the serial port, whichever comes first. The Timer0 overflow interrupt
+ *  behind millis() would wake the MCU every msec, so it is switched off for the sleep
+ *  and Timer1 is set to wake it at the deadline instead. The time slept is added to
+ *  millis() on waking. The USART keeps running in idle sleep and its receive interrupt
+ *  wakes the MCU. Sleeps are capped at MAX_SLEEP, the loop simply sleeps again.
+ */
+void sleepUntil(u_int32_ard deadline)
+{
+  long msec = (long)(deadline - millis());
+  if ( msec <= 0 )
+    return;
+  if ( msec > MAX_SLEEP )
+    msec = MAX_SLEEP;
+
+  cli();
+  // Checked with interrupts off, so a byte arriving now wakes the sleep below
+  if ( Serial.available() )
+  {
+    sei();
+    return;
+  }
+  // Timer1 counts at F_CPU/1024 in normal mode and interrupts on compare match A
+  TCCR1A = 0;
+  TCCR1B = 0;
+  TCNT1 = 0;
+  OCR1A = (u_int16_ard)(msec * (F_CPU/1024) / 1000);
+  TIFR1 = _BV(OCF1A);
+  TIMSK1 = _BV(OCIE1A);
+  TCCR1B = _BV(CS12) | _BV(CS10);
+  TIMSK0 &= ~_BV(TOIE0);
+  ADCSRA &= ~_BV(ADEN);  // The ADC draws current even when idle
+
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  sleep_enable();
+  sei();       // The instruction after sei() always runs, so no wakeup is missed
+  sleep_cpu();
+  sleep_disable();
+
+  cli();
+  u_int16_ard ticks = TCNT1;
+  TCCR1B = 0;
+  TIMSK1 = 0;
+  timer0_millis += (u_int32_ard)ticks * 1000 / (F_CPU/1024);
+  TIMSK0 |= _BV(TOIE0);
+  ADCSRA |= _BV(ADEN);
+  sei();
+}
+#endif
+
 /**
  *  loop
  *
- *  The Arduino loop function
+ *  The Arduino loop function. Each pass handles whatever is due -- a command on the serial
+ *  line, a protocol timeout, a sample, an LED change -- and then sleeps until the next
+ *  deadline or the next byte from the host. Samples are taken on time whatever else the
+ *  pass did, since the deadlines are kept in millis() time rather than counted in delays.
  */
 void loop(void) 
 {      
-  static byte_ard timeUpdateCounter=0;
-  static bool blinkStateFast=false;
-  static bool blinkStateSlow=false;
-  static byte_ard blinkCounter=0;
+  FW_STATIC u_int32_ard clockTime=0;      // millis() when currentTime last ticked
+  FW_STATIC u_int32_ard nextSampleTime=0;
+  FW_STATIC u_int32_ard ledOffTime=0;     // When the sample and TX LEDs go off, 0 if they are off
+  FW_STATIC u_int32_ard nextBlinkTime=0;
+  FW_STATIC bool blinkState=false;
+  FW_STATIC bool sampling=false;
   
-  // Maintain the blink counter and state
-  blinkCounter++;
-  blinkCounter%=100; // wrap at 100 ticks
-  if (blinkCounter%2==0)
-    blinkStateFast=!blinkStateFast;
-  if (blinkCounter%10==0)
-    blinkStateSlow=!blinkStateSlow; 
+  u_int32_ard now = millis();
+
+  // Update the clock. The currentTime is in seconds.
+  while ( now - clockTime >= 1000 )
+  {
+    currentTime++;
+    clockTime += 1000;
+  }
    
   // Check on protocol timeouts
   if ( timeout > 0 )
   {
-    if( timeout <= millis() ) 
+    if( timeout <= now ) 
     {
       // millis returns the number of msecs since the program began executing
       // If the timeout set equals the current time then reset
@@ -265,38 +403,72 @@ void loop(void)
   // Handle any waiting commands on the serial line
   getCommand();  
 
+  u_int32_ard wakeTime;
   if ( protocolState == PROT_STATE_RUNNING )
   {
     // Running state
     digitalWrite(LED_STATUS,HIGH);    
-    sampleAndReport();  // This function delays for at least a second
-    // Update the current time. Note that we rely on the delay command to keep
-    // reasonably accurate time. The currentTime and samplingInterval are in seconds.
-    currentTime += samplingInterval; 
+    if ( !sampling )
+    {
+      nextSampleTime = now;
+      sampling = true;
+      adaptReset();
+    }
+    now = millis();
+    if ( (long)(now - nextSampleTime) >= 0 )
+    {
+      sampleAndReport();
+      nextSampleTime += currentInterval()*1000UL;
+      ledOffTime = now + currentInterval()*200UL;
+      if ( ledOffTime == 0 )
+        ledOffTime = 1;
+    }
+    if ( ledOffTime != 0 && (long)(now - ledOffTime) >= 0 )
+    {
+      digitalWrite(LED_SIGNAL_SAMPLE,LOW);
+      digitalWrite(LED_SIGNAL_TX,LOW);  
+      ledOffTime = 0;
+    }
+    wakeTime = nextSampleTime;
+    if ( ledOffTime != 0 && (long)(ledOffTime - wakeTime) < 0 )
+      wakeTime = ledOffTime;
   }
   else
   {        
-    delay(SHORT_DELAY);   // Delay for a while
+    sampling = false;
+    if ( (long)(now - nextBlinkTime) >= 0 )
+    {
+      blinkState = !blinkState;
+      if ( protocolState == PROT_STATE_STANDBY || protocolState == PROT_STATE_ERROR )
+        nextBlinkTime = now + BLINK_SLOW;
+      else
+        nextBlinkTime = now + BLINK_FAST;
+    }
     switch(protocolState)
     {
       case PROT_STATE_ERROR: 
         digitalWrite(LED_STATUS,LOW);
         break;
-      case PROT_STATE_STANDBY:
-        digitalWrite(LED_STATUS,blinkStateSlow);
-        break;
       default: 
-        digitalWrite(LED_STATUS,blinkStateFast);
+        digitalWrite(LED_STATUS,blinkState);
         break;
     }
-    
-    // Update the clock (about) every second
-    if ( ++timeUpdateCounter >= 1000/SHORT_DELAY )
-    {
-      currentTime++;
-      timeUpdateCounter=0;
-    }
+    wakeTime = nextBlinkTime;
   } 
+
+  if ( timeout > 0 && (long)(timeout - wakeTime) < 0 )
+    wakeTime = timeout;
+
+  // Send what the pass wrote, and wake for the resends and the commands still waiting
+  linkPoll();
+  if ( linkFramed )
+  {
+    if ( link_free(&serialLink) < LINK_WINDOW && (long)(now + serialLink.retryMs - wakeTime) < 0 )
+      wakeTime = now + serialLink.retryMs;
+    if ( linkInPos < linkInLen )
+      wakeTime = now;
+  }
+  sleepUntil(wakeTime);
 }
 
 /**
@@ -310,7 +482,7 @@ void loop(void)
 void getCommand() 
 {   
   // Read the first byte -- the message identifier.
-  byte_ard cmdCode = Serial.read();
+  byte_ard cmdCode = serialRead();
   if ( cmdCode==0xFF )
     return;   // -1 (0xFF) means no data available.
 
@@ -363,14 +535,23 @@ void getCommand()
     case MSG_T_SET_SAMPLE_BUF_SIZE_CMD:        
       handleSetSampleBufferSizeCmd();
       break;
+    case MSG_T_SET_DEADBAND_CMD:
+      handleSetDeadbandCmd();
+      break;
+    case MSG_T_SET_ADAPTIVE_CMD:
+      handleSetAdaptiveCmd();
+      break;
     case MSG_T_PRIVATE_KEY_Q:
       handlePrivateKeyQuery();
       break;
     case MSG_T_EEPROM_DUMP_Q:
       handleEepromDumpQuery();
       return;        
+    case LINK_START_CMD:
+      handleLinkStartCmd();
+      break;
     default:
-      Serial.flush(); // Crear the crud
+      serialFlush(); // Crear the crud
       sendAck(MSG_ACK_UNKNOWN_MESSAGE);
       break;
   }
@@ -385,12 +566,14 @@ void getCommand()
  */
 void handleDeviceIdQuery()
 {
+  FW_PROFILE("idresponse");
+
   // Only handle if the sensor is in standby mode or id delivered mode. We dont want the sensor
   // state to be messed up by spurious device id queries.
   if ( protocolState != PROT_STATE_STANDBY )
   {
     setWarningState(ERR_CODE_IDQUERY_UNEXPECTED);
-    Serial.flush(); // Get rid of crud
+    serialFlush(); // Get rid of crud
     sendAck(errorCode);
     return;  
   }
@@ -402,7 +585,7 @@ void handleDeviceIdQuery()
   getPrivateKeyFromEEPROM(masterKeyBuf);  
   // Expand the masterkey (temporarily) to get encryption and authentication schedules.
   // Use the public constant for derivation of authentication key.
-  TSenseKeyPair masterKeys(masterKeyBuf,cAlpha);
+  TSenseKeyPair masterKeys(masterKeyBuf,&cAlphaKey);
 
   // Get the public id from EEPROM
   byte_ard idbuf[DEV_ID_LEN];  
@@ -423,8 +606,8 @@ void handleDeviceIdQuery()
                    (const u_int32_ard *)masterKeys.getMacKeySched(), (void *)pBuffer);
      
   // Write the crypto buffer to the serial port
-  Serial.write(pBuffer,IDMSG_FULLSIZE);
-  Serial.flush();
+  serialWrite(pBuffer,IDMSG_FULLSIZE);
+  serialFlush();
   
   setProtocolState(PROT_STATE_ID_DELIVERED);  
 }
@@ -438,7 +621,7 @@ void handleIdResponseError()
 {
   // TODO: CHECK HANDLING
   setWarningState(ERR_CODE_ID_RESPONSE_ERROR); 
-  Serial.flush();
+  serialFlush();
   sendAck(errorCode);
 }
 
@@ -450,13 +633,15 @@ void handleIdResponseError()
  */
 void handleKeyToSense()
 {  
+  FW_PROFILE("keytosense");
+
   errorCode = 0x00;
   
   // Only handle if the sensor is in correct protocol stage
   if ( protocolState != PROT_STATE_ID_DELIVERED )
   {
     setWarningState(ERR_CODE_KEYTOSENSE_UNEXPECTED);
-    Serial.flush(); // Get rid of crud
+    serialFlush(); // Get rid of crud
     sendAck(errorCode);
     return;  
   }
@@ -466,7 +651,7 @@ void handleKeyToSense()
   getPrivateKeyFromEEPROM(masterKeyBuf);  
   // Expand the masterkey (temporarily) to get encryption and authentication schedules.
   // Use the public constant for derivation of authentication key.
-  TSenseKeyPair masterKeys(masterKeyBuf,cAlpha);
+  TSenseKeyPair masterKeys(masterKeyBuf,&cAlphaKey);
     
   // Allocate the raw command buffer and read the expected number of bytes
   byte_ard pCommandBuffer[KEYTOSENS_FULLSIZE];
@@ -514,8 +699,8 @@ void handleKeyToSense()
   // Store the session key in a keypair object
   if (sessionKeys!=NULL)
     delete sessionKeys;
-  sessionKeys = new TSenseKeyPair(senserecv.key,cBeta);  // Use the key derivation constant
-  if ( senserecv.renewal_timer=0 )
+  sessionKeys = new TSenseKeyPair(senserecv.key,&cBetaKey);  // Use the key derivation constant
+  if ( senserecv.renewal_timer==0 )
     sessionRekeyInterval=DEFAULT_REKEY_INTERVAL;
   else
     sessionRekeyInterval=senserecv.renewal_timer;
@@ -553,10 +738,12 @@ void handleKeyToSense()
  */
 void sendRekeyRequest()
 {
+  FW_PROFILE("rekey");
+
   if ( sessionKeys == NULL )
   {
     setErrorState(ERR_CODE_REKEY_REQ_SKEY_ERROR);
-    Serial.flush(); // Get rid of crud
+    serialFlush(); // Get rid of crud
     sendAck(errorCode);
     return;  
   }
@@ -587,7 +774,7 @@ void sendRekeyRequest()
   ****/
   
   // Write the buffer to serial and free
-  Serial.write(buffer,REKEY_FULLSIZE);  
+  serialWrite(buffer,REKEY_FULLSIZE);  
 
   // Update the protocol state
   setProtocolState(PROT_STATE_REKEY_PENDING);
@@ -601,11 +788,13 @@ void sendRekeyRequest()
  */
 void handleRekeyResponse()
 {
+  FW_PROFILE("newkey");
+
   // Only handle if the sensor is in correct protocol stage
   if ( protocolState != PROT_STATE_REKEY_PENDING )
   {
     setWarningState(ERR_CODE_REKEYRESPONSE_UNEXPECTED);
-    Serial.flush(); // Get rid of crud
+    serialFlush(); // Get rid of crud
     sendAck(errorCode);
     return;  
   }
@@ -613,7 +802,7 @@ void handleRekeyResponse()
   // Allocate a receive buffer and read the expected number of bytes from the serial port
   byte_ard pCommandBuffer[NEWKEY_FULLSIZE]; // = (byte_ard *)malloc(NEWKEY_FULLSIZE);  // TODO: CHECK THE BUFFER SIZE
   pCommandBuffer[0]=MSG_T_REKEY_RESPONSE;
-  readFromSerial(pCommandBuffer+1,NEWKEY_FULLSIZE);
+  readFromSerial(pCommandBuffer+1,NEWKEY_FULLSIZE-1);
 
   // Unpack the raw buffer into a message struct
   message msg; 
@@ -667,17 +856,14 @@ void handleRekeyResponse()
 
   // Get the random number R delivered by sink and derive transport encryption and authentication keys
   byte_ard pTransportKey[KEY_BYTES];  
-  // Allocate temporary buffer for the transport encryption key
-  byte_ard* pGammaKeySched[KEY_BYTES*11]; 
-  // Expand the derivation key schedule for random -> K_STe
-  KeyExpansion(cGamma,pGammaKeySched);      
-  // CMAC the random number to get K_STe
-  aesCMac((const u_int32_ard *)pGammaKeySched,msg.rand,KEY_BYTES,pTransportKey); 
+  // CMAC the random number to get K_STe. The schedule and subkeys of gamma
+  // are precomputed in flash.
+  deriveKey(&cGammaKey,msg.rand,pTransportKey); 
 
   // Save the transport key -- cEpsilon is the constant for authentication key derivation    
   if ( transportKeys != NULL )
     delete transportKeys;
-  transportKeys = new TSenseKeyPair(pTransportKey,cEpsilon);
+  transportKeys = new TSenseKeyPair(pTransportKey,&cEpsilonKey);
   // Reset the rekey counter since we have a fresh key
   transportKeyUseCounter=0; 
 
@@ -714,66 +900,106 @@ void handleRekeyResponse()
  
 void sendData()
 {
+  FW_PROFILE("data");
+
   //
   // NOTE: This completely bypasses the pack function in the protocol which caused weird crashes
   // probably due to memory issues. Rewrite when time allows.
   //
+  // The message is encrypted and MACed into a single buffer from the measurement buffer, so the
+  // RAM needed to send is the buffer itself and nothing more.
+  //
   
-  u_int16_ard plainsize = ID_SIZE + MSGTIME_SIZE + 1 + measBufferCount;
-  u_int16_ard cipher_len = plainsize;
-  if ( plainsize%16!=0 )  
-    cipher_len = (1+(cipher_len/16))*16;
-  u_int16_ard bufsize = MSGTYPE_SIZE + 1 + ID_SIZE + cipher_len + 16;
+  // The interfaces in the order they are stored in each record of the measurement buffer
+  const byte_ard interfaceTypes[INTERFACE_COUNT] = { INTERFACE2_TYPE, INTERFACE1_TYPE };
+  byte_ard records = measBufferCount/INTERFACE_COUNT;
+  byte_ard msgtype = MSG_T_DATA_SEND;
+  u_int16_ard payloadsize = measBufferCount;
+  // In adaptive sampling the records are kept at irregular times, their times go first. They
+  // are turned into seconds before the message time, low to high, in place.
+  u_int16_ard timessize = 0;
+  if ( adaptMaxSilence > 0 )
+  {
+    byte_ard *times = (byte_ard*)recordTimes;
+    for ( byte_ard i = 0; i < records; i++ )
+    {
+      u_int16_ard offset = (u_int16_ard)currentTime - recordTimes[i];
+      times[2*i] = lowByte(offset);
+      times[2*i+1] = highByte(offset);
+    }
+    timessize = PAYLOAD_TIMES_SIZE(records);
+    msgtype |= MSG_T_DATA_TIMED_FLAG;
+  }
+  #ifdef PACK_PAYLOAD
+  // Noisy readings may not pack, those go out as they are
+  u_int16_ard packedsize = payload_packed_size(measBuffer,INTERFACE_COUNT,records,VAL_BIT_SIZE);
+  if ( packedsize < payloadsize )
+  {
+    payloadsize = packedsize;
+    msgtype |= MSG_T_DATA_PACKED_FLAG;
+  }
+  #endif
+
+  u_int16_ard plainsize = DataMsg::Plain::headerSize + timessize + payloadsize;
+  u_int16_ard cipher_len = paddedSize(plainsize);
+  u_int16_ard bufsize = DataMsg::headerSize + cipher_len + BLOCK_BYTE_SIZE;
   byte_ard* transmitBuffer = (byte_ard*)malloc(bufsize);
+  byte_ard* cipher = transmitBuffer + DataMsg::headerSize;
+  byte_ard header[DataMsg::Plain::headerSize];
+  const byte_ard* payload = measBuffer;
   memset(transmitBuffer,0,bufsize);
 
   // Insert the message identifier  
-  transmitBuffer[0]=0x01;
+  transmitBuffer[DataMsg::MsgType::offset]=msgtype;
   // Insert the cipher buffer length in bytes.
   // Must be a multiple of blocklenght (16 bytes per block)
-  transmitBuffer[1]=cipher_len;
+  transmitBuffer[DataMsg::CipherLen::offset]=cipher_len;
   // Insert the public device id -- once for plaintext, once for ciphertext
-  getPublicIdFromEEPROM(transmitBuffer+2);
-  memcpy(transmitBuffer+8,transmitBuffer+2,6);
+  getPublicIdFromEEPROM(transmitBuffer+DataMsg::Id::offset);
+  putField<DataMsg::Plain::Id>(header,transmitBuffer+DataMsg::Id::offset);
   // Insert the curren ttime
-  for( int i=0; i<4; i++ )
-    transmitBuffer[14+i] = ( currentTime >> (8*i) ) & 0xFF;
+  putIntField<DataMsg::Plain::MsgTime>(header,currentTime);
   // Insert the data size
-  transmitBuffer[18]=measBufferCount;
-  // Insert the data
-  memcpy(transmitBuffer+19,measBuffer,measBufferCount);
+  header[DataMsg::Plain::DataLen::offset]=timessize+payloadsize;
+  // Raw samples are encrypted straight from the measurement buffer. A packed payload is packed
+  // where its plaintext would be in the message and encrypted in place.
+  if ( msgtype & MSG_T_DATA_PACKED_FLAG )
+  {
+    payload = cipher+DataMsg::Plain::headerSize+timessize;
+    pack_payload(measBuffer,INTERFACE_COUNT,records,interfaceTypes,VAL_BIT_SIZE,
+                 cipher+DataMsg::Plain::headerSize+timessize);
+  }
 
-  /***  
-  sendDebugPacket("BUF",transmitBuffer,bufsize);
-  ***/
-    
   // This is a dummy IV -- REPLACE!
   byte_ard IV[] = {
     0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30, 0x30 
   };
   
-  // Allocate a cipher buffer -- TODO: DO IN PLACE TO SAVE MEM!!
-  byte_ard *cipherbuff = (byte_ard*)malloc(cipher_len);
-  // Encrypt the data to the temporary cipher buffer
-  CBCEncrypt((void*)(transmitBuffer+8), (void*)cipherbuff, plainsize, AUTOPAD,
-             (const u_int32_ard*)transportKeys->getCryptoKeySched(), (const u_int16_ard*)IV);  
-  // Copy the temporary cipherbuffer into the transmit buffer -- after the plaintext header
-  memcpy(transmitBuffer+8,cipherbuff,cipher_len);  
-  // Mac the cipherbuffer and insert directly into the last 16 bytes of the transmit buffer
-  aesCMac((const u_int32_ard*)transportKeys->getMacKeySched(), cipherbuff, cipher_len, transmitBuffer+8+cipher_len);  
-  // Now we can safely get rid of the cipherbuffer
-  free(cipherbuff);
+  // Encrypt the header and the payload from where they are into the transmit buffer, after the
+  // plaintext header, and MAC the ciphertext into the last 16 bytes of the buffer.
+  struct cbc_ctx cbc;
+  CBCEncryptInit(&cbc,(const u_int32_ard*)transportKeys->getCryptoKeySched(),(const u_int16_ard*)IV);
+  u_int16_ard written = CBCEncryptUpdate(&cbc,header,DataMsg::Plain::headerSize,cipher);
+  if ( timessize > 0 )
+  {
+    written += CBCEncryptUpdate(&cbc,&records,1,cipher+written);
+    written += CBCEncryptUpdate(&cbc,(const byte_ard*)recordTimes,timessize-1,cipher+written);
+  }
+  written += CBCEncryptUpdate(&cbc,payload,payloadsize,cipher+written);
+  written += CBCEncryptFinal(&cbc,AUTOPAD,cipher+written);
+  aesCMac((const u_int32_ard*)transportKeys->getMacKeySched(),cipher,written,cipher+written);
 
   /***  
   sendDebugPacket("BUF",transmitBuffer,bufsize);  
   ***/
   
   // Send on the wire and free the transmit buffer
-  Serial.write(transmitBuffer,bufsize); 
+  serialWrite(transmitBuffer,bufsize); 
   free(transmitBuffer);
   
   // Reset for the next round
   measBufferCount=0;
+  adaptLastSend=currentTime;
 }
   
 /**
@@ -812,10 +1038,10 @@ void handleGeneralProtocolError()
 void handleSetTimeCmd()
 {
   // Read four bytes off the serial port
-  byte_ard t_ll = Serial.read();
-  byte_ard t_lh = Serial.read();
-  byte_ard t_hl = Serial.read();
-  byte_ard t_hh = Serial.read();
+  byte_ard t_ll = serialRead();
+  byte_ard t_lh = serialRead();
+  byte_ard t_hl = serialRead();
+  byte_ard t_hh = serialRead();
   // Calculate the 32-bit time value.
   currentTime = long(t_ll) + (long(t_lh)<<8) + (long(t_hl)<<16) + (long(t_hh)<<24);   
   // Send an ACK back.
@@ -830,9 +1056,101 @@ void handleSetTimeCmd()
  */
 void handleSetSamplingRateCmd()
 {
-   samplingInterval = Serial.read(); 
+   samplingInterval = serialRead(); 
+   adaptReset();
    sendAck(MSG_ACK_NORMAL);
 }
+
+/**
+ *  handleSetDeadbandCmd
+ *
+ *  Sets the deadbands of adaptive sampling, how far an interface has to move in sample units
+ *  before the sample is stored. Expects INTERFACE_COUNT bytes, luminosity then temperature
+ *  as in a record. Replies with an ACK message.
+ */
+void handleSetDeadbandCmd()
+{
+  for ( byte_ard i = 0; i < INTERFACE_COUNT; i++ )
+    adaptDeadband[i] = serialRead();
+  adaptReset();
+  sendAck(MSG_ACK_NORMAL);
+}
+
+/**
+ *  handleSetAdaptiveCmd
+ *
+ *  Turns adaptive sampling on or off. Expects the longest silence in seconds in two bytes, low
+ *  to high, then the widest sampling interval in seconds in one. A silence of 0 turns it off.
+ *  Replies with an ACK message.
+ */
+void handleSetAdaptiveCmd()
+{
+  byte_ard s_l = serialRead();
+  byte_ard s_h = serialRead();
+  adaptMaxSilence = s_l + (s_h<<8);
+  adaptMaxInterval = serialRead();
+  adaptReset();
+  sendAck(MSG_ACK_NORMAL);
+}
+
+/**
+ *  adaptReset
+ *
+ *  Starts adaptive sampling over at samplingInterval, with the next sample stored.
+ */
+void adaptReset()
+{
+  adaptInterval = samplingInterval;
+  adaptHaveLast = false;
+  adaptStable = 0;
+  adaptLastSend = currentTime;
+}
+
+/**
+ *  currentInterval
+ *
+ *  The sampling interval in seconds, as widened by adaptive sampling.
+ */
+byte_ard currentInterval()
+{
+  return adaptMaxSilence > 0 ? adaptInterval : samplingInterval;
+}
+
+/**
+ *  adaptKeep
+ *
+ *  Whether a record is worth storing in adaptive sampling: an interface moved past its deadband,
+ *  or the sensor has been silent too long. Widens or resets the sampling interval as it goes.
+ */
+bool adaptKeep(const byte_ard *record)
+{
+  bool changed = !adaptHaveLast;
+  for ( byte_ard i = 0; i < INTERFACE_COUNT; i++ )
+  {
+    byte_ard diff = record[i] > adaptLast[i] ? record[i]-adaptLast[i] : adaptLast[i]-record[i];
+    if ( diff > adaptDeadband[i] )
+      changed = true;
+  }
+
+  if ( changed )
+  {
+    adaptStable = 0;
+    adaptInterval = samplingInterval;
+  }
+  else if ( ++adaptStable >= ADAPT_STABLE_SAMPLES )
+  {
+    adaptStable = 0;
+    adaptInterval = adaptInterval > adaptMaxInterval/2 ? adaptMaxInterval : adaptInterval*2;
+    if ( adaptInterval < samplingInterval )
+      adaptInterval = samplingInterval;
+  }
+
+  if ( !changed && currentTime - adaptLastSend < adaptMaxSilence )
+    return false;
+  memcpy(adaptLast,record,INTERFACE_COUNT);
+  adaptHaveLast = true;
+  return true;
+}
   
 /**
  *  handleSetSampleBufferSizeCmd
@@ -842,7 +1160,7 @@ void handleSetSamplingRateCmd()
  */
 void handleSetSampleBufferSizeCmd()
 {
-  measBufferSize = Serial.read();
+  measBufferSize = serialRead();
   sendAck(MSG_ACK_NORMAL);
   // Reallocate the buffer if already allocated. Otherwise, simply store the new size
   if ( measBuffer != NULL )
@@ -862,10 +1180,10 @@ void handleSetSampleBufferSizeCmd()
 void sendFreeMemory()
 {
   u_int16_ard freemem = freeMemory();  
-  Serial.write(MSG_T_FREE_MEM_R);
-  Serial.write(lowByte(freemem));
-  Serial.write(highByte(freemem));  
-  Serial.flush();
+  serialWrite(MSG_T_FREE_MEM_R);
+  serialWrite(lowByte(freemem));
+  serialWrite(highByte(freemem));  
+  serialFlush();
 }
 
 /**
@@ -880,15 +1198,15 @@ void sendFreeMemory()
  */
 void sendDebugPacket(char szText[], byte_ard *buf, u_int16_ard len)
 {
-  Serial.write(MSG_T_DEBUG_PACKET);
+  serialWrite(MSG_T_DEBUG_PACKET);
   byte_ard tlen = strlen(szText);
-  Serial.write(tlen);
+  serialWrite(tlen);
   for( int i=0; i<tlen; i++ )
-    Serial.write(szText[i]);
-  Serial.write(lowByte(len));
-  Serial.write(highByte(len));
+    serialWrite(szText[i]);
+  serialWrite(lowByte(len));
+  serialWrite(highByte(len));
   for( int i=0; i<len; i++ )
-    Serial.write(buf[i]);
+    serialWrite(buf[i]);
 }
 
 /**
@@ -899,10 +1217,10 @@ void sendDebugPacket(char szText[], byte_ard *buf, u_int16_ard len)
  */
 void sendCurrentState()
 {
-  Serial.write(MSG_T_STATE_R);
-  Serial.write(protocolState);
-  Serial.write(errorCode);
-  Serial.flush();
+  serialWrite(MSG_T_STATE_R);
+  serialWrite(protocolState);
+  serialWrite(errorCode);
+  serialFlush();
 }
 
 /**
@@ -913,11 +1231,11 @@ void sendCurrentState()
  */
 void handleVersionQuery()
 {
-  Serial.write(MSG_T_VERSION_R);  
-  Serial.write((byte_ard)MAJOR_VERSION);
-  Serial.write((byte_ard)MINOR_VERSION);
-  Serial.write((byte_ard)REVISION);
-  Serial.flush();
+  serialWrite(MSG_T_VERSION_R);  
+  serialWrite((byte_ard)MAJOR_VERSION);
+  serialWrite((byte_ard)MINOR_VERSION);
+  serialWrite((byte_ard)REVISION);
+  serialFlush();
 }
 
 /**
@@ -931,8 +1249,8 @@ void handleVersionQuery()
 void handleStartupIdQuery()
 {
   byte_ard buf[] = {0xAB, 0x2E, 0x12, 0xF1, 0xC3, 0x13, 0xD9, 0x01, 0x39, 0xBA, 0x2E, 0x51, 0xC3, 0x81, 0xFF, 0x0A};
-  Serial.write(buf,16);
-  Serial.flush();
+  serialWrite(buf,16);
+  serialFlush();
 }
 
 /**
@@ -942,12 +1260,12 @@ void handleStartupIdQuery()
  */
 void handleCurTimeQuery()
 {
-  Serial.write(MSG_T_CUR_TIME_R);
-  Serial.write(currentTime & 0xFF);
-  Serial.write((currentTime>>8) & 0xFF);
-  Serial.write((currentTime>>16) & 0xFF);    
-  Serial.write((currentTime>>24) & 0xFF);
-  Serial.flush();
+  serialWrite(MSG_T_CUR_TIME_R);
+  serialWrite(currentTime & 0xFF);
+  serialWrite((currentTime>>8) & 0xFF);
+  serialWrite((currentTime>>16) & 0xFF);    
+  serialWrite((currentTime>>24) & 0xFF);
+  serialFlush();
 }
 
 /**
@@ -961,11 +1279,11 @@ void handleCurTimeQuery()
  */
 void handlePrivateKeyQuery()
 {
-  Serial.write(MSG_T_PRIVATE_KEY_R);
+  serialWrite(MSG_T_PRIVATE_KEY_R);
   byte_ard PK[16];
   getPrivateKeyFromEEPROM(PK);
   for( int i=0; i<16; i++ )
-    Serial.write(PK[i]);
+    serialWrite(PK[i]);
 }
 
 /**
@@ -979,9 +1297,9 @@ void handlePrivateKeyQuery()
  */
 void handleEepromDumpQuery()
 {
-  Serial.write(MSG_T_EEPROM_DUMP_R);
+  serialWrite(MSG_T_EEPROM_DUMP_R);
   for( int i=0; i<1024; i++ )
-    Serial.write(EEPROM.read(i));
+    serialWrite(EEPROM.read(i));
 }
 
 /**
@@ -992,15 +1310,16 @@ void handleEepromDumpQuery()
  */
 void sendAck(byte_ard code)
 {
-  Serial.write(MSG_T_ACK);
-  Serial.write(code);
-  Serial.flush();
+  serialWrite(MSG_T_ACK);
+  serialWrite(code);
+  serialFlush();
 }
 
 /**
  *  sampleAndReport
  *
- *  This is the main measure loop, executed once the device is enabled.
+ *  Takes one sample of every interface, executed by the loop at each sampling deadline
+ *  once the device is enabled.
  *  Values are stored in the measurement section of the allocated buffer. Note that
  *  the 10-bit arduino analog values are truncated by cutting off the 2 LSBs in order
  *  to fit into a byte. The rationale for this is that the 2 LSBs are probably mostly 
@@ -1013,34 +1332,39 @@ void sampleAndReport()
   // Use the test counters -- this is only used for testing to get predictable
   // measurement results. Helps to determine if data is garbled in buffer manipulation,
   // transit or on reception.  
-  static u_int16_ard counter1 = 0;
-  static u_int16_ard counter2 = 10;
-  measBuffer[measBufferCount++] = counter1++;
-  measBuffer[measBufferCount++] = counter2++;
+  FW_STATIC u_int16_ard counter1 = 0;
+  FW_STATIC u_int16_ard counter2 = 10;
+  byte_ard *record = measBuffer+measBufferCount;
+  record[0] = counter1++;
+  record[1] = counter2++;
   counter1 %= 0xFF;  // Make sure the counters are within the AI range
   counter2 %= 0xFF;
   #else
-  measBuffer[measBufferCount++] = (analogRead(AI_LUM) >> AI_CUT_BITS) & 0xFF; // Cut off 2 LSBs
-  measBuffer[measBufferCount++] = (analogRead(AI_TEMP) >> AI_CUT_BITS) & 0xFF;
+  byte_ard *record = measBuffer+measBufferCount;
+  record[0] = (analogRead(AI_LUM) >> AI_CUT_BITS) & 0xFF; // Cut off 2 LSBs
+  record[1] = (analogRead(AI_TEMP) >> AI_CUT_BITS) & 0xFF;
   /* Stick other interfaces in here */
   #endif  
       
   digitalWrite(LED_SIGNAL_SAMPLE,HIGH);
+
+  // The record is read into the free end of the buffer, it stays there if it is kept
+  if ( adaptMaxSilence > 0 && !adaptKeep(record) )
+    return;
+  recordTimes[measBufferCount/INTERFACE_COUNT] = (u_int16_ard)currentTime;
+  measBufferCount += INTERFACE_COUNT;
+  bool silent = adaptMaxSilence > 0 && currentTime - adaptLastSend >= adaptMaxSilence;
   
-  // Check if the buffer is full. If so, dump to the serial interface.
+  // Check if the buffer is full, or has waited too long in adaptive sampling. If so, dump to
+  // the serial interface.
   // TODO: Add some handling for the case when the serial port is not connected.
-  if ( measBufferCount >= measBufferSize*INTERFACE_COUNT )
+  if ( measBufferCount >= measBufferSize*INTERFACE_COUNT || silent )
   {
     sendData();
     digitalWrite(LED_SIGNAL_TX,HIGH);
   } 
 
-  // Delay for the sampling interval (in msec)  
-  // Split in two for nicer LED control.
-  delay(samplingInterval*200); 
-  digitalWrite(LED_SIGNAL_SAMPLE,LOW);
-  digitalWrite(LED_SIGNAL_TX,LOW);  
-  delay(samplingInterval*800); 
+  // The loop turns the LEDs off again and schedules the next sample
 }
 
 /**
@@ -1070,8 +1394,12 @@ bool allocateMeasBuffer()
   // Try to allocate the buffer
   recordByteSize = (INTERFACE_COUNT*VAL_BYTE_SIZE);
   measBuffer = (byte_ard*)malloc(measBufferSize*recordByteSize);
-  if ( measBuffer == NULL )
+  recordTimes = (u_int16_ard*)malloc(measBufferSize*sizeof(u_int16_ard));
+  if ( measBuffer == NULL || recordTimes == NULL )
+  {
+    deallocateMeasBuffer();
     return false;
+  }
   
   // Zero the buffer
   memset(measBuffer,0,headerByteSize+measBufferSize*recordByteSize);
@@ -1086,6 +1414,8 @@ bool allocateMeasBuffer()
  */
 void deallocateMeasBuffer()
 {
+  free(recordTimes);
+  recordTimes=NULL;
   if (measBuffer==NULL)
     return;
   free(measBuffer); 
@@ -1157,15 +1487,15 @@ void setErrorState( byte_ard code )
  */
 int readFromSerial(byte_ard *buf, u_int16_ard length)
 {
-  if ( Serial.available() < 1 )
+  if ( serialAvailable() < 1 )
     return -1;
   int tries=0;
   int pos=0;
   do
   {
-    if ( Serial.available() > 0 )
+    if ( serialAvailable() > 0 )
     {
-      buf[pos++] = Serial.read();     
+      buf[pos++] = serialRead();     
       tries=0;
     }
     else
@@ -1179,6 +1509,218 @@ int readFromSerial(byte_ard *buf, u_int16_ard length)
   return pos;
 }
 
+/**
+ *  handleLinkStartCmd
+ *
+ *  Switches the line to frames at the rate the host asks for, or at LINK_MAX_BAUD if that
+ *  is lower. Expects one byte, the LINK_BAUD_ code. The answer still goes out raw at the
+ *  old rate, then both ends switch. The host has LINK_CONFIRM_MS to send a valid frame,
+ *  or the sensor goes back to the raw line.
+ */
+void handleLinkStartCmd()
+{
+  int code = serialRead();
+  if ( linkFramed || code < 0 || link_baud(code) == 0 )
+  {
+    serialFlush();
+    sendAck(MSG_ACK_RUN_ERROR);
+    return;
+  }
+  if ( code > LINK_MAX_BAUD )
+    code = LINK_MAX_BAUD;
+
+  Serial.write(LINK_START_R);
+  Serial.write((byte_ard)code);
+  delay(2);  // Let the last byte leave the UART before the rate changes
+  Serial.begin(link_baud(code));
+  link_init(&serialLink,link_baud(code));
+  linkFramed = true;
+  linkLastRx = millis();
+  linkIdleLimit = LINK_CONFIRM_MS;
+  linkInLen = linkInPos = linkOutLen = 0;
+}
+
+/**
+ *  linkStop
+ *
+ *  Back to the raw line at 9600 baud, as after a reset.
+ */
+void linkStop()
+{
+  Serial.begin(9600);
+  linkFramed = false;
+  linkInLen = linkInPos = linkOutLen = 0;
+}
+
+/**
+ *  linkReceive
+ *
+ *  Takes what has arrived on the framed line. Data frames are acknowledged and their
+ *  payload goes to linkIn for the command handlers; a frame that does not fit behind what
+ *  they have not read yet is left for the host to resend.
+ */
+void linkReceive()
+{
+  while ( Serial.available() > 0 )
+  {
+    if ( link_rx_byte(&serialLink,Serial.read()) != LINK_RX_FRAME )
+      continue;
+    linkLastRx = millis();
+    linkIdleLimit = LINK_IDLE_MS;
+    if ( serialLink.rxCtl != LINK_CTL_DATA )
+    {
+      link_control(&serialLink);
+      continue;
+    }
+
+    if ( linkInPos > 0 )
+    {
+      memmove(linkIn,linkIn+linkInPos,linkInLen-linkInPos);
+      linkInLen -= linkInPos;
+      linkInPos = 0;
+    }
+    if ( serialLink.rxLen > LINK_MTU-linkInLen )
+      continue;
+    link_accept(&serialLink);
+    const byte_ard *payload;
+    u_int16_ard len;
+    while ( (payload = link_deliver(&serialLink,&len)) != NULL )
+    {
+      memcpy(linkIn+linkInLen,payload,len);
+      linkInLen += len;
+    }
+
+    byte_ard ctl, seq;
+    byte_ard frame[LINK_CTL_FRAME_SIZE];
+    link_reply(&serialLink,&ctl,&seq);
+    Serial.write(frame,link_encode_frame(ctl,seq,frame,0,frame));
+  }
+}
+
+/**
+ *  linkSend
+ *
+ *  Sends the frames that are due, new ones and those the host has not acknowledged in time.
+ */
+void linkSend()
+{
+  byte_ard frame[LINK_FRAME_MAX];
+  struct link_slot *slot;
+  while ( (slot = link_due(&serialLink,millis())) != NULL )
+    Serial.write(frame,link_encode_frame(LINK_CTL_DATA,slot->seq,slot->data,slot->len,frame));
+}
+
+/**
+ *  linkFlushOut
+ *
+ *  Sends what has been written in a frame. While LINK_WINDOW frames are in flight the line
+ *  is served until the host acknowledges one or the oldest is given up.
+ */
+void linkFlushOut()
+{
+  if ( linkOutLen == 0 )
+    return;
+  while ( !link_queue(&serialLink,linkOut,linkOutLen) )
+  {
+    linkReceive();
+    linkSend();
+    delay(1);
+  }
+  linkOutLen = 0;
+  linkSend();
+}
+
+/**
+ *  linkPoll
+ *
+ *  Run once per loop pass. Sends what the pass wrote and what is due again, and goes back
+ *  to the raw line when the host has not been heard from for too long.
+ */
+void linkPoll()
+{
+  if ( !linkFramed )
+    return;
+  linkReceive();
+  linkFlushOut();
+  linkSend();
+  if ( millis() - linkLastRx > linkIdleLimit )
+    linkStop();
+}
+
+/**
+ *  serialAvailable
+ *
+ *  The number of bytes from the host waiting to be read, on the raw or the framed line.
+ */
+int serialAvailable()
+{
+  if ( !linkFramed )
+    return Serial.available();
+  linkReceive();
+  return linkInLen - linkInPos;
+}
+
+/**
+ *  serialRead
+ *
+ *  The next byte from the host, -1 if there is none.
+ */
+int serialRead()
+{
+  if ( !linkFramed )
+    return Serial.read();
+  if ( serialAvailable() == 0 )
+    return -1;
+  return linkIn[linkInPos++];
+}
+
+/**
+ *  serialFlush
+ *
+ *  Discards the bytes from the host not read yet.
+ */
+void serialFlush()
+{
+  if ( !linkFramed )
+  {
+    Serial.flush();
+    return;
+  }
+  linkInLen = linkInPos = 0;
+}
+
+/**
+ *  serialWrite
+ *
+ *  Writes to the host. On the framed line the bytes collect into a frame, which goes out
+ *  when it is full or at the end of the loop pass.
+ */
+void serialWrite(const byte_ard *buf, u_int16_ard len)
+{
+  if ( !linkFramed )
+  {
+    Serial.write(buf,len);
+    return;
+  }
+  while ( len > 0 )
+  {
+    u_int16_ard n = LINK_MTU-linkOutLen;
+    if ( n > len )
+      n = len;
+    memcpy(linkOut+linkOutLen,buf,n);
+    linkOutLen += n;
+    buf += n;
+    len -= n;
+    if ( linkOutLen == LINK_MTU )
+      linkFlushOut();
+  }
+}
+
+void serialWrite(byte_ard b)
+{
+  serialWrite(&b,1);
+}
+
 /**
  *  setProtocolState
  *
@@ -1245,18 +1787,18 @@ void doEncryptDecryptTest()
   byte_ard pFipsStr[] = {0x32,0x43,0xf6,0xa8,0x88,0x5a,0x30,0x8d,0x31,0x31,0x98,0xa2,0xe0,0x37,0x07,0x34}; // FIPS test vector
   byte_ard pFipsKey[] = {0x2b,0x7e,0x15,0x16,0x28,0xae,0xd2,0xa6,0xab,0xf7,0x15,0x88,0x09,0xcf,0x4f,0x3c}; // FIPS key
     
-  Serial.write(pFipsKey,16);
-  Serial.write(pFipsStr,16);
+  serialWrite(pFipsKey,16);
+  serialWrite(pFipsStr,16);
 
   byte_ard pKeys[KEY_BYTES*11];  
   memset(pKeys,0,KEY_BYTES*11);  
   KeyExpansion(pFipsKey,pKeys);
 
   EncryptBlock((void*)pFipsStr, (u_int32_ard *)pKeys);  
-  Serial.write(pFipsStr,16);
+  serialWrite(pFipsStr,16);
 
   DecryptBlock((void*)pFipsStr, (u_int32_ard *)pKeys);
-  Serial.write(pFipsStr,16);
+  serialWrite(pFipsStr,16);
 }
 
 // TODO: DEFINE OUT